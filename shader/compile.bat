@@ -1,3 +1,10 @@
 D:/Graphic/VulkanSDK/Bin/glslangValidator.exe -V simpleTriangle.vert
 D:/Graphic/VulkanSDK/Bin/glslangValidator.exe -V simpleTriangle.frag
+D:/Graphic/VulkanSDK/Bin/glslangValidator.exe -V -DRUNTIME_FEATURES simpleTriangle.frag -o fragBranchy.spv
+D:/Graphic/VulkanSDK/Bin/glslangValidator.exe -V sceneIndirect.vert -o sceneIndirect.vert.spv
+D:/Graphic/VulkanSDK/Bin/glslangValidator.exe -V hizDownsample.comp -o hizDownsample.comp.spv
+D:/Graphic/VulkanSDK/Bin/glslangValidator.exe -V occlusionCull.comp -o occlusionCull.comp.spv
+D:/Graphic/VulkanSDK/Bin/glslangValidator.exe -V occlusionProxy.vert -o occlusionProxy.vert.spv
+D:/Graphic/VulkanSDK/Bin/glslangValidator.exe -V --target-env vulkan1.3 meshlet.task -o meshlet.task.spv
+D:/Graphic/VulkanSDK/Bin/glslangValidator.exe -V --target-env vulkan1.3 meshlet.mesh -o meshlet.mesh.spv
 pause
\ No newline at end of file
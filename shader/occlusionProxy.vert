@@ -0,0 +1,21 @@
+#version 450
+
+// maps the unit cube [0, 1]^3 onto the object's bounding box in clip space
+layout(push_constant) uniform ProxyConstants {
+    mat4 boxToClip;
+} proxy;
+
+const uint cubeIndices[36] = uint[36](
+    0, 2, 1, 1, 2, 3,
+    4, 5, 6, 5, 7, 6,
+    0, 1, 4, 1, 5, 4,
+    2, 6, 3, 3, 6, 7,
+    0, 4, 2, 2, 4, 6,
+    1, 3, 5, 3, 7, 5
+);
+
+void main() {
+    uint corner = cubeIndices[gl_VertexIndex];
+    vec3 position = vec3(corner & 1u, (corner >> 1) & 1u, (corner >> 2) & 1u);
+    gl_Position = proxy.boxToClip * vec4(position, 1.0);
+}
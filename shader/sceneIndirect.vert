@@ -0,0 +1,25 @@
+#version 450
+
+layout(binding = 0) uniform CullGlobals {
+    mat4 view;
+    mat4 proj;
+    mat4 viewProj;
+} globals;
+
+layout(std430, binding = 2) readonly buffer ObjectTransforms {
+    mat4 models[];
+};
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+
+void main() {
+    // firstInstance of each indirect draw is the object index
+    gl_Position = globals.viewProj * models[gl_InstanceIndex] * vec4(inPosition, 1.0);
+    fragColor = inColor;
+    fragTexCoord = inTexCoord;
+}
@@ -1,5 +1,24 @@
 #version 450
 
+// bits of ShaderFeature in src/shader_variants.h
+const uint FEATURE_TEXTURE = 1u;
+const uint FEATURE_VERTEX_COLOR = 2u;
+const uint FEATURE_ALPHA_TEST = 4u;
+const uint FEATURE_FOG = 8u;
+
+// set per pipeline through VkSpecializationInfo, the default is what frag.spv did before variants
+layout(constant_id = 0) const uint FEATURES = FEATURE_TEXTURE;
+
+#ifdef RUNTIME_FEATURES
+// fragBranchy.spv for --bench-variants: the same mask read at runtime, nothing can be folded away
+layout(push_constant) uniform RuntimeFeatures {
+    uint features;
+} runtimeFeatures;
+#define ACTIVE_FEATURES runtimeFeatures.features
+#else
+#define ACTIVE_FEATURES FEATURES
+#endif
+
 layout(binding = 1) uniform sampler2D texSampler;
 
 layout(location = 0) in vec3 fragColor;
@@ -8,5 +27,19 @@ layout(location = 1) in vec2 fragTexCoord;
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = texture(texSampler, fragTexCoord);
-}
\ No newline at end of file
+    vec4 color = vec4(1.0);
+    if ((ACTIVE_FEATURES & FEATURE_TEXTURE) != 0u) {
+        color *= texture(texSampler, fragTexCoord);
+    }
+    if ((ACTIVE_FEATURES & FEATURE_VERTEX_COLOR) != 0u) {
+        color.rgb *= fragColor;
+    }
+    if ((ACTIVE_FEATURES & FEATURE_ALPHA_TEST) != 0u && color.a < 0.5) {
+        discard;
+    }
+    if ((ACTIVE_FEATURES & FEATURE_FOG) != 0u) {
+        float fog = clamp(pow(gl_FragCoord.z, 64.0), 0.0, 1.0);
+        color.rgb = mix(color.rgb, vec3(0.5, 0.6, 0.7), fog);
+    }
+    outColor = color;
+}
@@ -5,16 +5,41 @@
 #include <functional>
 #include <cstdlib>
 #include <vector>
-#include <fstream>
 #include <filesystem>
-#define GLM_FORCE_RADIANS
-#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <memory>
+#include <string>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 #include <chrono>
 #include <array>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include "frame_stats.h"
+#include "frustum_culling.h"
+#include "gpu_timeline.h"
+#include "latency_tracer.h"
+#include "layout_cache.h"
+#include "deletion_queue.h"
+#include "draw_packets.h"
+#include "frame_context.h"
+#include "frame_pacer.h"
+#include "dynamic_state.h"
+#include "meshlet.h"
+#include "pipeline_cache.h"
+#include "pipeline_library.h"
+#include "pipeline_registry.h"
+#include "render_graph.h"
+#include "resource_state.h"
+#include "shader_object.h"
+#include "shader_variants.h"
+#include "spirv_reflect.h"
+#include "thread_pool.h"
+#include "triple_buffer.h"
+#include "vk_helpers.h"
 const std::vector<const char*> validationLayers = 
 {
 	"VK_LAYER_KHRONOS_validation"
@@ -23,7 +48,55 @@ const std::vector<const char*> deviceExtensions =
 {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
-const int MAX_FRAMES_IN_FLIGHT = 2;
+// --frames-in-flight的上限
+const int MAX_FRAMES_IN_FLIGHT = 4;
+const VkFormat DEPTH_FORMAT = VK_FORMAT_D32_SFLOAT_S8_UINT;
+const float SCENE_FAR_PLANE = 10.0f;
+// 绘制少于这个数的块不值得交给另一个线程录制
+const uint32_t MIN_DRAWS_PER_RECORD_THREAD = 256;
+
+enum class OcclusionMode
+{
+	None,
+	HiZ,
+	Queries,
+};
+
+struct AppOptions
+{
+	uint32_t objectCount = 1;
+	OcclusionMode occlusion = OcclusionMode::None;
+	uint32_t overdrawLayers = 1;
+	bool meshShading = false;
+	bool pipelineLibrary = true;
+	uint32_t framesInFlight = 2;
+	bool dynamicState = true;
+	std::string pipelineCachePath = "pipeline_cache.bin";
+	std::string pipelineKeysPath = "pipeline_keys.txt";
+	uint32_t benchResizeCount = 0;
+	ShaderFeatures shaderFeatures = kDefaultShaderFeatures;
+	bool benchVariants = false;
+	bool shaderObjects = false;
+	bool benchDraw = false;
+	bool sortDraws = true;
+	bool benchSort = false;
+	// 0表示每个核一个
+	uint32_t recordThreads = 0;
+	bool benchRecord = false;
+	bool cacheCommands = false;
+	// VK_PRESENT_MODE_MAX_ENUM_KHR表示依次选MAILBOX、IMMEDIATE、FIFO
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAX_ENUM_KHR;
+	double fpsLimit = 0.0;
+	bool presentWait = true;
+	// 非空时记录每帧的延迟标记，退出时写成JSON
+	std::string latencyTracePath;
+	bool dumpRenderGraph = false;
+	bool asyncCompute = true;
+	bool renderThread = false;
+	bool showStats = false;
+	bool benchCulling = false;
+	bool benchMeshlets = false;
+};
 
 VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger)
 {
@@ -47,25 +120,6 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
 	}
 }
 
-static std::vector<char> ReadFile(const std::string& filename)
-{
-	std::ifstream ifs(filename, std::ios::ate | std::ios::binary);
-
-	if (!ifs.is_open())
-	{
-		throw std::runtime_error("fail to open file!");
-	}
-
-	size_t fileSize = (size_t)ifs.tellg();
-	std::vector<char> buffer(fileSize);
-
-	ifs.seekg(0);
-	ifs.read(buffer.data(), fileSize);
-
-	ifs.close();
-	return buffer;
-}
-
 #ifdef NDEBUG
 const bool enableValidationLayers = false;
 #else
@@ -76,6 +130,8 @@ struct QueueFamilyIndices
 {
 	int presentFamily = -1;
 	int graphicsFamily = -1;
+	// 只有计算没有图形的族，没有时为-1
+	int computeFamily = -1;
 
 	bool IsCompelete()
 	{
@@ -132,6 +188,45 @@ struct UniformBufferObject {
 	glm::mat4 proj;
 };
 
+// 一帧的模拟结果，生成后不再修改。--render-thread时由模拟线程生成，渲染线程读取
+struct SceneSnapshot {
+	std::chrono::steady_clock::time_point inputTime;
+	glm::mat4 view;
+	glm::mat4 proj;
+	glm::mat4 viewProj;
+	Frustum frustum;
+	// 每个物体的model矩阵，没有Hi-Z时只有可见物体的是这一帧的
+	std::vector<glm::mat4> transforms;
+	// Hi-Z在GPU上剔除，这时为空
+	std::vector<uint32_t> visibleObjects;
+	// 每次重新剔除加一，槽位里的可见列表版本相同时不用再复制
+	uint64_t cullVersion = 0;
+};
+
+// 与occlusionCull.comp中的CullGlobals保持一致(std140)
+struct CullGlobals {
+	glm::mat4 view;
+	glm::mat4 proj;
+	glm::mat4 viewProj;
+	glm::vec4 frustum[6];
+	glm::vec4 hizParams;
+	uint32_t objectCount;
+	uint32_t indexCount;
+	uint32_t padding[2];
+};
+
+struct ObjectBounds {
+	glm::vec4 aabbMin;
+	glm::vec4 aabbMax;
+};
+
+// 与meshlet.task中的push constant保持一致
+struct MeshletCullConstants {
+	glm::vec4 frustum[6];
+	glm::vec3 cameraPosition;
+	uint32_t meshletCount;
+};
+
 const std::vector<Vertex> vertices = {
 	{{0.5f, -0.5f, 0.0f}, {1.0f, 0.3f, 0.0f}, {1.0f, 0.0f}},
 	{{0.5f, 0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}, {1.0f, 1.0f}},
@@ -149,9 +244,15 @@ const std::vector<uint16_t> indices = {
 	4, 5, 6, 6, 7, 4
 };
 
+static_assert(sizeof(Vertex) == 8 * sizeof(float), "meshlet.mesh reads vertices as 8 floats");
+
 class HelloTriangleApplication
 {
+public:
+	explicit HelloTriangleApplication(const AppOptions& options) : options(options) {}
+
 private:
+	AppOptions options;
 	GLFWwindow* window;
 	int WIDTH = 1400;
 	int HEIGHT = 1200;
@@ -162,6 +263,9 @@ private:
 	VkDevice vkDevice;
 	VkQueue graphicsQueue;
 	VkQueue presentQueue;
+	// 异步计算队列，-1表示没有专用计算族或用了--no-async-compute，异步pass在图形队列上按顺序执行
+	VkQueue computeQueue = VK_NULL_HANDLE;
+	int computeFamily = -1;
 	VkSurfaceKHR vkSurface;
 
 	// buffers
@@ -169,9 +273,14 @@ private:
 	VkDeviceMemory vertexBufferMemory;
 	VkBuffer indexBuffer;
 	VkDeviceMemory indexBufferMemory;
-	std::vector<VkBuffer> uniformBuffers;
-	std::vector<VkDeviceMemory> uniformBuffersMemory;
-	std::vector<void*> uniformBuffersMapped;
+	VkDeviceSize uniformStride = 0;//每个物体的UniformBufferObject按minUniformBufferOffsetAlignment对齐
+
+	// scene
+	std::vector<glm::vec3> objectPositions;
+	std::vector<ObjectBounds> objectAabbs;
+	CullingSoA objectBounds;
+	std::vector<uint32_t> visibleObjects;
+	std::unique_ptr<ThreadPool> threadPool;
 
 	VkSwapchainKHR vkSwapChain;
 	std::vector<VkImage> vkSwapChainImages;
@@ -179,34 +288,249 @@ private:
 	VkFormat vkSwapChainImageFormat;
 	VkExtent2D vkSwapChainExtent;
 
-	VkRenderPass renderPass;
 	VkDescriptorSetLayout descriptorLayout;
-	VkDescriptorPool descriptorPool;
-	std::vector<VkDescriptorSet> descriptorSets;
+	// 每帧从FrameContext分配，写入这一帧的uniform
+	VkDescriptorSet sceneDescriptorSet = VK_NULL_HANDLE;
 
 	VkPipelineLayout pipelineLayout;
 	VkPipeline graphicsPipeline;
-	std::vector<VkFramebuffer> swapChainFramebuffers;
 	VkCommandPool commandPool;
-	std::vector<VkCommandBuffer> commandBuffers;
 
-	//VkSemaphore imageAvailableSemaphore;
-	std::vector<VkSemaphore> imageAvailableSemaphores;
-	//VkSemaphore renderFinishedSemaphore;
-	std::vector<VkSemaphore> renderFinishedSemaphores;
-	std::vector<VkFence> inFlightFences;
+	// 所有提交共用的计数器，每帧等待framesInFlight帧之前的值
+	std::unique_ptr<GpuTimeline> timeline;
+	// 异步计算队列自己的计数器。一帧最后的图形提交等待它，所以timeline完成时这一帧的计算也完成了
+	std::unique_ptr<GpuTimeline> computeTimeline;
+	// 每个在途帧的命令池、描述符池、uniform和交换链信号量，复用前整体重置
+	std::vector<std::unique_ptr<FrameContext>> frameContexts;
 
 	VkImage textureImage;
 	VkImageView textureImageView;
 	VkDeviceMemory textureImageMemory;
 	VkSampler textureSampler;
 
+	// 深度缓冲是帧图的临时图像，这两个句柄从帧图取，随帧图一起重建
 	VkImage depthImage;
-	VkDeviceMemory depthImageMemory;
 	VkImageView depthImageView;
 
-	bool framebufferResized = false;
+	// hi-z occlusion culling
+	VkDescriptorSetLayout indirectDescriptorLayout;
+	VkPipelineLayout indirectPipelineLayout;
+	VkPipeline indirectPipeline;
+	VkDescriptorSetLayout cullDescriptorLayout;
+	VkPipelineLayout cullPipelineLayout;
+	VkPipeline cullPipeline;
+	VkDescriptorSetLayout hizDescriptorLayout;
+	VkPipelineLayout hizPipelineLayout;
+	VkPipeline hizPipeline;
+	VkDescriptorPool occlusionDescriptorPool;
+	std::vector<VkDescriptorSet> indirectDescriptorSets;
+	std::vector<VkDescriptorSet> cullDescriptorSets;
+	std::vector<VkBuffer> cullGlobalsBuffers;
+	std::vector<VkDeviceMemory> cullGlobalsBuffersMemory;
+	std::vector<void*> cullGlobalsBuffersMapped;
+	std::vector<VkBuffer> objectTransformBuffers;
+	std::vector<VkDeviceMemory> objectTransformBuffersMemory;
+	std::vector<void*> objectTransformBuffersMapped;
+	VkBuffer objectBoundsBuffer;
+	VkDeviceMemory objectBoundsBufferMemory;
+	VkBuffer objectVisibilityBuffer;
+	VkDeviceMemory objectVisibilityBufferMemory;
+	VkBuffer earlyDrawBuffer;
+	VkDeviceMemory earlyDrawBufferMemory;
+	VkBuffer lateDrawBuffer;
+	VkDeviceMemory lateDrawBufferMemory;
+	VkSampler hizSampler;
+	VkImage hizImage;
+	VkDeviceMemory hizImageMemory;
+	VkImageView hizImageView;
+	std::vector<VkImageView> hizMipViews;
+	uint32_t hizMipLevels = 0;
+	VkExtent2D hizExtent;
+	VkDescriptorPool hizDescriptorPool;
+	std::vector<VkDescriptorSet> hizDescriptorSets;
+
+	// occlusion queries + conditional rendering
+	PFN_vkCmdBeginConditionalRenderingEXT vkCmdBeginConditionalRendering = nullptr;
+	PFN_vkCmdEndConditionalRenderingEXT vkCmdEndConditionalRendering = nullptr;
+	VkPipelineLayout proxyPipelineLayout;
+	VkPipeline proxyPipeline;
+	std::vector<VkQueryPool> occlusionQueryPools;
+	VkBuffer occlusionResultBuffer;
+	VkDeviceMemory occlusionResultBufferMemory;
+	glm::mat4 sceneViewProj;
+	Frustum sceneFrustum;
+	glm::vec3 cameraPosition = glm::vec3(2.0f, 2.0f, 2.0f);
+
+	// mesh shading
+	PFN_vkCmdDrawMeshTasksEXT vkCmdDrawMeshTasks = nullptr;
+	uint32_t meshletCount = 0;
+	VkBuffer meshletVertexDataBuffer;
+	VkDeviceMemory meshletVertexDataBufferMemory;
+	VkBuffer meshletBuffer;
+	VkDeviceMemory meshletBufferMemory;
+	VkBuffer meshletBoundsBuffer;
+	VkDeviceMemory meshletBoundsBufferMemory;
+	VkBuffer meshletVerticesBuffer;
+	VkDeviceMemory meshletVerticesBufferMemory;
+	VkBuffer meshletTrianglesBuffer;
+	VkDeviceMemory meshletTrianglesBufferMemory;
+	VkDescriptorSetLayout meshletDescriptorLayout;
+	VkDescriptorPool meshletDescriptorPool;
+	VkDescriptorSet meshletDescriptorSet;
+	VkPipelineLayout meshletPipelineLayout;
+	VkPipeline meshletPipeline;
+
+	std::unique_ptr<FrameStats> frameStats;
+	std::unique_ptr<FramePacer> framePacer;
+	std::unique_ptr<LatencyTracer> latencyTracer;
+	// 所有图像和缓冲的屏障都由它按录制顺序跟踪的状态生成
+	std::unique_ptr<ResourceStateTracker> resourceStates;
+	// 一帧的所有pass，屏障由pass声明的读写生成。交换链重建时整个重建
+	std::unique_ptr<RenderGraph> frameGraph;
+	struct FrameGraphResources
+	{
+		RenderGraphResource color;
+		RenderGraphResource depth;
+		RenderGraphResource hiz;
+		RenderGraphResource visibility;
+		RenderGraphResource earlyDraw;
+		RenderGraphResource lateDraw;
+		RenderGraphResource occlusionResult;
+	} frameGraphResources = {};
+	// 正在录制的帧的交换链图像，pass里开始渲染时用
+	uint32_t recordImageIndex = 0;
+	// 这一帧发出了遮挡查询，结果需要复制
+	bool queriesIssued = false;
+	// 启用了VK_EXT_calibrated_timestamps，GPU时间戳能换算到CPU时钟
+	bool calibratedTimestamps = false;
+	std::unique_ptr<PipelineCache> pipelineCache;
+	std::unique_ptr<PipelineRegistry> pipelineRegistry;
+	// 只在启用VK_EXT_graphics_pipeline_library时创建
+	std::unique_ptr<PipelineLibraryCache> pipelineLibraries;
+	// --shader-objects时场景不用管线，用sceneDesc的状态动态设置
+	std::unique_ptr<ShaderObjectCache> shaderObjects;
+	GraphicsPipelineDesc sceneDesc;
+	ShaderObjectSet sceneShaders;
+	// 管线里动态的状态在录制时按各自的desc设置，重复的值跳过
+	std::unique_ptr<DynamicStateTracker> dynamicState;
+	uint32_t dynamicStateGroups = 0;
+	GraphicsPipelineDesc indirectDesc;
+	GraphicsPipelineDesc proxyDesc;
+	GraphicsPipelineDesc meshletDesc;
+	std::unique_ptr<LayoutCache> layoutCache;
+	ShaderInterface sceneInterface;
+	ShaderInterface meshletInterface;
+	uint64_t scenePipelineKey = 0;
+	uint64_t indirectPipelineKey = 0;
+	uint64_t proxyPipelineKey = 0;
+	uint64_t meshletPipelineKey = 0;
+
+	struct VariantBenchEntry
+	{
+		ShaderFeatures features;
+		uint64_t specializedKey;
+		uint64_t branchyKey;
+		double gpuMilliseconds[2];
+		uint32_t frames[2];
+	};
+	std::vector<VariantBenchEntry> variantBench;
+	VkQueryPool variantQueryPool = VK_NULL_HANDLE;
+	float timestampPeriod = 1.0f;
+	// slot = 条目序号 * 2 + 是否为运行时分支版本，这一帧不测量时为-1
+	int benchVariantSlot = -1;
+	bool benchVariantMeasure = false;
+	std::array<int, MAX_FRAMES_IN_FLIGHT> variantOfFrame;
+
+	struct DrawBenchCombo
+	{
+		GraphicsPipelineDesc desc;
+		uint64_t pipelineKey;
+		// 不同组合共用管线时相同，作为绘制包排序键里的管线
+		uint32_t pipelineId;
+		// 每帧从注册表重新取
+		VkPipeline pipeline;
+		ShaderObjectSet shaders;
+	};
+	std::vector<DrawBenchCombo> drawBench;
+	// 偶数slot用管线，奇数slot用shader object，-1表示不在测量
+	int benchDrawSlot = -1;
+	bool benchDrawMeasure = false;
+	double drawBenchCreateMs[2] = {};
+	double drawBenchRecordMs[2] = {};
+	double drawBenchFrameMs[2] = {};
+	uint64_t drawBenchDraws[2] = {};
+	uint32_t drawBenchFrames[2] = {};
+
+	// 每个可见物体一个绘制包，按状态排序后录制时只在状态变化时绑定
+	std::vector<DrawPacket> drawPackets;
+	std::vector<DrawPacket> drawPacketScratch;
+	DrawBindCounts bindTotals;
+	uint64_t packetFrames = 0;
+	// 偶数slot排序，奇数slot按剔除输出的顺序提交，-1表示不在测量
+	int benchSortSlot = -1;
+	bool benchSortMeasure = false;
+	double sortBenchSortMs[2] = {};
+	double sortBenchRecordMs[2] = {};
+	double sortBenchFrameMs[2] = {};
+	DrawBindCounts sortBenchBinds[2];
+	uint32_t sortBenchFrames[2] = {};
+
+	// 录制场景的一个命令缓冲需要的、录制前在主线程上确定的状态
+	struct SceneRecordFlags
+	{
+		bool useMeshlets;
+		bool benchDraw;
+		bool useQueries;
+		// --bench-variants测量的管线和它的特性
+		VkPipeline variantPipeline;
+		uint32_t variantFeatures;
+	};
+	// 并行录制时每个块一份，块号和FrameContext的次级命令池对应
+	std::vector<DynamicStateTracker> recordStates;
+	std::vector<DrawBindCounts> secondaryBinds;
+	std::vector<VkCommandBuffer> secondaryCommandBuffers;
+	// --bench-record依次测量的线程数，slot为-1表示不在测量
+	std::vector<uint32_t> benchRecordThreads;
+	int benchRecordSlot = -1;
+	bool benchRecordMeasure = false;
+	std::vector<double> recordBenchMs;
+	std::vector<double> recordBenchFrameMs;
+	std::vector<uint64_t> recordBenchDraws;
+	std::vector<uint32_t> recordBenchFrames;
+
+	// --cache-commands：影响录制内容的变化(相机、交换链、管线句柄)都会增加sceneVersion，
+	// 每个FrameContext缓存的次级命令缓冲版本落后时才重新录制
+	uint64_t sceneVersion = 1;
+	uint64_t renderCullVersion = 0;
+	VkPipeline cachedScenePipeline = VK_NULL_HANDLE;
+	uint64_t cacheRecords = 0;
+	uint64_t cacheReuses = 0;
+
+	// 延迟销毁：timeline到达标记的值后才销毁，resize时不需要vkDeviceWaitIdle
+	DeletionQueue deletionQueue;
+	std::vector<double> resizeTimes;
+	std::vector<double> resizeFrameTimes;
+	std::vector<double> steadyFrameTimes;
+
+	// 主线程的回调写，--render-thread时渲染线程读
+	std::atomic<bool> framebufferResized{ false };
+	std::atomic<int> framebufferWidth{ 0 };
+	std::atomic<int> framebufferHeight{ 0 };
 	uint32_t currentFrame = 0;
+
+	// 模拟。单线程时DrawFrame在获取交换链图像之后模拟到serialSnapshot，
+	// --render-thread时模拟线程生成快照，渲染线程总是取最新的一份，两边通过三缓冲交接不会互相等待
+	std::chrono::steady_clock::time_point simulationStart = std::chrono::steady_clock::now();
+	std::vector<uint32_t> simVisibleObjects;
+	glm::mat4 culledViewProj = glm::mat4(0.0f);
+	uint64_t simCullVersion = 0;
+	SceneSnapshot serialSnapshot;
+	TripleBuffer<SceneSnapshot> snapshots;
+	std::atomic<bool> threadsStopping{ false };
+	std::atomic<bool> threadFailed{ false };
+	std::exception_ptr threadError;
+	double simulationMs = 0.0;
+	double renderMs = 0.0;
 public:
 	void Run()
 	{
@@ -227,14 +551,32 @@ private:
 		window = glfwCreateWindow(WIDTH, HEIGHT, "vk", nullptr, nullptr);
 		glfwSetWindowUserPointer(window, this);//important!!!
 		glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);	
+		int width = 0, height = 0;
+		glfwGetFramebufferSize(window, &width, &height);
+		framebufferWidth = width;
+		framebufferHeight = height;
 	}
 
 	static void framebufferResizeCallback(GLFWwindow* window, int width, int height)
 	{
 		auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+		app->framebufferWidth = width;
+		app->framebufferHeight = height;
 		app->framebufferResized = true;
 	}
 
+	// GLFW的窗口函数只能在主线程调用，--render-thread时用回调记下的尺寸
+	void GetFramebufferSize(int& width, int& height)
+	{
+		if (options.renderThread)
+		{
+			width = framebufferWidth;
+			height = framebufferHeight;
+			return;
+		}
+		glfwGetFramebufferSize(window, &width, &height);
+	}
+
 	void InitVulkan()
 	{
 		CreateInstance();
@@ -242,1598 +584,4037 @@ private:
 		CreateSurface();
 		PickPhysicalDevice();
 		CreateLogicalDevice();
+		timeline = std::make_unique<GpuTimeline>(vkDevice);
+		if (computeFamily >= 0)
+		{
+			computeTimeline = std::make_unique<GpuTimeline>(vkDevice);
+		}
+		resourceStates = std::make_unique<ResourceStateTracker>();
+		pipelineCache = std::make_unique<PipelineCache>(vkDevice, vkPhysicalDevice, options.pipelineCachePath);
+		layoutCache = std::make_unique<LayoutCache>(vkDevice);
+		// 管线在后台线程编译，启动时需要的管线在InitVulkan最后统一等待
+		if (options.pipelineLibrary)
+		{
+			pipelineLibraries = std::make_unique<PipelineLibraryCache>(vkDevice);
+		}
+		pipelineRegistry = std::make_unique<PipelineRegistry>(vkDevice,
+			[this](const GraphicsPipelineDesc& desc, VkPipelineLayout layout, PipelineLink link) { return CreateScenePipeline(desc, layout, link); },
+			2, options.pipelineLibrary);
+		pipelineRegistry->SetDynamicState(dynamicStateGroups);
+		dynamicState = std::make_unique<DynamicStateTracker>(vkDevice, dynamicStateGroups);
+		if (options.shaderObjects || options.benchDraw)
+		{
+			// 启用了的可选阶段都要绑定为空
+			shaderObjects = std::make_unique<ShaderObjectCache>(vkDevice,
+				options.meshShading ? VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT : 0);
+		}
+		CreateScene();
 		CreateSwapChain();
 		CreateImageViews();
-		CreateRenderPass();
+		pipelineRegistry->SetRenderTargetFormats(vkSwapChainImageFormat, DEPTH_FORMAT);
 		CreateDescriptorSetLayout();
 		CreateGraphicsPipeline();
 		CreateCommandPool();
-		CreateDepthResources();
-		CreateFramebuffers();
+		BuildFrameGraph();
 		CreateTextureImage();
 		CreateTextureImageView();
 		CreateTextureSampler();
 		CreateVertexBuffer();
 		CreateIndexBuffer();
-		CreateUniformBuffer();
-		CreateDescriptorPool();
-		CreateDescriptorSets();
-		CreateCommandBuffers();
-		CreateSyncObjects();
-	}
+		CreateFrameContexts();
 
-	void MainLoop()
-	{
-		while (!glfwWindowShouldClose(window))
+		if (options.occlusion == OcclusionMode::HiZ)
 		{
-			glfwPollEvents();
-			DrawFrame();
+			CreateOcclusionCulling();
+		}
+		else if (options.occlusion == OcclusionMode::Queries)
+		{
+			CreateOcclusionQueries();
 		}
-		vkDeviceWaitIdle(vkDevice);
-	}
-
-	void Cleanup()
-	{
-		CleanupSwapChain();
-
-		vkDestroySampler(vkDevice, textureSampler, nullptr);
-		vkDestroyImageView(vkDevice, textureImageView, nullptr);
-		vkDestroyImage(vkDevice, textureImage, nullptr);
-		vkFreeMemory(vkDevice, textureImageMemory, nullptr);
 
-		vkDestroyDescriptorSetLayout(vkDevice, descriptorLayout, nullptr);
-		for (int i = 0; i < vkSwapChainImages.size(); i++)
+		if (options.meshShading)
 		{
-			vkDestroyBuffer(vkDevice, uniformBuffers[i], nullptr);
-			vkFreeMemory(vkDevice, uniformBuffersMemory[i], nullptr);
+			CreateMeshletResources();
 		}
-		vkDestroyDescriptorPool(vkDevice, descriptorPool, nullptr);
 
-		vkDestroyCommandPool(vkDevice, commandPool, nullptr);
-		for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		if (options.benchVariants)
 		{
-			vkDestroySemaphore(vkDevice, imageAvailableSemaphores[i], nullptr);
-			vkDestroySemaphore(vkDevice, renderFinishedSemaphores[i], nullptr);
-			vkDestroyFence(vkDevice, inFlightFences[i], nullptr);
+			CreateVariantBenchmark();
 		}
 
-		vkDestroyBuffer(vkDevice, vertexBuffer, nullptr);
-		vkFreeMemory(vkDevice, vertexBufferMemory, nullptr);
-		vkDestroyBuffer(vkDevice, indexBuffer, nullptr);
-		vkFreeMemory(vkDevice, indexBufferMemory, nullptr);
+		if (options.benchSort && options.occlusion == OcclusionMode::HiZ)
+		{
+			std::cout << "hi-z occlusion culling draws indirectly without draw packets, --bench-sort is ignored" << std::endl;
+			options.benchSort = false;
+		}
+		if (options.benchDraw || options.benchSort)
+		{
+			CreateDrawBenchmark();
+		}
+		if (options.benchRecord && options.occlusion == OcclusionMode::HiZ)
+		{
+			std::cout << "hi-z occlusion culling draws indirectly without draw packets, --bench-record is ignored" << std::endl;
+			options.benchRecord = false;
+		}
+		if (options.cacheCommands && (options.occlusion != OcclusionMode::None || !variantBench.empty() || options.benchDraw
+			|| options.benchSort || options.benchRecord))
+		{
+			// 这些模式每帧录制的内容都不同
+			std::cout << "--cache-commands only applies to the plain scene without occlusion culling or benchmarks, it is ignored" << std::endl;
+			options.cacheCommands = false;
+		}
+		if (options.renderThread && (options.benchResizeCount > 0 || !variantBench.empty() || options.benchDraw || options.benchSort
+			|| options.benchRecord))
+		{
+			// 基准测试在主线程上逐帧控制窗口和测量
+			std::cout << "benchmarks run on the main thread, --render-thread is ignored" << std::endl;
+			options.renderThread = false;
+		}
+		if (options.benchRecord)
+		{
+			// 1, 2, 4, ...线程，最后是所有线程
+			uint32_t maxThreads = frameContexts[0]->GetRecordThreadCount();
+			for (uint32_t threads = 1; threads < maxThreads; threads *= 2)
+			{
+				benchRecordThreads.push_back(threads);
+			}
+			benchRecordThreads.push_back(maxThreads);
+			recordBenchMs.assign(benchRecordThreads.size(), 0.0);
+			recordBenchFrameMs.assign(benchRecordThreads.size(), 0.0);
+			recordBenchDraws.assign(benchRecordThreads.size(), 0);
+			recordBenchFrames.assign(benchRecordThreads.size(), 0);
+		}
 
-		vkDestroyDevice(vkDevice, nullptr);
+		// 代理盒和mesh shader管线不等待，编译完成前分别跳过查询和使用顶点管线绘制
+		pipelineRegistry->Prewarm(options.pipelineKeysPath);
+		if (!options.shaderObjects)
+		{
+			pipelineRegistry->Wait(scenePipelineKey);
+		}
+		if (options.occlusion == OcclusionMode::HiZ)
+		{
+			pipelineRegistry->Wait(indirectPipelineKey);
+		}
 
-		if (enableValidationLayers)
+		pipelineCache->PrintStats("startup");
+		pipelineRegistry->PrintStats("startup");
+		if (pipelineLibraries)
 		{
-			DestroyDebugUtilsMessengerEXT(vkInstance, debugMessenger, nullptr);
+			pipelineLibraries->PrintStats();
+		}
+		if (shaderObjects)
+		{
+			shaderObjects->PrintStats();
 		}
+		layoutCache->PrintStats();
 
-		vkDestroySurfaceKHR(vkInstance, vkSurface, nullptr);
+		if (options.showStats)
+		{
+			const char* modeNames[] = { "occlusion none", "occlusion hiz", "occlusion queries" };
+			frameStats = std::make_unique<FrameStats>(modeNames[(int)options.occlusion]);
+		}
+		framePacer = std::make_unique<FramePacer>(vkDevice, options.fpsLimit, options.presentWait, frameStats.get());
+		framePacer->SetSwapchain(vkSwapChain);
+		if (!options.latencyTracePath.empty())
+		{
+			latencyTracer = std::make_unique<LatencyTracer>(vkInstance, vkPhysicalDevice, vkDevice, (uint32_t)FindQueueFamilies(vkPhysicalDevice).graphicsFamily,
+				options.framesInFlight, calibratedTimestamps);
+			framePacer->SetPresentCallback([this](uint64_t presentId, std::chrono::steady_clock::time_point time)
+				{
+					latencyTracer->MarkOnScreen(presentId, time);
+				});
+		}
+	}
 
-		vkDestroyInstance(vkInstance, nullptr);
+	void MainLoop()
+	{
+		if (options.renderThread)
+		{
+			RunThreads();
+			return;
+		}
 
-		glfwDestroyWindow(window);
+		uint64_t frame = 0;
+		while (!glfwWindowShouldClose(window))
+		{
+			glfwPollEvents();
+			if (latencyTracer)
+			{
+				latencyTracer->BeginFrame();
+			}
 
-		glfwTerminate();
+			if (options.benchResizeCount > 0)
+			{
+				BenchResizeStep(frame++);
+				continue;
+			}
+			if (!variantBench.empty())
+			{
+				BenchVariantStep(frame++);
+				continue;
+			}
+			if (options.benchSort)
+			{
+				BenchSortStep(frame++);
+				continue;
+			}
+			if (options.benchRecord)
+			{
+				BenchRecordStep(frame++);
+				continue;
+			}
+			if (options.benchDraw)
+			{
+				BenchDrawStep(frame++);
+				continue;
+			}
+			DrawFrame();
+		}
+		// 图形队列最后的提交会等待同一帧的计算，所以timeline覆盖了所有提交的工作。
+		// 呈现不在timeline上，只有呈现队列需要等空闲
+		timeline->Wait(timeline->LastSubmitted());
+		vkQueueWaitIdle(presentQueue);
 	}
 
-	std::vector<const char*> getRequiredExtensions()
+	// 主线程只处理窗口事件，模拟和渲染各占一个线程，每帧的耗时接近两者中较长的一个而不是它们的和
+	void RunThreads()
 	{
-		uint32_t glfwExtensionCount = 0;
-		const char** glfwExtensions;
-		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-		std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
-
-		if (enableValidationLayers)
+		std::thread simulationThread([this]() { RunGuarded([this]() { SimulationLoop(); }); });
+		std::thread renderThread([this]() { RunGuarded([this]() { RenderLoop(); }); });
+		while (!glfwWindowShouldClose(window) && !threadsStopping)
 		{
-			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+			glfwWaitEvents();
+		}
+		StopThreads();
+		simulationThread.join();
+		renderThread.join();
+
+		timeline->Wait(timeline->LastSubmitted());
+		vkQueueWaitIdle(presentQueue);
+		uint64_t frames = snapshots.Taken();
+		if (frames > 0)
+		{
+			std::cout << "render thread: " << frames << " frames, simulation avg " << simulationMs / snapshots.Published()
+				<< " ms, render avg " << renderMs / frames << " ms per frame" << std::endl;
 		}
+		if (threadError)
+		{
+			std::rethrow_exception(threadError);
+		}
+	}
 
-		return extensions;
+	// 一个线程出错时停下两个线程，异常交给主线程重新抛出
+	void RunGuarded(const std::function<void()>& loop)
+	{
+		try
+		{
+			loop();
+		}
+		catch (...)
+		{
+			if (!threadFailed.exchange(true))
+			{
+				threadError = std::current_exception();
+			}
+		}
+		StopThreads();
 	}
 
-	bool CheckValidationLayerSupport()
+	void StopThreads()
 	{
-		uint32_t layerCount;
-		vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
-		std::vector<VkLayerProperties> availableLayers(layerCount);
-		vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
+		threadsStopping = true;
+		snapshots.Close();
+		glfwPostEmptyEvent();
+	}
 
-		for (const char* layerName : validationLayers)
+	void SimulationLoop()
+	{
+		simVisibleObjects.reserve(objectPositions.size());
+		while (true)
 		{
-			bool layerFound = false;
-
-			for (const auto& layerProperties : availableLayers)
+			auto start = std::chrono::steady_clock::now();
+			SceneSnapshot& snapshot = snapshots.WriteSlot();
+			snapshot.inputTime = start;
+			int width = framebufferWidth;
+			int height = framebufferHeight;
+			Simulate(snapshot, width > 0 && height > 0 ? width / (float)height : 1.0f);
+			simulationMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			snapshots.Publish();
+			// 渲染线程取走这一份之后才生成下一份，模拟只领先一帧，不做注定被覆盖的工作
+			if (!snapshots.WaitTaken())
 			{
-				if (strcmp(layerName, layerProperties.layerName) == 0)
-				{
-					layerFound = true;
-					break;
-				}
+				return;
 			}
+		}
+	}
 
-			if (!layerFound)
+	void RenderLoop()
+	{
+		while (snapshots.WaitPublished())
+		{
+			const SceneSnapshot& snapshot = snapshots.Take();
+			auto start = std::chrono::steady_clock::now();
+			if (latencyTracer)
 			{
-				return false;
+				latencyTracer->BeginFrame(snapshot.inputTime);
 			}
+			DrawFrame(&snapshot);
+			renderMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 		}
-
-		return true;
 	}
 
-	void PopulateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo)
+	// 基准测试的一帧，返回这一帧的CPU耗时(毫秒)
+	double TimedDrawFrame()
 	{
-		createInfo = {};
-		createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-		createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-		createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-		createInfo.pfnUserCallback = debugCallback;
+		auto start = std::chrono::high_resolution_clock::now();
+		DrawFrame();
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 	}
 
-	void CreateInstance()
+	// 按段轮流测量：每段framesPerSlot帧，前warmupFrames帧预热不计入，slot和measure交给DrawFrame读取。
+	// 测量帧的CPU耗时交给onMeasured累计。所有段结束后slot为-1，再画drainFrames帧把在途帧的GPU结果读回来，
+	// 然后返回false，由调用者打印结果
+	bool StepBenchmark(uint64_t frame, uint64_t slotCount, uint64_t framesPerSlot, uint64_t drainFrames, int& slot, bool& measure,
+		const std::function<void(uint64_t slot, double ms)>& onMeasured = nullptr)
 	{
-		if (enableValidationLayers && !CheckValidationLayerSupport())
+		const uint64_t warmupFrames = 16;
+		if (frame / framesPerSlot < slotCount)
 		{
-			throw std::runtime_error("validation layers requested, but not available");
+			slot = (int)(frame / framesPerSlot);
+			measure = frame % framesPerSlot >= warmupFrames;
+			double ms = TimedDrawFrame();
+			if (measure && onMeasured)
+			{
+				onMeasured(slot, ms);
+			}
+			return true;
 		}
 
-		VkApplicationInfo vkApplicationInfo = {};
-		vkApplicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-		vkApplicationInfo.pApplicationName = "vk";
-		vkApplicationInfo.applicationVersion = VK_MAKE_VERSION(1, 3, 0);
-		vkApplicationInfo.pEngineName = "no";
-		vkApplicationInfo.engineVersion = VK_MAKE_VERSION(1, 3, 0);
-		vkApplicationInfo.apiVersion = VK_API_VERSION_1_3;
+		slot = -1;
+		measure = false;
+		if (frame < slotCount * framesPerSlot + drainFrames)
+		{
+			DrawFrame();
+			return true;
+		}
+		return false;
+	}
 
-		VkInstanceCreateInfo vkInstanceCreateInfo = {};
-		vkInstanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-		vkInstanceCreateInfo.pApplicationInfo = &vkApplicationInfo;
+	// 每隔几帧在两个窗口尺寸之间切换，分别统计resize帧和普通帧的耗时
+	void BenchResizeStep(uint64_t frame)
+	{
+		const uint64_t framesPerResize = 8;
+		if (frame % framesPerResize == 0 && frame > 0)
+		{
+			bool shrink = (frame / framesPerResize) % 2 == 1;
+			glfwSetWindowSize(window, shrink ? WIDTH * 3 / 4 : WIDTH, shrink ? HEIGHT * 3 / 4 : HEIGHT);
+			glfwPollEvents();
+		}
 
-		auto extensions = getRequiredExtensions();
-		vkInstanceCreateInfo.enabledExtensionCount = extensions.size();
-		vkInstanceCreateInfo.ppEnabledExtensionNames = extensions.data();
+		size_t resizesBefore = resizeTimes.size();
+		double ms = TimedDrawFrame();
+		(resizeTimes.size() > resizesBefore ? resizeFrameTimes : steadyFrameTimes).push_back(ms);
 
-		VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo = {};
-		if (enableValidationLayers)
+		if (resizeTimes.size() < options.benchResizeCount)
 		{
-			vkInstanceCreateInfo.enabledLayerCount = validationLayers.size();
-			vkInstanceCreateInfo.ppEnabledLayerNames = validationLayers.data();
-
-			PopulateDebugMessengerCreateInfo(debugCreateInfo);
-			vkInstanceCreateInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*)&debugCreateInfo;
+			return;
 		}
-		else
+
+		auto average = [](const std::vector<double>& values)
+			{
+				double sum = 0.0;
+				for (double value : values)
+				{
+					sum += value;
+				}
+				return values.empty() ? 0.0 : sum / values.size();
+			};
+		std::cout << "resize benchmark: " << resizeTimes.size() << " resizes, recreate avg " << average(resizeTimes)
+			<< " ms max " << *std::max_element(resizeTimes.begin(), resizeTimes.end()) << " ms, resize frame avg "
+			<< average(resizeFrameTimes) << " ms, other frames avg " << average(steadyFrameTimes) << " ms, "
+			<< deletionQueue.Size() << " deletions pending" << std::endl;
+		glfwSetWindowShouldClose(window, GLFW_TRUE);
+	}
+
+	// 所有变体先编译完，测量时每个变体都由GPU时间戳计时，特化版本与运行时分支版本交替进行
+	void CreateVariantBenchmark()
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(vkPhysicalDevice, &properties);
+		if (!properties.limits.timestampComputeAndGraphics || options.occlusion == OcclusionMode::HiZ)
 		{
-			vkInstanceCreateInfo.enabledLayerCount = 0;
-			vkInstanceCreateInfo.pNext = nullptr;
+			std::cout << "variant benchmark needs timestamps and the vertex path, skipped" << std::endl;
+			return;
 		}
+		timestampPeriod = properties.limits.timestampPeriod;
 
-		if (vkCreateInstance(&vkInstanceCreateInfo, nullptr, &vkInstance) != VK_SUCCESS)
+		const ShaderFeatures variants[] = {
+			ShaderFeature::Texture,
+			ShaderFeature::Texture | ShaderFeature::VertexColor,
+			ShaderFeature::Texture | ShaderFeature::VertexColor | ShaderFeature::AlphaTest,
+			ShaderFeature::Texture | ShaderFeature::VertexColor | ShaderFeature::AlphaTest | ShaderFeature::Fog,
+		};
+		for (ShaderFeatures features : variants)
 		{
-			throw std::runtime_error("fail to craete instance!");
+			VariantBenchEntry entry = {};
+			entry.features = features;
+
+			GraphicsPipelineDesc desc = SceneDesc({
+				{ VK_SHADER_STAGE_VERTEX_BIT, SHADER_DIR"vert.spv" },
+				{ VK_SHADER_STAGE_FRAGMENT_BIT, SHADER_DIR"frag.spv" },
+				}, "scene");
+			desc.features = features.Mask();
+			entry.specializedKey = pipelineRegistry->Request(desc);
+
+			desc.shaders[1].second = SHADER_DIR"fragBranchy.spv";
+			entry.branchyKey = pipelineRegistry->Request(desc);
+			variantBench.push_back(entry);
 		}
-		else
+		for (const auto& entry : variantBench)
 		{
-			std::cout << "succeed to create vk instance!!!" << std::endl;
+			pipelineRegistry->Wait(entry.specializedKey);
+			pipelineRegistry->Wait(entry.branchyKey);
 		}
-	}
 
+		VkQueryPoolCreateInfo queryPoolInfo = {};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = 2 * options.framesInFlight;
+		if (vkCreateQueryPool(vkDevice, &queryPoolInfo, nullptr, &variantQueryPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create timestamp query pool");
+		}
+		variantOfFrame.fill(-1);
+	}
 
-	void SetupDebugMessenger()
+	void BenchVariantStep(uint64_t frame)
 	{
-		if (!enableValidationLayers) return;
-
-		VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
-		PopulateDebugMessengerCreateInfo(debugCreateInfo);
-
-		if (CreateDebugUtilsMessengerEXT(vkInstance, &debugCreateInfo, nullptr, &debugMessenger) != VK_SUCCESS) 
+		if (StepBenchmark(frame, variantBench.size() * 2, 96, options.framesInFlight, benchVariantSlot, benchVariantMeasure))
 		{
-			throw std::runtime_error("failed to set up debug messenger!");
+			return;
 		}
-		else
+
+		std::cout << "variant benchmark, gpu time of the scene pass:" << std::endl;
+		for (const auto& entry : variantBench)
 		{
-			std::cout << "succeed to set up debug messenger" << std::endl;
+			double specialized = entry.gpuMilliseconds[0] / std::max(1u, entry.frames[0]);
+			double branchy = entry.gpuMilliseconds[1] / std::max(1u, entry.frames[1]);
+			std::cout << "  " << entry.features.Name() << ": specialized " << specialized << " ms, branchy " << branchy
+				<< " ms (" << (specialized > 0.0 ? (branchy / specialized - 1.0) * 100.0 : 0.0) << "%)" << std::endl;
 		}
+		glfwSetWindowShouldClose(window, GLFW_TRUE);
 	}
 
-	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-		VkDebugUtilsMessageTypeFlagsEXT messageType,
-		const VkDebugUtilsMessengerCallbackDataEXT* pCallback, void* pUserdata)
+	// 32种状态组合。管线路径每种组合一个管线，shader object路径只按片元特性创建着色器，其余状态都动态设置
+	void CreateDrawBenchmark()
 	{
-		std::cerr << "[VALIDATION LAYER]: " << pCallback->pMessage << std::endl;
-
-		return VK_FALSE;
-	}
-
-	bool CheckDeviceExtensionSupport(VkPhysicalDevice device)
-	{
-		uint32_t extensionCount;
-		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
-		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
-	
-		std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+		const ShaderFeatures featureSets[] = {
+			ShaderFeature::Texture,
+			ShaderFeature::Texture | ShaderFeature::VertexColor,
+			ShaderFeature::Texture | ShaderFeature::Fog,
+			ShaderFeature::Texture | ShaderFeature::AlphaTest,
+		};
+		for (ShaderFeatures features : featureSets)
+		{
+			for (VkCullModeFlags cullMode : { VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_NONE })
+			{
+				for (VkCompareOp depthCompare : { VK_COMPARE_OP_LESS, VK_COMPARE_OP_LESS_OR_EQUAL })
+				{
+					for (bool blendEnable : { false, true })
+					{
+						DrawBenchCombo combo = {};
+						combo.desc = SceneDesc({
+							{ VK_SHADER_STAGE_VERTEX_BIT, SHADER_DIR"vert.spv" },
+							{ VK_SHADER_STAGE_FRAGMENT_BIT, SHADER_DIR"frag.spv" },
+							}, "scene");
+						combo.desc.features = features.Mask();
+						combo.desc.cullMode = cullMode;
+						combo.desc.depthCompare = depthCompare;
+						combo.desc.blendEnable = blendEnable;
+						drawBench.push_back(combo);
+					}
+				}
+			}
+		}
 
-		for (const auto& extension : availableExtensions)
+		auto start = std::chrono::high_resolution_clock::now();
+		for (auto& combo : drawBench)
 		{
-			requiredExtensions.erase(extension.extensionName);
+			combo.pipelineKey = pipelineRegistry->Request(combo.desc);
+		}
+		for (const auto& combo : drawBench)
+		{
+			pipelineRegistry->Wait(combo.pipelineKey);
+		}
+		drawBenchCreateMs[0] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::vector<uint64_t> pipelineKeys;
+		for (const auto& combo : drawBench)
+		{
+			pipelineKeys.push_back(combo.pipelineKey);
+		}
+		std::sort(pipelineKeys.begin(), pipelineKeys.end());
+		pipelineKeys.erase(std::unique(pipelineKeys.begin(), pipelineKeys.end()), pipelineKeys.end());
+		size_t pipelineCount = pipelineKeys.size();
+		for (auto& combo : drawBench)
+		{
+			combo.pipelineId = (uint32_t)(std::lower_bound(pipelineKeys.begin(), pipelineKeys.end(), combo.pipelineKey) - pipelineKeys.begin());
 		}
+		std::cout << "succeed to map " << drawBench.size() << " state combinations to " << pipelineCount << " pipelines" << std::endl;
+		// 后台的优化链接也完成后再测量绘制
+		pipelineRegistry->WaitIdle();
 
-		return requiredExtensions.empty();
+		// 排序基准只用管线路径
+		if (!options.benchDraw)
+		{
+			return;
+		}
+		std::vector<VkDescriptorSetLayout> setLayouts = layoutCache->GetSetLayouts(sceneInterface);
+		start = std::chrono::high_resolution_clock::now();
+		for (auto& combo : drawBench)
+		{
+			combo.shaders = shaderObjects->Get(combo.desc, setLayouts, sceneInterface.pushConstants);
+		}
+		drawBenchCreateMs[1] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 	}
 
-	bool isDeviceSuitable(VkPhysicalDevice device)
+	// 两条路径交替测量三轮
+	void BenchDrawStep(uint64_t frame)
 	{
-		VkPhysicalDeviceProperties  deviceProperties;
-		VkPhysicalDeviceFeatures    deviceFeatures;
-		vkGetPhysicalDeviceProperties(device, &deviceProperties);
-		vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
-		//std::cout << deviceProperties.deviceName << std::endl;
-		
-		QueueFamilyIndices indices = FindQueueFamilies(device);
-		bool extensionSupported = CheckDeviceExtensionSupport(device);
-
-		bool swapChainAdequate = false;
-		if (extensionSupported)
+		if (StepBenchmark(frame, 6, 120, 0, benchDrawSlot, benchDrawMeasure, [this](uint64_t slot, double ms)
+			{
+				drawBenchFrameMs[slot % 2] += ms;
+				drawBenchFrames[slot % 2]++;
+			}))
 		{
-			SwapChainSupportDetails swapChainDetails = QuerySwapChainSupport(device);
-			swapChainAdequate = !swapChainDetails.formats.empty() && !swapChainDetails.presetnModes.empty();
+			return;
 		}
 
-		return deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU && indices.IsCompelete()
-			&& extensionSupported && swapChainAdequate;
+		std::cout << "draw benchmark, " << drawBench.size() << " state combinations, the state changes with every draw:" << std::endl;
+		const char* pathNames[] = { "pipelines", "shader objects" };
+		for (int path = 0; path < 2; path++)
+		{
+			uint32_t frames = std::max(1u, drawBenchFrames[path]);
+			double recordMs = drawBenchRecordMs[path] / frames;
+			double draws = (double)drawBenchDraws[path] / frames;
+			std::cout << "  " << pathNames[path] << ": created in " << drawBenchCreateMs[path] << " ms, " << draws << " draws recorded in "
+				<< recordMs << " ms (" << (recordMs > 0.0 ? draws / recordMs : 0.0) << " draws per ms), frame "
+				<< drawBenchFrameMs[path] / frames << " ms" << std::endl;
+		}
+		glfwSetWindowShouldClose(window, GLFW_TRUE);
 	}
 
-
-	void PickPhysicalDevice()
+	// 排序和不排序交替测量三轮，物体的状态组合和--bench-draw相同
+	void BenchSortStep(uint64_t frame)
 	{
-		uint32_t deviceCount = 0;
-		vkEnumeratePhysicalDevices(vkInstance, &deviceCount, nullptr);
-		std::vector<VkPhysicalDevice> devices(deviceCount);
-		vkEnumeratePhysicalDevices(vkInstance, &deviceCount, devices.data());
-
-		for (const auto& device : devices)
-		{
-			if (isDeviceSuitable(device))
+		if (StepBenchmark(frame, 6, 120, 0, benchSortSlot, benchSortMeasure, [this](uint64_t slot, double ms)
 			{
-				vkPhysicalDevice = device;
-				break;
-			}
-		}
-		
-		if (vkPhysicalDevice == VK_NULL_HANDLE)
+				sortBenchFrameMs[slot % 2] += ms;
+				sortBenchFrames[slot % 2]++;
+			}))
 		{
-			throw std::runtime_error("failed to find a suitable GPU");
+			return;
 		}
-		else
+
+		std::cout << "draw sort benchmark, " << drawBench.size() << " state combinations:" << std::endl;
+		const char* modeNames[] = { "sorted", "unsorted" };
+		for (int mode = 0; mode < 2; mode++)
 		{
-			std::cout << "succeed to find a suitable GPU" << std::endl;
+			uint32_t frames = std::max(1u, sortBenchFrames[mode]);
+			const DrawBindCounts& binds = sortBenchBinds[mode];
+			std::cout << "  " << modeNames[mode] << ": " << binds.draws / frames << " draws, " << binds.Binds() / frames << " binds ("
+				<< binds.pipelines / frames << " pipelines) per frame, sort " << sortBenchSortMs[mode] / frames << " ms, record "
+				<< sortBenchRecordMs[mode] / frames << " ms, frame " << sortBenchFrameMs[mode] / frames << " ms" << std::endl;
 		}
+		glfwSetWindowShouldClose(window, GLFW_TRUE);
 	}
 
-	QueueFamilyIndices FindQueueFamilies(VkPhysicalDevice device)
+	void BenchRecordStep(uint64_t frame)
 	{
-		QueueFamilyIndices indices;
-
-		uint32_t queueFamilyCount = 0;
-		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
-		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
-		
-		int i = 0;
-		for (const auto& queueFamily : queueFamilies)
-		{
-			if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT);
-			{
-				indices.graphicsFamily = i;
-			}
-			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, vkSurface, &presentSupport);
-			if (queueFamily.queueCount > 0 && presentSupport)
+		if (StepBenchmark(frame, benchRecordThreads.size(), 120, 0, benchRecordSlot, benchRecordMeasure, [this](uint64_t slot, double ms)
 			{
-				indices.presentFamily = i;
-			}
-			if (indices.IsCompelete())
-			{
-				break;
-			}
-			i++;
+				recordBenchFrameMs[slot] += ms;
+				recordBenchFrames[slot]++;
+			}))
+		{
+			return;
 		}
 
-		return indices;
+		std::cout << "command recording benchmark, " << visibleObjects.size() << " draws:" << std::endl;
+		double singleMs = recordBenchMs[0] / std::max(1u, recordBenchFrames[0]);
+		for (size_t i = 0; i < benchRecordThreads.size(); i++)
+		{
+			uint32_t frames = std::max(1u, recordBenchFrames[i]);
+			double recordMs = recordBenchMs[i] / frames;
+			std::cout << "  " << benchRecordThreads[i] << " threads: record " << recordMs << " ms, "
+				<< (recordMs > 0.0 ? recordBenchDraws[i] / frames / recordMs : 0.0) << " draws/ms, speedup "
+				<< (recordMs > 0.0 ? singleMs / recordMs : 0.0) << "x, frame " << recordBenchFrameMs[i] / frames << " ms" << std::endl;
+		}
+		glfwSetWindowShouldClose(window, GLFW_TRUE);
 	}
 
-	void CreateLogicalDevice()
+	// 组合之间共用的管线不重复绑定，返回是否绑定了管线
+	bool BindDrawBenchState(VkCommandBuffer commandBuffer, DynamicStateTracker& tracker, uint32_t state, VkPipeline& boundPipeline)
 	{
-		QueueFamilyIndices indices = FindQueueFamilies(vkPhysicalDevice);
+		const DrawBenchCombo& combo = drawBench[state];
+		if (benchDrawSlot % 2 == 1)
+		{
+			shaderObjects->Bind(commandBuffer, combo.shaders);
+			shaderObjects->SetState(commandBuffer, combo.desc, vkSwapChainExtent);
+			tracker.Reset();
+			return false;
+		}
 
-		std::vector<VkDeviceQueueCreateInfo> deviceQueueCreateInfos;
-		std::set<int> uniqueFamilies = { indices.graphicsFamily, indices.presentFamily };
-	
-		float queuePriority = 1.0f;
-		for (int queueFamily : uniqueFamilies)
+		bool bind = combo.pipeline != boundPipeline;
+		if (bind)
 		{
-			VkDeviceQueueCreateInfo queueCreateInfo = {};
-			queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-			queueCreateInfo.queueFamilyIndex = queueFamily;
-			queueCreateInfo.queueCount = 1;
-			queueCreateInfo.pQueuePriorities = &queuePriority;
-			deviceQueueCreateInfos.push_back(queueCreateInfo);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, combo.pipeline);
+			boundPipeline = combo.pipeline;
 		}
+		tracker.Apply(commandBuffer, combo.desc);
+		return bind;
+	}
 
-		VkPhysicalDeviceFeatures physicalDeviceFeatures = {};
-		physicalDeviceFeatures.samplerAnisotropy = VK_TRUE;
+	void ReadVariantTimestamps(uint32_t frameIndex)
+	{
+		int slot = variantOfFrame[frameIndex];
+		variantOfFrame[frameIndex] = -1;
+		if (slot < 0)
+		{
+			return;
+		}
 
-		VkDeviceCreateInfo deviceCreateInfo = {};
-		deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-		deviceCreateInfo.pQueueCreateInfos = deviceQueueCreateInfos.data();
-		deviceCreateInfo.queueCreateInfoCount = deviceQueueCreateInfos.size();
-		deviceCreateInfo.pEnabledFeatures = &physicalDeviceFeatures;
+		// 这一帧在timeline上的值已经完成，结果一定可用
+		uint64_t timestamps[2];
+		if (vkGetQueryPoolResults(vkDevice, variantQueryPool, frameIndex * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+			VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+		{
+			return;
+		}
 
-		deviceCreateInfo.enabledExtensionCount = deviceExtensions.size();
-		deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+		VariantBenchEntry& entry = variantBench[slot / 2];
+		entry.gpuMilliseconds[slot % 2] += (timestamps[1] - timestamps[0]) * timestampPeriod / 1e6;
+		entry.frames[slot % 2]++;
+	}
 
-		if (enableValidationLayers)
+	void Cleanup()
+	{
+		pipelineRegistry->PrintStats("shutdown");
+		for (const DynamicStateTracker& recordState : recordStates)
 		{
-			deviceCreateInfo.enabledLayerCount = validationLayers.size();
-			deviceCreateInfo.ppEnabledLayerNames = validationLayers.data();
+			dynamicState->AddStats(recordState);
 		}
-		else
+		dynamicState->PrintStats();
+		resourceStates->PrintStats();
+		framePacer->PrintStats();
+		if (latencyTracer)
 		{
-			deviceCreateInfo.enabledLayerCount = 0;
+			// MainLoop和RunThreads退出前已经等到timeline的最后提交值，最后几帧的时间戳都能读了
+			for (uint32_t slot = 0; slot < options.framesInFlight; slot++)
+			{
+				latencyTracer->ResolveGpu(slot);
+			}
+			latencyTracer->PrintSummary();
+			latencyTracer->WriteJson(options.latencyTracePath);
+			latencyTracer.reset();
+		}
+		if (options.cacheCommands)
+		{
+			std::cout << "command cache: " << cacheReuses << " frames executed cached commands, " << cacheRecords << " recorded them again" << std::endl;
+		}
+		if (packetFrames > 0)
+		{
+			std::cout << "draw packets: " << bindTotals.draws / packetFrames << " draws, " << bindTotals.Binds() / packetFrames
+				<< " binds per frame (" << bindTotals.pipelines / packetFrames << " pipelines, " << bindTotals.descriptorSets / packetFrames
+				<< " descriptor sets), " << (options.sortDraws ? "sorted" : "unsorted") << std::endl;
 		}
+		pipelineRegistry->SaveKeys(options.pipelineKeysPath);
+		pipelineRegistry.reset();
+		pipelineLibraries.reset();
+		shaderObjects.reset();
 
-		if (vkCreateDevice(vkPhysicalDevice, &deviceCreateInfo, nullptr, &vkDevice) != VK_SUCCESS)
+		CleanupSwapChain();
+		vkDestroySwapchainKHR(vkDevice, vkSwapChain, nullptr);
+		deletionQueue.FlushAll();
+
+		if (options.occlusion == OcclusionMode::HiZ)
 		{
-			throw std::runtime_error("fail to create logical device!");
+			CleanupOcclusionCulling();
 		}
-		else
+		else if (options.occlusion == OcclusionMode::Queries)
 		{
-			std::cout << "succeed to create logical device" << std::endl;
+			CleanupOcclusionQueries();
 		}
 
-		vkGetDeviceQueue(vkDevice, indices.graphicsFamily, 0, &graphicsQueue);
-		vkGetDeviceQueue(vkDevice, indices.presentFamily, 0, &presentQueue);
-	}
+		if (options.meshShading)
+		{
+			CleanupMeshletResources();
+		}
 
-	void CreateSurface()
-	{
-		if (glfwCreateWindowSurface(vkInstance, window, nullptr, &vkSurface) != VK_SUCCESS)
+		if (variantQueryPool != VK_NULL_HANDLE)
 		{
-			throw std::runtime_error("fail to create window surface!");
+			vkDestroyQueryPool(vkDevice, variantQueryPool, nullptr);
 		}
-		else
+
+		vkDestroySampler(vkDevice, textureSampler, nullptr);
+		vkDestroyImageView(vkDevice, textureImageView, nullptr);
+		vkDestroyImage(vkDevice, textureImage, nullptr);
+		vkFreeMemory(vkDevice, textureImageMemory, nullptr);
+
+		vkDestroyCommandPool(vkDevice, commandPool, nullptr);
+		frameContexts.clear();
+		timeline.reset();
+		computeTimeline.reset();
+
+		vkDestroyBuffer(vkDevice, vertexBuffer, nullptr);
+		vkFreeMemory(vkDevice, vertexBufferMemory, nullptr);
+		vkDestroyBuffer(vkDevice, indexBuffer, nullptr);
+		vkFreeMemory(vkDevice, indexBufferMemory, nullptr);
+
+		layoutCache.reset();
+		pipelineCache->Save();
+		pipelineCache.reset();
+
+		vkDestroyDevice(vkDevice, nullptr);
+
+		if (enableValidationLayers)
 		{
-			std::cout << "succeed to create window surface" << std::endl;
+			DestroyDebugUtilsMessengerEXT(vkInstance, debugMessenger, nullptr);
 		}
-	}
 
-	SwapChainSupportDetails QuerySwapChainSupport(VkPhysicalDevice device)
-	{
-		SwapChainSupportDetails details;
+		vkDestroySurfaceKHR(vkInstance, vkSurface, nullptr);
 
-		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, vkSurface, &details.capabilities);
-		
-		uint32_t formatCount;
-		vkGetPhysicalDeviceSurfaceFormatsKHR(device, vkSurface, &formatCount, nullptr);
-		if (formatCount != 0)
-			details.formats.resize(formatCount);
-		vkGetPhysicalDeviceSurfaceFormatsKHR(device, vkSurface, &formatCount, details.formats.data());
-		
-		uint32_t presentModeCount;
-		vkGetPhysicalDeviceSurfacePresentModesKHR(device, vkSurface, &presentModeCount, nullptr);
-		if (presentModeCount != 0)
-			details.presetnModes.resize(presentModeCount);
-		vkGetPhysicalDeviceSurfacePresentModesKHR(device, vkSurface, &presentModeCount, details.presetnModes.data());
+		vkDestroyInstance(vkInstance, nullptr);
 
-		return details;
+		glfwDestroyWindow(window);
+
+		glfwTerminate();
 	}
 
-	VkSurfaceFormatKHR ChooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
+	std::vector<const char*> getRequiredExtensions()
 	{
-		if (availableFormats.size() == 1 && availableFormats[0].format == VK_FORMAT_UNDEFINED)
-		{
-			return { VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
-		}
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions;
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-		for (const auto& availableFormat : availableFormats)
+		std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+
+		if (enableValidationLayers)
 		{
-			if (availableFormat.format == VK_FORMAT_B8G8R8A8_UNORM && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
-			{
-				return availableFormat;
-			}
+			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 		}
 
-		return availableFormats[0];
+		return extensions;
 	}
 
-	VkPresentModeKHR ChooseSwapPresentMode(const std::vector<VkPresentModeKHR> availablePresentModes)
+	bool CheckValidationLayerSupport()
 	{
-		VkPresentModeKHR bestMode = VK_PRESENT_MODE_FIFO_KHR;
+		uint32_t layerCount;
+		vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+		std::vector<VkLayerProperties> availableLayers(layerCount);
+		vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
 
-		for (const auto& availablePresentMode : availablePresentModes)
+		for (const char* layerName : validationLayers)
 		{
-			if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+			bool layerFound = false;
+
+			for (const auto& layerProperties : availableLayers)
 			{
-				return availablePresentMode;
+				if (strcmp(layerName, layerProperties.layerName) == 0)
+				{
+					layerFound = true;
+					break;
+				}
 			}
-			else if (availablePresentMode == VK_PRESENT_MODE_IMMEDIATE_KHR)
+
+			if (!layerFound)
 			{
-				bestMode = availablePresentMode;
+				return false;
 			}
 		}
 
-		return bestMode;
+		return true;
 	}
 
-	VkExtent2D ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
+	void PopulateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo)
 	{
-		if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
-		{
-			return capabilities.currentExtent;
-		}
-		else
-		{
-			int width, height;
-			glfwGetFramebufferSize(window, &width, &height);
-			VkExtent2D actualExtent = { width, height };
-			return actualExtent;
-		}
+		createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+		createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+		createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+		createInfo.pfnUserCallback = debugCallback;
 	}
 
-	void CreateSwapChain()
+	void CreateInstance()
 	{
-		SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(vkPhysicalDevice);
-		
-		VkSurfaceFormatKHR surfaceFormat = ChooseSwapSurfaceFormat(swapChainSupport.formats);
-		VkPresentModeKHR presentMode = ChooseSwapPresentMode(swapChainSupport.presetnModes);
-		VkExtent2D extent = ChooseSwapExtent(swapChainSupport.capabilities);
+		if (enableValidationLayers && !CheckValidationLayerSupport())
+		{
+			throw std::runtime_error("validation layers requested, but not available");
+		}
 
-		vkSwapChainImageFormat = surfaceFormat.format;
-		vkSwapChainExtent = extent;
+		VkApplicationInfo vkApplicationInfo = {};
+		vkApplicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+		vkApplicationInfo.pApplicationName = "vk";
+		vkApplicationInfo.applicationVersion = VK_MAKE_VERSION(1, 3, 0);
+		vkApplicationInfo.pEngineName = "no";
+		vkApplicationInfo.engineVersion = VK_MAKE_VERSION(1, 3, 0);
+		vkApplicationInfo.apiVersion = VK_API_VERSION_1_3;
 
-		uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
-		if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
+		VkInstanceCreateInfo vkInstanceCreateInfo = {};
+		vkInstanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+		vkInstanceCreateInfo.pApplicationInfo = &vkApplicationInfo;
+
+		auto extensions = getRequiredExtensions();
+		vkInstanceCreateInfo.enabledExtensionCount = extensions.size();
+		vkInstanceCreateInfo.ppEnabledExtensionNames = extensions.data();
+
+		VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo = {};
+		if (enableValidationLayers)
 		{
-			imageCount = swapChainSupport.capabilities.maxImageCount;
-		}
+			vkInstanceCreateInfo.enabledLayerCount = validationLayers.size();
+			vkInstanceCreateInfo.ppEnabledLayerNames = validationLayers.data();
 
-		VkSwapchainCreateInfoKHR createInfo = {};
-		createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-		createInfo.surface = vkSurface;
-		createInfo.minImageCount = imageCount;
-		createInfo.imageFormat = surfaceFormat.format;
-		createInfo.imageColorSpace = surfaceFormat.colorSpace;
-		createInfo.imageExtent = extent;
-		createInfo.imageArrayLayers = 1;
-		createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+			PopulateDebugMessengerCreateInfo(debugCreateInfo);
+			vkInstanceCreateInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*)&debugCreateInfo;
+		}
+		else
+		{
+			vkInstanceCreateInfo.enabledLayerCount = 0;
+			vkInstanceCreateInfo.pNext = nullptr;
+		}
 
-		QueueFamilyIndices indices = FindQueueFamilies(vkPhysicalDevice);
-		uint32_t queueFamilyIndices[] = { (uint32_t)indices.graphicsFamily, (uint32_t)indices.presentFamily };
-		if (indices.graphicsFamily != indices.presentFamily)
+		if (vkCreateInstance(&vkInstanceCreateInfo, nullptr, &vkInstance) != VK_SUCCESS)
 		{
-			createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-			createInfo.queueFamilyIndexCount = 2;
-			createInfo.pQueueFamilyIndices = queueFamilyIndices;
+			throw std::runtime_error("fail to craete instance!");
 		}
 		else
 		{
-			createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-			createInfo.queueFamilyIndexCount = 0;
-			createInfo.pQueueFamilyIndices = nullptr;
+			std::cout << "succeed to create vk instance!!!" << std::endl;
 		}
+	}
 
-		createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
-		createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-		createInfo.presentMode = presentMode;
-		createInfo.clipped = VK_TRUE;
-		createInfo.oldSwapchain = VK_NULL_HANDLE;
 
-		if (vkCreateSwapchainKHR(vkDevice, &createInfo, nullptr, &vkSwapChain) != VK_SUCCESS)
+	void SetupDebugMessenger()
+	{
+		if (!enableValidationLayers) return;
+
+		VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
+		PopulateDebugMessengerCreateInfo(debugCreateInfo);
+
+		if (CreateDebugUtilsMessengerEXT(vkInstance, &debugCreateInfo, nullptr, &debugMessenger) != VK_SUCCESS) 
 		{
-			throw std::runtime_error("fail to create swap chain!");
+			throw std::runtime_error("failed to set up debug messenger!");
 		}
 		else
 		{
-			std::cout << "succeed to create swap chain" << std::endl;
+			std::cout << "succeed to set up debug messenger" << std::endl;
 		}
+	}
 
-		vkGetSwapchainImagesKHR(vkDevice, vkSwapChain, &imageCount, nullptr);
-		vkSwapChainImages.resize(imageCount);
-		vkGetSwapchainImagesKHR(vkDevice, vkSwapChain, &imageCount, vkSwapChainImages.data());
+	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
+		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+		VkDebugUtilsMessageTypeFlagsEXT messageType,
+		const VkDebugUtilsMessengerCallbackDataEXT* pCallback, void* pUserdata)
+	{
+		std::cerr << "[VALIDATION LAYER]: " << pCallback->pMessage << std::endl;
+
+		return VK_FALSE;
 	}
 
-	VkImageView CreateImageView(VkImage image, VkFormat format)
+	bool CheckDeviceExtensionSupport(VkPhysicalDevice device)
 	{
-		VkImageViewCreateInfo viewInfo = {};
-		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		viewInfo.image = image;
-		viewInfo.format = format;
-		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		viewInfo.subresourceRange.baseMipLevel = 0;
-		viewInfo.subresourceRange.levelCount = 1;
-		viewInfo.subresourceRange.baseArrayLayer = 0;
-		viewInfo.subresourceRange.layerCount = 1;
+		uint32_t extensionCount;
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+	
+		std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
 
-		VkImageView imageView;
-		if (vkCreateImageView(vkDevice, &viewInfo, nullptr, &imageView) != VK_SUCCESS)
+		for (const auto& extension : availableExtensions)
 		{
-			throw std::runtime_error("fail to create texture image view");
+			requiredExtensions.erase(extension.extensionName);
 		}
 
-		return imageView;
+		return requiredExtensions.empty();
 	}
 
-	VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags)
+	bool IsDeviceExtensionSupported(VkPhysicalDevice device, const char* extensionName)
 	{
-		VkImageViewCreateInfo viewInfo = {};
-		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		viewInfo.image = image;
-		viewInfo.format = format;
-		viewInfo.subresourceRange.aspectMask = aspectFlags;
-		viewInfo.subresourceRange.baseMipLevel = 0;
-		viewInfo.subresourceRange.levelCount = 1;
-		viewInfo.subresourceRange.baseArrayLayer = 0;
-		viewInfo.subresourceRange.layerCount = 1;
+		uint32_t extensionCount;
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
-		VkImageView imageView;
-		if (vkCreateImageView(vkDevice, &viewInfo, nullptr, &imageView) != VK_SUCCESS)
+		for (const auto& extension : availableExtensions)
 		{
-			throw std::runtime_error("fail to create texture image view");
+			if (strcmp(extension.extensionName, extensionName) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// 填写一个扩展的特性结构体，扩展本身不支持时返回false
+	bool QueryExtensionFeatures(const char* extensionName, void* features)
+	{
+		if (!IsDeviceExtensionSupported(vkPhysicalDevice, extensionName))
+		{
+			return false;
 		}
 
-		return imageView;
+		VkPhysicalDeviceFeatures2 features2 = {};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = features;
+		vkGetPhysicalDeviceFeatures2(vkPhysicalDevice, &features2);
+		return true;
 	}
 
-	void CreateImageViews()
+	void PrintPipelineLibraryProperties()
 	{
-		vkSwapChainImageViews.resize(vkSwapChainImages.size());
-		for (size_t i = 0; i < vkSwapChainImages.size(); i++)
+		VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT libraryProperties = {};
+		libraryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT;
+		VkPhysicalDeviceProperties2 properties2 = {};
+		properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties2.pNext = &libraryProperties;
+		vkGetPhysicalDeviceProperties2(vkPhysicalDevice, &properties2);
+
+		// 没有fastLinking时快速链接也可能要做完整编译，但仍然只编译缺少的部分
+		std::cout << "graphics pipeline library enabled, fast linking "
+			<< (libraryProperties.graphicsPipelineLibraryFastLinking ? "supported" : "not reported by the driver") << std::endl;
+	}
+
+	bool isDeviceSuitable(VkPhysicalDevice device)
+	{
+		VkPhysicalDeviceProperties  deviceProperties;
+		VkPhysicalDeviceFeatures    deviceFeatures;
+		vkGetPhysicalDeviceProperties(device, &deviceProperties);
+		vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+		//std::cout << deviceProperties.deviceName << std::endl;
+		
+		QueueFamilyIndices indices = FindQueueFamilies(device);
+		bool extensionSupported = CheckDeviceExtensionSupport(device);
+
+		bool swapChainAdequate = false;
+		if (extensionSupported)
 		{
-			vkSwapChainImageViews[i] = CreateImageView(vkSwapChainImages[i], vkSwapChainImageFormat);
+			SwapChainSupportDetails swapChainDetails = QuerySwapChainSupport(device);
+			swapChainAdequate = !swapChainDetails.formats.empty() && !swapChainDetails.presetnModes.empty();
 		}
 
-		std::cout << "succeed to create image views" << std::endl;
+		VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures = {};
+		timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+		VkPhysicalDeviceDynamicRenderingFeatures dynamicRenderingFeatures = {};
+		dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+		dynamicRenderingFeatures.pNext = &timelineFeatures;
+		VkPhysicalDeviceFeatures2 features2 = {};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &dynamicRenderingFeatures;
+		vkGetPhysicalDeviceFeatures2(device, &features2);
+
+		return indices.IsCompelete() && extensionSupported && swapChainAdequate && deviceProperties.apiVersion >= VK_API_VERSION_1_3
+			&& dynamicRenderingFeatures.dynamicRendering && timelineFeatures.timelineSemaphore;
 	}
 
-	VkShaderModule CreateShaderModule(const std::vector<char>& code)
+
+	void PickPhysicalDevice()
 	{
-		VkShaderModuleCreateInfo createInfo = {};
-		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		createInfo.codeSize = code.size();
-		createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+		uint32_t deviceCount = 0;
+		vkEnumeratePhysicalDevices(vkInstance, &deviceCount, nullptr);
+		std::vector<VkPhysicalDevice> devices(deviceCount);
+		vkEnumeratePhysicalDevices(vkInstance, &deviceCount, devices.data());
 
-		VkShaderModule vkShaderModule;
-		if (vkCreateShaderModule(vkDevice, &createInfo, nullptr, &vkShaderModule) != VK_SUCCESS)
+		// 优先独立显卡，没有的话也接受集成显卡和lavapipe这样的软件实现
+		for (const auto& device : devices)
 		{
-			throw std::runtime_error("fail to create shader module");
+			if (!isDeviceSuitable(device))
+			{
+				continue;
+			}
+
+			VkPhysicalDeviceProperties deviceProperties;
+			vkGetPhysicalDeviceProperties(device, &deviceProperties);
+			if (vkPhysicalDevice == VK_NULL_HANDLE || deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+			{
+				vkPhysicalDevice = device;
+			}
+			if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+			{
+				break;
+			}
+		}
+		
+		if (vkPhysicalDevice == VK_NULL_HANDLE)
+		{
+			throw std::runtime_error("failed to find a suitable GPU");
+		}
+		else
+		{
+			std::cout << "succeed to find a suitable GPU" << std::endl;
+		}
+	}
+
+	QueueFamilyIndices FindQueueFamilies(VkPhysicalDevice device)
+	{
+		QueueFamilyIndices indices;
+
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+		
+		// 每种取第一个符合的族，专用计算族可能排在后面，所以遍历所有族
+		int i = 0;
+		for (const auto& queueFamily : queueFamilies)
+		{
+			if (queueFamily.queueCount > 0 && (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && indices.graphicsFamily < 0)
+			{
+				indices.graphicsFamily = i;
+			}
+			VkBool32 presentSupport = false;
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, vkSurface, &presentSupport);
+			if (queueFamily.queueCount > 0 && presentSupport && indices.presentFamily < 0)
+			{
+				indices.presentFamily = i;
+			}
+			if (queueFamily.queueCount > 0 && (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+				&& indices.computeFamily < 0)
+			{
+				indices.computeFamily = i;
+			}
+			i++;
+		}
+
+		return indices;
+	}
+
+	void CreateLogicalDevice()
+	{
+		QueueFamilyIndices indices = FindQueueFamilies(vkPhysicalDevice);
+
+		std::vector<VkDeviceQueueCreateInfo> deviceQueueCreateInfos;
+		std::set<int> uniqueFamilies = { indices.graphicsFamily, indices.presentFamily };
+		if (options.asyncCompute && indices.computeFamily >= 0)
+		{
+			computeFamily = indices.computeFamily;
+			uniqueFamilies.insert(computeFamily);
+		}
+	
+		float queuePriority = 1.0f;
+		for (int queueFamily : uniqueFamilies)
+		{
+			VkDeviceQueueCreateInfo queueCreateInfo = {};
+			queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+			queueCreateInfo.queueFamilyIndex = queueFamily;
+			queueCreateInfo.queueCount = 1;
+			queueCreateInfo.pQueuePriorities = &queuePriority;
+			deviceQueueCreateInfos.push_back(queueCreateInfo);
+		}
+
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(vkPhysicalDevice, &supportedFeatures);
+
+		VkPhysicalDeviceFeatures physicalDeviceFeatures = {};
+		physicalDeviceFeatures.samplerAnisotropy = VK_TRUE;
+
+		if (options.occlusion == OcclusionMode::HiZ)
+		{
+			if (supportedFeatures.multiDrawIndirect && supportedFeatures.drawIndirectFirstInstance)
+			{
+				physicalDeviceFeatures.multiDrawIndirect = VK_TRUE;
+				physicalDeviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+			}
+			else
+			{
+				std::cout << "hi-z occlusion culling needs multiDrawIndirect and drawIndirectFirstInstance, disabled" << std::endl;
+				options.occlusion = OcclusionMode::None;
+			}
+		}
+
+		std::vector<const char*> enabledExtensions = deviceExtensions;
+
+		// 扩展的feature结构串在deviceCreateInfo.pNext上
+		void* featureChain = nullptr;
+
+		VkPhysicalDeviceConditionalRenderingFeaturesEXT conditionalRenderingFeatures = {};
+		conditionalRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_CONDITIONAL_RENDERING_FEATURES_EXT;
+		if (options.occlusion == OcclusionMode::Queries)
+		{
+			if (QueryExtensionFeatures(VK_EXT_CONDITIONAL_RENDERING_EXTENSION_NAME, &conditionalRenderingFeatures) &&
+				conditionalRenderingFeatures.conditionalRendering)
+			{
+				enabledExtensions.push_back(VK_EXT_CONDITIONAL_RENDERING_EXTENSION_NAME);
+				conditionalRenderingFeatures.inheritedConditionalRendering = VK_FALSE;
+				conditionalRenderingFeatures.pNext = featureChain;
+				featureChain = &conditionalRenderingFeatures;
+			}
+			else
+			{
+				std::cout << "occlusion queries need VK_EXT_conditional_rendering, disabled" << std::endl;
+				options.occlusion = OcclusionMode::None;
+			}
+		}
+
+		VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures = {};
+		meshShaderFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT;
+		if (options.meshShading)
+		{
+			if (QueryExtensionFeatures(VK_EXT_MESH_SHADER_EXTENSION_NAME, &meshShaderFeatures) &&
+				meshShaderFeatures.taskShader && meshShaderFeatures.meshShader)
+			{
+				enabledExtensions.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+				VkPhysicalDeviceMeshShaderFeaturesEXT enabledFeatures = {};
+				enabledFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT;
+				enabledFeatures.taskShader = VK_TRUE;
+				enabledFeatures.meshShader = VK_TRUE;
+				meshShaderFeatures = enabledFeatures;
+				meshShaderFeatures.pNext = featureChain;
+				featureChain = &meshShaderFeatures;
+			}
+			else
+			{
+				std::cout << "VK_EXT_mesh_shader not supported, falling back to the vertex pipeline" << std::endl;
+				options.meshShading = false;
+			}
+		}
+
+		VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT pipelineLibraryFeatures = {};
+		pipelineLibraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+		if (options.pipelineLibrary)
+		{
+			if (IsDeviceExtensionSupported(vkPhysicalDevice, VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+				QueryExtensionFeatures(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME, &pipelineLibraryFeatures) &&
+				pipelineLibraryFeatures.graphicsPipelineLibrary)
+			{
+				enabledExtensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+				enabledExtensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+				pipelineLibraryFeatures.pNext = featureChain;
+				featureChain = &pipelineLibraryFeatures;
+				PrintPipelineLibraryProperties();
+			}
+			else
+			{
+				std::cout << "VK_EXT_graphics_pipeline_library not supported, falling back to monolithic pipelines" << std::endl;
+				options.pipelineLibrary = false;
+			}
+		}
+
+		if ((options.shaderObjects || options.benchDraw) && options.occlusion == OcclusionMode::HiZ)
+		{
+			std::cout << "shader objects only replace the scene pipeline of the vertex path, not used with hi-z occlusion culling" << std::endl;
+			options.shaderObjects = false;
+			options.benchDraw = false;
+		}
+
+		VkPhysicalDeviceShaderObjectFeaturesEXT shaderObjectFeatures = {};
+		shaderObjectFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT;
+		if (options.shaderObjects || options.benchDraw)
+		{
+			if (QueryExtensionFeatures(VK_EXT_SHADER_OBJECT_EXTENSION_NAME, &shaderObjectFeatures) &&
+				shaderObjectFeatures.shaderObject)
+			{
+				enabledExtensions.push_back(VK_EXT_SHADER_OBJECT_EXTENSION_NAME);
+				shaderObjectFeatures.pNext = featureChain;
+				featureChain = &shaderObjectFeatures;
+			}
+			else
+			{
+				std::cout << "VK_EXT_shader_object not supported, drawing with pipelines" << std::endl;
+				options.shaderObjects = false;
+				options.benchDraw = false;
+			}
+		}
+
+		// extended dynamic state 1/2是1.3核心功能，混合状态需要VK_EXT_extended_dynamic_state3
+		VkPhysicalDeviceExtendedDynamicState3FeaturesEXT dynamicState3Features = {};
+		dynamicState3Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+		if (options.dynamicState)
+		{
+			dynamicStateGroups = DynamicStateGroup::Extended | DynamicStateGroup::Extended2;
+			VkPhysicalDeviceExtendedDynamicState3FeaturesEXT supported = {};
+			supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+			if (QueryExtensionFeatures(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME, &supported) &&
+				supported.extendedDynamicState3ColorBlendEnable && supported.extendedDynamicState3ColorBlendEquation &&
+				supported.extendedDynamicState3ColorWriteMask)
+			{
+				enabledExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+				dynamicState3Features.extendedDynamicState3ColorBlendEnable = VK_TRUE;
+				dynamicState3Features.extendedDynamicState3ColorBlendEquation = VK_TRUE;
+				dynamicState3Features.extendedDynamicState3ColorWriteMask = VK_TRUE;
+				dynamicState3Features.pNext = featureChain;
+				featureChain = &dynamicState3Features;
+				dynamicStateGroups |= (uint32_t)DynamicStateGroup::Extended3Blend;
+			}
+			else
+			{
+				std::cout << "VK_EXT_extended_dynamic_state3 not supported, blend state stays in the pipeline" << std::endl;
+			}
+		}
+
+		// 场景用vkCmdBeginRendering绘制，isDeviceSuitable已经检查过支持
+		VkPhysicalDeviceDynamicRenderingFeatures dynamicRenderingFeatures = {};
+		dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+		dynamicRenderingFeatures.dynamicRendering = VK_TRUE;
+		dynamicRenderingFeatures.pNext = featureChain;
+		featureChain = &dynamicRenderingFeatures;
+
+		// 等上一帧呈现到屏幕上再开始下一帧，需要present id给每次呈现编号
+		VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures = {};
+		presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+		VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures = {};
+		presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+		if (options.presentWait)
+		{
+			if (QueryExtensionFeatures(VK_KHR_PRESENT_ID_EXTENSION_NAME, &presentIdFeatures) && presentIdFeatures.presentId &&
+				QueryExtensionFeatures(VK_KHR_PRESENT_WAIT_EXTENSION_NAME, &presentWaitFeatures) && presentWaitFeatures.presentWait)
+			{
+				enabledExtensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+				enabledExtensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+				presentIdFeatures.pNext = featureChain;
+				presentWaitFeatures.pNext = &presentIdFeatures;
+				featureChain = &presentWaitFeatures;
+			}
+			else
+			{
+				std::cout << "VK_KHR_present_wait not supported, frames are paced by the swapchain and --fps-limit only" << std::endl;
+				options.presentWait = false;
+			}
+		}
+
+		// GPU时间戳换算到CPU时钟才能和其他延迟标记放在一条时间线上
+		if (!options.latencyTracePath.empty())
+		{
+			if (IsDeviceExtensionSupported(vkPhysicalDevice, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME))
+			{
+				enabledExtensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+				calibratedTimestamps = true;
+			}
+			else
+			{
+				std::cout << "VK_EXT_calibrated_timestamps not supported, the latency trace only has the gpu duration of each frame" << std::endl;
+			}
+		}
+
+		// 屏障都用vkCmdPipelineBarrier2，1.3核心
+		VkPhysicalDeviceSynchronization2Features synchronization2Features = {};
+		synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+		synchronization2Features.synchronization2 = VK_TRUE;
+		synchronization2Features.pNext = featureChain;
+		featureChain = &synchronization2Features;
+
+		// 帧和资源的生命周期都用一个timeline semaphore跟踪
+		VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures = {};
+		timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+		timelineFeatures.timelineSemaphore = VK_TRUE;
+		timelineFeatures.pNext = featureChain;
+		featureChain = &timelineFeatures;
+
+		VkDeviceCreateInfo deviceCreateInfo = {};
+		deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		deviceCreateInfo.pQueueCreateInfos = deviceQueueCreateInfos.data();
+		deviceCreateInfo.queueCreateInfoCount = deviceQueueCreateInfos.size();
+		deviceCreateInfo.pEnabledFeatures = &physicalDeviceFeatures;
+		deviceCreateInfo.pNext = featureChain;
+
+		deviceCreateInfo.enabledExtensionCount = enabledExtensions.size();
+		deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions.data();
+
+		if (enableValidationLayers)
+		{
+			deviceCreateInfo.enabledLayerCount = validationLayers.size();
+			deviceCreateInfo.ppEnabledLayerNames = validationLayers.data();
+		}
+		else
+		{
+			deviceCreateInfo.enabledLayerCount = 0;
+		}
+
+		if (vkCreateDevice(vkPhysicalDevice, &deviceCreateInfo, nullptr, &vkDevice) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create logical device!");
+		}
+		else
+		{
+			std::cout << "succeed to create logical device" << std::endl;
+		}
+
+		vkGetDeviceQueue(vkDevice, indices.graphicsFamily, 0, &graphicsQueue);
+		vkGetDeviceQueue(vkDevice, indices.presentFamily, 0, &presentQueue);
+		if (computeFamily >= 0)
+		{
+			vkGetDeviceQueue(vkDevice, computeFamily, 0, &computeQueue);
+			std::cout << "succeed to create async compute queue in family " << computeFamily << std::endl;
+		}
+		else
+		{
+			std::cout << "no async compute queue, async passes run on the graphics queue" << std::endl;
+		}
+	}
+
+	void CreateSurface()
+	{
+		if (glfwCreateWindowSurface(vkInstance, window, nullptr, &vkSurface) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create window surface!");
+		}
+		else
+		{
+			std::cout << "succeed to create window surface" << std::endl;
+		}
+	}
+
+	SwapChainSupportDetails QuerySwapChainSupport(VkPhysicalDevice device)
+	{
+		SwapChainSupportDetails details;
+
+		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, vkSurface, &details.capabilities);
+		
+		uint32_t formatCount;
+		vkGetPhysicalDeviceSurfaceFormatsKHR(device, vkSurface, &formatCount, nullptr);
+		if (formatCount != 0)
+			details.formats.resize(formatCount);
+		vkGetPhysicalDeviceSurfaceFormatsKHR(device, vkSurface, &formatCount, details.formats.data());
+		
+		uint32_t presentModeCount;
+		vkGetPhysicalDeviceSurfacePresentModesKHR(device, vkSurface, &presentModeCount, nullptr);
+		if (presentModeCount != 0)
+			details.presetnModes.resize(presentModeCount);
+		vkGetPhysicalDeviceSurfacePresentModesKHR(device, vkSurface, &presentModeCount, details.presetnModes.data());
+
+		return details;
+	}
+
+	VkSurfaceFormatKHR ChooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
+	{
+		if (availableFormats.size() == 1 && availableFormats[0].format == VK_FORMAT_UNDEFINED)
+		{
+			return { VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+		}
+
+		for (const auto& availableFormat : availableFormats)
+		{
+			if (availableFormat.format == VK_FORMAT_B8G8R8A8_UNORM && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+			{
+				return availableFormat;
+			}
+		}
+
+		return availableFormats[0];
+	}
+
+	static const char* PresentModeName(VkPresentModeKHR mode)
+	{
+		switch (mode)
+		{
+		case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+		case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo-relaxed";
+		case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+		case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+		default: return "other";
+		}
+	}
+
+	VkPresentModeKHR ChooseSwapPresentMode(const std::vector<VkPresentModeKHR> availablePresentModes)
+	{
+		if (options.presentMode != VK_PRESENT_MODE_MAX_ENUM_KHR)
+		{
+			if (std::find(availablePresentModes.begin(), availablePresentModes.end(), options.presentMode) == availablePresentModes.end())
+			{
+				// FIFO一定支持
+				std::cout << "present mode " << PresentModeName(options.presentMode) << " not supported, using fifo" << std::endl;
+				options.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+			}
+			return options.presentMode;
+		}
+
+		VkPresentModeKHR bestMode = VK_PRESENT_MODE_FIFO_KHR;
+
+		for (const auto& availablePresentMode : availablePresentModes)
+		{
+			if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+			{
+				return availablePresentMode;
+			}
+			else if (availablePresentMode == VK_PRESENT_MODE_IMMEDIATE_KHR)
+			{
+				bestMode = availablePresentMode;
+			}
+		}
+
+		return bestMode;
+	}
+
+	VkExtent2D ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
+	{
+		if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
+		{
+			return capabilities.currentExtent;
+		}
+		else
+		{
+			int width, height;
+			GetFramebufferSize(width, height);
+			VkExtent2D actualExtent = { width, height };
+			return actualExtent;
+		}
+	}
+
+	void CreateSwapChain(VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE)
+	{
+		SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(vkPhysicalDevice);
+		
+		VkSurfaceFormatKHR surfaceFormat = ChooseSwapSurfaceFormat(swapChainSupport.formats);
+		VkPresentModeKHR presentMode = ChooseSwapPresentMode(swapChainSupport.presetnModes);
+		VkExtent2D extent = ChooseSwapExtent(swapChainSupport.capabilities);
+
+		vkSwapChainImageFormat = surfaceFormat.format;
+		vkSwapChainExtent = extent;
+
+		uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+		if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
+		{
+			imageCount = swapChainSupport.capabilities.maxImageCount;
+		}
+
+		VkSwapchainCreateInfoKHR createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+		createInfo.surface = vkSurface;
+		createInfo.minImageCount = imageCount;
+		createInfo.imageFormat = surfaceFormat.format;
+		createInfo.imageColorSpace = surfaceFormat.colorSpace;
+		createInfo.imageExtent = extent;
+		createInfo.imageArrayLayers = 1;
+		createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+		QueueFamilyIndices indices = FindQueueFamilies(vkPhysicalDevice);
+		uint32_t queueFamilyIndices[] = { (uint32_t)indices.graphicsFamily, (uint32_t)indices.presentFamily };
+		if (indices.graphicsFamily != indices.presentFamily)
+		{
+			createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+			createInfo.queueFamilyIndexCount = 2;
+			createInfo.pQueueFamilyIndices = queueFamilyIndices;
+		}
+		else
+		{
+			createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			createInfo.queueFamilyIndexCount = 0;
+			createInfo.pQueueFamilyIndices = nullptr;
+		}
+
+		createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
+		createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+		createInfo.presentMode = presentMode;
+		createInfo.clipped = VK_TRUE;
+		createInfo.oldSwapchain = oldSwapChain;
+
+		if (vkCreateSwapchainKHR(vkDevice, &createInfo, nullptr, &vkSwapChain) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create swap chain!");
+		}
+		else
+		{
+			std::cout << "succeed to create swap chain, present mode " << PresentModeName(presentMode) << std::endl;
+		}
+
+		vkGetSwapchainImagesKHR(vkDevice, vkSwapChain, &imageCount, nullptr);
+		vkSwapChainImages.resize(imageCount);
+		vkGetSwapchainImagesKHR(vkDevice, vkSwapChain, &imageCount, vkSwapChainImages.data());
+	}
+
+	VkImageView CreateImageView(VkImage image, VkFormat format)
+	{
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.image = image;
+		viewInfo.format = format;
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+
+		VkImageView imageView;
+		if (vkCreateImageView(vkDevice, &viewInfo, nullptr, &imageView) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create texture image view");
+		}
+
+		return imageView;
+	}
+
+	VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags,
+		uint32_t baseMipLevel = 0, uint32_t levelCount = 1)
+	{
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.image = image;
+		viewInfo.format = format;
+		viewInfo.subresourceRange.aspectMask = aspectFlags;
+		viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
+		viewInfo.subresourceRange.levelCount = levelCount;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+
+		VkImageView imageView;
+		if (vkCreateImageView(vkDevice, &viewInfo, nullptr, &imageView) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create texture image view");
+		}
+
+		return imageView;
+	}
+
+	void CreateImageViews()
+	{
+		vkSwapChainImageViews.resize(vkSwapChainImages.size());
+		for (size_t i = 0; i < vkSwapChainImages.size(); i++)
+		{
+			vkSwapChainImageViews[i] = CreateImageView(vkSwapChainImages[i], vkSwapChainImageFormat);
+			resourceStates->AddImage(vkSwapChainImages[i], VK_IMAGE_ASPECT_COLOR_BIT, 1, 1);
+		}
+
+		std::cout << "succeed to create image views" << std::endl;
+	}
+
+	VkShaderModule CreateShaderModule(const std::vector<char>& code)
+	{
+		VkShaderModuleCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		createInfo.codeSize = code.size();
+		createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+		VkShaderModule vkShaderModule;
+		if (vkCreateShaderModule(vkDevice, &createInfo, nullptr, &vkShaderModule) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create shader module");
+		}
+
+		return vkShaderModule;
+	}
+
+	void CopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+	{
+		VkBufferImageCopy region = {};
+		region.bufferOffset = 0;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = 0;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { width, height, 1 };
+
+		vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	}
+
+	void CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
+		VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, uint32_t mipLevels = 1)
+	{
+		VkImageCreateInfo imageInfo = {};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.extent.width = width;
+		imageInfo.extent.height = height;
+		imageInfo.extent.depth = 1;
+		imageInfo.mipLevels = mipLevels;
+		imageInfo.arrayLayers = 1;
+		imageInfo.format = format;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.usage = usage;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.flags = 0;
+
+		if (vkCreateImage(vkDevice, &imageInfo, nullptr, &image))
+		{
+			throw std::runtime_error("fail to create image");
+		}
+
+		VkMemoryRequirements memRequirements;
+		vkGetImageMemoryRequirements(vkDevice, image, &memRequirements);
+
+		VkMemoryAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = memRequirements.size;
+		allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		if (vkAllocateMemory(vkDevice, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to allocate image memory");
+		}
+
+		vkBindImageMemory(vkDevice, image, imageMemory, 0);
+	}
+
+	void CreateTextureImage()
+	{
+		int texWidth, texHeight, texChannels;
+		stbi_uc* pixel = stbi_load(ASSET_DIR"texture/TestTexture0.png", &texWidth, &texHeight,
+			&texChannels, STBI_rgb_alpha);
+		VkDeviceSize imageSize = texWidth * texHeight * 4;
+		if (!pixel)
+		{
+			throw std::runtime_error("fail to load texture image!");
+		}
+
+		VkBuffer stagingBuffer;
+		VkDeviceMemory stagingMemory;
+
+		CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			stagingBuffer, stagingMemory);
+
+		void* data;
+		vkMapMemory(vkDevice, stagingMemory, 0, imageSize, 0, &data);
+		memcpy(data, pixel, imageSize);
+		vkUnmapMemory(vkDevice, stagingMemory);
+
+		stbi_image_free(pixel);
+
+		CreateImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
+
+		// 两次布局转换和复制在同一次提交里
+		resourceStates->AddImage(textureImage, VK_IMAGE_ASPECT_COLOR_BIT, 1, 1);
+		VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+		resourceStates->UseImage(textureImage, ImageRange(), VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+		resourceStates->Flush(commandBuffer);
+		CopyBufferToImage(commandBuffer, stagingBuffer, textureImage, texWidth, texHeight);
+		resourceStates->UseImage(textureImage, ImageRange(), VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		resourceStates->Flush(commandBuffer);
+		EndSingleTimeCommands(commandBuffer);
+
+		DestroyStagingBuffer(stagingBuffer, stagingMemory);
+	}
+
+	void CreateTextureImageView()
+	{
+		textureImageView = CreateImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM);
+	}
+
+	void CreateTextureSampler()
+	{
+		VkSamplerCreateInfo samplerInfo = {};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.magFilter = VK_FILTER_LINEAR;
+		samplerInfo.minFilter = VK_FILTER_LINEAR;
+
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+
+		samplerInfo.anisotropyEnable = VK_TRUE;
+		samplerInfo.maxAnisotropy = 16;
+		samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+		samplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+		samplerInfo.compareEnable = VK_FALSE;
+		samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+		samplerInfo.mipLodBias = 0.0f;
+		samplerInfo.minLod = 0.0f;
+		samplerInfo.maxLod = 0.0f;
+
+		if (vkCreateSampler(vkDevice, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create texture sampler");
+		}
+	}
+
+	void CreateVertexBuffer()
+	{
+		VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+
+		VkBuffer stagingBuffer;
+		VkDeviceMemory stagingBufferMemory;
+
+		CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+		
+		void* data;
+		vkMapMemory(vkDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
+		memcpy(data, vertices.data(), (size_t)bufferSize);
+		vkUnmapMemory(vkDevice, stagingBufferMemory);
+
+		CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+
+		CopyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+
+		DestroyStagingBuffer(stagingBuffer, stagingBufferMemory);
+	}
+
+	void CreateIndexBuffer()
+	{
+		VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+
+		VkBuffer stagingBuffer;
+		VkDeviceMemory stagingMemory;
+		CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingMemory);
+
+		void* data;
+		vkMapMemory(vkDevice, stagingMemory, 0, bufferSize, 0, &data);
+		memcpy(data, indices.data(), bufferSize);
+		vkUnmapMemory(vkDevice, stagingMemory);
+
+		CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+
+		CopyBuffer(stagingBuffer, indexBuffer, bufferSize);
+
+		DestroyStagingBuffer(stagingBuffer, stagingMemory);
+	}
+
+	void CreateScene()
+	{
+		// 物体绕自身z轴旋转，所以包围体取旋转不变的形状
+		float radiusXY = 0.0f;
+		float minZ = std::numeric_limits<float>::max();
+		float maxZ = -std::numeric_limits<float>::max();
+		for (const auto& vertex : vertices)
+		{
+			radiusXY = std::max(radiusXY, glm::length(glm::vec2(vertex.pos)));
+			minZ = std::min(minZ, vertex.pos.z);
+			maxZ = std::max(maxZ, vertex.pos.z);
+		}
+		glm::vec3 localCenter(0.0f, 0.0f, (minZ + maxZ) * 0.5f);
+		float radius = 0.0f;
+		for (const auto& vertex : vertices)
+		{
+			radius = std::max(radius, glm::length(vertex.pos - localCenter));
+		}
+
+		// --overdraw把网格叠成多层，上层挡住下层，用来测试遮挡剔除
+		uint32_t layerCount = std::max(1u, std::min(options.overdrawLayers, options.objectCount));
+		uint32_t objectsPerLayer = (options.objectCount + layerCount - 1) / layerCount;
+		uint32_t gridSize = (uint32_t)std::ceil(std::sqrt((float)objectsPerLayer));
+		float spacing = layerCount > 1 ? 1.0f : 1.5f;
+		float layerSpacing = 0.6f;
+		float gridOrigin = -0.5f * spacing * (gridSize - 1);
+
+		objectPositions.resize(options.objectCount);
+		objectAabbs.resize(options.objectCount);
+		objectBounds.Clear();
+		objectBounds.Reserve(options.objectCount);
+		for (uint32_t i = 0; i < options.objectCount; i++)
+		{
+			uint32_t layer = i / objectsPerLayer;
+			uint32_t cell = i % objectsPerLayer;
+			glm::vec3 position(gridOrigin + spacing * (cell % gridSize), gridOrigin + spacing * (cell / gridSize), -layerSpacing * layer);
+			objectPositions[i] = position;
+			objectAabbs[i].aabbMin = glm::vec4(position + glm::vec3(-radiusXY, -radiusXY, minZ), 1.0f);
+			objectAabbs[i].aabbMax = glm::vec4(position + glm::vec3(radiusXY, radiusXY, maxZ), 1.0f);
+			objectBounds.Add(position + localCenter, radius, glm::vec3(objectAabbs[i].aabbMin), glm::vec3(objectAabbs[i].aabbMax));
+		}
+		visibleObjects.reserve(options.objectCount);
+
+		threadPool = std::make_unique<ThreadPool>();
+
+		std::cout << "succeed to create scene with " << options.objectCount << " objects" << std::endl;
+	}
+
+	void CreateBufferWithData(const void* srcData, VkDeviceSize bufferSize, VkBufferUsageFlags usage,
+		VkBuffer& buffer, VkDeviceMemory& bufferMemory, bool shared = false)
+	{
+		VkBuffer stagingBuffer;
+		VkDeviceMemory stagingMemory;
+		CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingMemory);
+
+		void* data;
+		vkMapMemory(vkDevice, stagingMemory, 0, bufferSize, 0, &data);
+		memcpy(data, srcData, (size_t)bufferSize);
+		vkUnmapMemory(vkDevice, stagingMemory);
+
+		CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory, shared);
+		CopyBuffer(stagingBuffer, buffer, bufferSize);
+
+		DestroyStagingBuffer(stagingBuffer, stagingMemory);
+	}
+
+	// 上传不等待GPU，暂存缓冲在复制完成后由deletionQueue销毁
+	void DestroyStagingBuffer(VkBuffer stagingBuffer, VkDeviceMemory stagingMemory)
+	{
+		deletionQueue.Push(timeline->LastSubmitted(), vkDevice, stagingBuffer);
+		deletionQueue.Push(timeline->LastSubmitted(), vkDevice, stagingMemory);
+	}
+
+	VkCommandBuffer BeginSingleTimeCommands()
+	{
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = commandPool;
+		allocInfo.commandBufferCount = 1;
+
+		VkCommandBuffer commandBuffer;
+		vkAllocateCommandBuffers(vkDevice, &allocInfo, &commandBuffer);
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+		return commandBuffer;
+	}
+
+	void EndSingleTimeCommands(VkCommandBuffer commandBuffer)
+	{
+		vkEndCommandBuffer(commandBuffer);
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+
+		// 和帧共用timeline，不等待完成：之后在同一队列上的提交都排在它后面，
+		// 命令缓冲和上传用的暂存缓冲等timeline到达这个值后再释放
+		uint64_t value = timeline->Next();
+		VkSemaphore semaphore = timeline->Get();
+		VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &value;
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &semaphore;
+
+		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to submit single time commands");
+		}
+		deletionQueue.Push(value, vkDevice, commandPool, commandBuffer);
+	}
+
+	void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+	{
+
+		VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+		VkBufferCopy copyRegion = {};
+		copyRegion.srcOffset = 0;
+		copyRegion.dstOffset = 0;
+		copyRegion.size = size;
+		resourceStates->UseBuffer(dstBuffer, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+		resourceStates->Flush(commandBuffer);
+		vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+		// 提交后不等待，屏障让复制对之后提交到这个队列的所有命令可见，使用者就不用再声明这次写入
+		resourceStates->UseBuffer(dstBuffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT);
+		resourceStates->Flush(commandBuffer);
+		resourceStates->RemoveBuffer(dstBuffer);
+
+		EndSingleTimeCommands(commandBuffer);
+	}
+
+	bool HasStencilComponent(VkFormat format)
+	{
+		return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
+	}
+
+	uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+	{
+		VkPhysicalDeviceMemoryProperties memProperties;
+		vkGetPhysicalDeviceMemoryProperties(vkPhysicalDevice, &memProperties);
+		for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+		{
+			if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			{
+				return i;
+			}
+		}
+
+		throw std::runtime_error("fail to find suitable memory type");
+	}
+
+	// shared为true时图形队列和异步计算队列都会使用，CONCURRENT共享就不用转移所有权
+	void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+		VkBuffer &buffer, VkDeviceMemory& bufferMemory, bool shared = false)
+	{
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = size;
+		bufferInfo.usage = usage;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		uint32_t families[] = { (uint32_t)FindQueueFamilies(vkPhysicalDevice).graphicsFamily, (uint32_t)computeFamily };
+		if (shared && computeFamily >= 0)
+		{
+			bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+			bufferInfo.queueFamilyIndexCount = 2;
+			bufferInfo.pQueueFamilyIndices = families;
+		}
+
+		if (vkCreateBuffer(vkDevice, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create buffer");
+		}
+
+		VkMemoryRequirements memRequirements;
+		vkGetBufferMemoryRequirements(vkDevice, buffer, &memRequirements);
+
+		VkMemoryAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = memRequirements.size;
+		allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
+
+		if (vkAllocateMemory(vkDevice, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to allocate memory");
+		}
+
+		vkBindBufferMemory(vkDevice, buffer, bufferMemory, 0);
+	}
+
+	void CreateGraphicsPipeline()
+	{
+		// 测试变体时反射结果包含fragBranchy.spv的push constant
+		pipelineLayout = layoutCache->GetPipelineLayout(sceneInterface);
+		std::cout << "succeed to create pipeline layout" << std::endl;
+
+		pipelineRegistry->RegisterLayout("scene", pipelineLayout);
+		sceneDesc = SceneDesc({
+			{ VK_SHADER_STAGE_VERTEX_BIT, SHADER_DIR"vert.spv" },
+			{ VK_SHADER_STAGE_FRAGMENT_BIT, SHADER_DIR"frag.spv" },
+			}, "scene");
+		if (options.shaderObjects)
+		{
+			// 着色器按pipelineLayout的set layout和push constant创建，描述符集照常绑定
+			ValidateVertexInputs(sceneDesc);
+			sceneShaders = shaderObjects->Get(sceneDesc, layoutCache->GetSetLayouts(sceneInterface), sceneInterface.pushConstants);
+			std::cout << "succeed to create scene shader objects" << std::endl;
+		}
+		else
+		{
+			scenePipelineKey = pipelineRegistry->Request(sceneDesc);
+		}
+	}
+
+	// 没有片元阶段的管线只做深度测试(遮挡代理盒)，没有顶点阶段的管线没有顶点输入(mesh shading)
+	GraphicsPipelineDesc SceneDesc(const std::vector<std::pair<VkShaderStageFlagBits, std::string>>& shaders, const std::string& layout)
+	{
+		bool depthOnly = true;
+		bool vertexStage = false;
+		for (const auto& shader : shaders)
+		{
+			depthOnly &= shader.first != VK_SHADER_STAGE_FRAGMENT_BIT;
+			vertexStage |= shader.first == VK_SHADER_STAGE_VERTEX_BIT;
+		}
+
+		GraphicsPipelineDesc desc;
+		desc.shaders = shaders;
+		desc.layout = layout;
+		if (vertexStage && !depthOnly)
+		{
+			auto attributeDescriptions = Vertex::getAttributeDescriptions();
+			desc.vertexBindings = { Vertex::getBindingDescription() };
+			desc.vertexAttributes.assign(attributeDescriptions.begin(), attributeDescriptions.end());
+		}
+		desc.cullMode = depthOnly ? VK_CULL_MODE_NONE : VK_CULL_MODE_BACK_BIT;
+		desc.depthWrite = !depthOnly;
+		desc.depthCompare = depthOnly ? VK_COMPARE_OP_LESS_OR_EQUAL : VK_COMPARE_OP_LESS;
+		if (depthOnly)
+		{
+			desc.colorWriteMask = 0;
+		}
+		desc.colorFormat = vkSwapChainImageFormat;
+		desc.depthFormat = DEPTH_FORMAT;
+		desc.features = depthOnly ? 0 : options.shaderFeatures.Mask();
+		return desc;
+	}
+
+	// 顶点着色器的输入必须能从desc的顶点布局里取到，否则修改着色器后会读到错误的属性
+	void ValidateVertexInputs(const GraphicsPipelineDesc& desc)
+	{
+		for (const auto& shader : desc.shaders)
+		{
+			if (shader.first != VK_SHADER_STAGE_VERTEX_BIT)
+			{
+				continue;
+			}
+
+			for (const auto& input : ReflectSpirv(ReadFile(shader.second)).vertexInputs)
+			{
+				bool found = false;
+				for (const auto& attribute : desc.vertexAttributes)
+				{
+					found |= attribute.location == input.location && attribute.format == input.format;
+				}
+				if (!found)
+				{
+					throw std::runtime_error("fail to match vertex input location " + std::to_string(input.location) + " of " + shader.second);
+				}
+			}
+		}
+	}
+
+	// 在管线注册表的工作线程上调用，只读取desc和设备对象，交换链重建时会改变的状态(尺寸、视图)都不能碰。
+	// 不在这里输出日志，创建结果由注册表统计，失败原因由Wait抛出
+	VkPipeline CreateScenePipeline(const GraphicsPipelineDesc& desc, VkPipelineLayout layout, PipelineLink link)
+	{
+		if (!desc.vertexAttributes.empty() && link != PipelineLink::Optimized)
+		{
+			ValidateVertexInputs(desc);
+		}
+
+		if (link == PipelineLink::Monolithic)
+		{
+			return CreateMonolithicPipeline(desc, layout);
+		}
+		return LinkScenePipeline(desc, layout, link == PipelineLink::Optimized);
+	}
+
+	// 场景管线的全部固定状态，create info之间用指针互相引用，所以不能拷贝
+	struct ScenePipelineState
+	{
+		VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+		VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+		VkPipelineViewportStateCreateInfo viewportState = {};
+		VkPipelineRasterizationStateCreateInfo rasterizer = {};
+		VkPipelineMultisampleStateCreateInfo multisampling = {};
+		VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+		VkPipelineColorBlendStateCreateInfo colorBlending = {};
+		std::vector<VkDynamicState> dynamicStates;
+		VkPipelineDynamicStateCreateInfo dynamicState = {};
+		VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+		// 动态渲染没有render pass，附件格式直接写在管线里
+		VkPipelineRenderingCreateInfo renderingInfo = {};
+		// 着色器阶段由调用者填写
+		VkGraphicsPipelineCreateInfo pipelineInfo = {};
+
+		ScenePipelineState() = default;
+		ScenePipelineState(const ScenePipelineState&) = delete;
+		ScenePipelineState& operator=(const ScenePipelineState&) = delete;
+	};
+
+	void FillScenePipelineState(const GraphicsPipelineDesc& desc, VkPipelineLayout layout, ScenePipelineState& state)
+	{
+		bool vertexInput = false;
+		for (const auto& shader : desc.shaders)
+		{
+			vertexInput |= shader.first == VK_SHADER_STAGE_VERTEX_BIT;
+		}
+
+		// 顶点布局直接引用desc，desc在管线创建完之前一直有效
+		state.vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		state.vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(desc.vertexBindings.size());
+		state.vertexInputInfo.pVertexBindingDescriptions = desc.vertexBindings.data();
+		state.vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(desc.vertexAttributes.size());
+		state.vertexInputInfo.pVertexAttributeDescriptions = desc.vertexAttributes.data();
+
+		state.inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		state.inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		state.inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+		// 视口和裁剪矩形是动态状态，录制时按当前交换链尺寸设置，管线里只需要数量
+		state.viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		state.viewportState.viewportCount = 1;
+		state.viewportState.pViewports = nullptr;
+		state.viewportState.scissorCount = 1;
+		state.viewportState.pScissors = nullptr;
+
+		state.rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		state.rasterizer.depthClampEnable = VK_FALSE;
+		state.rasterizer.rasterizerDiscardEnable = VK_FALSE;
+		state.rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+		state.rasterizer.cullMode = desc.cullMode;
+		state.rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		state.rasterizer.lineWidth = 1.0f;
+		state.rasterizer.depthBiasEnable = VK_FALSE;
+		state.rasterizer.depthBiasConstantFactor = 0.0f;
+		state.rasterizer.depthBiasClamp = 0.0f;
+		state.rasterizer.depthBiasSlopeFactor = 0.0f;
+
+		state.multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		state.multisampling.sampleShadingEnable = VK_FALSE;
+		state.multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+		state.multisampling.minSampleShading = 1.0f;
+		state.multisampling.pSampleMask = nullptr;
+		state.multisampling.alphaToCoverageEnable = VK_FALSE;
+		state.multisampling.alphaToOneEnable = VK_FALSE;
+
+		state.colorBlendAttachment.colorWriteMask = desc.colorWriteMask;
+		state.colorBlendAttachment.blendEnable = desc.blendEnable ? VK_TRUE : VK_FALSE;
+		state.colorBlendAttachment.srcColorBlendFactor = desc.blendEnable ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+		state.colorBlendAttachment.dstColorBlendFactor = desc.blendEnable ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ZERO;
+		state.colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+		state.colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		state.colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		state.colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+		state.colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		state.colorBlending.logicOpEnable = VK_FALSE;
+		state.colorBlending.logicOp = VK_LOGIC_OP_COPY;
+		state.colorBlending.attachmentCount = 1;
+		state.colorBlending.pAttachments = &state.colorBlendAttachment;
+		state.colorBlending.blendConstants[0] = 0.0f;
+		state.colorBlending.blendConstants[1] = 0.0f;
+		state.colorBlending.blendConstants[2] = 0.0f;
+		state.colorBlending.blendConstants[3] = 0.0f;
+
+		state.dynamicStates = {
+			  VK_DYNAMIC_STATE_VIEWPORT,
+			  VK_DYNAMIC_STATE_SCISSOR
+		};
+		std::vector<VkDynamicState> extendedStates = DynamicStatesOf(desc.dynamicState, !vertexInput);
+		state.dynamicStates.insert(state.dynamicStates.end(), extendedStates.begin(), extendedStates.end());
+		state.dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		state.dynamicState.dynamicStateCount = state.dynamicStates.size();
+		state.dynamicState.pDynamicStates = state.dynamicStates.data();
+
+		state.depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		state.depthStencil.depthTestEnable = VK_TRUE;
+		state.depthStencil.depthWriteEnable = desc.depthWrite ? VK_TRUE : VK_FALSE;
+		state.depthStencil.depthCompareOp = desc.depthCompare;
+		state.depthStencil.depthBoundsTestEnable = VK_FALSE;
+		state.depthStencil.minDepthBounds = 0.0f;
+		state.depthStencil.maxDepthBounds = 1.0f;
+		state.depthStencil.stencilTestEnable = VK_FALSE;
+		state.depthStencil.front = {};
+		state.depthStencil.back = {};
+
+		// 深度视图只有depth aspect，模板附件不参与渲染
+		state.renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+		state.renderingInfo.colorAttachmentCount = 1;
+		state.renderingInfo.pColorAttachmentFormats = &desc.colorFormat;
+		state.renderingInfo.depthAttachmentFormat = desc.depthFormat;
+		state.renderingInfo.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+
+		VkGraphicsPipelineCreateInfo& pipelineInfo = state.pipelineInfo;
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineInfo.pNext = &state.renderingInfo;
+		pipelineInfo.pVertexInputState = vertexInput ? &state.vertexInputInfo : nullptr;
+		pipelineInfo.pInputAssemblyState = vertexInput ? &state.inputAssembly : nullptr;
+		pipelineInfo.pViewportState = &state.viewportState;
+		pipelineInfo.pRasterizationState = &state.rasterizer;
+		pipelineInfo.pMultisampleState = &state.multisampling;
+		pipelineInfo.pDepthStencilState = &state.depthStencil;
+		pipelineInfo.pColorBlendState = &state.colorBlending;
+		pipelineInfo.pDynamicState = &state.dynamicState;
+		pipelineInfo.layout = layout;
+		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+		pipelineInfo.basePipelineIndex = -1;
+	}
+
+	// 只创建stageMask里的着色器，module由调用者用DestroyShaderStages销毁
+	std::vector<VkPipelineShaderStageCreateInfo> CreateShaderStages(const GraphicsPipelineDesc& desc, VkShaderStageFlags stageMask,
+		const ShaderSpecialization& specialization)
+	{
+		std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+		for (const auto& shader : desc.shaders)
+		{
+			if ((shader.first & stageMask) == 0)
+			{
+				continue;
+			}
+
+			VkPipelineShaderStageCreateInfo shaderStageInfo = {};
+			shaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+			shaderStageInfo.stage = shader.first;
+			shaderStageInfo.module = CreateShaderModule(ReadFile(shader.second));
+			shaderStageInfo.pName = "main";
+			if (shader.first == VK_SHADER_STAGE_FRAGMENT_BIT)
+			{
+				shaderStageInfo.pSpecializationInfo = specialization.Get();
+			}
+			shaderStages.push_back(shaderStageInfo);
 		}
-
-		return vkShaderModule;
+		return shaderStages;
 	}
 
-	void CreateRenderPass()
+	void DestroyShaderStages(const std::vector<VkPipelineShaderStageCreateInfo>& shaderStages)
 	{
-		VkAttachmentDescription colorAttachment = {};
-		colorAttachment.format = vkSwapChainImageFormat;
-		colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-		VkAttachmentDescription depthAttachment = {};
-		depthAttachment.format = VK_FORMAT_D32_SFLOAT_S8_UINT;
-		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-		
-		VkAttachmentReference colorAttachmentRef = {};
-		colorAttachmentRef.attachment = 0;
-		colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-		VkAttachmentReference depthAttachmentRef = {};
-		depthAttachmentRef.attachment = 1;
-		depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-		VkSubpassDescription subpass = {};
-		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-		subpass.colorAttachmentCount = 1;
-		subpass.pColorAttachments = &colorAttachmentRef;
-		subpass.pDepthStencilAttachment = &depthAttachmentRef;
-
-		VkSubpassDependency dependency = {};
-		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-		dependency.dstSubpass = 0;
-		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.srcAccessMask = 0;
-		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-		std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
-
-		VkRenderPassCreateInfo renderPassInfo = {};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		renderPassInfo.attachmentCount = attachments.size();
-		renderPassInfo.pAttachments = attachments.data();
-		renderPassInfo.subpassCount = 1;
-		renderPassInfo.pSubpasses = &subpass;
-		renderPassInfo.dependencyCount = 1;
-		renderPassInfo.pDependencies = &dependency;
-
-		if (vkCreateRenderPass(vkDevice, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
-		{
-			throw std::runtime_error("fail to create render pass");
-		}
-		else
+		for (const auto& shaderStage : shaderStages)
 		{
-			std::cout << "succeed to create render pass" << std::endl;
+			vkDestroyShaderModule(vkDevice, shaderStage.module, nullptr);
 		}
 	}
 
-	void CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+	// 失败时返回VK_NULL_HANDLE，创建时间计入管线缓存的统计
+	VkPipeline CompileGraphicsPipeline(const VkGraphicsPipelineCreateInfo& pipelineInfo)
 	{
-		VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+		VkPipeline pipeline;
+		auto start = std::chrono::high_resolution_clock::now();
+		VkResult result = vkCreateGraphicsPipelines(vkDevice, pipelineCache->Get(), 1, &pipelineInfo, nullptr, &pipeline);
+		pipelineCache->AddCreationTime(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+		return result == VK_SUCCESS ? pipeline : VK_NULL_HANDLE;
+	}
 
-		VkBufferImageCopy region = {};
-		region.bufferOffset = 0;
-		region.bufferRowLength = 0;
-		region.bufferImageHeight = 0;
+	VkPipeline CreateMonolithicPipeline(const GraphicsPipelineDesc& desc, VkPipelineLayout layout)
+	{
+		ScenePipelineState state;
+		FillScenePipelineState(desc, layout, state);
 
-		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		region.imageSubresource.mipLevel = 0;
-		region.imageSubresource.baseArrayLayer = 0;
-		region.imageSubresource.layerCount = 1;
+		ShaderSpecialization specialization(ShaderFeatures::FromMask(desc.features));
+		std::vector<VkPipelineShaderStageCreateInfo> shaderStages = CreateShaderStages(desc, VK_SHADER_STAGE_ALL, specialization);
+		state.pipelineInfo.stageCount = shaderStages.size();
+		state.pipelineInfo.pStages = shaderStages.data();
 
-		region.imageOffset = { 0, 0, 0 };
-		region.imageExtent = { width, height, 1 };
+		VkPipeline pipeline = CompileGraphicsPipeline(state.pipelineInfo);
+		DestroyShaderStages(shaderStages);
+		if (pipeline == VK_NULL_HANDLE)
+		{
+			throw std::runtime_error("fail to create graphics pipeline");
+		}
+		return pipeline;
+	}
 
-		vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	// 管线库的一部分。不属于这部分的状态会被忽略，所以直接传完整的状态，只有着色器按部分挑选
+	VkPipeline CreateLibraryPart(VkGraphicsPipelineLibraryFlagBitsEXT part, const GraphicsPipelineDesc& desc, VkPipelineLayout layout)
+	{
+		ScenePipelineState state;
+		FillScenePipelineState(desc, layout, state);
 
-		EndSingleTimeCommands(commandBuffer);
+		VkShaderStageFlags stageMask = 0;
+		if (part == VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT)
+		{
+			stageMask = VK_SHADER_STAGE_ALL & ~VK_SHADER_STAGE_FRAGMENT_BIT;
+		}
+		else if (part == VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT)
+		{
+			stageMask = VK_SHADER_STAGE_FRAGMENT_BIT;
+		}
+		ShaderSpecialization specialization(ShaderFeatures::FromMask(desc.features));
+		std::vector<VkPipelineShaderStageCreateInfo> shaderStages = CreateShaderStages(desc, stageMask, specialization);
+
+		VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo = {};
+		libraryInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+		libraryInfo.pNext = state.pipelineInfo.pNext;
+		libraryInfo.flags = part;
+
+		// 保留链接时优化需要的信息，后台的优化链接和快速链接用同一组库
+		state.pipelineInfo.pNext = &libraryInfo;
+		state.pipelineInfo.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+		state.pipelineInfo.stageCount = shaderStages.size();
+		state.pipelineInfo.pStages = shaderStages.data();
+
+		VkPipeline library = CompileGraphicsPipeline(state.pipelineInfo);
+		DestroyShaderStages(shaderStages);
+		if (library == VK_NULL_HANDLE)
+		{
+			throw std::runtime_error("fail to create graphics pipeline library part " + desc.LibraryKey(part));
+		}
+		return library;
 	}
 
-	void CreateImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
-		VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory)
+	// 缺少的部分先编译并缓存，再把四个部分链接成完整的管线
+	VkPipeline LinkScenePipeline(const GraphicsPipelineDesc& desc, VkPipelineLayout layout, bool optimize)
 	{
-		VkImageCreateInfo imageInfo = {};
-		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-		imageInfo.imageType = VK_IMAGE_TYPE_2D;
-		imageInfo.extent.width = width;
-		imageInfo.extent.height = height;
-		imageInfo.extent.depth = 1;
-		imageInfo.mipLevels = 1;
-		imageInfo.arrayLayers = 1;
-		imageInfo.format = format;
-		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		imageInfo.usage = usage;
-		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-		imageInfo.flags = 0;
+		std::vector<VkGraphicsPipelineLibraryFlagBitsEXT> parts = {
+			VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+			VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+			VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT,
+		};
+		// mesh shader管线没有顶点输入
+		for (const auto& shader : desc.shaders)
+		{
+			if (shader.first == VK_SHADER_STAGE_VERTEX_BIT)
+			{
+				parts.insert(parts.begin(), VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT);
+			}
+		}
 
-		if (vkCreateImage(vkDevice, &imageInfo, nullptr, &image))
+		std::vector<VkPipeline> libraries;
+		for (VkGraphicsPipelineLibraryFlagBitsEXT part : parts)
 		{
-			throw std::runtime_error("fail to create image");
+			libraries.push_back(pipelineLibraries->Get(desc.LibraryKey(part), [&] { return CreateLibraryPart(part, desc, layout); }));
 		}
 
-		VkMemoryRequirements memRequirements;
-		vkGetImageMemoryRequirements(vkDevice, image, &memRequirements);
+		VkPipelineLibraryCreateInfoKHR linkInfo = {};
+		linkInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+		linkInfo.libraryCount = (uint32_t)libraries.size();
+		linkInfo.pLibraries = libraries.data();
 
-		VkMemoryAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VkGraphicsPipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineInfo.pNext = &linkInfo;
+		pipelineInfo.flags = optimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+		pipelineInfo.layout = layout;
+		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+		pipelineInfo.basePipelineIndex = -1;
 
-		if (vkAllocateMemory(vkDevice, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
+		VkPipeline pipeline = CompileGraphicsPipeline(pipelineInfo);
+		if (pipeline == VK_NULL_HANDLE)
 		{
-			throw std::runtime_error("fail to allocate image memory");
+			throw std::runtime_error("fail to link graphics pipeline");
 		}
-
-		vkBindImageMemory(vkDevice, image, imageMemory, 0);
+		return pipeline;
 	}
 
-	void CreateTextureImage()
+	VkPipeline CreateComputePipeline(const std::string& path, VkPipelineLayout layout)
 	{
-		int texWidth, texHeight, texChannels;
-		stbi_uc* pixel = stbi_load(ASSET_DIR"texture/TestTexture0.png", &texWidth, &texHeight,
-			&texChannels, STBI_rgb_alpha);
-		VkDeviceSize imageSize = texWidth * texHeight * 4;
-		if (!pixel)
+		auto shaderCode = ReadFile(path);
+		VkShaderModule shaderModule = CreateShaderModule(shaderCode);
+
+		VkComputePipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = shaderModule;
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.layout = layout;
+
+		VkPipeline pipeline;
+		auto start = std::chrono::high_resolution_clock::now();
+		VkResult result = vkCreateComputePipelines(vkDevice, pipelineCache->Get(), 1, &pipelineInfo, nullptr, &pipeline);
+		pipelineCache->AddCreationTime(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+		if (result != VK_SUCCESS)
 		{
-			throw std::runtime_error("fail to load texture image!");
+			throw std::runtime_error("fail to create compute pipeline");
 		}
 
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingMemory;
-
-		CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			stagingBuffer, stagingMemory);
-
-		void* data;
-		vkMapMemory(vkDevice, stagingMemory, 0, imageSize, 0, &data);
-		memcpy(data, pixel, imageSize);
-		vkUnmapMemory(vkDevice, stagingMemory);
+		vkDestroyShaderModule(vkDevice, shaderModule, nullptr);
+		return pipeline;
+	}
 
-		stbi_image_free(pixel);
 
-		CreateImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
+	void CreateCommandPool()
+	{
+		QueueFamilyIndices queueFamilyIndices = FindQueueFamilies(vkPhysicalDevice);
 
-		TransitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED
-			, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-		CopyBufferToImage(stagingBuffer, textureImage, texWidth, texHeight);
-		TransitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-			, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		VkCommandPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
-		vkDestroyBuffer(vkDevice, stagingBuffer, nullptr);
-		vkFreeMemory(vkDevice, stagingMemory, nullptr);
+		if (vkCreateCommandPool(vkDevice, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create command pool");
+		}
+		else
+		{
+			std::cout << "succeed to create command pool" << std::endl;
+		}
 	}
 
-	void CreateTextureImageView()
+	void BuildDrawPackets(bool useCombos, bool sort)
 	{
-		textureImageView = CreateImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM);
+		drawPackets.clear();
+		for (uint32_t objectIndex : visibleObjects)
+		{
+			DrawPacket packet = {};
+			packet.objectIndex = objectIndex;
+			packet.state = useCombos ? objectIndex % (uint32_t)drawBench.size() : 0;
+			const GraphicsPipelineDesc& desc = useCombos ? drawBench[packet.state].desc : sceneDesc;
+			uint32_t pipelineId = useCombos ? drawBench[packet.state].pipelineId : 0;
+			float depth = glm::length(objectPositions[objectIndex] - cameraPosition) / SCENE_FAR_PLANE;
+			packet.sortKey = MakeDrawSortKey(desc.blendEnable ? DrawPass::Translucent : DrawPass::Opaque, pipelineId, 0, 0, depth);
+			drawPackets.push_back(packet);
+		}
+
+		if (sort)
+		{
+			SortDrawPackets(drawPackets, drawPacketScratch, threadPool.get());
+		}
 	}
 
-	void CreateTextureSampler()
+	// 帧图按队列切分成几次提交，每次一个命令缓冲，由帧图开始和结束录制
+	void RecordFrame(FrameContext& frame, uint32_t imageIndex)
 	{
-		VkSamplerCreateInfo samplerInfo = {};
-		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-		samplerInfo.magFilter = VK_FILTER_LINEAR;
-		samplerInfo.minFilter = VK_FILTER_LINEAR;
-
-		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-
-		samplerInfo.anisotropyEnable = VK_TRUE;
-		samplerInfo.maxAnisotropy = 16;
-		samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-		samplerInfo.unnormalizedCoordinates = VK_FALSE;
-
-		samplerInfo.compareEnable = VK_FALSE;
-		samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-
-		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-		samplerInfo.mipLodBias = 0.0f;
-		samplerInfo.minLod = 0.0f;
-		samplerInfo.maxLod = 0.0f;
+		// 优化链接完成后句柄会变，每帧重新取
+		if (!options.shaderObjects)
+		{
+			graphicsPipeline = pipelineRegistry->Acquire(scenePipelineKey);
+		}
+		if (options.occlusion == OcclusionMode::HiZ)
+		{
+			indirectPipeline = pipelineRegistry->Acquire(indirectPipelineKey);
+		}
 
-		if (vkCreateSampler(vkDevice, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS)
+		// 帧图外部的资源每帧绑定，交换链图像每帧不同
+		recordImageIndex = imageIndex;
+		frameGraph->SetImage(frameGraphResources.color, vkSwapChainImages[imageIndex]);
+		if (options.occlusion == OcclusionMode::HiZ)
 		{
-			throw std::runtime_error("fail to create texture sampler");
+			frameGraph->SetImage(frameGraphResources.hiz, hizImage);
+			frameGraph->SetBuffer(frameGraphResources.visibility, objectVisibilityBuffer);
+			frameGraph->SetBuffer(frameGraphResources.earlyDraw, earlyDrawBuffer);
+			frameGraph->SetBuffer(frameGraphResources.lateDraw, lateDrawBuffer);
+		}
+		else if (options.occlusion == OcclusionMode::Queries)
+		{
+			frameGraph->SetBuffer(frameGraphResources.occlusionResult, occlusionResultBuffer);
 		}
+		frameGraph->Execute(
+			[&](RenderGraphQueue queue)
+			{
+				if (queue == RenderGraphQueue::Compute)
+				{
+					return frame.AllocateComputeCommandBuffer();
+				}
+				// 动态状态只在一个命令缓冲内有效
+				dynamicState->Reset();
+				return frame.AllocateCommandBuffer();
+			},
+			[&](const RenderGraphSubmit& batch) { SubmitFrameBatch(frame, batch); });
 	}
 
-	void CreateVertexBuffer()
+	// 每次提交给自己队列的timeline发信号，等另一个队列timeline上的值。
+	// 图形队列第一次提交等获取信号量，最后一次提交给present发信号，它的timeline值标记这一帧
+	void SubmitFrameBatch(FrameContext& frame, const RenderGraphSubmit& batch)
 	{
-		VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+		bool graphics = batch.queue == RenderGraphQueue::Graphics;
+		GpuTimeline& signalTimeline = graphics ? *timeline : *computeTimeline;
 
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
+		// 开启延迟追踪时前后各多提交一个只写时间戳的命令缓冲
+		VkCommandBufferSubmitInfo commandBufferInfos[3] = {};
+		uint32_t commandBufferCount = 0;
+		if (latencyTracer && graphics && batch.first)
+		{
+			VkCommandBuffer gpuStart = frame.AllocateCommandBuffer();
+			latencyTracer->RecordGpuStart(gpuStart, currentFrame);
+			commandBufferInfos[commandBufferCount++].commandBuffer = gpuStart;
+		}
+		commandBufferInfos[commandBufferCount++].commandBuffer = batch.commandBuffer;
+		if (latencyTracer && graphics && batch.last)
+		{
+			latencyTracer->Mark(LatencyMarker::Recorded);
+			VkCommandBuffer gpuEnd = frame.AllocateCommandBuffer();
+			latencyTracer->RecordGpuEnd(gpuEnd, currentFrame);
+			commandBufferInfos[commandBufferCount++].commandBuffer = gpuEnd;
+		}
+		for (uint32_t i = 0; i < commandBufferCount; i++)
+		{
+			commandBufferInfos[i].sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+		}
 
-		CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-		
-		void* data;
-		vkMapMemory(vkDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, vertices.data(), (size_t)bufferSize);
-		vkUnmapMemory(vkDevice, stagingBufferMemory);
+		VkSemaphoreSubmitInfo waitInfos[2] = {};
+		uint32_t waitCount = 0;
+		if (graphics && batch.first)
+		{
+			waitInfos[waitCount].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+			waitInfos[waitCount].semaphore = frame.GetImageAvailable();
+			waitInfos[waitCount++].stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+		}
+		if (batch.waitValue != 0)
+		{
+			waitInfos[waitCount].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+			waitInfos[waitCount].semaphore = graphics ? computeTimeline->Get() : timeline->Get();
+			waitInfos[waitCount].value = batch.waitValue;
+			waitInfos[waitCount++].stageMask = batch.waitStages;
+		}
 
-		CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+		// binary semaphore给present用
+		uint64_t value = signalTimeline.Next();
+		VkSemaphoreSubmitInfo signalInfos[2] = {};
+		uint32_t signalCount = 0;
+		signalInfos[signalCount].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+		signalInfos[signalCount].semaphore = signalTimeline.Get();
+		signalInfos[signalCount].value = value;
+		signalInfos[signalCount++].stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		if (graphics && batch.last)
+		{
+			signalInfos[signalCount].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+			signalInfos[signalCount].semaphore = frame.GetRenderFinished();
+			signalInfos[signalCount++].stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		}
 
-		CopyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+		VkSubmitInfo2 submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+		submitInfo.waitSemaphoreInfoCount = waitCount;
+		submitInfo.pWaitSemaphoreInfos = waitInfos;
+		submitInfo.commandBufferInfoCount = commandBufferCount;
+		submitInfo.pCommandBufferInfos = commandBufferInfos;
+		submitInfo.signalSemaphoreInfoCount = signalCount;
+		submitInfo.pSignalSemaphoreInfos = signalInfos;
+		if (vkQueueSubmit2(graphics ? graphicsQueue : computeQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to submit draw command buffer!");
+		}
 
-		vkDestroyBuffer(vkDevice, stagingBuffer, nullptr);
-		vkFreeMemory(vkDevice, stagingBufferMemory, nullptr);
+		if (graphics && batch.last)
+		{
+			frame.timelineValue = value;
+			if (latencyTracer)
+			{
+				latencyTracer->Mark(LatencyMarker::Submit);
+			}
+		}
 	}
 
-	void CreateIndexBuffer()
+	// 没有Hi-Z时的场景pass：视锥剔除后的物体，可能还有遮挡查询的代理盒
+	void RecordScene(VkCommandBuffer commandBuffer)
 	{
-		VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
-
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingMemory;
-		CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingMemory);
-
-		void* data;
-		vkMapMemory(vkDevice, stagingMemory, 0, bufferSize, 0, &data);
-		memcpy(data, indices.data(), bufferSize);
-		vkUnmapMemory(vkDevice, stagingMemory);
+		uint32_t imageIndex = recordImageIndex;
+		// 管线还在后台编译时：没有代理盒管线就不发查询，沿用上次的结果；没有mesh管线就用顶点管线绘制
+		bool useQueries = options.occlusion == OcclusionMode::Queries;
+		bool issueQueries = useQueries && (proxyPipeline = pipelineRegistry->Acquire(proxyPipelineKey)) != VK_NULL_HANDLE;
+		bool benchVariant = benchVariantSlot >= 0;
+		bool benchDraw = benchDrawSlot >= 0 || benchSortSlot >= 0;
+		bool useMeshlets = !benchVariant && !benchDraw && options.meshShading
+			&& (meshletPipeline = pipelineRegistry->Acquire(meshletPipelineKey)) != VK_NULL_HANDLE;
+		queriesIssued = issueQueries;
+		if (options.cacheCommands)
+		{
+			RecordCachedScene(commandBuffer, imageIndex, useMeshlets);
+			return;
+		}
+		if (useQueries)
+		{
+			BeginOcclusionQueries(commandBuffer);
+		}
 
-		CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+		bool writeTimestamps = benchVariant && benchVariantMeasure;
+		if (writeTimestamps)
+		{
+			vkCmdResetQueryPool(commandBuffer, variantQueryPool, currentFrame * 2, 2);
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, variantQueryPool, currentFrame * 2);
+		}
+		variantOfFrame[currentFrame] = writeTimestamps ? benchVariantSlot : -1;
+
+		// --bench-draw要求每次绘制都切换状态，不排序
+		bool sortPackets = benchSortSlot >= 0 ? benchSortSlot % 2 == 0 : options.sortDraws && benchDrawSlot < 0;
+		auto sortStart = std::chrono::high_resolution_clock::now();
+		BuildDrawPackets(benchDraw, sortPackets);
+		double sortMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sortStart).count();
+
+		SceneRecordFlags flags = {};
+		flags.useMeshlets = useMeshlets;
+		flags.benchDraw = benchDraw;
+		flags.useQueries = useQueries;
+		if (benchVariant)
+		{
+			const VariantBenchEntry& entry = variantBench[benchVariantSlot / 2];
+			flags.variantPipeline = pipelineRegistry->Acquire(benchVariantSlot % 2 == 1 ? entry.branchyKey : entry.specializedKey);
+			flags.variantFeatures = entry.features.Mask();
+		}
+		if (benchDraw)
+		{
+			// 注册表在主线程上访问，录制线程只用取到的句柄
+			for (auto& combo : drawBench)
+			{
+				combo.pipeline = benchDrawSlot % 2 == 1 ? VK_NULL_HANDLE : pipelineRegistry->Acquire(combo.pipelineKey);
+			}
+		}
 
-		CopyBuffer(stagingBuffer, indexBuffer, bufferSize);
+		// 代理盒要在同一个渲染实例里直接录制，发查询的帧不拆分
+		uint32_t recordThreads = benchRecordSlot >= 0 ? benchRecordThreads[benchRecordSlot % benchRecordThreads.size()]
+			: std::min(frameContexts[currentFrame]->GetRecordThreadCount(), (uint32_t)drawPackets.size() / MIN_DRAWS_PER_RECORD_THREAD);
+		bool parallel = recordThreads > 1 && !issueQueries;
 
-		vkDestroyBuffer(vkDevice, stagingBuffer, nullptr);
-		vkFreeMemory(vkDevice, stagingMemory, nullptr);
-	}
+		BeginSceneRendering(commandBuffer, imageIndex, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			parallel ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0);
 
-	VkCommandBuffer BeginSingleTimeCommands()
-	{
-		VkCommandBufferAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		allocInfo.commandPool = commandPool;
-		allocInfo.commandBufferCount = 1;
+		DrawBindCounts binds;
+		auto recordStart = std::chrono::high_resolution_clock::now();
+		if (parallel)
+		{
+			RecordScenePacketsParallel(commandBuffer, flags, recordThreads, binds);
+		}
+		else
+		{
+			RecordScenePackets(commandBuffer, *dynamicState, 0, (uint32_t)drawPackets.size(), flags, binds);
+		}
+		double recordMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - recordStart).count();
+		if (benchDrawSlot >= 0 && benchDrawMeasure)
+		{
+			drawBenchRecordMs[benchDrawSlot % 2] += recordMs;
+			drawBenchDraws[benchDrawSlot % 2] += visibleObjects.size();
+		}
+		if (benchSortSlot >= 0 && benchSortMeasure)
+		{
+			sortBenchSortMs[benchSortSlot % 2] += sortMs;
+			sortBenchRecordMs[benchSortSlot % 2] += recordMs;
+			sortBenchBinds[benchSortSlot % 2] += binds;
+		}
+		if (benchRecordSlot >= 0 && benchRecordMeasure)
+		{
+			recordBenchMs[benchRecordSlot] += recordMs;
+			recordBenchDraws[benchRecordSlot] += binds.draws;
+		}
+		bindTotals += binds;
+		packetFrames++;
 
-		VkCommandBuffer commandBuffer;
-		vkAllocateCommandBuffers(vkDevice, &allocInfo, &commandBuffer);
+		if (issueQueries)
+		{
+			DrawOcclusionProxies(commandBuffer);
+		}
 
-		VkCommandBufferBeginInfo beginInfo = {};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		vkCmdEndRendering(commandBuffer);
 
-		return commandBuffer;
+		if (writeTimestamps)
+		{
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, variantQueryPool, currentFrame * 2 + 1);
+		}
 	}
 
-	void EndSingleTimeCommands(VkCommandBuffer commandBuffer)
+	// 绑定场景状态并录制[begin, end)的绘制包，主命令缓冲和并行录制的次级命令缓冲共用
+	void RecordScenePackets(VkCommandBuffer commandBuffer, DynamicStateTracker& tracker, uint32_t begin, uint32_t end,
+		const SceneRecordFlags& flags, DrawBindCounts& binds)
 	{
-		vkEndCommandBuffer(commandBuffer);
-
-		VkSubmitInfo submitInfo = {};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffer;
-
-		vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-		vkQueueWaitIdle(graphicsQueue);
+		if (flags.useMeshlets)
+		{
+			BindMeshletPipeline(commandBuffer, tracker);
+			binds.pipelines++;
+			binds.descriptorSets++;
+		}
+		else if (flags.variantPipeline != VK_NULL_HANDLE)
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, flags.variantPipeline);
+			tracker.Apply(commandBuffer, sceneDesc);
+			binds.pipelines++;
+			vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(flags.variantFeatures), &flags.variantFeatures);
+		}
+		else if (flags.benchDraw)
+		{
+			// 绘制包的状态变化时在循环里绑定
+		}
+		else if (options.shaderObjects)
+		{
+			shaderObjects->Bind(commandBuffer, sceneShaders);
+			shaderObjects->SetState(commandBuffer, sceneDesc, vkSwapChainExtent);
+			tracker.Reset();
+		}
+		else
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+			tracker.Apply(commandBuffer, sceneDesc);
+			binds.pipelines++;
+		}
 
-		vkFreeCommandBuffers(vkDevice, commandPool, 1, &commandBuffer);
-	}
+		// 场景只有一个网格，顶点和索引缓冲绑定一次
+		if (!flags.useMeshlets)
+		{
+			VkBuffer vertexBuffers[] = { vertexBuffer };
+			VkDeviceSize offsetes[] = { 0 };
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsetes);
+			vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+			binds.vertexBuffers++;
+			binds.indexBuffers++;
+		}
+		VkPipelineLayout sceneLayout = flags.useMeshlets ? meshletPipelineLayout : pipelineLayout;
 
-	void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
-	{
+		uint32_t boundState = UINT32_MAX;
+		VkPipeline boundPipeline = VK_NULL_HANDLE;
+		for (uint32_t i = begin; i < end; i++)
+		{
+			const DrawPacket& packet = drawPackets[i];
+			uint32_t objectIndex = packet.objectIndex;
+			if (flags.benchDraw && packet.state != boundState)
+			{
+				binds.pipelines += BindDrawBenchState(commandBuffer, tracker, packet.state, boundPipeline) ? 1 : 0;
+				boundState = packet.state;
+			}
 
-		VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+			// 每个物体的uniform偏移不同，描述符集每次都要绑定
+			uint32_t dynamicOffset = (uint32_t)(objectIndex * uniformStride);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, sceneLayout, 0, 1, &sceneDescriptorSet,
+				1, &dynamicOffset);
+			binds.descriptorSets++;
+			binds.draws++;
 
-		VkBufferCopy copyRegion = {};
-		copyRegion.srcOffset = 0;
-		copyRegion.dstOffset = 0;
-		copyRegion.size = size;
-		vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+			if (flags.useQueries)
+			{
+				// 上一帧代理盒的查询结果为0时GPU直接跳过这次绘制
+				VkConditionalRenderingBeginInfoEXT conditionalInfo = {};
+				conditionalInfo.sType = VK_STRUCTURE_TYPE_CONDITIONAL_RENDERING_BEGIN_INFO_EXT;
+				conditionalInfo.buffer = occlusionResultBuffer;
+				conditionalInfo.offset = sizeof(uint32_t) * objectIndex;
+				vkCmdBeginConditionalRendering(commandBuffer, &conditionalInfo);
+			}
 
-		EndSingleTimeCommands(commandBuffer);
-	}
+			if (flags.useMeshlets)
+			{
+				vkCmdDrawMeshTasks(commandBuffer, (meshletCount + 31) / 32, 1, 1);
+			}
+			else
+			{
+				vkCmdDrawIndexed(commandBuffer, indices.size(), 1, 0, 0, 0);
+			}
 
-	bool HasStencilComponent(VkFormat format)
-	{
-		return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
+			if (flags.useQueries)
+			{
+				vkCmdEndConditionalRendering(commandBuffer);
+			}
+		}
 	}
 
-	void TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout,
-		VkImageLayout newLayout)
+	// 绘制包按线程数切块，每块在工作线程上录进自己命令池的次级命令缓冲，再由主命令缓冲按顺序执行，保持排序后的顺序
+	void RecordScenePacketsParallel(VkCommandBuffer commandBuffer, const SceneRecordFlags& flags, uint32_t threadCount, DrawBindCounts& binds)
 	{
-		VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
-		VkImageMemoryBarrier barrier = {};
-		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		barrier.oldLayout = oldLayout;
-		barrier.newLayout = newLayout;
+		FrameContext& frame = *frameContexts[currentFrame];
 
-		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		uint32_t count = (uint32_t)drawPackets.size();
+		uint32_t chunkSize = (count + threadCount - 1) / threadCount;
+		secondaryCommandBuffers.assign(threadCount, VK_NULL_HANDLE);
+		secondaryBinds.assign(threadCount, DrawBindCounts());
+		std::vector<VkResult> results(threadCount, VK_SUCCESS);
 
-		barrier.image = image;
-		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		barrier.subresourceRange.baseMipLevel = 0;
-		barrier.subresourceRange.levelCount = 1;
-		barrier.subresourceRange.baseArrayLayer = 0;
-		barrier.subresourceRange.layerCount = 1;
+		// 块号对应命令池和状态跟踪器，同一时刻只有一个线程用它们；工作线程里不抛异常，结果回到主线程再检查
+		threadPool->ParallelFor(threadCount, 1, 1, [&](uint32_t firstChunk, uint32_t lastChunk)
+			{
+				for (uint32_t chunk = firstChunk; chunk < lastChunk; chunk++)
+				{
+					VkCommandBuffer secondary = frame.AllocateSecondaryCommandBuffer(chunk);
+					results[chunk] = BeginSceneSecondary(secondary, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+					if (results[chunk] != VK_SUCCESS)
+					{
+						continue;
+					}
+					recordStates[chunk].Reset();
+					uint32_t begin = std::min(chunk * chunkSize, count);
+					RecordScenePackets(secondary, recordStates[chunk], begin, std::min(begin + chunkSize, count), flags, secondaryBinds[chunk]);
+					results[chunk] = vkEndCommandBuffer(secondary);
+					secondaryCommandBuffers[chunk] = secondary;
+				}
+			});
 
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask = 0;
+		for (uint32_t chunk = 0; chunk < threadCount; chunk++)
+		{
+			if (results[chunk] != VK_SUCCESS)
+			{
+				throw std::runtime_error("fail to record secondary command buffer");
+			}
+			binds += secondaryBinds[chunk];
+		}
+		vkCmdExecuteCommands(commandBuffer, threadCount, secondaryCommandBuffers.data());
+	}
 
-		VkPipelineStageFlags sourceStage;
-		VkPipelineStageFlags destinationStage;
+	// 开始一个在场景渲染实例里执行的次级命令缓冲，可以在录制线程上调用
+	VkResult BeginSceneSecondary(VkCommandBuffer commandBuffer, VkCommandBufferUsageFlags usage)
+	{
+		VkCommandBufferInheritanceRenderingInfo renderingInfo = {};
+		renderingInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+		renderingInfo.colorAttachmentCount = 1;
+		renderingInfo.pColorAttachmentFormats = &vkSwapChainImageFormat;
+		renderingInfo.depthAttachmentFormat = DEPTH_FORMAT;
+		// 和BeginSceneRendering、场景管线一致：深度视图只有depth aspect，模板附件不参与渲染
+		renderingInfo.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+		renderingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+		VkCommandBufferInheritanceInfo inheritanceInfo = {};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfo.pNext = &renderingInfo;
 
-		if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-		{
-			barrier.srcAccessMask = 0;
-			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = usage | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
 
-			sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-			destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		}
-		else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		VkResult result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		if (result == VK_SUCCESS)
 		{
-			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-			sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-			destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+			// 次级命令缓冲不继承动态状态
+			SetSceneViewport(commandBuffer);
 		}
-		else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-		{
-			barrier.srcAccessMask = 0;
-			barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		return result;
+	}
 
-			sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-			destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-		}
-		else
+	// 场景没有变化时再次执行这一帧上次录制的次级命令缓冲，主命令缓冲里只剩屏障和渲染实例的开始结束
+	void RecordCachedScene(VkCommandBuffer commandBuffer, uint32_t imageIndex, bool useMeshlets)
+	{
+		// 优化链接替换了管线，或者mesh管线编译完成时，句柄会变
+		VkPipeline scenePipeline = useMeshlets ? meshletPipeline : graphicsPipeline;
+		if (scenePipeline != cachedScenePipeline)
 		{
-			throw std::invalid_argument("unsupported layout transition");
+			cachedScenePipeline = scenePipeline;
+			sceneVersion++;
 		}
 
-		if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
+		// 这一帧上次的提交已经完成，可以重新录制
+		FrameContext::Cache& cache = frameContexts[currentFrame]->GetCache(descriptorLayout);
+		if (cache.version != sceneVersion)
 		{
-			barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-
-			if (HasStencilComponent(format))
+			BuildDrawPackets(false, options.sortDraws);
+			// 继承信息(附件格式)和视口在开始录制时固定，会改变它们的交换链重建也会增加sceneVersion，
+			// 所以重新执行的缓存和并行录制的次级命令缓冲始终与BeginSceneRendering的附件一致
+			if (BeginSceneSecondary(cache.commandBuffer, 0) != VK_SUCCESS)
+			{
+				throw std::runtime_error("fail to begin cached command buffer");
+			}
+			SceneRecordFlags flags = {};
+			flags.useMeshlets = useMeshlets;
+			DrawBindCounts binds;
+			dynamicState->Reset();
+			RecordScenePackets(cache.commandBuffer, *dynamicState, 0, (uint32_t)drawPackets.size(), flags, binds);
+			if (vkEndCommandBuffer(cache.commandBuffer) != VK_SUCCESS)
 			{
-				barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+				throw std::runtime_error("fail to record cached command buffer");
 			}
+			cache.version = sceneVersion;
+			cacheRecords++;
 		}
 		else
 		{
-			barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			cacheReuses++;
 		}
 
-		vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0,
-			nullptr, 1, &barrier);
-		EndSingleTimeCommands(commandBuffer);
+		BeginSceneRendering(commandBuffer, imageIndex, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT);
+		vkCmdExecuteCommands(commandBuffer, 1, &cache.commandBuffer);
+		vkCmdEndRendering(commandBuffer);
 	}
 
-	uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+	// flags带VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT时绘制都在次级命令缓冲里，视口也由它们设置。
+	// 附件的布局转换由帧图在pass开始前完成
+	void BeginSceneRendering(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkAttachmentLoadOp loadOp, VkAttachmentStoreOp depthStoreOp,
+		VkRenderingFlags flags = 0)
 	{
-		VkPhysicalDeviceMemoryProperties memProperties;
-		vkGetPhysicalDeviceMemoryProperties(vkPhysicalDevice, &memProperties);
-		for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+		VkRenderingAttachmentInfo colorAttachment = {};
+		colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+		colorAttachment.imageView = vkSwapChainImageViews[imageIndex];
+		colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		colorAttachment.loadOp = loadOp;
+		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		colorAttachment.clearValue.color = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+		VkRenderingAttachmentInfo depthAttachment = {};
+		depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+		depthAttachment.imageView = depthImageView;
+		depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		depthAttachment.loadOp = loadOp;
+		depthAttachment.storeOp = depthStoreOp;
+		depthAttachment.clearValue.depthStencil = { 1.0f, 0 };
+
+		VkRenderingInfo renderingInfo = {};
+		renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+		renderingInfo.renderArea.offset = { 0, 0 };
+		renderingInfo.renderArea.extent = vkSwapChainExtent;
+		renderingInfo.layerCount = 1;
+		renderingInfo.colorAttachmentCount = 1;
+		renderingInfo.pColorAttachments = &colorAttachment;
+		renderingInfo.pDepthAttachment = &depthAttachment;
+		renderingInfo.flags = flags;
+
+		vkCmdBeginRendering(commandBuffer, &renderingInfo);
+		if ((flags & VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT) == 0)
 		{
-			if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-			{
-				return i;
-			}
+			SetSceneViewport(commandBuffer);
 		}
-
-		throw std::runtime_error("fail to find suitable memory type");
 	}
 
-	void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-		VkBuffer &buffer, VkDeviceMemory& bufferMemory)
+	void SetSceneViewport(VkCommandBuffer commandBuffer)
 	{
-		VkBufferCreateInfo bufferInfo = {};
-		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bufferInfo.size = size;
-		bufferInfo.usage = usage;
-		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		VkViewport viewport{};
+		viewport.x = 0.0f;
+		viewport.y = 0.0f;
+		viewport.width = (float)vkSwapChainExtent.width;
+		viewport.height = (float)vkSwapChainExtent.height;
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-		if (vkCreateBuffer(vkDevice, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+		VkRect2D scissor{};
+		scissor.offset = { 0, 0 };
+		scissor.extent = vkSwapChainExtent;
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+	}
+
+	// 深度缓冲是帧图里唯一的临时图像，其他都从外部导入。pass按添加的顺序执行，屏障由声明的读写生成
+	void BuildFrameGraph()
+	{
+		const VkPipelineStageFlags2 depthStages = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+		const VkAccessFlags2 colorAccess = VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+		const VkAccessFlags2 depthAccess = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		const VkAccessFlags2 storageAccess = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+		frameGraph = std::make_unique<RenderGraph>(vkPhysicalDevice, vkDevice, *resourceStates);
+		FrameGraphResources& res = frameGraphResources;
+		res.color = frameGraph->ImportImage("swapchain");
+
+		RenderGraphImageDesc depthDesc = {};
+		depthDesc.format = DEPTH_FORMAT;
+		depthDesc.extent = vkSwapChainExtent;
+		depthDesc.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		depthDesc.aspect = VK_IMAGE_ASPECT_DEPTH_BIT | (HasStencilComponent(DEPTH_FORMAT) ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
+		if (options.occlusion == OcclusionMode::HiZ)
 		{
-			throw std::runtime_error("fail to create buffer");
+			depthDesc.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
 		}
+		res.depth = frameGraph->CreateImage("depth", depthDesc);
 
-		VkMemoryRequirements memRequirements;
-		vkGetBufferMemoryRequirements(vkDevice, buffer, &memRequirements);
+		if (computeFamily >= 0)
+		{
+			frameGraph->SetAsyncCompute((uint32_t)FindQueueFamilies(vkPhysicalDevice).graphicsFamily, (uint32_t)computeFamily, *timeline,
+				*computeTimeline);
+		}
+		if (options.occlusion == OcclusionMode::HiZ)
+		{
+			res.hiz = frameGraph->ImportImage("hiz");
+			res.visibility = frameGraph->ImportBuffer("visibility");
+			res.earlyDraw = frameGraph->ImportBuffer("early draws");
+			res.lateDraw = frameGraph->ImportBuffer("late draws");
+
+			// 第一阶段：绘制上一帧可见的物体。剔除和Hi-Z都在异步计算队列上，和图形队列上前后的工作重叠
+			frameGraph->AddPass("cull early", [this](VkCommandBuffer commandBuffer) { DispatchOcclusionCull(commandBuffer, 0); })
+				.Async()
+				.Read(res.visibility, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT)
+				.Discard(res.earlyDraw, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+			// 保留深度用于构建Hi-Z，颜色留在附件布局给第二阶段继续绘制
+			frameGraph->AddPass("scene early", [this](VkCommandBuffer commandBuffer)
+				{
+					BeginSceneRendering(commandBuffer, recordImageIndex, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_STORE);
+					DrawIndirectScene(commandBuffer, earlyDrawBuffer);
+					vkCmdEndRendering(commandBuffer);
+				})
+				.Read(res.earlyDraw, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT)
+				.Discard(res.color, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, colorAccess, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
+				.Discard(res.depth, depthStages, depthAccess, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+			// 用第一阶段的深度构建Hi-Z。只声明第0级，后面每一级读上一级，在BuildHiZ里逐级声明
+			frameGraph->AddPass("hiz", [this](VkCommandBuffer commandBuffer) { BuildHiZ(commandBuffer); })
+				.Async()
+				.Read(res.depth, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+					VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL)
+				.Write(res.hiz, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL,
+					ImageRange{ 0, 1 });
+			// 再测试所有物体，写回可见性给下一帧
+			frameGraph->AddPass("cull late", [this](VkCommandBuffer commandBuffer) { DispatchOcclusionCull(commandBuffer, 1); })
+				.Async()
+				.Write(res.visibility, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, storageAccess)
+				.Read(res.hiz, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_GENERAL)
+				.Discard(res.lateDraw, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+			// 第二阶段：绘制本帧新变为可见的物体
+			frameGraph->AddPass("scene late", [this](VkCommandBuffer commandBuffer)
+				{
+					BeginSceneRendering(commandBuffer, recordImageIndex, VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_STORE_OP_DONT_CARE);
+					DrawIndirectScene(commandBuffer, lateDrawBuffer);
+					vkCmdEndRendering(commandBuffer);
+				})
+				.Read(res.lateDraw, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT)
+				.Write(res.color, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, colorAccess, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
+				.Write(res.depth, depthStages, depthAccess, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+			frameGraph->MarkOutput(res.visibility);
+		}
+		else
+		{
+			RenderGraph::PassBuilder scene = frameGraph->AddPass("scene", [this](VkCommandBuffer commandBuffer) { RecordScene(commandBuffer); })
+				.Discard(res.color, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, colorAccess, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
+				.Discard(res.depth, depthStages, depthAccess, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+			if (options.occlusion == OcclusionMode::Queries)
+			{
+				// 条件渲染读上一帧复制的结果，本帧的结果在读完之后才能覆盖
+				res.occlusionResult = frameGraph->ImportBuffer("occlusion results");
+				scene.Read(res.occlusionResult, VK_PIPELINE_STAGE_2_CONDITIONAL_RENDERING_BIT_EXT, VK_ACCESS_2_CONDITIONAL_RENDERING_READ_BIT_EXT);
+				frameGraph->AddPass("copy occlusion results", [this](VkCommandBuffer commandBuffer)
+					{
+						if (queriesIssued)
+						{
+							CopyOcclusionResults(commandBuffer);
+						}
+					})
+					.Discard(res.occlusionResult, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+				frameGraph->MarkOutput(res.occlusionResult);
+			}
+		}
 
-		VkMemoryAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
+		// 呈现引擎由renderFinished信号量同步，屏障只做布局转换
+		frameGraph->AddPass("present", [](VkCommandBuffer) {})
+			.Read(res.color, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR)
+			.SideEffect();
 
-		if (vkAllocateMemory(vkDevice, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
+		frameGraph->Compile();
+		// 不在这里转换深度的布局：每帧第一次使用时从UNDEFINED转换后清除，resize时也就不用等待队列
+		depthImage = frameGraph->GetImage(res.depth);
+		depthImageView = frameGraph->GetImageView(res.depth);
+		if (options.dumpRenderGraph)
 		{
-			throw std::runtime_error("fail to allocate memory");
+			frameGraph->PrintSchedule();
 		}
-
-		vkBindBufferMemory(vkDevice, buffer, bufferMemory, 0);
 	}
 
-	void CreateGraphicsPipeline()
+	// snapshot为空时在获取交换链图像之后当场模拟
+	void DrawFrame(const SceneSnapshot* snapshot = nullptr)
 	{
-		auto vertShaderCode = ReadFile(SHADER_DIR"vert.spv");
-		auto fragShaderCode = ReadFile(SHADER_DIR"frag.spv");
+		framePacer->BeginFrame();
+
+		// 这个槽位上次提交的帧完成后才能整体重置它的命令池、描述符池和uniform
+		FrameContext& frame = *frameContexts[currentFrame];
+		timeline->Wait(frame.timelineValue);
+		frame.Begin();
+		deletionQueue.Flush(timeline->Completed());
+		// 优化链接替换下来的管线可能还被在途的帧使用
+		for (VkPipeline pipeline : pipelineRegistry->TakeRetired())
+		{
+			deletionQueue.Push(timeline->LastSubmitted(), vkDevice, pipeline);
+		}
+		if (variantQueryPool != VK_NULL_HANDLE)
+		{
+			ReadVariantTimestamps(currentFrame);
+		}
+		if (latencyTracer)
+		{
+			latencyTracer->ResolveGpu(currentFrame);
+		}
+
+		uint32_t imageIndex;
+		VkResult result = vkAcquireNextImageKHR(vkDevice, vkSwapChain, UINT64_MAX, frame.GetImageAvailable(), VK_NULL_HANDLE, &imageIndex);
+
+		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+			ReCreateSwapChain();
+			return;
+		}
+		else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+		{
+			throw std::runtime_error("fail to acquire swap chain image");
+		}
+		// 呈现之后图像的内容不再需要，写入要等获取信号量，提交时它在颜色输出阶段等待
+		resourceStates->ImportImage(vkSwapChainImages[imageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT);
 		
-		VkShaderModule vertShaderModule;
-		VkShaderModule fragShaderModule;
-		vertShaderModule = CreateShaderModule(vertShaderCode);
-		fragShaderModule = CreateShaderModule(fragShaderCode);
-
-		VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-		vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-		vertShaderStageInfo.module = vertShaderModule;
-		vertShaderStageInfo.pName = "main";
-
-		VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-		fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		fragShaderStageInfo.module = fragShaderModule;
-		fragShaderStageInfo.pName = "main";
-
-		VkPipelineShaderStageCreateInfo shaderStages[] = {
-			vertShaderStageInfo, fragShaderStageInfo
-		};
+		if (snapshot == nullptr)
+		{
+			Simulate(serialSnapshot, vkSwapChainExtent.width / (float)vkSwapChainExtent.height);
+			snapshot = &serialSnapshot;
+		}
+		UpdateUniformBuffer(currentFrame, *snapshot);
+		if (latencyTracer)
+		{
+			latencyTracer->Mark(LatencyMarker::Simulation);
+		}
 
-		VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-		vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		RecordFrame(frame, imageIndex);
 
-		auto bindingDescription = Vertex::getBindingDescription();
-		auto attributeDescriptions = Vertex::getAttributeDescriptions();
+		VkSemaphore renderFinished = frame.GetRenderFinished();
+		VkPresentInfoKHR presentInfo = {};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = &renderFinished;
+		
+		VkSwapchainKHR swapChains[] = { vkSwapChain };
+		presentInfo.pSwapchains = swapChains;
+		presentInfo.pImageIndices = &imageIndex;
+		presentInfo.swapchainCount = 1;
 
-		vertexInputInfo.vertexBindingDescriptionCount = 1;
-		vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-		vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-		vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+		presentInfo.pResults = nullptr;
 
-		VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-		inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-		inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-		inputAssembly.primitiveRestartEnable = VK_FALSE;
+		uint64_t presentId = framePacer->NextPresentId();
+		VkPresentIdKHR presentIdInfo = {};
+		presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+		presentIdInfo.swapchainCount = 1;
+		presentIdInfo.pPresentIds = &presentId;
+		if (presentId != 0)
+		{
+			presentInfo.pNext = &presentIdInfo;
+		}
+	
+		result = vkQueuePresentKHR(presentQueue, &presentInfo);
+		if (latencyTracer)
+		{
+			latencyTracer->SetPresentId(presentId);
+			latencyTracer->Mark(LatencyMarker::Present);
+		}
 
-		VkViewport viewport = {};
-		viewport.x = 0.0f;
-		viewport.y = 0.0f;
-		viewport.width = (float)vkSwapChainExtent.width;
-		viewport.height = (float)vkSwapChainExtent.height;
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 1.0f;
-		VkRect2D scissor = {};
-		scissor.offset = { 0,0 };
-		scissor.extent = vkSwapChainExtent;
-		VkPipelineViewportStateCreateInfo viewportState = {};
-		viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-		viewportState.viewportCount = 1;
-		viewportState.pViewports = &viewport;
-		viewportState.scissorCount = 1;
-		viewportState.pScissors = &scissor;
+		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
+			framebufferResized = false;
+			ReCreateSwapChain();
+		}
+		else if (result != VK_SUCCESS) {
+			throw std::runtime_error("failed to present swap chain image!");
+		}
 
-		VkPipelineRasterizationStateCreateInfo rasterizer = {};
-		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-		rasterizer.depthClampEnable = VK_FALSE;
-		rasterizer.rasterizerDiscardEnable = VK_FALSE;
-		rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-		rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-		rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-		rasterizer.lineWidth = 1.0f;
-		rasterizer.depthBiasEnable = VK_FALSE;
-		rasterizer.depthBiasConstantFactor = 0.0f;
-		rasterizer.depthBiasClamp = 0.0f;
-		rasterizer.depthBiasSlopeFactor = 0.0f;
+		currentFrame = (currentFrame + 1) % options.framesInFlight;
 
-		VkPipelineMultisampleStateCreateInfo multisampling = {};
-		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-		multisampling.sampleShadingEnable = VK_FALSE;
-		multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-		multisampling.minSampleShading = 1.0f;
-		multisampling.pSampleMask = nullptr;
-		multisampling.alphaToCoverageEnable = VK_FALSE;
-		multisampling.alphaToOneEnable = VK_FALSE;
+		if (frameStats)
+		{
+			frameStats->Tick();
+		}
 
-		VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-		colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT
-			| VK_COLOR_COMPONENT_A_BIT;
-		colorBlendAttachment.blendEnable = VK_FALSE;
-		colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-		colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-		colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
-		colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-		colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-		colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+		pipelineCache->SaveIfDue(60.0);
+	}
 
-		VkPipelineColorBlendStateCreateInfo colorBlending = {};
-		colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-		colorBlending.logicOpEnable = VK_FALSE;
-		colorBlending.logicOp = VK_LOGIC_OP_COPY;
-		colorBlending.attachmentCount = 1;
-		colorBlending.pAttachments = &colorBlendAttachment;
-		colorBlending.blendConstants[0] = 0.0f;
-		colorBlending.blendConstants[1] = 0.0f;
-		colorBlending.blendConstants[2] = 0.0f;
-		colorBlending.blendConstants[3] = 0.0f;
-		
-		std::vector<VkDynamicState> dynamicStates = {
-			  VK_DYNAMIC_STATE_VIEWPORT,
-			  VK_DYNAMIC_STATE_SCISSOR
-		};
-		VkPipelineDynamicStateCreateInfo dynamicState = {};
-		dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-		dynamicState.dynamicStateCount = dynamicStates.size();
-		dynamicState.pDynamicStates = dynamicStates.data();
- 
-		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		pipelineLayoutInfo.setLayoutCount = 1;
-		pipelineLayoutInfo.pSetLayouts = &descriptorLayout;
-		pipelineLayoutInfo.pushConstantRangeCount = 0;
-		pipelineLayoutInfo.pPushConstantRanges = nullptr;
+	ShaderInterface ReflectShaders(const std::vector<std::string>& paths)
+	{
+		ShaderInterface shaderInterface;
+		for (const auto& path : paths)
+		{
+			shaderInterface.Merge(ReflectSpirv(ReadFile(path)));
+		}
+		return shaderInterface;
+	}
 
-		if (vkCreatePipelineLayout(vkDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+	void CreateDescriptorSetLayout()
+	{
+		// --features和变体测试靠特化常量选择特性，没有这个常量的旧frag.spv会静默忽略特化信息
+		if (ReflectShaders({ SHADER_DIR"frag.spv" }).specConstants.count(kShaderFeaturesConstantId) == 0)
 		{
-			throw std::runtime_error("fail to create pipeline layout");
+			throw std::runtime_error("fail to find the shader feature constant in frag.spv, recompile the shaders");
 		}
-		else
+		// 写描述符集时按变量名找绑定，去掉了调试信息的模块没有名字。逐个模块检查，合并后别的模块的同名变量会掩盖问题
+		const std::pair<const char*, const char*> requiredNames[] = { { "vert.spv", "ubo" }, { "frag.spv", "texSampler" } };
+		for (const auto& required : requiredNames)
 		{
-			std::cout << "succeed to create pipeline layout" << std::endl;
+			if (ReflectShaders({ std::string(SHADER_DIR) + required.first }).bindingNames.count(required.second) == 0)
+			{
+				throw std::runtime_error(std::string("fail to find shader binding ") + required.second + " in " + required.first
+					+ ", compile the shaders with debug names (glslangValidator -V without -g0)");
+			}
 		}
 
-		VkPipelineDepthStencilStateCreateInfo depthStencil = {};
-		depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-		depthStencil.depthTestEnable = VK_TRUE;
-		depthStencil.depthWriteEnable = VK_TRUE;
-		depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
-		depthStencil.depthBoundsTestEnable = VK_FALSE;
-		depthStencil.minDepthBounds = 0.0f;
-		depthStencil.maxDepthBounds = 1.0f;
-		depthStencil.stencilTestEnable = VK_FALSE;
-		depthStencil.front = {};
-		depthStencil.back = {};
-
-		VkGraphicsPipelineCreateInfo pipelineInfo = {};
-		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		pipelineInfo.stageCount = 2;
-		pipelineInfo.pStages = shaderStages;
-		pipelineInfo.pVertexInputState = &vertexInputInfo;
-		pipelineInfo.pInputAssemblyState = &inputAssembly;
-		pipelineInfo.pViewportState = &viewportState;
-		pipelineInfo.pRasterizationState = &rasterizer;
-		pipelineInfo.pMultisampleState = &multisampling;
-		pipelineInfo.pDepthStencilState = nullptr;
-		pipelineInfo.pColorBlendState = &colorBlending;
-		pipelineInfo.pDynamicState = &dynamicState;
-		pipelineInfo.layout = pipelineLayout;
-		pipelineInfo.renderPass = renderPass;
-		pipelineInfo.subpass = 0;
-		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-		pipelineInfo.basePipelineIndex = -1;
-		pipelineInfo.pDepthStencilState = &depthStencil;
+		// set 0由顶点路径、mesh路径和变体测试共用，所有会绑定它的着色器一起反射，保证各个pipeline layout兼容
+		std::vector<std::string> sceneShaders = { SHADER_DIR"vert.spv", SHADER_DIR"frag.spv" };
+		if (options.benchVariants)
+		{
+			sceneShaders.push_back(SHADER_DIR"fragBranchy.spv");
+		}
+		sceneInterface = ReflectShaders(sceneShaders);
 
-		if (vkCreateGraphicsPipelines(vkDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS)
+		if (options.meshShading)
 		{
-			throw std::runtime_error("fail to create graphics pipeline");
+			meshletInterface = ReflectShaders({ SHADER_DIR"meshlet.task.spv", SHADER_DIR"meshlet.mesh.spv", SHADER_DIR"frag.spv" });
+			ShaderInterface combined = sceneInterface;
+			combined.Merge(meshletInterface);
+			sceneInterface.sets[0] = combined.sets[0];
+			meshletInterface.sets[0] = combined.sets[0];
 		}
-		else
+
+		// 每个物体的矩阵通过动态偏移绑定，反射无法得知
+		uint32_t uboBinding = sceneInterface.FindBinding(0, "ubo");
+		sceneInterface.SetDescriptorType(0, uboBinding, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+		if (options.meshShading)
 		{
-			std::cout << "succeed to create graphics pipeline" << std::endl;
+			meshletInterface.SetDescriptorType(0, uboBinding, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
 		}
 
-		vkDestroyShaderModule(vkDevice, vertShaderModule, nullptr);
-		vkDestroyShaderModule(vkDevice, fragShaderModule, nullptr);
+		descriptorLayout = layoutCache->GetSetLayout(sceneInterface.Bindings(0));
+		std::cout << "succeed to create descriptor set layout" << std::endl;
 	}
 
-	void CreateFramebuffers()
+	void CreateFrameContexts()
 	{
-		swapChainFramebuffers.resize(vkSwapChainImageViews.size());
-		for (int i = 0; i < swapChainFramebuffers.size(); i++)
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(vkPhysicalDevice, &properties);
+		VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+		uniformStride = (sizeof(UniformBufferObject) + alignment - 1) / alignment * alignment;
+
+		// 每帧一个场景描述符集，uniform按物体下标排列
+		VkDeviceSize uniformCapacity = uniformStride * objectPositions.size();
+		std::vector<VkDescriptorPoolSize> poolSizes = LayoutCache::PoolSizes(sceneInterface.Bindings(0), 1);
+		uint32_t graphicsFamily = (uint32_t)FindQueueFamilies(vkPhysicalDevice).graphicsFamily;
+		// 线程池的工作线程加上主线程
+		uint32_t maxRecordThreads = threadPool->GetThreadCount() + 1;
+		uint32_t recordThreads = options.recordThreads == 0 ? maxRecordThreads : std::min(options.recordThreads, maxRecordThreads);
+		for (uint32_t i = 0; i < options.framesInFlight; i++)
 		{
-			std::array<VkImageView, 2> attachments =
-			{
-				vkSwapChainImageViews[i],
-				depthImageView
-			};
-
-			VkFramebufferCreateInfo framebufferInfo = {};
-			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-			framebufferInfo.renderPass = renderPass;
-			framebufferInfo.attachmentCount = attachments.size();
-			framebufferInfo.pAttachments = attachments.data();
-			framebufferInfo.width = vkSwapChainExtent.width;
-			framebufferInfo.height = vkSwapChainExtent.height;
-			framebufferInfo.layers = 1;
-
-			if (vkCreateFramebuffer(vkDevice, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS)
-			{
-				throw std::runtime_error("fail to create framebuffer");
-			}
+			frameContexts.push_back(std::make_unique<FrameContext>(vkPhysicalDevice, vkDevice, graphicsFamily, uniformCapacity, poolSizes, 1,
+				recordThreads, computeFamily));
 		}
-		std::cout << "succeed to create frame buffers" << std::endl;
+		recordStates.assign(recordThreads, *dynamicState);
+		std::cout << "succeed to create " << options.framesInFlight << " frame contexts" << std::endl;
 	}
 
-	void CreateCommandPool()
+	// 相机、剔除和物体的变换。只读场景的静态数据和模拟自己的状态，可以在模拟线程上运行
+	void Simulate(SceneSnapshot& snapshot, float aspect)
 	{
-		QueueFamilyIndices queueFamilyIndices = FindQueueFamilies(vkPhysicalDevice);
+		float time = std::chrono::duration<float, std::chrono::seconds::period>(std::chrono::steady_clock::now() - simulationStart).count();
 
-		VkCommandPoolCreateInfo poolInfo = {};
-		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
-		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		snapshot.view = glm::lookAt(cameraPosition, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		snapshot.proj = glm::perspective(glm::radians(45.0f), aspect, 0.1f, SCENE_FAR_PLANE);
+		snapshot.proj[1][1] *= -1;
+		snapshot.viewProj = snapshot.proj * snapshot.view;
+		snapshot.frustum = ExtractFrustumPlanes(snapshot.viewProj);
+		glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		snapshot.transforms.resize(objectPositions.size());
 
-		if (vkCreateCommandPool(vkDevice, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+		if (options.occlusion == OcclusionMode::HiZ)
 		{
-			throw std::runtime_error("fail to create command pool");
+			// 剔除完全在GPU上完成
+			for (size_t i = 0; i < objectPositions.size(); i++)
+			{
+				snapshot.transforms[i] = glm::translate(glm::mat4(1.0f), objectPositions[i]) * rotation;
+			}
+			return;
 		}
-		else
+
+		// 缓存命令时相机不动就不重新剔除，可见列表不变，录制好的绘制也就不变
+		if (!options.cacheCommands || snapshot.viewProj != culledViewProj)
 		{
-			std::cout << "succeed to create command pool" << std::endl;
+			objectBounds.CullAll(snapshot.frustum, CullShape::SphereThenAabb, simVisibleObjects, threadPool.get());
+			culledViewProj = snapshot.viewProj;
+			simCullVersion++;
+		}
+		if (snapshot.cullVersion != simCullVersion)
+		{
+			snapshot.visibleObjects = simVisibleObjects;
+			snapshot.cullVersion = simCullVersion;
+		}
+		for (uint32_t objectIndex : snapshot.visibleObjects)
+		{
+			snapshot.transforms[objectIndex] = glm::translate(glm::mat4(1.0f), objectPositions[objectIndex]) * rotation;
 		}
 	}
 
-	void CreateCommandBuffers()
+	void UpdateUniformBuffer(uint32_t frameIndex, const SceneSnapshot& snapshot)
 	{
-		commandBuffers.resize(swapChainFramebuffers.size());
-		VkCommandBufferAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.commandPool = commandPool;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
+		UniformBufferObject ubo{};
+		ubo.view = snapshot.view;
+		ubo.proj = snapshot.proj;
+		sceneViewProj = snapshot.viewProj;
+		sceneFrustum = snapshot.frustum;
 
-		if (vkAllocateCommandBuffers(vkDevice, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
+		if (options.occlusion == OcclusionMode::HiZ)
 		{
-			throw std::runtime_error("fail to create command buffers");
+			UpdateOcclusionBuffers(frameIndex, ubo.view, ubo.proj, sceneFrustum, snapshot.transforms);
+			return;
 		}
-		else
+
+		// 重新剔除过才复制可见列表，录制的内容也因此变化
+		if (snapshot.cullVersion != renderCullVersion)
 		{
-			std::cout << "succeed to create command buffers" << std::endl;
+			visibleObjects = snapshot.visibleObjects;
+			renderCullVersion = snapshot.cullVersion;
+			sceneVersion++;
 		}
-	}
-
-	void RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
-		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
-			throw std::runtime_error("failed to begin recording command buffer!");
+		FrameContext& frame = *frameContexts[frameIndex];
+		FrameContext::Uniform uniform = frame.AllocateUniform(uniformStride * objectPositions.size());
+		char* mapped = static_cast<char*>(uniform.data);
+		for (uint32_t objectIndex : visibleObjects)
+		{
+			ubo.model = snapshot.transforms[objectIndex];
+			memcpy(mapped + objectIndex * uniformStride, &ubo, sizeof(ubo));
 		}
 
-		VkRenderPassBeginInfo renderPassInfo{};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = renderPass;
-		renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
-		renderPassInfo.renderArea.offset = { 0, 0 };
-		renderPassInfo.renderArea.extent = vkSwapChainExtent;
-
-		std::array<VkClearValue, 2> clearValues = {};
-		clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-		clearValues[1].depthStencil = { 1.0f, 0 };
+		if (options.cacheCommands)
+		{
+			// uniform总是Begin之后第一次分配，位置不变；缓存的命令缓冲绑定着这个描述符集，只在创建时写一次
+			FrameContext::Cache& cache = frame.GetCache(descriptorLayout);
+			sceneDescriptorSet = cache.descriptorSet;
+			if (cache.version == 0)
+			{
+				WriteSceneDescriptorSet(sceneDescriptorSet, uniform);
+			}
+			return;
+		}
 
-		renderPassInfo.clearValueCount = clearValues.size();
-		renderPassInfo.pClearValues = clearValues.data();
+		// 描述符池在Begin里整体重置，每帧重新分配和写入
+		sceneDescriptorSet = frame.AllocateDescriptorSet(descriptorLayout);
+		WriteSceneDescriptorSet(sceneDescriptorSet, uniform);
+	}
 
-		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	void WriteSceneDescriptorSet(VkDescriptorSet set, const FrameContext::Uniform& uniform)
+	{
+		VkDescriptorBufferInfo bufferInfo = {};
+		bufferInfo.buffer = uniform.buffer;
+		bufferInfo.offset = uniform.offset;
+		bufferInfo.range = sizeof(UniformBufferObject);
+
+		VkDescriptorImageInfo imageInfo = {};
+		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfo.imageView = textureImageView;
+		imageInfo.sampler = textureSampler;
+
+		// 按着色器里的变量名找binding，着色器调整binding编号时这里不需要修改
+		std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+		descriptorWrites[0] = MakeBufferWrite(set, sceneInterface.FindBinding(0, "ubo"),
+			VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &bufferInfo);
+		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[1].dstSet = set;
+		descriptorWrites[1].dstBinding = sceneInterface.FindBinding(0, "texSampler");
+		descriptorWrites[1].dstArrayElement = 0;
+		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[1].descriptorCount = 1;
+		descriptorWrites[1].pImageInfo = &imageInfo;
+		vkUpdateDescriptorSets(vkDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
 
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+	static VkWriteDescriptorSet MakeBufferWrite(VkDescriptorSet set, uint32_t binding, VkDescriptorType type,
+		const VkDescriptorBufferInfo* bufferInfo)
+	{
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = set;
+		write.dstBinding = binding;
+		write.dstArrayElement = 0;
+		write.descriptorType = type;
+		write.descriptorCount = 1;
+		write.pBufferInfo = bufferInfo;
+		return write;
+	}
 
-		VkBuffer vertexBuffers[] = { vertexBuffer };
-		VkDeviceSize offsetes[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsetes);
-		vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+	static VkWriteDescriptorSet MakeImageWrite(VkDescriptorSet set, uint32_t binding, VkDescriptorType type,
+		const VkDescriptorImageInfo* imageInfo)
+	{
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = set;
+		write.dstBinding = binding;
+		write.dstArrayElement = 0;
+		write.descriptorType = type;
+		write.descriptorCount = 1;
+		write.pImageInfo = imageInfo;
+		return write;
+	}
 
-		VkViewport viewport{};
-		viewport.x = 0.0f;
-		viewport.y = 0.0f;
-		viewport.width = (float)vkSwapChainExtent.width;
-		viewport.height = (float)vkSwapChainExtent.height;
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 1.0f;
-		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	void CreateOcclusionCulling()
+	{
+		VkSamplerCreateInfo samplerInfo = {};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.magFilter = VK_FILTER_NEAREST;
+		samplerInfo.minFilter = VK_FILTER_NEAREST;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.minLod = 0.0f;
+		samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+		if (vkCreateSampler(vkDevice, &samplerInfo, nullptr, &hizSampler) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create hi-z sampler");
+		}
 
-		VkRect2D scissor{};
-		scissor.offset = { 0, 0 };
-		scissor.extent = vkSwapChainExtent;
-		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+		uint32_t objectCount = (uint32_t)objectPositions.size();
+		VkDeviceSize drawBufferSize = sizeof(VkDrawIndexedIndirectCommand) * objectCount;
 
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[imageIndex],
-			0, nullptr);
+		// 剔除在异步计算队列上运行，这些缓冲两个队列都会使用
+		CreateBufferWithData(objectAabbs.data(), sizeof(ObjectBounds) * objectCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			objectBoundsBuffer, objectBoundsBufferMemory, true);
+		CreateBuffer(sizeof(uint32_t) * objectCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, objectVisibilityBuffer, objectVisibilityBufferMemory, true);
+		CreateBuffer(drawBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, earlyDrawBuffer, earlyDrawBufferMemory, true);
+		CreateBuffer(drawBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, lateDrawBuffer, lateDrawBufferMemory, true);
+
+		// 第一帧没有上一帧的可见性，全部交给第二阶段
+		VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+		resourceStates->UseBuffer(objectVisibilityBuffer, VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+		resourceStates->Flush(commandBuffer);
+		vkCmdFillBuffer(commandBuffer, objectVisibilityBuffer, 0, VK_WHOLE_SIZE, 0);
+		EndSingleTimeCommands(commandBuffer);
+
+		size_t frameCount = options.framesInFlight;
+		cullGlobalsBuffers.resize(frameCount);
+		cullGlobalsBuffersMemory.resize(frameCount);
+		cullGlobalsBuffersMapped.resize(frameCount);
+		objectTransformBuffers.resize(frameCount);
+		objectTransformBuffersMemory.resize(frameCount);
+		objectTransformBuffersMapped.resize(frameCount);
+		for (size_t i = 0; i < frameCount; i++)
+		{
+			CreateBuffer(sizeof(CullGlobals), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cullGlobalsBuffers[i], cullGlobalsBuffersMemory[i]);
+			vkMapMemory(vkDevice, cullGlobalsBuffersMemory[i], 0, sizeof(CullGlobals), 0, &cullGlobalsBuffersMapped[i]);
+
+			VkDeviceSize transformSize = sizeof(glm::mat4) * objectCount;
+			CreateBuffer(transformSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, objectTransformBuffers[i], objectTransformBuffersMemory[i]);
+			vkMapMemory(vkDevice, objectTransformBuffersMemory[i], 0, transformSize, 0, &objectTransformBuffersMapped[i]);
+		}
 
-		vkCmdDrawIndexed(commandBuffer, indices.size(), 1, 0, 0, 0);
+		ShaderInterface indirectInterface = ReflectShaders({ SHADER_DIR"sceneIndirect.vert.spv", SHADER_DIR"frag.spv" });
+		ShaderInterface cullInterface = ReflectShaders({ SHADER_DIR"occlusionCull.comp.spv" });
+		ShaderInterface hizInterface = ReflectShaders({ SHADER_DIR"hizDownsample.comp.spv" });
+		indirectDescriptorLayout = layoutCache->GetSetLayout(indirectInterface.Bindings(0));
+		cullDescriptorLayout = layoutCache->GetSetLayout(cullInterface.Bindings(0));
+		hizDescriptorLayout = layoutCache->GetSetLayout(hizInterface.Bindings(0));
+
+		indirectPipelineLayout = layoutCache->GetPipelineLayout(indirectInterface);
+		cullPipelineLayout = layoutCache->GetPipelineLayout(cullInterface);
+		hizPipelineLayout = layoutCache->GetPipelineLayout(hizInterface);
+
+		// 片元着色器与普通路径共用
+		pipelineRegistry->RegisterLayout("indirect", indirectPipelineLayout);
+		indirectDesc = SceneDesc({
+			{ VK_SHADER_STAGE_VERTEX_BIT, SHADER_DIR"sceneIndirect.vert.spv" },
+			{ VK_SHADER_STAGE_FRAGMENT_BIT, SHADER_DIR"frag.spv" },
+			}, "indirect");
+		indirectPipelineKey = pipelineRegistry->Request(indirectDesc);
+		cullPipeline = CreateComputePipeline(SHADER_DIR"occlusionCull.comp.spv", cullPipelineLayout);
+		hizPipeline = CreateComputePipeline(SHADER_DIR"hizDownsample.comp.spv", hizPipelineLayout);
+
+		std::array<VkDescriptorPoolSize, 3> poolSizes = {};
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		poolSizes[0].descriptorCount = (uint32_t)frameCount;
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		poolSizes[1].descriptorCount = (uint32_t)frameCount;
+		poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		poolSizes[2].descriptorCount = (uint32_t)frameCount;
 
-		vkCmdEndRenderPass(commandBuffer);
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = poolSizes.size();
+		poolInfo.pPoolSizes = poolSizes.data();
+		poolInfo.maxSets = (uint32_t)frameCount;
+		if (vkCreateDescriptorPool(vkDevice, &poolInfo, nullptr, &occlusionDescriptorPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create occlusion descriptor pool");
+		}
 
-		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-			throw std::runtime_error("failed to record command buffer!");
+		// cull描述符集引用Hi-Z图像，和它一起在CreateHiZResources中分配
+		indirectDescriptorSets = AllocateDescriptorSets(occlusionDescriptorPool, indirectDescriptorLayout, (uint32_t)frameCount);
+		for (size_t i = 0; i < frameCount; i++)
+		{
+			VkDescriptorBufferInfo globalsInfo = { cullGlobalsBuffers[i], 0, sizeof(CullGlobals) };
+			VkDescriptorBufferInfo transformInfo = { objectTransformBuffers[i], 0, VK_WHOLE_SIZE };
+			VkDescriptorImageInfo textureInfo = { textureSampler, textureImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+			std::array<VkWriteDescriptorSet, 3> writes = {
+				MakeBufferWrite(indirectDescriptorSets[i], 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &globalsInfo),
+				MakeImageWrite(indirectDescriptorSets[i], 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &textureInfo),
+				MakeBufferWrite(indirectDescriptorSets[i], 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &transformInfo),
+			};
+			vkUpdateDescriptorSets(vkDevice, (uint32_t)writes.size(), writes.data(), 0, nullptr);
 		}
+
+		CreateHiZResources();
+
+		std::cout << "succeed to create hi-z occlusion culling" << std::endl;
 	}
 
-	void CreateDepthResources()
+	std::vector<VkDescriptorSet> AllocateDescriptorSets(VkDescriptorPool pool, VkDescriptorSetLayout layout, uint32_t count)
 	{
-		VkFormat depthFormat = VK_FORMAT_D32_SFLOAT_S8_UINT;
-		CreateImage(vkSwapChainExtent.width, vkSwapChainExtent.height, depthFormat,
-			VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			depthImage, depthImageMemory);
-		depthImageView = CreateImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
-		TransitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+		std::vector<VkDescriptorSetLayout> layouts(count, layout);
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = pool;
+		allocInfo.descriptorSetCount = count;
+		allocInfo.pSetLayouts = layouts.data();
 
+		std::vector<VkDescriptorSet> sets(count);
+		if (vkAllocateDescriptorSets(vkDevice, &allocInfo, sets.data()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to allocate descriptor sets");
+		}
+		return sets;
 	}
 
-	void CreateSyncObjects()
+	void CreateHiZResources()
 	{
-		imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-		renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-		inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+		// Hi-Z第0级是深度缓冲的一半，每一级保存覆盖区域内最远的深度
+		hizExtent.width = std::max(1u, vkSwapChainExtent.width / 2);
+		hizExtent.height = std::max(1u, vkSwapChainExtent.height / 2);
+		hizMipLevels = (uint32_t)std::floor(std::log2((float)std::max(hizExtent.width, hizExtent.height))) + 1;
+
+		CreateImage(hizExtent.width, hizExtent.height, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			hizImage, hizImageMemory, hizMipLevels);
+		hizImageView = CreateImageView(hizImage, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 0, hizMipLevels);
+		hizMipViews.resize(hizMipLevels);
+		for (uint32_t level = 0; level < hizMipLevels; level++)
+		{
+			hizMipViews[level] = CreateImageView(hizImage, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, level, 1);
+		}
+		// 布局转换在下一帧的命令缓冲里完成(BuildHiZ)，不用在resize时等待队列
+		resourceStates->AddImage(hizImage, VK_IMAGE_ASPECT_COLOR_BIT, hizMipLevels, 1);
+
+		// 旧的描述符集可能还被在途的帧使用，所以每次都从新的pool分配
+		std::array<VkDescriptorPoolSize, 4> poolSizes = {};
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		poolSizes[0].descriptorCount = hizMipLevels + options.framesInFlight;
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		poolSizes[1].descriptorCount = hizMipLevels;
+		poolSizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		poolSizes[2].descriptorCount = options.framesInFlight;
+		poolSizes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		poolSizes[3].descriptorCount = options.framesInFlight * 4;
 
-		VkSemaphoreCreateInfo semaphoreInfo = {};
-		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = poolSizes.size();
+		poolInfo.pPoolSizes = poolSizes.data();
+		poolInfo.maxSets = hizMipLevels + options.framesInFlight;
+		if (vkCreateDescriptorPool(vkDevice, &poolInfo, nullptr, &hizDescriptorPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create hi-z descriptor pool");
+		}
 
-		VkFenceCreateInfo fenceInfo{};
-		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		hizDescriptorSets = AllocateDescriptorSets(hizDescriptorPool, hizDescriptorLayout, hizMipLevels);
+		for (uint32_t level = 0; level < hizMipLevels; level++)
+		{
+			VkDescriptorImageInfo srcInfo = {};
+			srcInfo.sampler = hizSampler;
+			srcInfo.imageView = level == 0 ? depthImageView : hizMipViews[level - 1];
+			srcInfo.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+			VkDescriptorImageInfo dstInfo = {};
+			dstInfo.imageView = hizMipViews[level];
+			dstInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+			std::array<VkWriteDescriptorSet, 2> writes = {
+				MakeImageWrite(hizDescriptorSets[level], 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &srcInfo),
+				MakeImageWrite(hizDescriptorSets[level], 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &dstInfo),
+			};
+			vkUpdateDescriptorSets(vkDevice, (uint32_t)writes.size(), writes.data(), 0, nullptr);
+		}
 
-		for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		cullDescriptorSets = AllocateDescriptorSets(hizDescriptorPool, cullDescriptorLayout, options.framesInFlight);
+		for (size_t i = 0; i < options.framesInFlight; i++)
 		{
-			if (vkCreateSemaphore(vkDevice, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-				vkCreateSemaphore(vkDevice, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-				vkCreateFence(vkDevice, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS)
-			{
-				throw std::runtime_error("fail to create sync obj for a frame");
-			}
+			VkDescriptorBufferInfo globalsInfo = { cullGlobalsBuffers[i], 0, sizeof(CullGlobals) };
+			VkDescriptorBufferInfo boundsInfo = { objectBoundsBuffer, 0, VK_WHOLE_SIZE };
+			VkDescriptorBufferInfo visibilityInfo = { objectVisibilityBuffer, 0, VK_WHOLE_SIZE };
+			VkDescriptorBufferInfo earlyDrawInfo = { earlyDrawBuffer, 0, VK_WHOLE_SIZE };
+			VkDescriptorBufferInfo lateDrawInfo = { lateDrawBuffer, 0, VK_WHOLE_SIZE };
+			VkDescriptorImageInfo hizInfo = { hizSampler, hizImageView, VK_IMAGE_LAYOUT_GENERAL };
+
+			std::array<VkWriteDescriptorSet, 6> writes = {
+				MakeBufferWrite(cullDescriptorSets[i], 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &globalsInfo),
+				MakeBufferWrite(cullDescriptorSets[i], 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &boundsInfo),
+				MakeBufferWrite(cullDescriptorSets[i], 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &visibilityInfo),
+				MakeBufferWrite(cullDescriptorSets[i], 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &earlyDrawInfo),
+				MakeBufferWrite(cullDescriptorSets[i], 4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &lateDrawInfo),
+				MakeImageWrite(cullDescriptorSets[i], 5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &hizInfo),
+			};
+			vkUpdateDescriptorSets(vkDevice, (uint32_t)writes.size(), writes.data(), 0, nullptr);
 		}
 	}
 
-	void DrawFrame()
+	void CleanupHiZResources()
 	{
-		vkWaitForFences(vkDevice, 1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+		uint64_t lastUse = timeline->LastSubmitted();
+		resourceStates->RemoveImage(hizImage);
+		deletionQueue.Push(lastUse, vkDevice, hizDescriptorPool);
+		for (auto mipView : hizMipViews)
+		{
+			deletionQueue.Push(lastUse, vkDevice, mipView);
+		}
+		deletionQueue.Push(lastUse, vkDevice, hizImageView);
+		deletionQueue.Push(lastUse, vkDevice, hizImage);
+		deletionQueue.Push(lastUse, vkDevice, hizImageMemory);
+	}
 
-		uint32_t imageIndex;
-		VkResult result = vkAcquireNextImageKHR(vkDevice, vkSwapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+	void CleanupOcclusionCulling()
+	{
+		vkDestroyPipeline(vkDevice, cullPipeline, nullptr);
+		vkDestroyPipeline(vkDevice, hizPipeline, nullptr);
+		vkDestroyDescriptorPool(vkDevice, occlusionDescriptorPool, nullptr);
 
-		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-			ReCreateSwapChain();
-			return;
+		for (size_t i = 0; i < cullGlobalsBuffers.size(); i++)
+		{
+			vkDestroyBuffer(vkDevice, cullGlobalsBuffers[i], nullptr);
+			vkFreeMemory(vkDevice, cullGlobalsBuffersMemory[i], nullptr);
+			vkDestroyBuffer(vkDevice, objectTransformBuffers[i], nullptr);
+			vkFreeMemory(vkDevice, objectTransformBuffersMemory[i], nullptr);
 		}
-		else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+		vkDestroyBuffer(vkDevice, objectBoundsBuffer, nullptr);
+		vkFreeMemory(vkDevice, objectBoundsBufferMemory, nullptr);
+		resourceStates->RemoveBuffer(objectVisibilityBuffer);
+		resourceStates->RemoveBuffer(earlyDrawBuffer);
+		resourceStates->RemoveBuffer(lateDrawBuffer);
+		vkDestroyBuffer(vkDevice, objectVisibilityBuffer, nullptr);
+		vkFreeMemory(vkDevice, objectVisibilityBufferMemory, nullptr);
+		vkDestroyBuffer(vkDevice, earlyDrawBuffer, nullptr);
+		vkFreeMemory(vkDevice, earlyDrawBufferMemory, nullptr);
+		vkDestroyBuffer(vkDevice, lateDrawBuffer, nullptr);
+		vkFreeMemory(vkDevice, lateDrawBufferMemory, nullptr);
+
+		vkDestroySampler(vkDevice, hizSampler, nullptr);
+	}
+
+	void UpdateOcclusionBuffers(uint32_t frameIndex, const glm::mat4& view, const glm::mat4& proj, const Frustum& frustum,
+		const std::vector<glm::mat4>& transforms)
+	{
+		CullGlobals globals = {};
+		globals.view = view;
+		globals.proj = proj;
+		globals.viewProj = proj * view;
+		for (int i = 0; i < 6; i++)
 		{
-			throw std::runtime_error("fail to acquire swap chain image");
+			globals.frustum[i] = frustum.planes[i];
 		}
-		
-		UpdateUniformBuffer(imageIndex);
+		globals.hizParams = glm::vec4((float)vkSwapChainExtent.width, (float)vkSwapChainExtent.height, (float)hizMipLevels, 0.0f);
+		globals.objectCount = (uint32_t)objectPositions.size();
+		globals.indexCount = (uint32_t)indices.size();
+		memcpy(cullGlobalsBuffersMapped[frameIndex], &globals, sizeof(globals));
 
-		vkResetFences(vkDevice, 1, &inFlightFences[currentFrame]);
+		memcpy(objectTransformBuffersMapped[frameIndex], transforms.data(), sizeof(glm::mat4) * transforms.size());
+	}
 
-		auto commandBuffer = commandBuffers[imageIndex];
-		vkResetCommandBuffer(commandBuffer, /*VkCommandBufferResetFlagBits*/ 0);
-		RecordCommandBuffer(commandBuffer, imageIndex);
+	void DispatchOcclusionCull(VkCommandBuffer commandBuffer, uint32_t late)
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullDescriptorSets[currentFrame],
+			0, nullptr);
+		vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(late), &late);
+		vkCmdDispatch(commandBuffer, ((uint32_t)objectPositions.size() + 63) / 64, 1, 1);
+	}
 
-		VkSubmitInfo submitInfo = {};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	void DrawIndirectScene(VkCommandBuffer commandBuffer, VkBuffer drawBuffer)
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, indirectPipeline);
+		dynamicState->Apply(commandBuffer, indirectDesc);
 
-		VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame]};
-		VkPipelineStageFlags waitStages[] = {
-			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
-		};
-		submitInfo.waitSemaphoreCount = 1;
-		submitInfo.pWaitSemaphores = waitSemaphores;
-		submitInfo.pWaitDstStageMask = waitStages;
+		VkBuffer vertexBuffers[] = { vertexBuffer };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, indirectPipelineLayout, 0, 1,
+			&indirectDescriptorSets[currentFrame], 0, nullptr);
 
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+		vkCmdDrawIndexedIndirect(commandBuffer, drawBuffer, 0, (uint32_t)objectPositions.size(), sizeof(VkDrawIndexedIndirectCommand));
+	}
 
-		VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame]};
-		submitInfo.signalSemaphoreCount = 1;
-		submitInfo.pSignalSemaphores = signalSemaphores;
+	void BuildHiZ(VkCommandBuffer commandBuffer)
+	{
+		// 每一级读上一级，只等刚写完的那一级。第0级读深度，帧图在pass开始前已经声明
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hizPipeline);
 
-		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS)
+		VkExtent2D srcExtent = vkSwapChainExtent;
+		for (uint32_t level = 0; level < hizMipLevels; level++)
 		{
-			throw std::runtime_error("fail to submit draw command buffer!");
-		}
-
-		VkPresentInfoKHR presentInfo = {};
-		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-		presentInfo.waitSemaphoreCount = 1;
-		presentInfo.pWaitSemaphores = signalSemaphores;
-		
-		VkSwapchainKHR swapChains[] = { vkSwapChain };
-		presentInfo.pSwapchains = swapChains;
-		presentInfo.pImageIndices = &imageIndex;
-		presentInfo.swapchainCount = 1;
+			VkExtent2D dstExtent = { std::max(1u, hizExtent.width >> level), std::max(1u, hizExtent.height >> level) };
+			glm::ivec4 sizes((int)srcExtent.width, (int)srcExtent.height, (int)dstExtent.width, (int)dstExtent.height);
 
-		presentInfo.pResults = nullptr;
-	
-		result = vkQueuePresentKHR(presentQueue, &presentInfo);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hizPipelineLayout, 0, 1, &hizDescriptorSets[level],
+				0, nullptr);
+			vkCmdPushConstants(commandBuffer, hizPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sizes), &sizes);
+			if (level > 0)
+			{
+				resourceStates->UseImage(hizImage, ImageRange{ level - 1, 1 }, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+					VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+				resourceStates->UseImage(hizImage, ImageRange{ level, 1 }, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+					VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL);
+				resourceStates->Flush(commandBuffer);
+			}
+			vkCmdDispatch(commandBuffer, (dstExtent.width + 7) / 8, (dstExtent.height + 7) / 8, 1);
 
-		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
-			framebufferResized = false;
-			ReCreateSwapChain();
-		}
-		else if (result != VK_SUCCESS) {
-			throw std::runtime_error("failed to present swap chain image!");
+			srcExtent = dstExtent;
 		}
-
-		currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 	}
 
-	void CreateDescriptorSetLayout()
+	void CreateOcclusionQueries()
 	{
-		VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-		uboLayoutBinding.binding = 0;
-		uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		uboLayoutBinding.descriptorCount = 1;
-		uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-		uboLayoutBinding.pImmutableSamplers = nullptr;
-		
-		VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
-		samplerLayoutBinding.binding = 1;
-		samplerLayoutBinding.descriptorCount = 1;
-		samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		samplerLayoutBinding.pImmutableSamplers = nullptr;
-		samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-		
-		std::array<VkDescriptorSetLayoutBinding, 2> bindings = { uboLayoutBinding, samplerLayoutBinding };
+		vkCmdBeginConditionalRendering = LoadDeviceFunction<PFN_vkCmdBeginConditionalRenderingEXT>(vkDevice,
+			"vkCmdBeginConditionalRenderingEXT");
+		vkCmdEndConditionalRendering = LoadDeviceFunction<PFN_vkCmdEndConditionalRenderingEXT>(vkDevice,
+			"vkCmdEndConditionalRenderingEXT");
+
+		// 没有描述符，代理盒的变换通过push constant传入
+		proxyPipelineLayout = layoutCache->GetPipelineLayout(ReflectShaders({ SHADER_DIR"occlusionProxy.vert.spv" }));
+		pipelineRegistry->RegisterLayout("proxy", proxyPipelineLayout);
+		proxyDesc = SceneDesc({ { VK_SHADER_STAGE_VERTEX_BIT, SHADER_DIR"occlusionProxy.vert.spv" } }, "proxy");
+		proxyPipelineKey = pipelineRegistry->Request(proxyDesc);
+
+		// 第一帧还没有查询结果，所有物体都按可见处理
+		VkDeviceSize resultSize = sizeof(uint32_t) * objectPositions.size();
+		CreateBuffer(resultSize, VK_BUFFER_USAGE_CONDITIONAL_RENDERING_BIT_EXT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, occlusionResultBuffer, occlusionResultBufferMemory);
+		VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+		resourceStates->UseBuffer(occlusionResultBuffer, VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+		resourceStates->Flush(commandBuffer);
+		vkCmdFillBuffer(commandBuffer, occlusionResultBuffer, 0, VK_WHOLE_SIZE, 1);
+		EndSingleTimeCommands(commandBuffer);
 
-		VkDescriptorSetLayoutCreateInfo	layoutInfo = {};
-		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-		layoutInfo.bindingCount = bindings.size();
-		layoutInfo.pBindings = bindings.data();
+		CreateOcclusionQueryPools();
 
-		if (vkCreateDescriptorSetLayout(vkDevice, &layoutInfo, nullptr, &descriptorLayout) != VK_SUCCESS)
-		{
-			throw std::runtime_error("fail to create descriptor set layout");
-		}
-		else
+		std::cout << "succeed to create occlusion queries" << std::endl;
+	}
+
+	void CreateOcclusionQueryPools()
+	{
+		// 和FrameContext一样每个在途帧一份
+		VkQueryPoolCreateInfo queryPoolInfo = {};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_OCCLUSION;
+		queryPoolInfo.queryCount = (uint32_t)objectPositions.size();
+
+		occlusionQueryPools.resize(options.framesInFlight);
+		for (auto& queryPool : occlusionQueryPools)
 		{
-			std::cout << "succeed to create descriptor set layout" << std::endl;
+			if (vkCreateQueryPool(vkDevice, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS)
+			{
+				throw std::runtime_error("fail to create occlusion query pool");
+			}
 		}
 	}
 
-	void CreateUniformBuffer()
+	void CleanupOcclusionQueries()
 	{
-		VkDeviceSize bufferSize = sizeof(UniformBufferObject);
-
-		uniformBuffers.resize(vkSwapChainImages.size());
-		uniformBuffersMemory.resize(vkSwapChainImages.size());
-		uniformBuffersMapped.resize(vkSwapChainImages.size());
-
-		for (int i = 0; i < vkSwapChainImages.size(); i++)
+		for (auto queryPool : occlusionQueryPools)
 		{
-			CreateBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
-		
-			vkMapMemory(vkDevice, uniformBuffersMemory[i], 0, bufferSize, 0, &uniformBuffersMapped[i]);
+			vkDestroyQueryPool(vkDevice, queryPool, nullptr);
 		}
+		resourceStates->RemoveBuffer(occlusionResultBuffer);
+		vkDestroyBuffer(vkDevice, occlusionResultBuffer, nullptr);
+		vkFreeMemory(vkDevice, occlusionResultBufferMemory, nullptr);
 	}
 
-	void CreateDescriptorPool()
+	void BeginOcclusionQueries(VkCommandBuffer commandBuffer)
 	{
-		std::array<VkDescriptorPoolSize, 2> poolSizes = {};
-		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		poolSizes[0].descriptorCount = static_cast<uint32_t>(vkSwapChainImages.size());
-		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		poolSizes[1].descriptorCount = static_cast<uint32_t>(vkSwapChainImages.size());
+		vkCmdResetQueryPool(commandBuffer, occlusionQueryPools[currentFrame], 0, (uint32_t)objectPositions.size());
+	}
 
-		VkDescriptorPoolCreateInfo poolInfo = {};
-		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		poolInfo.poolSizeCount = poolSizes.size();
-		poolInfo.pPoolSizes = poolSizes.data();
-		poolInfo.maxSets = vkSwapChainImages.size();
-		
-		if (vkCreateDescriptorPool(vkDevice, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+	void DrawOcclusionProxies(VkCommandBuffer commandBuffer)
+	{
+		// 每个物体都要发出查询，否则复制时会等待一个永远不可用的结果
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, proxyPipeline);
+		dynamicState->Apply(commandBuffer, proxyDesc);
+		for (uint32_t i = 0; i < objectPositions.size(); i++)
 		{
-			throw std::runtime_error("fail to create descriptor pool");
-		}
-		else
-		{ 
-			std::cout << "succeed to create descriptor pool" << std::endl;
+			glm::vec3 boxMin(objectAabbs[i].aabbMin);
+			glm::vec3 boxMax(objectAabbs[i].aabbMax);
+			glm::mat4 boxToClip = sceneViewProj * glm::translate(glm::mat4(1.0f), boxMin) * glm::scale(glm::mat4(1.0f), boxMax - boxMin);
+
+			vkCmdPushConstants(commandBuffer, proxyPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(boxToClip), &boxToClip);
+			vkCmdBeginQuery(commandBuffer, occlusionQueryPools[currentFrame], i, 0);
+			vkCmdDraw(commandBuffer, 36, 1, 0, 0);
+			vkCmdEndQuery(commandBuffer, occlusionQueryPools[currentFrame], i);
 		}
 	}
 
-	void CreateDescriptorSets()
+	void CopyOcclusionResults(VkCommandBuffer commandBuffer)
 	{
-		std::vector<VkDescriptorSetLayout> layouts(vkSwapChainImages.size(), descriptorLayout);
-		VkDescriptorSetAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		allocInfo.descriptorPool = descriptorPool;
-		allocInfo.descriptorSetCount = vkSwapChainImages.size();
-		allocInfo.pSetLayouts = layouts.data();
+		// 下一帧再作为条件使用
+		vkCmdCopyQueryPoolResults(commandBuffer, occlusionQueryPools[currentFrame], 0, (uint32_t)objectPositions.size(),
+			occlusionResultBuffer, 0, sizeof(uint32_t), VK_QUERY_RESULT_WAIT_BIT);
+	}
+
+	void CreateMeshletResources()
+	{
+		vkCmdDrawMeshTasks = LoadDeviceFunction<PFN_vkCmdDrawMeshTasksEXT>(vkDevice, "vkCmdDrawMeshTasksEXT");
 
-		descriptorSets.resize(vkSwapChainImages.size());
-		if (vkAllocateDescriptorSets(vkDevice, &allocInfo, descriptorSets.data()) != VK_SUCCESS)
+		std::vector<glm::vec3> positions;
+		positions.reserve(vertices.size());
+		for (const auto& vertex : vertices)
 		{
-			throw std::runtime_error("fail to create descriptor sets");
+			positions.push_back(vertex.pos);
 		}
-		else
+		MeshletData meshlets = BuildMeshlets(positions, std::vector<uint32_t>(indices.begin(), indices.end()));
+		meshletCount = (uint32_t)meshlets.meshlets.size();
+
+		CreateBufferWithData(vertices.data(), sizeof(Vertex) * vertices.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			meshletVertexDataBuffer, meshletVertexDataBufferMemory);
+		CreateBufferWithData(meshlets.meshlets.data(), sizeof(Meshlet) * meshletCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			meshletBuffer, meshletBufferMemory);
+		CreateBufferWithData(meshlets.bounds.data(), sizeof(MeshletBounds) * meshletCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			meshletBoundsBuffer, meshletBoundsBufferMemory);
+		CreateBufferWithData(meshlets.vertices.data(), sizeof(uint32_t) * meshlets.vertices.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			meshletVerticesBuffer, meshletVerticesBufferMemory);
+		CreateBufferWithData(meshlets.triangles.data(), meshlets.triangles.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			meshletTrianglesBuffer, meshletTrianglesBufferMemory);
+
+		// set 1的布局来自meshlet.task和meshlet.mesh的反射结果(CreateDescriptorSetLayout)
+		meshletDescriptorLayout = layoutCache->GetSetLayout(meshletInterface.Bindings(1));
+
+		std::vector<VkDescriptorPoolSize> poolSizes = LayoutCache::PoolSizes(meshletInterface.Bindings(1), 1);
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = (uint32_t)poolSizes.size();
+		poolInfo.pPoolSizes = poolSizes.data();
+		poolInfo.maxSets = 1;
+		if (vkCreateDescriptorPool(vkDevice, &poolInfo, nullptr, &meshletDescriptorPool) != VK_SUCCESS)
 		{
-			std::cout << "succeed to create descriptor sets" << std::endl;
+			throw std::runtime_error("fail to create meshlet descriptor pool");
 		}
-
-		for (int i = 0; i < vkSwapChainImages.size(); i++)
+		meshletDescriptorSet = AllocateDescriptorSets(meshletDescriptorPool, meshletDescriptorLayout, 1)[0];
+
+		std::array<VkDescriptorBufferInfo, 5> bufferInfos = { {
+			{ meshletVertexDataBuffer, 0, VK_WHOLE_SIZE },
+			{ meshletBuffer, 0, VK_WHOLE_SIZE },
+			{ meshletBoundsBuffer, 0, VK_WHOLE_SIZE },
+			{ meshletVerticesBuffer, 0, VK_WHOLE_SIZE },
+			{ meshletTrianglesBuffer, 0, VK_WHOLE_SIZE },
+		} };
+		std::array<VkWriteDescriptorSet, 5> writes;
+		for (uint32_t i = 0; i < writes.size(); i++)
 		{
-			VkDescriptorBufferInfo bufferInfo = {};
-			bufferInfo.buffer = uniformBuffers[i];
-			bufferInfo.offset = 0;
-			bufferInfo.range = sizeof(UniformBufferObject);
-
-			VkDescriptorImageInfo imageInfo = {};
-			imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			imageInfo.imageView = textureImageView;
-			imageInfo.sampler = textureSampler;
-			std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+			writes[i] = MakeBufferWrite(meshletDescriptorSet, i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &bufferInfos[i]);
+		}
+		vkUpdateDescriptorSets(vkDevice, (uint32_t)writes.size(), writes.data(), 0, nullptr);
 
-			descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descriptorWrites[0].dstSet = descriptorSets[i];
-			descriptorWrites[0].dstBinding = 0;
-			descriptorWrites[0].dstArrayElement = 0;
-			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			descriptorWrites[0].descriptorCount = 1;
-			descriptorWrites[0].pBufferInfo = &bufferInfo;
+		// set 0与顶点路径共用同一个布局对象，每个物体的矩阵仍然通过动态偏移绑定
+		meshletPipelineLayout = layoutCache->GetPipelineLayout(meshletInterface);
 
-			descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descriptorWrites[1].dstSet = descriptorSets[i];
-			descriptorWrites[1].dstBinding = 1;
-			descriptorWrites[1].dstArrayElement = 0;
-			descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-			descriptorWrites[1].descriptorCount = 1;
-			descriptorWrites[1].pImageInfo = &imageInfo;
+		pipelineRegistry->RegisterLayout("meshlet", meshletPipelineLayout);
+		meshletDesc = SceneDesc({
+			{ VK_SHADER_STAGE_TASK_BIT_EXT, SHADER_DIR"meshlet.task.spv" },
+			{ VK_SHADER_STAGE_MESH_BIT_EXT, SHADER_DIR"meshlet.mesh.spv" },
+			{ VK_SHADER_STAGE_FRAGMENT_BIT, SHADER_DIR"frag.spv" },
+			}, "meshlet");
+		meshletPipelineKey = pipelineRegistry->Request(meshletDesc);
 
-			vkUpdateDescriptorSets(vkDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
-		}
+		std::cout << "succeed to create mesh shading path with " << meshletCount << " meshlets" << std::endl;
 	}
 
-	void UpdateUniformBuffer(uint32_t currentImage)
+	void CleanupMeshletResources()
 	{
-		static auto startTime = std::chrono::high_resolution_clock::now();
-
-		auto currentTime = std::chrono::high_resolution_clock::now();
-		float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+		vkDestroyDescriptorPool(vkDevice, meshletDescriptorPool, nullptr);
+
+		vkDestroyBuffer(vkDevice, meshletVertexDataBuffer, nullptr);
+		vkFreeMemory(vkDevice, meshletVertexDataBufferMemory, nullptr);
+		vkDestroyBuffer(vkDevice, meshletBuffer, nullptr);
+		vkFreeMemory(vkDevice, meshletBufferMemory, nullptr);
+		vkDestroyBuffer(vkDevice, meshletBoundsBuffer, nullptr);
+		vkFreeMemory(vkDevice, meshletBoundsBufferMemory, nullptr);
+		vkDestroyBuffer(vkDevice, meshletVerticesBuffer, nullptr);
+		vkFreeMemory(vkDevice, meshletVerticesBufferMemory, nullptr);
+		vkDestroyBuffer(vkDevice, meshletTrianglesBuffer, nullptr);
+		vkFreeMemory(vkDevice, meshletTrianglesBufferMemory, nullptr);
+	}
 
-		UniformBufferObject ubo{};
-		ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		ubo.proj = glm::perspective(glm::radians(45.0f), vkSwapChainExtent.width / (float)vkSwapChainExtent.height, 0.1f, 10.0f);
-		ubo.proj[1][1] *= -1;
+	void BindMeshletPipeline(VkCommandBuffer commandBuffer, DynamicStateTracker& tracker)
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshletPipeline);
+		tracker.Apply(commandBuffer, meshletDesc);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshletPipelineLayout, 1, 1, &meshletDescriptorSet,
+			0, nullptr);
 
-		memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+		MeshletCullConstants constants = {};
+		for (int i = 0; i < 6; i++)
+		{
+			constants.frustum[i] = sceneFrustum.planes[i];
+		}
+		constants.cameraPosition = cameraPosition;
+		constants.meshletCount = meshletCount;
+		vkCmdPushConstants(commandBuffer, meshletPipelineLayout, VK_SHADER_STAGE_TASK_BIT_EXT, 0, sizeof(constants), &constants);
 	}
 
 	void ReCreateSwapChain()
 	{
 		int width = 0, height = 0;
-		glfwGetFramebufferSize(window, &width, &height);
+		GetFramebufferSize(width, height);
 		while (width == 0 || height == 0) 
 		{
-			glfwGetFramebufferSize(window, &width, &height);
-			glfwWaitEvents();
+			// 最小化时等待，渲染线程不能处理事件，只能等主线程更新尺寸
+			if (!options.renderThread)
+			{
+				glfwWaitEvents();
+			}
+			else if (threadsStopping)
+			{
+				return;
+			}
+			else
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+			GetFramebufferSize(width, height);
 		}
 
-		vkDeviceWaitIdle(vkDevice);
+		auto start = std::chrono::high_resolution_clock::now();
 
+		// 只重建和尺寸有关的图像：动态渲染没有render pass和framebuffer，pipeline的viewport和scissor是动态状态，
+		// 命令缓冲和uniform按在途帧分配，都不需要重建。旧对象交给deletionQueue，不等待设备空闲
 		CleanupSwapChain();
 
-		CreateSwapChain();
+		VkSwapchainKHR oldSwapChain = vkSwapChain;
+		VkFormat oldFormat = vkSwapChainImageFormat;
+		CreateSwapChain(oldSwapChain);
+		framePacer->SetSwapchain(vkSwapChain);
+		deletionQueue.Push(timeline->LastSubmitted(), vkDevice, oldSwapChain);
+		if (vkSwapChainImageFormat != oldFormat)
+		{
+			throw std::runtime_error("swap chain format changed, pipelines were built for the old format");
+		}
+
 		CreateImageViews();
-		CreateRenderPass();
-		CreateGraphicsPipeline();
-		CreateDepthResources();
-		CreateFramebuffers();
-		CreateCommandBuffers();
+		BuildFrameGraph();
+		sceneVersion++;
+
+		if (options.occlusion == OcclusionMode::HiZ)
+		{
+			CreateHiZResources();
+		}
+
+		resizeTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
 	}
 
+	// 交换链尺寸相关的对象可能还被在途的帧使用，推迟到这些帧完成后再销毁
 	void CleanupSwapChain()
 	{
-		vkDestroySwapchainKHR(vkDevice, vkSwapChain, nullptr);
-
+		for (VkImage image : vkSwapChainImages)
+		{
+			resourceStates->RemoveImage(image);
+		}
 		for (auto imageView : vkSwapChainImageViews)
 		{
-			vkDestroyImageView(vkDevice, imageView, nullptr);
+			deletionQueue.Push(timeline->LastSubmitted(), vkDevice, imageView);
 		}
+		// 帧图的临时图像和内存随它一起销毁
+		std::shared_ptr<RenderGraph> graph = std::move(frameGraph);
+		deletionQueue.Push(timeline->LastSubmitted(), [=]() mutable { graph.reset(); });
 
-		vkDestroyImageView(vkDevice, depthImageView, nullptr);
-		vkDestroyImage(vkDevice, depthImage, nullptr);
-		vkFreeMemory(vkDevice, depthImageMemory, nullptr);
-
-		vkFreeCommandBuffers(vkDevice, commandPool, commandBuffers.size(), commandBuffers.data());
-		vkDestroyPipeline(vkDevice, graphicsPipeline, nullptr);
-		vkDestroyPipelineLayout(vkDevice, pipelineLayout, nullptr);
-		vkDestroyRenderPass(vkDevice, renderPass, nullptr);
-		
-		for (auto framebuffer : swapChainFramebuffers)
+		if (options.occlusion == OcclusionMode::HiZ)
 		{
-			vkDestroyFramebuffer(vkDevice, framebuffer, nullptr);
+			CleanupHiZResources();
 		}
 	}
 };
 
-int main()
+static AppOptions ParseOptions(int argc, char** argv)
+{
+	AppOptions options;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--objects" && i + 1 < argc)
+		{
+			options.objectCount = std::max(1, std::stoi(argv[++i]));
+		}
+		else if (arg == "--occlusion" && i + 1 < argc)
+		{
+			std::string mode = argv[++i];
+			if (mode == "none")
+			{
+				options.occlusion = OcclusionMode::None;
+			}
+			else if (mode == "hiz")
+			{
+				options.occlusion = OcclusionMode::HiZ;
+			}
+			else if (mode == "queries")
+			{
+				options.occlusion = OcclusionMode::Queries;
+			}
+			else
+			{
+				throw std::runtime_error("unknown occlusion mode " + mode);
+			}
+		}
+		else if (arg == "--overdraw" && i + 1 < argc)
+		{
+			options.overdrawLayers = std::max(1, std::stoi(argv[++i]));
+		}
+		else if (arg == "--pipeline-cache" && i + 1 < argc)
+		{
+			options.pipelineCachePath = argv[++i];
+		}
+		else if (arg == "--pipeline-keys" && i + 1 < argc)
+		{
+			options.pipelineKeysPath = argv[++i];
+		}
+		else if (arg == "--bench-resize" && i + 1 < argc)
+		{
+			options.benchResizeCount = std::max(1, std::stoi(argv[++i]));
+		}
+		else if (arg == "--features" && i + 1 < argc)
+		{
+			std::string features = argv[++i];
+			if (!ShaderFeatures::Parse(features, options.shaderFeatures))
+			{
+				throw std::runtime_error("unknown shader features " + features);
+			}
+		}
+		else if (arg == "--bench-variants")
+		{
+			options.benchVariants = true;
+		}
+		else if (arg == "--shader-objects")
+		{
+			options.shaderObjects = true;
+		}
+		else if (arg == "--bench-draw")
+		{
+			options.benchDraw = true;
+		}
+		else if (arg == "--frames-in-flight" && i + 1 < argc)
+		{
+			options.framesInFlight = (uint32_t)std::min(std::max(1, std::stoi(argv[++i])), MAX_FRAMES_IN_FLIGHT);
+		}
+		else if (arg == "--no-pipeline-library")
+		{
+			options.pipelineLibrary = false;
+		}
+		else if (arg == "--no-dynamic-state")
+		{
+			options.dynamicState = false;
+		}
+		else if (arg == "--no-draw-sort")
+		{
+			options.sortDraws = false;
+		}
+		else if (arg == "--bench-sort")
+		{
+			options.benchSort = true;
+		}
+		else if (arg == "--record-threads" && i + 1 < argc)
+		{
+			options.recordThreads = (uint32_t)std::max(1, std::stoi(argv[++i]));
+		}
+		else if (arg == "--bench-record")
+		{
+			options.benchRecord = true;
+		}
+		else if (arg == "--cache-commands")
+		{
+			options.cacheCommands = true;
+		}
+		else if (arg == "--present-mode" && i + 1 < argc)
+		{
+			std::string mode = argv[++i];
+			if (mode == "fifo")
+			{
+				options.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+			}
+			else if (mode == "fifo-relaxed")
+			{
+				options.presentMode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+			}
+			else if (mode == "mailbox")
+			{
+				options.presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+			}
+			else if (mode == "immediate")
+			{
+				options.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+			}
+			else
+			{
+				throw std::runtime_error("unknown present mode " + mode);
+			}
+		}
+		else if (arg == "--fps-limit" && i + 1 < argc)
+		{
+			options.fpsLimit = std::max(0.0, std::stod(argv[++i]));
+		}
+		else if (arg == "--no-present-wait")
+		{
+			options.presentWait = false;
+		}
+		else if (arg == "--latency-trace" && i + 1 < argc)
+		{
+			options.latencyTracePath = argv[++i];
+		}
+		else if (arg == "--dump-render-graph")
+		{
+			options.dumpRenderGraph = true;
+		}
+		else if (arg == "--no-async-compute")
+		{
+			options.asyncCompute = false;
+		}
+		else if (arg == "--render-thread")
+		{
+			options.renderThread = true;
+		}
+		else if (arg == "--mesh-shader")
+		{
+			options.meshShading = true;
+		}
+		else if (arg == "--stats")
+		{
+			options.showStats = true;
+		}
+		else if (arg == "--bench-culling")
+		{
+			options.benchCulling = true;
+		}
+		else if (arg == "--bench-meshlets")
+		{
+			options.benchMeshlets = true;
+		}
+		else
+		{
+			throw std::runtime_error("unknown option " + arg);
+		}
+	}
+	return options;
+}
+
+int main(int argc, char** argv)
 {
-	HelloTriangleApplication app;
 	try
 	{
+		AppOptions options = ParseOptions(argc, argv);
+		if (options.benchCulling)
+		{
+			RunCullingBenchmark(options.objectCount > 1 ? options.objectCount : 100000, 200);
+			return EXIT_SUCCESS;
+		}
+		if (options.benchMeshlets)
+		{
+			RunMeshletBenchmark(512);
+			return EXIT_SUCCESS;
+		}
+
+		HelloTriangleApplication app(options);
 		app.Run();
 	}
 	catch (const std::exception& e)
@@ -0,0 +1,110 @@
+#include "deletion_queue.h"
+
+void DeletionQueue::Push(uint64_t timelineValue, std::function<void()> deleter)
+{
+	entries.push_back({ timelineValue, VK_OBJECT_TYPE_UNKNOWN, VK_NULL_HANDLE, 0, 0, std::move(deleter) });
+}
+
+void DeletionQueue::Push(uint64_t timelineValue, VkDevice device, VkBuffer buffer)
+{
+	PushHandle(timelineValue, VK_OBJECT_TYPE_BUFFER, device, (uint64_t)buffer);
+}
+
+void DeletionQueue::Push(uint64_t timelineValue, VkDevice device, VkImage image)
+{
+	PushHandle(timelineValue, VK_OBJECT_TYPE_IMAGE, device, (uint64_t)image);
+}
+
+void DeletionQueue::Push(uint64_t timelineValue, VkDevice device, VkImageView imageView)
+{
+	PushHandle(timelineValue, VK_OBJECT_TYPE_IMAGE_VIEW, device, (uint64_t)imageView);
+}
+
+void DeletionQueue::Push(uint64_t timelineValue, VkDevice device, VkDeviceMemory memory)
+{
+	PushHandle(timelineValue, VK_OBJECT_TYPE_DEVICE_MEMORY, device, (uint64_t)memory);
+}
+
+void DeletionQueue::Push(uint64_t timelineValue, VkDevice device, VkPipeline pipeline)
+{
+	PushHandle(timelineValue, VK_OBJECT_TYPE_PIPELINE, device, (uint64_t)pipeline);
+}
+
+void DeletionQueue::Push(uint64_t timelineValue, VkDevice device, VkDescriptorPool descriptorPool)
+{
+	PushHandle(timelineValue, VK_OBJECT_TYPE_DESCRIPTOR_POOL, device, (uint64_t)descriptorPool);
+}
+
+void DeletionQueue::Push(uint64_t timelineValue, VkDevice device, VkSwapchainKHR swapchain)
+{
+	PushHandle(timelineValue, VK_OBJECT_TYPE_SWAPCHAIN_KHR, device, (uint64_t)swapchain);
+}
+
+void DeletionQueue::Push(uint64_t timelineValue, VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer)
+{
+	PushHandle(timelineValue, VK_OBJECT_TYPE_COMMAND_BUFFER, device, (uint64_t)commandBuffer, (uint64_t)commandPool);
+}
+
+void DeletionQueue::PushHandle(uint64_t timelineValue, VkObjectType type, VkDevice device, uint64_t handle, uint64_t owner)
+{
+	if (handle != 0)
+	{
+		entries.push_back({ timelineValue, type, device, handle, owner, nullptr });
+	}
+}
+
+void DeletionQueue::Destroy(Entry& entry)
+{
+	switch (entry.type)
+	{
+	case VK_OBJECT_TYPE_BUFFER:
+		vkDestroyBuffer(entry.device, (VkBuffer)entry.handle, nullptr);
+		break;
+	case VK_OBJECT_TYPE_IMAGE:
+		vkDestroyImage(entry.device, (VkImage)entry.handle, nullptr);
+		break;
+	case VK_OBJECT_TYPE_IMAGE_VIEW:
+		vkDestroyImageView(entry.device, (VkImageView)entry.handle, nullptr);
+		break;
+	case VK_OBJECT_TYPE_DEVICE_MEMORY:
+		vkFreeMemory(entry.device, (VkDeviceMemory)entry.handle, nullptr);
+		break;
+	case VK_OBJECT_TYPE_PIPELINE:
+		vkDestroyPipeline(entry.device, (VkPipeline)entry.handle, nullptr);
+		break;
+	case VK_OBJECT_TYPE_DESCRIPTOR_POOL:
+		vkDestroyDescriptorPool(entry.device, (VkDescriptorPool)entry.handle, nullptr);
+		break;
+	case VK_OBJECT_TYPE_SWAPCHAIN_KHR:
+		vkDestroySwapchainKHR(entry.device, (VkSwapchainKHR)entry.handle, nullptr);
+		break;
+	case VK_OBJECT_TYPE_COMMAND_BUFFER:
+	{
+		VkCommandBuffer commandBuffer = (VkCommandBuffer)entry.handle;
+		vkFreeCommandBuffers(entry.device, (VkCommandPool)entry.owner, 1, &commandBuffer);
+		break;
+	}
+	default:
+		entry.deleter();
+		break;
+	}
+}
+
+void DeletionQueue::Flush(uint64_t completedValue)
+{
+	// tags only grow, so the completed entries are always at the front
+	while (!entries.empty() && entries.front().timelineValue <= completedValue)
+	{
+		Destroy(entries.front());
+		entries.pop_front();
+	}
+}
+
+void DeletionQueue::FlushAll()
+{
+	while (!entries.empty())
+	{
+		Destroy(entries.front());
+		entries.pop_front();
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+// Defers destruction of GPU objects until the submissions that may still use them have finished.
+// Entries are tagged with GpuTimeline::LastSubmitted() when the object was retired and run once
+// the timeline has reached that value.
+//
+// Plain handles are stored as they are and destroyed with the matching vkDestroy or vkFree call,
+// anything else, e.g. an object that owns several handles, takes a deleter.
+class DeletionQueue
+{
+public:
+	void Push(uint64_t timelineValue, std::function<void()> deleter);
+	void Push(uint64_t timelineValue, VkDevice device, VkBuffer buffer);
+	void Push(uint64_t timelineValue, VkDevice device, VkImage image);
+	void Push(uint64_t timelineValue, VkDevice device, VkImageView imageView);
+	void Push(uint64_t timelineValue, VkDevice device, VkDeviceMemory memory);
+	void Push(uint64_t timelineValue, VkDevice device, VkPipeline pipeline);
+	void Push(uint64_t timelineValue, VkDevice device, VkDescriptorPool descriptorPool);
+	void Push(uint64_t timelineValue, VkDevice device, VkSwapchainKHR swapchain);
+	void Push(uint64_t timelineValue, VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer);
+
+	// runs every deleter tagged with a value <= completedValue, in push order
+	void Flush(uint64_t completedValue);
+	void FlushAll();
+
+	size_t Size() const { return entries.size(); }
+
+private:
+	struct Entry
+	{
+		uint64_t timelineValue;
+		VkObjectType type;
+		VkDevice device;
+		uint64_t handle;
+		// the command pool of a command buffer
+		uint64_t owner;
+		std::function<void()> deleter;
+	};
+
+	void PushHandle(uint64_t timelineValue, VkObjectType type, VkDevice device, uint64_t handle, uint64_t owner = 0);
+	static void Destroy(Entry& entry);
+
+	std::deque<Entry> entries;
+};
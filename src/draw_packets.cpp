@@ -0,0 +1,121 @@
+#include "draw_packets.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+namespace
+{
+	const uint32_t kRadixBuckets = 256;
+	// below this one thread sorts faster than handing chunks to the pool
+	const uint32_t kParallelThreshold = 16384;
+	const uint64_t kDepthMax = (1u << 24) - 1;
+	const uint32_t kIdMask = (1u << 12) - 1;
+}
+
+uint64_t MakeDrawSortKey(DrawPass pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth)
+{
+	uint64_t depthBits = (uint64_t)(std::min(std::max(depth, 0.0f), 1.0f) * kDepthMax);
+	uint64_t state = ((uint64_t)(pipeline & kIdMask) << 24) | ((uint64_t)(material & kIdMask) << 12) | (mesh & kIdMask);
+	uint64_t key = (uint64_t)((uint32_t)pass & 0xF) << 60;
+	if (pass == DrawPass::Translucent)
+	{
+		return key | ((kDepthMax - depthBits) << 36) | state;
+	}
+	return key | (state << 24) | depthBits;
+}
+
+void SortDrawPackets(std::vector<DrawPacket>& packets, std::vector<DrawPacket>& scratch, ThreadPool* pool)
+{
+	uint32_t count = (uint32_t)packets.size();
+	if (count < 2)
+	{
+		return;
+	}
+	scratch.resize(count);
+
+	uint32_t chunkCount = pool != nullptr && count >= kParallelThreshold ? pool->GetThreadCount() + 1 : 1;
+	uint32_t chunkSize = (count + chunkCount - 1) / chunkCount;
+	std::vector<uint32_t> histograms(chunkCount * kRadixBuckets);
+
+	auto forEachChunk = [&](const std::function<void(uint32_t chunk, uint32_t begin, uint32_t end)>& fn)
+	{
+		auto run = [&](uint32_t firstChunk, uint32_t lastChunk)
+		{
+			for (uint32_t chunk = firstChunk; chunk < lastChunk; chunk++)
+			{
+				uint32_t begin = std::min(chunk * chunkSize, count);
+				fn(chunk, begin, std::min(begin + chunkSize, count));
+			}
+		};
+		if (chunkCount == 1)
+		{
+			run(0, 1);
+		}
+		else
+		{
+			pool->ParallelFor(chunkCount, 1, 1, run);
+		}
+	};
+
+	DrawPacket* source = packets.data();
+	DrawPacket* target = scratch.data();
+	for (uint32_t shift = 0; shift < 64; shift += 8)
+	{
+		std::fill(histograms.begin(), histograms.end(), 0);
+		forEachChunk([&](uint32_t chunk, uint32_t begin, uint32_t end)
+			{
+				uint32_t* histogram = &histograms[chunk * kRadixBuckets];
+				for (uint32_t i = begin; i < end; i++)
+				{
+					histogram[(source[i].sortKey >> shift) & 0xFF]++;
+				}
+			});
+
+		// counts become each chunk's first slot in the bucket, earlier chunks first so the sort stays stable
+		bool sameByte = false;
+		uint32_t offset = 0;
+		for (uint32_t bucket = 0; bucket < kRadixBuckets && !sameByte; bucket++)
+		{
+			uint32_t bucketTotal = 0;
+			for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+			{
+				uint32_t& slot = histograms[chunk * kRadixBuckets + bucket];
+				uint32_t bucketCount = slot;
+				slot = offset;
+				offset += bucketCount;
+				bucketTotal += bucketCount;
+			}
+			sameByte = bucketTotal == count;
+		}
+		if (sameByte)
+		{
+			continue;
+		}
+
+		forEachChunk([&](uint32_t chunk, uint32_t begin, uint32_t end)
+			{
+				uint32_t* histogram = &histograms[chunk * kRadixBuckets];
+				for (uint32_t i = begin; i < end; i++)
+				{
+					target[histogram[(source[i].sortKey >> shift) & 0xFF]++] = source[i];
+				}
+			});
+		std::swap(source, target);
+	}
+
+	if (source != packets.data())
+	{
+		packets.swap(scratch);
+	}
+}
+
+DrawBindCounts& DrawBindCounts::operator+=(const DrawBindCounts& other)
+{
+	pipelines += other.pipelines;
+	vertexBuffers += other.vertexBuffers;
+	indexBuffers += other.indexBuffers;
+	descriptorSets += other.descriptorSets;
+	draws += other.draws;
+	return *this;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+enum class DrawPass : uint32_t
+{
+	Opaque = 0,
+	Translucent = 1,
+};
+
+// One draw, small enough that sorting a frame's worth of them is cheap. The recorder looks the
+// state up through state, and the per object data through objectIndex.
+struct DrawPacket
+{
+	uint64_t sortKey;
+	uint32_t objectIndex;
+	// index into the recorder's table of bind states
+	uint32_t state;
+};
+static_assert(sizeof(DrawPacket) == 16, "DrawPacket is meant to stay 16 bytes");
+
+// From the highest bits: pass (4), then for opaque draws pipeline (12), material (12), mesh (12)
+// and depth (24), so draws that share state are adjacent and go front to back within it.
+// Translucent draws put the inverted depth right after the pass, back to front comes first.
+// depth is in [0, 1], ids wrap at 4096.
+uint64_t MakeDrawSortKey(DrawPass pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth);
+
+// Stable LSD radix sort on sortKey, one pass per byte. Bytes that are the same in every key are
+// skipped, so the unused fields of a key cost nothing. scratch is resized as needed, the pool
+// splits histograms and scatters across its threads when there are enough packets.
+void SortDrawPackets(std::vector<DrawPacket>& packets, std::vector<DrawPacket>& scratch, ThreadPool* pool = nullptr);
+
+// what the recorder actually bound, for one frame or summed over several
+struct DrawBindCounts
+{
+	uint64_t pipelines = 0;
+	uint64_t vertexBuffers = 0;
+	uint64_t indexBuffers = 0;
+	uint64_t descriptorSets = 0;
+	uint64_t draws = 0;
+
+	uint64_t Binds() const { return pipelines + vertexBuffers + indexBuffers + descriptorSets; }
+	DrawBindCounts& operator+=(const DrawBindCounts& other);
+};
@@ -0,0 +1,192 @@
+#include "dynamic_state.h"
+#include "pipeline_registry.h"
+#include "vk_helpers.h"
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+	bool IsMeshPipeline(const GraphicsPipelineDesc& desc)
+	{
+		for (const auto& shader : desc.shaders)
+		{
+			if (shader.first == VK_SHADER_STAGE_MESH_BIT_EXT)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+std::vector<VkDynamicState> DynamicStatesOf(uint32_t groups, bool meshPipeline)
+{
+	std::vector<VkDynamicState> states;
+	if (HasDynamicState(groups, DynamicStateGroup::Extended))
+	{
+		states.insert(states.end(), {
+			VK_DYNAMIC_STATE_CULL_MODE,
+			VK_DYNAMIC_STATE_FRONT_FACE,
+			VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE,
+			VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE,
+			VK_DYNAMIC_STATE_DEPTH_COMPARE_OP,
+			VK_DYNAMIC_STATE_DEPTH_BOUNDS_TEST_ENABLE,
+			VK_DYNAMIC_STATE_STENCIL_TEST_ENABLE,
+			});
+		if (!meshPipeline)
+		{
+			states.push_back(VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY);
+		}
+	}
+	if (HasDynamicState(groups, DynamicStateGroup::Extended2))
+	{
+		states.insert(states.end(), {
+			VK_DYNAMIC_STATE_DEPTH_BIAS_ENABLE,
+			VK_DYNAMIC_STATE_RASTERIZER_DISCARD_ENABLE,
+			});
+		if (!meshPipeline)
+		{
+			states.push_back(VK_DYNAMIC_STATE_PRIMITIVE_RESTART_ENABLE);
+		}
+	}
+	if (HasDynamicState(groups, DynamicStateGroup::Extended3Blend))
+	{
+		states.insert(states.end(), {
+			VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT,
+			VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT,
+			VK_DYNAMIC_STATE_COLOR_WRITE_MASK_EXT,
+			});
+	}
+	return states;
+}
+
+DynamicStateTracker::DynamicStateTracker(VkDevice device, uint32_t groups)
+	: groups(groups)
+{
+	if (HasDynamicState(groups, DynamicStateGroup::Extended3Blend))
+	{
+		cmdSetColorBlendEnable = LoadDeviceFunction<PFN_vkCmdSetColorBlendEnableEXT>(device, "vkCmdSetColorBlendEnableEXT");
+		cmdSetColorBlendEquation = LoadDeviceFunction<PFN_vkCmdSetColorBlendEquationEXT>(device, "vkCmdSetColorBlendEquationEXT");
+		cmdSetColorWriteMask = LoadDeviceFunction<PFN_vkCmdSetColorWriteMaskEXT>(device, "vkCmdSetColorWriteMaskEXT");
+	}
+}
+
+void DynamicStateTracker::Reset()
+{
+	for (bool& slot : valid)
+	{
+		slot = false;
+	}
+}
+
+bool DynamicStateTracker::Changed(Slot slot, uint32_t value)
+{
+	if (valid[slot] && values[slot] == value)
+	{
+		skipped++;
+		return false;
+	}
+	valid[slot] = true;
+	values[slot] = value;
+	emitted++;
+	return true;
+}
+
+void DynamicStateTracker::Apply(VkCommandBuffer commandBuffer, const GraphicsPipelineDesc& desc)
+{
+	bool meshPipeline = IsMeshPipeline(desc);
+	if (meshPipeline)
+	{
+		// mesh pipelines have no dynamic input assembly, binding one leaves these two undefined
+		valid[Topology] = false;
+		valid[PrimitiveRestart] = false;
+	}
+
+	if (HasDynamicState(groups, DynamicStateGroup::Extended))
+	{
+		if (Changed(CullMode, desc.cullMode))
+		{
+			vkCmdSetCullMode(commandBuffer, desc.cullMode);
+		}
+		if (Changed(FrontFace, VK_FRONT_FACE_COUNTER_CLOCKWISE))
+		{
+			vkCmdSetFrontFace(commandBuffer, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+		}
+		if (!meshPipeline && Changed(Topology, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST))
+		{
+			vkCmdSetPrimitiveTopology(commandBuffer, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+		}
+		if (Changed(DepthTest, VK_TRUE))
+		{
+			vkCmdSetDepthTestEnable(commandBuffer, VK_TRUE);
+		}
+		if (Changed(DepthWrite, desc.depthWrite))
+		{
+			vkCmdSetDepthWriteEnable(commandBuffer, desc.depthWrite ? VK_TRUE : VK_FALSE);
+		}
+		if (Changed(DepthCompare, desc.depthCompare))
+		{
+			vkCmdSetDepthCompareOp(commandBuffer, desc.depthCompare);
+		}
+		if (Changed(DepthBoundsTest, VK_FALSE))
+		{
+			vkCmdSetDepthBoundsTestEnable(commandBuffer, VK_FALSE);
+		}
+		if (Changed(StencilTest, VK_FALSE))
+		{
+			vkCmdSetStencilTestEnable(commandBuffer, VK_FALSE);
+		}
+	}
+
+	if (HasDynamicState(groups, DynamicStateGroup::Extended2))
+	{
+		if (!meshPipeline && Changed(PrimitiveRestart, VK_FALSE))
+		{
+			vkCmdSetPrimitiveRestartEnable(commandBuffer, VK_FALSE);
+		}
+		if (Changed(DepthBias, VK_FALSE))
+		{
+			vkCmdSetDepthBiasEnable(commandBuffer, VK_FALSE);
+		}
+		if (Changed(RasterizerDiscard, VK_FALSE))
+		{
+			vkCmdSetRasterizerDiscardEnable(commandBuffer, VK_FALSE);
+		}
+	}
+
+	if (HasDynamicState(groups, DynamicStateGroup::Extended3Blend))
+	{
+		VkBool32 blendEnable = desc.blendEnable ? VK_TRUE : VK_FALSE;
+		if (Changed(BlendEnable, blendEnable))
+		{
+			cmdSetColorBlendEnable(commandBuffer, 0, 1, &blendEnable);
+		}
+		// the equation only depends on blendEnable, same factors as FillScenePipelineState
+		if (Changed(BlendEquation, blendEnable))
+		{
+			VkColorBlendEquationEXT equation = {};
+			equation.srcColorBlendFactor = desc.blendEnable ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+			equation.dstColorBlendFactor = desc.blendEnable ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ZERO;
+			equation.colorBlendOp = VK_BLEND_OP_ADD;
+			equation.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+			equation.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+			equation.alphaBlendOp = VK_BLEND_OP_ADD;
+			cmdSetColorBlendEquation(commandBuffer, 0, 1, &equation);
+		}
+		if (Changed(WriteMask, desc.colorWriteMask))
+		{
+			cmdSetColorWriteMask(commandBuffer, 0, 1, &desc.colorWriteMask);
+		}
+	}
+}
+
+void DynamicStateTracker::AddStats(const DynamicStateTracker& other)
+{
+	emitted += other.emitted;
+	skipped += other.skipped;
+}
+
+void DynamicStateTracker::PrintStats()
+{
+	std::cout << "dynamic state: " << emitted << " commands recorded, " << skipped << " redundant commands skipped" << std::endl;
+}
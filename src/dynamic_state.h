@@ -0,0 +1,89 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+
+struct GraphicsPipelineDesc;
+
+// Pipeline state that is set at record time instead of being baked into the pipeline. Descs that
+// only differ in these states share one pipeline, see GraphicsPipelineDesc::WithDynamicState.
+enum class DynamicStateGroup : uint32_t
+{
+	// VK_EXT_extended_dynamic_state, core in 1.3: cull mode, front face, topology, depth test,
+	// depth write, depth compare, depth bounds test and stencil test
+	Extended = 1u << 0,
+	// VK_EXT_extended_dynamic_state2, core in 1.3: primitive restart, depth bias and rasterizer discard
+	Extended2 = 1u << 1,
+	// VK_EXT_extended_dynamic_state3: color blend enable, blend equation and color write mask
+	Extended3Blend = 1u << 2,
+};
+
+constexpr uint32_t operator|(DynamicStateGroup a, DynamicStateGroup b)
+{
+	return (uint32_t)a | (uint32_t)b;
+}
+
+constexpr bool HasDynamicState(uint32_t groups, DynamicStateGroup group)
+{
+	return (groups & (uint32_t)group) != 0;
+}
+
+// the VkDynamicState list for a pipeline built with groups, besides viewport and scissor. Mesh
+// pipelines have no input assembly, so topology and primitive restart stay out
+std::vector<VkDynamicState> DynamicStatesOf(uint32_t groups, bool meshPipeline);
+
+// Sets the dynamic state a draw needs and skips every command whose value is already set in the
+// command buffer. One tracker records one command buffer at a time, threads that record in
+// parallel each use their own.
+class DynamicStateTracker
+{
+public:
+	// groups are the ones every scene pipeline is built with
+	DynamicStateTracker(VkDevice device, uint32_t groups);
+
+	uint32_t GetGroups() const { return groups; }
+
+	// nothing is set at the start of a command buffer, and nothing is known after commands that
+	// set state behind the tracker, e.g. ShaderObjectCache::SetState
+	void Reset();
+	// after binding a pipeline built from desc.WithDynamicState(GetGroups()), desc holds the state
+	// the draws want
+	void Apply(VkCommandBuffer commandBuffer, const GraphicsPipelineDesc& desc);
+
+	// adds the counts of a tracker that recorded on another thread, before PrintStats
+	void AddStats(const DynamicStateTracker& other);
+	void PrintStats();
+
+private:
+	enum Slot
+	{
+		CullMode,
+		FrontFace,
+		Topology,
+		PrimitiveRestart,
+		DepthTest,
+		DepthWrite,
+		DepthCompare,
+		DepthBoundsTest,
+		StencilTest,
+		DepthBias,
+		RasterizerDiscard,
+		BlendEnable,
+		BlendEquation,
+		WriteMask,
+		SlotCount,
+	};
+
+	// true when the command for slot has to be recorded
+	bool Changed(Slot slot, uint32_t value);
+
+	uint32_t groups;
+	PFN_vkCmdSetColorBlendEnableEXT cmdSetColorBlendEnable = nullptr;
+	PFN_vkCmdSetColorBlendEquationEXT cmdSetColorBlendEquation = nullptr;
+	PFN_vkCmdSetColorWriteMaskEXT cmdSetColorWriteMask = nullptr;
+
+	uint32_t values[SlotCount] = {};
+	bool valid[SlotCount] = {};
+	uint64_t emitted = 0;
+	uint64_t skipped = 0;
+};
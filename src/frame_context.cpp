@@ -0,0 +1,252 @@
+#include "frame_context.h"
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+	uint32_t FindHostVisibleMemory(VkPhysicalDevice physicalDevice, uint32_t typeFilter)
+	{
+		const VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+		{
+			if ((typeFilter & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			{
+				return i;
+			}
+		}
+		throw std::runtime_error("fail to find host visible memory for frame uniforms");
+	}
+}
+
+FrameContext::FrameContext(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, VkDeviceSize uniformCapacity,
+	const std::vector<VkDescriptorPoolSize>& poolSizes, uint32_t maxSets, uint32_t recordThreads, int computeFamily)
+	: device(device), queueFamily(queueFamily), secondaryPools(recordThreads), poolSizes(poolSizes), uniformCapacity(uniformCapacity)
+{
+	CreateCommandPool(primaryPool, queueFamily);
+	for (CommandPool& pool : secondaryPools)
+	{
+		CreateCommandPool(pool, queueFamily);
+	}
+	if (computeFamily >= 0)
+	{
+		CreateCommandPool(computePool, (uint32_t)computeFamily);
+	}
+
+	VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+	descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	descriptorPoolInfo.poolSizeCount = (uint32_t)poolSizes.size();
+	descriptorPoolInfo.pPoolSizes = poolSizes.data();
+	descriptorPoolInfo.maxSets = maxSets;
+	if (vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to create frame descriptor pool");
+	}
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	uniformAlignment = properties.limits.minUniformBufferOffsetAlignment;
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = uniformCapacity;
+	bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &uniformBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to create frame uniform buffer");
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(device, uniformBuffer, &requirements);
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = requirements.size;
+	allocInfo.memoryTypeIndex = FindHostVisibleMemory(physicalDevice, requirements.memoryTypeBits);
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &uniformMemory) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to allocate frame uniform memory");
+	}
+	vkBindBufferMemory(device, uniformBuffer, uniformMemory, 0);
+	void* mapped = nullptr;
+	vkMapMemory(device, uniformMemory, 0, uniformCapacity, 0, &mapped);
+	uniformData = static_cast<char*>(mapped);
+
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailable) != VK_SUCCESS ||
+		vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinished) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to create sync obj for a frame");
+	}
+}
+
+FrameContext::~FrameContext()
+{
+	vkDestroySemaphore(device, imageAvailable, nullptr);
+	vkDestroySemaphore(device, renderFinished, nullptr);
+	vkDestroyBuffer(device, uniformBuffer, nullptr);
+	vkFreeMemory(device, uniformMemory, nullptr);
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	if (cachePool != VK_NULL_HANDLE)
+	{
+		vkDestroyCommandPool(device, cachePool, nullptr);
+		vkDestroyDescriptorPool(device, cacheDescriptorPool, nullptr);
+	}
+	// frees the command buffers with them
+	vkDestroyCommandPool(device, primaryPool.pool, nullptr);
+	if (computePool.pool != VK_NULL_HANDLE)
+	{
+		vkDestroyCommandPool(device, computePool.pool, nullptr);
+	}
+	for (CommandPool& pool : secondaryPools)
+	{
+		vkDestroyCommandPool(device, pool.pool, nullptr);
+	}
+}
+
+void FrameContext::CreateCommandPool(CommandPool& pool, uint32_t family)
+{
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = family;
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool.pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to create frame command pool");
+	}
+}
+
+void FrameContext::Begin()
+{
+	vkResetCommandPool(device, primaryPool.pool, 0);
+	primaryPool.used = 0;
+	if (computePool.used > 0)
+	{
+		vkResetCommandPool(device, computePool.pool, 0);
+		computePool.used = 0;
+	}
+	for (CommandPool& pool : secondaryPools)
+	{
+		if (pool.used > 0)
+		{
+			vkResetCommandPool(device, pool.pool, 0);
+			pool.used = 0;
+		}
+	}
+	vkResetDescriptorPool(device, descriptorPool, 0);
+	uniformHead = 0;
+}
+
+VkCommandBuffer FrameContext::Allocate(CommandPool& pool, VkCommandBufferLevel level)
+{
+	if (pool.used == pool.commandBuffers.size())
+	{
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = pool.pool;
+		allocInfo.level = level;
+		allocInfo.commandBufferCount = 1;
+
+		VkCommandBuffer commandBuffer;
+		if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create command buffers");
+		}
+		pool.commandBuffers.push_back(commandBuffer);
+	}
+	return pool.commandBuffers[pool.used++];
+}
+
+VkCommandBuffer FrameContext::AllocateCommandBuffer()
+{
+	return Allocate(primaryPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+}
+
+VkCommandBuffer FrameContext::AllocateComputeCommandBuffer()
+{
+	if (computePool.pool == VK_NULL_HANDLE)
+	{
+		throw std::runtime_error("fail to allocate a compute command buffer, the frame has no compute pool");
+	}
+	return Allocate(computePool, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+}
+
+VkCommandBuffer FrameContext::AllocateSecondaryCommandBuffer(uint32_t thread)
+{
+	return Allocate(secondaryPools.at(thread), VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+}
+
+FrameContext::Cache& FrameContext::GetCache(VkDescriptorSetLayout layout)
+{
+	if (cachePool != VK_NULL_HANDLE)
+	{
+		return cache;
+	}
+
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = queueFamily;
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &cachePool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to create frame cache command pool");
+	}
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = cachePool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+	allocInfo.commandBufferCount = 1;
+	if (vkAllocateCommandBuffers(device, &allocInfo, &cache.commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to create frame cache command buffer");
+	}
+
+	VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+	descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	descriptorPoolInfo.poolSizeCount = (uint32_t)poolSizes.size();
+	descriptorPoolInfo.pPoolSizes = poolSizes.data();
+	descriptorPoolInfo.maxSets = 1;
+	if (vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &cacheDescriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to create frame cache descriptor pool");
+	}
+	VkDescriptorSetAllocateInfo setInfo = {};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setInfo.descriptorPool = cacheDescriptorPool;
+	setInfo.descriptorSetCount = 1;
+	setInfo.pSetLayouts = &layout;
+	if (vkAllocateDescriptorSets(device, &setInfo, &cache.descriptorSet) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to allocate frame cache descriptor set");
+	}
+	return cache;
+}
+
+VkDescriptorSet FrameContext::AllocateDescriptorSet(VkDescriptorSetLayout layout)
+{
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &layout;
+
+	VkDescriptorSet set;
+	if (vkAllocateDescriptorSets(device, &allocInfo, &set) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to allocate frame descriptor set");
+	}
+	return set;
+}
+
+FrameContext::Uniform FrameContext::AllocateUniform(VkDeviceSize size)
+{
+	VkDeviceSize offset = (uniformHead + uniformAlignment - 1) / uniformAlignment * uniformAlignment;
+	if (offset + size > uniformCapacity)
+	{
+		throw std::runtime_error("fail to allocate " + std::to_string(size) + " bytes of frame uniforms");
+	}
+	uniformHead = offset + size;
+	return { uniformBuffer, offset, uniformData + offset };
+}
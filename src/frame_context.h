@@ -0,0 +1,94 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+
+// Everything one frame in flight records and allocates into. A context is only reused after the
+// GPU finished its previous frame, so Begin resets the command pool, the descriptor pool and the
+// uniform buffer wholesale instead of freeing objects one by one.
+class FrameContext
+{
+public:
+	struct Uniform
+	{
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		void* data;
+	};
+
+	// uniformCapacity bytes of host visible uniform memory, the pool holds maxSets sets of poolSizes.
+	// recordThreads is how many threads may record secondary command buffers at the same time.
+	// computeFamily is the async compute queue's family, -1 without one
+	FrameContext(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, VkDeviceSize uniformCapacity,
+		const std::vector<VkDescriptorPoolSize>& poolSizes, uint32_t maxSets, uint32_t recordThreads, int computeFamily = -1);
+	~FrameContext();
+
+	FrameContext(const FrameContext&) = delete;
+	FrameContext& operator=(const FrameContext&) = delete;
+
+	// after the frame's previous submission completed
+	void Begin();
+
+	// command buffers come back from the previous use of the context, more are allocated on demand
+	VkCommandBuffer AllocateCommandBuffer();
+	// for the async compute queue
+	VkCommandBuffer AllocateComputeCommandBuffer();
+	// every thread index has its own pool, so threads with different indices need no locking
+	VkCommandBuffer AllocateSecondaryCommandBuffer(uint32_t thread);
+	uint32_t GetRecordThreadCount() const { return (uint32_t)secondaryPools.size(); }
+	VkDescriptorSet AllocateDescriptorSet(VkDescriptorSetLayout layout);
+	// aligned to minUniformBufferOffsetAlignment, throws when the frame runs out of uniform memory
+	Uniform AllocateUniform(VkDeviceSize size);
+
+	// Survives Begin: a secondary command buffer and a descriptor set for content that is recorded
+	// once and executed again every frame until the caller's version moves past version. Created on
+	// first use, version 0 means nothing has been recorded into it yet.
+	struct Cache
+	{
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		uint64_t version = 0;
+	};
+	Cache& GetCache(VkDescriptorSetLayout layout);
+
+	// swapchain sync stays binary, GpuTimeline tracks the frame itself
+	VkSemaphore GetImageAvailable() const { return imageAvailable; }
+	VkSemaphore GetRenderFinished() const { return renderFinished; }
+
+	// the timeline value the frame's last submission signals
+	uint64_t timelineValue = 0;
+
+private:
+	struct CommandPool
+	{
+		VkCommandPool pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> commandBuffers;
+		uint32_t used = 0;
+	};
+
+	void CreateCommandPool(CommandPool& pool, uint32_t family);
+	VkCommandBuffer Allocate(CommandPool& pool, VkCommandBufferLevel level);
+
+	VkDevice device;
+	uint32_t queueFamily;
+	CommandPool primaryPool;
+	CommandPool computePool;
+	std::vector<CommandPool> secondaryPools;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorPoolSize> poolSizes;
+
+	// not transient, the cached command buffer is reset on its own when it is recorded again
+	VkCommandPool cachePool = VK_NULL_HANDLE;
+	VkDescriptorPool cacheDescriptorPool = VK_NULL_HANDLE;
+	Cache cache;
+
+	VkBuffer uniformBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory uniformMemory = VK_NULL_HANDLE;
+	char* uniformData = nullptr;
+	VkDeviceSize uniformCapacity;
+	VkDeviceSize uniformAlignment;
+	VkDeviceSize uniformHead = 0;
+
+	VkSemaphore imageAvailable = VK_NULL_HANDLE;
+	VkSemaphore renderFinished = VK_NULL_HANDLE;
+};
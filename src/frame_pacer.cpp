@@ -0,0 +1,112 @@
+#include "frame_pacer.h"
+#include "frame_stats.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace
+{
+	const size_t kPresentHistory = 8;
+	// don't hang on a present that never completes, e.g. a minimized window
+	const uint64_t kPresentWaitTimeoutNs = 100000000;
+	// sleep granularity is coarse, the last stretch before the deadline is spun
+	const std::chrono::microseconds kSpinMargin(1000);
+}
+
+FramePacer::FramePacer(VkDevice device, double targetFps, bool presentWait, FrameStats* stats)
+	: device(device), stats(stats), presentStarts(kPresentHistory)
+{
+	if (presentWait)
+	{
+		waitForPresent = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(device, "vkWaitForPresentKHR");
+		if (waitForPresent == nullptr)
+		{
+			throw std::runtime_error("fail to load vkWaitForPresentKHR");
+		}
+	}
+	if (targetFps > 0.0)
+	{
+		frameInterval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / targetFps));
+	}
+	nextFrameStart = Clock::now();
+}
+
+void FramePacer::SetSwapchain(VkSwapchainKHR newSwapchain)
+{
+	swapchain = newSwapchain;
+	presentId = 0;
+}
+
+void FramePacer::BeginFrame()
+{
+	Clock::time_point waitStart = Clock::now();
+
+	if (waitForPresent != nullptr && presentId > 0)
+	{
+		VkResult result = waitForPresent(device, swapchain, presentId, kPresentWaitTimeoutNs);
+		if (result == VK_SUCCESS)
+		{
+			Clock::time_point onScreen = Clock::now();
+			double latency = std::chrono::duration<double, std::milli>(onScreen - presentStarts[presentId % kPresentHistory]).count();
+			latencySamples++;
+			latencyMs += latency;
+			maxLatencyMs = std::max(maxLatencyMs, latency);
+			if (stats != nullptr)
+			{
+				stats->AddLatency(latency);
+			}
+			if (presentCallback)
+			{
+				presentCallback(presentId, onScreen);
+			}
+		}
+	}
+
+	if (frameInterval > Clock::duration::zero())
+	{
+		std::this_thread::sleep_until(nextFrameStart - kSpinMargin);
+		while (Clock::now() < nextFrameStart)
+		{
+			std::this_thread::yield();
+		}
+		// a late frame moves the schedule instead of being followed by a burst of catch-up frames
+		nextFrameStart = std::max(nextFrameStart + frameInterval, Clock::now());
+	}
+
+	frameStart = Clock::now();
+	waitMs += std::chrono::duration<double, std::milli>(frameStart - waitStart).count();
+	frames++;
+}
+
+void FramePacer::SetPresentCallback(std::function<void(uint64_t, Clock::time_point)> callback)
+{
+	presentCallback = std::move(callback);
+}
+
+uint64_t FramePacer::NextPresentId()
+{
+	if (waitForPresent == nullptr)
+	{
+		return 0;
+	}
+	presentId++;
+	presentStarts[presentId % kPresentHistory] = frameStart;
+	return presentId;
+}
+
+void FramePacer::PrintStats() const
+{
+	if (frames == 0)
+	{
+		return;
+	}
+	std::cout << "frame pacing: waited " << waitMs / frames << " ms per frame";
+	if (latencySamples > 0)
+	{
+		std::cout << ", frame start to on screen avg " << latencyMs / latencySamples << " ms, max " << maxLatencyMs << " ms";
+	}
+	std::cout << std::endl;
+}
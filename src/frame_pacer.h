@@ -0,0 +1,54 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class FrameStats;
+
+// Decides when the CPU starts a frame. With VK_KHR_present_wait the next frame starts once the
+// previous one is on screen, so input is read as late as possible and no more than one frame
+// queues up behind the display. A CPU limiter can cap the frame rate on top of that.
+class FramePacer
+{
+public:
+	// targetFps 0 means no cap. presentWait needs VK_KHR_present_id and VK_KHR_present_wait
+	// enabled on the device, stats receives the measured latency when it is set
+	FramePacer(VkDevice device, double targetFps, bool presentWait, FrameStats* stats);
+
+	// ids start over on every swapchain
+	void SetSwapchain(VkSwapchainKHR swapchain);
+	// called with each present id seen on screen and the time it was seen
+	void SetPresentCallback(std::function<void(uint64_t, std::chrono::steady_clock::time_point)> callback);
+
+	// blocks until the frame may start
+	void BeginFrame();
+	// the id to chain into VkPresentInfoKHR with VkPresentIdKHR, 0 when present ids are not used
+	uint64_t NextPresentId();
+
+	void PrintStats() const;
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	VkDevice device;
+	PFN_vkWaitForPresentKHR waitForPresent = nullptr;
+	FrameStats* stats;
+	std::function<void(uint64_t, std::chrono::steady_clock::time_point)> presentCallback;
+
+	Clock::duration frameInterval = Clock::duration::zero();
+	Clock::time_point nextFrameStart;
+
+	VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+	uint64_t presentId = 0;
+	Clock::time_point frameStart;
+	// start of the frame each recent present id belongs to, indexed by id modulo the size
+	std::vector<Clock::time_point> presentStarts;
+
+	uint64_t frames = 0;
+	double waitMs = 0.0;
+	uint64_t latencySamples = 0;
+	double latencyMs = 0.0;
+	double maxLatencyMs = 0.0;
+};
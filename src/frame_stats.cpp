@@ -0,0 +1,69 @@
+#include "frame_stats.h"
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+
+FrameStats::FrameStats(std::string label, double reportIntervalSeconds)
+	: label(std::move(label)), reportInterval(reportIntervalSeconds)
+{
+	frameTimes.reserve(1024);
+}
+
+void FrameStats::Tick()
+{
+	Clock::time_point now = Clock::now();
+	if (!started)
+	{
+		started = true;
+		lastTick = now;
+		windowStart = now;
+		return;
+	}
+
+	frameTimes.push_back(std::chrono::duration<double, std::milli>(now - lastTick).count());
+	lastTick = now;
+
+	if (std::chrono::duration<double>(now - windowStart).count() >= reportInterval)
+	{
+		Report();
+		frameTimes.clear();
+		latencies.clear();
+		windowStart = now;
+	}
+}
+
+void FrameStats::AddLatency(double milliseconds)
+{
+	latencies.push_back(milliseconds);
+}
+
+void FrameStats::Report()
+{
+	if (frameTimes.empty())
+	{
+		return;
+	}
+
+	auto percentile = [](const std::vector<double>& sorted, double p)
+		{
+			size_t index = std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5));
+			return sorted[index];
+		};
+
+	std::vector<double> sorted = frameTimes;
+	std::sort(sorted.begin(), sorted.end());
+	double avg = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+	std::cout << "[" << label << "] " << sorted.size() << " frames, avg " << avg << " ms (" << 1000.0 / avg
+		<< " fps), p50 " << percentile(sorted, 0.5) << " ms, p99 " << percentile(sorted, 0.99) << " ms, max " << sorted.back()
+		<< " ms";
+
+	if (!latencies.empty())
+	{
+		std::vector<double> sortedLatencies = latencies;
+		std::sort(sortedLatencies.begin(), sortedLatencies.end());
+		double avgLatency = std::accumulate(sortedLatencies.begin(), sortedLatencies.end(), 0.0) / sortedLatencies.size();
+		std::cout << ", latency avg " << avgLatency << " ms, p50 " << percentile(sortedLatencies, 0.5) << " ms, p99 "
+			<< percentile(sortedLatencies, 0.99) << " ms";
+	}
+	std::cout << std::endl;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Collects cpu frame times, and present latencies when a FramePacer measures them, and prints
+// avg / percentiles once per report interval.
+class FrameStats
+{
+public:
+	explicit FrameStats(std::string label, double reportIntervalSeconds = 2.0);
+
+	// call once per presented frame
+	void Tick();
+	// frame start to on screen, in milliseconds
+	void AddLatency(double milliseconds);
+
+private:
+	void Report();
+
+	using Clock = std::chrono::steady_clock;
+
+	std::string label;
+	double reportInterval;
+	Clock::time_point lastTick;
+	Clock::time_point windowStart;
+	bool started = false;
+	std::vector<double> frameTimes;
+	std::vector<double> latencies;
+};
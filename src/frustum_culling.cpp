@@ -0,0 +1,453 @@
+#include "frustum_culling.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <glm/gtc/matrix_transform.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CULLING_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CULLING_TARGET_AVX2
+#else
+#define CULLING_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define CULLING_X86 0
+#endif
+
+static inline uint32_t CountTrailingZeros(uint32_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+static inline uint32_t EmitVisible(uint32_t mask, uint32_t base, uint32_t* out)
+{
+	uint32_t written = 0;
+	while (mask)
+	{
+		out[written++] = base + CountTrailingZeros(mask);
+		mask &= mask - 1;
+	}
+	return written;
+}
+
+static inline uint32_t TailMask(uint32_t first, uint32_t end, uint32_t lanes)
+{
+	uint32_t valid = std::min(end - first, lanes);
+	return valid >= 32 ? 0xFFFFFFFFu : (1u << valid) - 1;
+}
+
+Frustum ExtractFrustumPlanes(const glm::mat4& viewProj)
+{
+	// glm is column major, m[column][row]
+	glm::vec4 row0(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+	glm::vec4 row1(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+	glm::vec4 row2(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+	glm::vec4 row3(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0;//left
+	frustum.planes[1] = row3 - row0;//right
+	frustum.planes[2] = row3 + row1;//bottom
+	frustum.planes[3] = row3 - row1;//top
+	frustum.planes[4] = row2;//near, z in [0, 1]
+	frustum.planes[5] = row3 - row2;//far
+
+	for (auto& plane : frustum.planes)
+	{
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	return frustum;
+}
+
+const char* CullPathName(CullPath path)
+{
+	switch (path)
+	{
+	case CullPath::Scalar: return "scalar";
+	case CullPath::Sse: return "sse";
+	case CullPath::Avx2: return "avx2";
+	default: return "auto";
+	}
+}
+
+bool CpuSupportsAvx2()
+{
+#if CULLING_X86
+	static const bool supported = []
+		{
+#ifdef _MSC_VER
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] < 7)
+			{
+				return false;
+			}
+			__cpuid(info, 1);
+			bool osxsave = (info[2] & (1 << 27)) != 0;
+			bool avx = (info[2] & (1 << 28)) != 0;
+			if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+			{
+				return false;
+			}
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+#else
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") != 0;
+#endif
+		}();
+	return supported;
+#else
+	return false;
+#endif
+}
+
+void CullingSoA::Reserve(uint32_t reserveCount)
+{
+	size_t size = reserveCount + kBlockSize;
+	for (auto* array : { &centerX, &centerY, &centerZ, &radius, &minX, &minY, &minZ, &maxX, &maxY, &maxZ })
+	{
+		array->reserve(size);
+	}
+}
+
+void CullingSoA::Clear()
+{
+	count = 0;
+	for (auto* array : { &centerX, &centerY, &centerZ, &radius, &minX, &minY, &minZ, &maxX, &maxY, &maxZ })
+	{
+		array->clear();
+	}
+}
+
+uint32_t CullingSoA::Add(const glm::vec3& center, float sphereRadius, const glm::vec3& aabbMin, const glm::vec3& aabbMax)
+{
+	uint32_t index = count++;
+
+	// the padding after the last object lets a block load run past the end
+	size_t size = count + kBlockSize;
+	for (auto* array : { &centerX, &centerY, &centerZ, &radius, &minX, &minY, &minZ, &maxX, &maxY, &maxZ })
+	{
+		array->resize(size, 0.0f);
+	}
+
+	Set(index, center, sphereRadius, aabbMin, aabbMax);
+	return index;
+}
+
+void CullingSoA::Set(uint32_t index, const glm::vec3& center, float sphereRadius, const glm::vec3& aabbMin, const glm::vec3& aabbMax)
+{
+	centerX[index] = center.x;
+	centerY[index] = center.y;
+	centerZ[index] = center.z;
+	radius[index] = sphereRadius;
+	minX[index] = aabbMin.x;
+	minY[index] = aabbMin.y;
+	minZ[index] = aabbMin.z;
+	maxX[index] = aabbMax.x;
+	maxY[index] = aabbMax.y;
+	maxZ[index] = aabbMax.z;
+}
+
+struct CullInput
+{
+	const float* centerX;
+	const float* centerY;
+	const float* centerZ;
+	const float* radius;
+	// per plane, the aabb corner furthest along the plane normal
+	const float* positiveX[6];
+	const float* positiveY[6];
+	const float* positiveZ[6];
+};
+
+static uint32_t CullScalar(const Frustum& frustum, CullShape shape, const CullInput& in,
+	uint32_t begin, uint32_t end, uint32_t* out)
+{
+	bool testSphere = shape != CullShape::Aabb;
+	bool testAabb = shape != CullShape::Sphere;
+
+	uint32_t written = 0;
+	for (uint32_t i = begin; i < end; i++)
+	{
+		bool visible = true;
+		for (int p = 0; p < 6 && visible; p++)
+		{
+			const glm::vec4& plane = frustum.planes[p];
+			if (testSphere)
+			{
+				float distance = plane.x * in.centerX[i] + plane.y * in.centerY[i] + plane.z * in.centerZ[i] + plane.w;
+				visible = distance >= -in.radius[i];
+			}
+			if (testAabb && visible)
+			{
+				float distance = plane.x * in.positiveX[p][i] + plane.y * in.positiveY[p][i] + plane.z * in.positiveZ[p][i] + plane.w;
+				visible = distance >= 0.0f;
+			}
+		}
+		out[written] = i;
+		written += visible ? 1 : 0;
+	}
+	return written;
+}
+
+#if CULLING_X86
+static inline __m128 CullBlockSse(const Frustum& frustum, bool testSphere, bool testAabb, const CullInput& in, uint32_t i)
+{
+	__m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+	__m128 cx = _mm_loadu_ps(in.centerX + i);
+	__m128 cy = _mm_loadu_ps(in.centerY + i);
+	__m128 cz = _mm_loadu_ps(in.centerZ + i);
+	__m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(in.radius + i));
+
+	for (int p = 0; p < 6; p++)
+	{
+		__m128 nx = _mm_set1_ps(frustum.planes[p].x);
+		__m128 ny = _mm_set1_ps(frustum.planes[p].y);
+		__m128 nz = _mm_set1_ps(frustum.planes[p].z);
+		__m128 d = _mm_set1_ps(frustum.planes[p].w);
+		if (testSphere)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_add_ps(_mm_mul_ps(nz, cz), d));
+			visible = _mm_and_ps(visible, _mm_cmpge_ps(distance, negRadius));
+		}
+		if (testAabb)
+		{
+			__m128 px = _mm_loadu_ps(in.positiveX[p] + i);
+			__m128 py = _mm_loadu_ps(in.positiveY[p] + i);
+			__m128 pz = _mm_loadu_ps(in.positiveZ[p] + i);
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, px), _mm_mul_ps(ny, py)), _mm_add_ps(_mm_mul_ps(nz, pz), d));
+			visible = _mm_and_ps(visible, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+		}
+	}
+	return visible;
+}
+
+// 8 objects per iteration as two independent 4 wide blocks
+static uint32_t CullSse(const Frustum& frustum, CullShape shape, const CullInput& in,
+	uint32_t begin, uint32_t end, uint32_t* out)
+{
+	bool testSphere = shape != CullShape::Aabb;
+	bool testAabb = shape != CullShape::Sphere;
+
+	uint32_t written = 0;
+	for (uint32_t i = begin; i < end; i += 8)
+	{
+		__m128 visible0 = CullBlockSse(frustum, testSphere, testAabb, in, i);
+		__m128 visible1 = CullBlockSse(frustum, testSphere, testAabb, in, i + 4);
+		uint32_t mask = (uint32_t)_mm_movemask_ps(visible0) | ((uint32_t)_mm_movemask_ps(visible1) << 4);
+		written += EmitVisible(mask & TailMask(i, end, 8), i, out + written);
+	}
+	return written;
+}
+
+CULLING_TARGET_AVX2
+static inline __m256 CullBlockAvx2(const Frustum& frustum, bool testSphere, bool testAabb, const CullInput& in, uint32_t i)
+{
+	__m256 visible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+	__m256 cx = _mm256_loadu_ps(in.centerX + i);
+	__m256 cy = _mm256_loadu_ps(in.centerY + i);
+	__m256 cz = _mm256_loadu_ps(in.centerZ + i);
+	__m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(in.radius + i));
+
+	for (int p = 0; p < 6; p++)
+	{
+		__m256 nx = _mm256_set1_ps(frustum.planes[p].x);
+		__m256 ny = _mm256_set1_ps(frustum.planes[p].y);
+		__m256 nz = _mm256_set1_ps(frustum.planes[p].z);
+		__m256 d = _mm256_set1_ps(frustum.planes[p].w);
+		if (testSphere)
+		{
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, cx), _mm256_mul_ps(ny, cy)), _mm256_add_ps(_mm256_mul_ps(nz, cz), d));
+			visible = _mm256_and_ps(visible, _mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+		}
+		if (testAabb)
+		{
+			__m256 px = _mm256_loadu_ps(in.positiveX[p] + i);
+			__m256 py = _mm256_loadu_ps(in.positiveY[p] + i);
+			__m256 pz = _mm256_loadu_ps(in.positiveZ[p] + i);
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, px), _mm256_mul_ps(ny, py)), _mm256_add_ps(_mm256_mul_ps(nz, pz), d));
+			visible = _mm256_and_ps(visible, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+		}
+	}
+	return visible;
+}
+
+// 16 objects per iteration as two independent 8 wide blocks
+CULLING_TARGET_AVX2
+static uint32_t CullAvx2(const Frustum& frustum, CullShape shape, const CullInput& in,
+	uint32_t begin, uint32_t end, uint32_t* out)
+{
+	bool testSphere = shape != CullShape::Aabb;
+	bool testAabb = shape != CullShape::Sphere;
+
+	uint32_t written = 0;
+	for (uint32_t i = begin; i < end; i += 16)
+	{
+		__m256 visible0 = CullBlockAvx2(frustum, testSphere, testAabb, in, i);
+		__m256 visible1 = CullBlockAvx2(frustum, testSphere, testAabb, in, i + 8);
+		uint32_t mask = (uint32_t)_mm256_movemask_ps(visible0) | ((uint32_t)_mm256_movemask_ps(visible1) << 8);
+		written += EmitVisible(mask & TailMask(i, end, 16), i, out + written);
+	}
+	return written;
+}
+#endif
+
+uint32_t CullingSoA::Cull(const Frustum& frustum, CullShape shape, uint32_t begin, uint32_t end,
+	uint32_t* outIndices, CullPath path) const
+{
+	end = std::min(end, count);
+	if (begin >= end)
+	{
+		return 0;
+	}
+
+	CullInput in = {};
+	in.centerX = centerX.data();
+	in.centerY = centerY.data();
+	in.centerZ = centerZ.data();
+	in.radius = radius.data();
+	for (int p = 0; p < 6; p++)
+	{
+		in.positiveX[p] = frustum.planes[p].x >= 0.0f ? maxX.data() : minX.data();
+		in.positiveY[p] = frustum.planes[p].y >= 0.0f ? maxY.data() : minY.data();
+		in.positiveZ[p] = frustum.planes[p].z >= 0.0f ? maxZ.data() : minZ.data();
+	}
+
+	if (path == CullPath::Auto)
+	{
+#if CULLING_X86
+		path = CpuSupportsAvx2() ? CullPath::Avx2 : CullPath::Sse;
+#else
+		path = CullPath::Scalar;
+#endif
+	}
+
+#if CULLING_X86
+	if (path == CullPath::Avx2 && CpuSupportsAvx2())
+	{
+		return CullAvx2(frustum, shape, in, begin, end, outIndices);
+	}
+	if (path == CullPath::Sse || path == CullPath::Avx2)
+	{
+		return CullSse(frustum, shape, in, begin, end, outIndices);
+	}
+#endif
+	return CullScalar(frustum, shape, in, begin, end, outIndices);
+}
+
+void CullingSoA::CullAll(const Frustum& frustum, CullShape shape, std::vector<uint32_t>& visible,
+	ThreadPool* pool, CullPath path) const
+{
+	// every chunk writes its visible indices in place starting at its first object, then the
+	// chunks are packed together in order
+	visible.resize(count);
+
+	const uint32_t kMinChunk = 4096;
+	if (pool == nullptr || count < 2 * kMinChunk)
+	{
+		visible.resize(Cull(frustum, shape, 0, count, visible.data(), path));
+		return;
+	}
+
+	std::vector<std::pair<uint32_t, uint32_t>> chunks;
+	std::mutex chunksMutex;
+	pool->ParallelFor(count, kMinChunk, kBlockSize, [&](uint32_t begin, uint32_t end)
+		{
+			uint32_t written = Cull(frustum, shape, begin, end, visible.data() + begin, path);
+
+			std::lock_guard<std::mutex> lock(chunksMutex);
+			chunks.emplace_back(begin, written);
+		});
+
+	std::sort(chunks.begin(), chunks.end());
+	uint32_t total = 0;
+	for (const auto& chunk : chunks)
+	{
+		if (chunk.first != total)
+		{
+			memmove(visible.data() + total, visible.data() + chunk.first, chunk.second * sizeof(uint32_t));
+		}
+		total += chunk.second;
+	}
+	visible.resize(total);
+}
+
+void RunCullingBenchmark(uint32_t objectCount, uint32_t iterations)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> position(-20.0f, 20.0f);
+	std::uniform_real_distribution<float> extent(0.1f, 1.0f);
+
+	CullingSoA soa;
+	soa.Reserve(objectCount);
+	for (uint32_t i = 0; i < objectCount; i++)
+	{
+		glm::vec3 center(position(rng), position(rng), position(rng));
+		glm::vec3 halfExtent(extent(rng), extent(rng), extent(rng));
+		soa.Add(center, glm::length(halfExtent), center - halfExtent, center + halfExtent);
+	}
+
+	// same camera as HelloTriangleApplication::UpdateUniformBuffer
+	glm::mat4 view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), 1400.0f / 1200.0f, 0.1f, 10.0f);
+	proj[1][1] *= -1;
+	Frustum frustum = ExtractFrustumPlanes(proj * view);
+
+	ThreadPool pool;
+	std::vector<uint32_t> visible;
+
+	std::cout << "culling benchmark: " << objectCount << " objects, " << iterations << " iterations, "
+		<< pool.GetThreadCount() + 1 << " threads" << std::endl;
+
+	auto run = [&](const char* name, CullShape shape, CullPath path, ThreadPool* threads)
+		{
+			if (path == CullPath::Avx2 && !CpuSupportsAvx2())
+			{
+				std::cout << "  " << name << ": skipped, avx2 not supported" << std::endl;
+				return;
+			}
+
+			soa.CullAll(frustum, shape, visible, threads, path);
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < iterations; i++)
+			{
+				soa.CullAll(frustum, shape, visible, threads, path);
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+
+			double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+			std::cout << "  " << name << ": " << ns / 1000.0 << " us/frame, " << ns / objectCount
+				<< " ns/object, " << visible.size() << " visible" << std::endl;
+		};
+
+	const std::pair<const char*, CullShape> shapes[] = {
+		{ "sphere", CullShape::Sphere },
+		{ "aabb", CullShape::Aabb },
+		{ "sphere+aabb", CullShape::SphereThenAabb },
+	};
+
+	for (const auto& shape : shapes)
+	{
+		std::cout << " " << shape.first << std::endl;
+		run("scalar", shape.second, CullPath::Scalar, nullptr);
+		run("sse", shape.second, CullPath::Sse, nullptr);
+		run("avx2", shape.second, CullPath::Avx2, nullptr);
+		run("auto, threaded", shape.second, CullPath::Auto, &pool);
+	}
+}
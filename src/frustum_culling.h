@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+class ThreadPool;
+
+struct Frustum
+{
+	// xyz = inward facing normal, w = distance, a point p is inside when dot(n, p) + w >= 0
+	glm::vec4 planes[6];
+};
+
+// planes in clip space with depth in [0, 1], i.e. matching GLM_FORCE_DEPTH_ZERO_TO_ONE
+Frustum ExtractFrustumPlanes(const glm::mat4& viewProj);
+
+enum class CullShape
+{
+	Sphere,
+	Aabb,
+	SphereThenAabb,
+};
+
+enum class CullPath
+{
+	Auto,
+	Scalar,
+	Sse,
+	Avx2,
+};
+
+const char* CullPathName(CullPath path);
+
+// Bounding volumes in structure-of-arrays form. Every array is padded to a multiple of
+// CullingSoA::kBlockSize so the simd loops never need a scalar tail.
+class CullingSoA
+{
+public:
+	static constexpr uint32_t kBlockSize = 16;
+
+	void Reserve(uint32_t count);
+	void Clear();
+	uint32_t Add(const glm::vec3& center, float radius, const glm::vec3& aabbMin, const glm::vec3& aabbMax);
+	void Set(uint32_t index, const glm::vec3& center, float radius, const glm::vec3& aabbMin, const glm::vec3& aabbMax);
+
+	uint32_t Size() const { return count; }
+
+	// writes the indices of visible objects in [begin, end) to outIndices (which needs room for
+	// end - begin entries) and returns how many were written, safe to call from several threads
+	uint32_t Cull(const Frustum& frustum, CullShape shape, uint32_t begin, uint32_t end,
+		uint32_t* outIndices, CullPath path = CullPath::Auto) const;
+
+	// culls every object, splitting the work across the pool when there are enough of them
+	void CullAll(const Frustum& frustum, CullShape shape, std::vector<uint32_t>& visible,
+		ThreadPool* pool = nullptr, CullPath path = CullPath::Auto) const;
+
+private:
+	uint32_t count = 0;
+	std::vector<float> centerX, centerY, centerZ, radius;
+	std::vector<float> minX, minY, minZ;
+	std::vector<float> maxX, maxY, maxZ;
+};
+
+bool CpuSupportsAvx2();
+
+void RunCullingBenchmark(uint32_t objectCount, uint32_t iterations);
@@ -0,0 +1,70 @@
+#include "gpu_timeline.h"
+#include <algorithm>
+#include <stdexcept>
+
+GpuTimeline::GpuTimeline(VkDevice device)
+	: device(device)
+{
+	VkSemaphoreTypeCreateInfo typeInfo = {};
+	typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = &typeInfo;
+	if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to create timeline semaphore");
+	}
+}
+
+GpuTimeline::~GpuTimeline()
+{
+	vkDestroySemaphore(device, semaphore, nullptr);
+}
+
+uint64_t GpuTimeline::Completed()
+{
+	uint64_t value = 0;
+	if (vkGetSemaphoreCounterValue(device, semaphore, &value) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to read timeline semaphore");
+	}
+
+	return Advance(value);
+}
+
+uint64_t GpuTimeline::Advance(uint64_t value)
+{
+	// several threads may read, keep the highest value seen
+	uint64_t known = completed.load();
+	while (value > known && !completed.compare_exchange_weak(known, value))
+	{
+	}
+	return std::max(value, known);
+}
+
+bool GpuTimeline::IsComplete(uint64_t value)
+{
+	return value <= completed.load() || value <= Completed();
+}
+
+void GpuTimeline::Wait(uint64_t value)
+{
+	if (IsComplete(value))
+	{
+		return;
+	}
+
+	VkSemaphoreWaitInfo waitInfo = {};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &semaphore;
+	waitInfo.pValues = &value;
+	if (vkWaitSemaphores(device, &waitInfo, UINT64_MAX) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to wait for timeline semaphore");
+	}
+	Advance(value);
+}
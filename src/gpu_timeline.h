@@ -0,0 +1,41 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include <cstdint>
+
+// One timeline semaphore shared by every submission. Each submission signals the next value of a
+// single counter, so a value is complete once the GPU has finished that submission and every one
+// before it, and "has the GPU finished X" is one comparison. Values have to be signaled in the
+// order Next handed them out, submissions to other queues wait on the previous value first.
+class GpuTimeline
+{
+public:
+	explicit GpuTimeline(VkDevice device);
+	~GpuTimeline();
+
+	GpuTimeline(const GpuTimeline&) = delete;
+	GpuTimeline& operator=(const GpuTimeline&) = delete;
+
+	VkSemaphore Get() const { return semaphore; }
+
+	// the value the next submission signals
+	uint64_t Next() { return ++submitted; }
+	// the last value handed out by Next, work recorded now is finished once it completes
+	uint64_t LastSubmitted() const { return submitted; }
+
+	// the highest value the GPU has signaled
+	uint64_t Completed();
+	// answers from the last known value when it can, without asking the driver
+	bool IsComplete(uint64_t value);
+	// blocks until value is signaled, returns at once for values already complete
+	void Wait(uint64_t value);
+
+private:
+	// raises the cached completed value, returns the new one
+	uint64_t Advance(uint64_t value);
+
+	VkDevice device;
+	VkSemaphore semaphore = VK_NULL_HANDLE;
+	std::atomic<uint64_t> submitted{ 0 };
+	std::atomic<uint64_t> completed{ 0 };
+};
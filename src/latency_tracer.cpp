@@ -0,0 +1,349 @@
+#include "latency_tracer.h"
+#include "vk_helpers.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+namespace
+{
+	// a minute at 2000 fps, later frames are not traced
+	const size_t kMaxRecords = 1 << 17;
+	const double kHistogramBucketMs = 1.0;
+	const uint32_t kHistogramBuckets = 100;
+	// the two clocks drift apart slowly
+	const double kCalibrationIntervalMs = 1000.0;
+
+	const char* const kMarkerNames[] = { "input", "simulation", "recorded", "submit", "gpuStart", "gpuEnd", "present", "onScreen" };
+	static_assert(sizeof(kMarkerNames) / sizeof(kMarkerNames[0]) == (size_t)LatencyMarker::Count, "one name per marker");
+
+	// the clock std::chrono::steady_clock reads, so a host timestamp lands directly on the tracer's timeline
+#ifdef _WIN32
+	const VkTimeDomainEXT kHostTimeDomain = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
+#else
+	const VkTimeDomainEXT kHostTimeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+#endif
+
+	// a kHostTimeDomain timestamp as a steady_clock time point
+	std::chrono::steady_clock::time_point HostTime(uint64_t timestamp)
+	{
+#ifdef _WIN32
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		uint64_t ticksPerSecond = (uint64_t)frequency.QuadPart;
+		uint64_t nanoseconds = timestamp / ticksPerSecond * 1000000000ull + timestamp % ticksPerSecond * 1000000000ull / ticksPerSecond;
+#else
+		uint64_t nanoseconds = timestamp;
+#endif
+		return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::nanoseconds(nanoseconds)));
+	}
+
+	double Percentile(const std::vector<double>& sorted, double p)
+	{
+		size_t index = std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5));
+		return sorted[index];
+	}
+}
+
+LatencyTracer::LatencyTracer(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily,
+	uint32_t frameSlots, bool calibrated)
+	: device(device), origin(Clock::now()), slotRecords(frameSlots, -1)
+{
+	records.reserve(4096);
+
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+	validBits = families[queueFamily].timestampValidBits;
+	if (validBits == 0)
+	{
+		std::cout << "the graphics queue has no timestamps, latency tracing skips the gpu markers" << std::endl;
+		return;
+	}
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	timestampPeriod = properties.limits.timestampPeriod;
+
+	VkQueryPoolCreateInfo queryPoolInfo = {};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = 2 * frameSlots;
+	if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to create latency query pool");
+	}
+
+	if (calibrated)
+	{
+		getCalibratedTimestamps = LoadDeviceFunction<PFN_vkGetCalibratedTimestampsEXT>(device, "vkGetCalibratedTimestampsEXT");
+
+		auto getTimeDomains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr(instance,
+			"vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+		uint32_t domainCount = 0;
+		if (getTimeDomains != nullptr && getTimeDomains(physicalDevice, &domainCount, nullptr) == VK_SUCCESS)
+		{
+			std::vector<VkTimeDomainEXT> domains(domainCount);
+			getTimeDomains(physicalDevice, &domainCount, domains.data());
+			hostDomain = std::find(domains.begin(), domains.end(), kHostTimeDomain) != domains.end();
+		}
+		if (!hostDomain)
+		{
+			std::cout << "the host clock can't be calibrated against the gpu, latency tracing reads it around the device timestamp" << std::endl;
+		}
+		Calibrate();
+	}
+}
+
+LatencyTracer::~LatencyTracer()
+{
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(device, queryPool, nullptr);
+	}
+}
+
+double LatencyTracer::Now() const
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - origin).count();
+}
+
+void LatencyTracer::BeginFrame(Clock::time_point input)
+{
+	if (records.size() == kMaxRecords)
+	{
+		current = -1;
+		dropped = true;
+		return;
+	}
+
+	FrameRecord record = {};
+	record.id = nextId++;
+	std::fill(std::begin(record.times), std::end(record.times), -1.0);
+	record.gpuMs = -1.0;
+	records.push_back(record);
+	current = (int64_t)records.size() - 1;
+	records[current].times[(size_t)LatencyMarker::Input] = std::chrono::duration<double, std::milli>(input - origin).count();
+}
+
+void LatencyTracer::Mark(LatencyMarker marker)
+{
+	if (current >= 0)
+	{
+		records[current].times[(size_t)marker] = Now();
+	}
+}
+
+void LatencyTracer::RecordGpuStart(VkCommandBuffer commandBuffer, uint32_t slot)
+{
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		vkCmdResetQueryPool(commandBuffer, queryPool, slot * 2, 2);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, slot * 2);
+	}
+	vkEndCommandBuffer(commandBuffer);
+}
+
+void LatencyTracer::RecordGpuEnd(VkCommandBuffer commandBuffer, uint32_t slot)
+{
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, slot * 2 + 1);
+	}
+	vkEndCommandBuffer(commandBuffer);
+	slotRecords[slot] = current;
+}
+
+void LatencyTracer::ResolveGpu(uint32_t slot)
+{
+	int64_t recordIndex = slotRecords[slot];
+	slotRecords[slot] = -1;
+	if (queryPool == VK_NULL_HANDLE || recordIndex < 0)
+	{
+		return;
+	}
+
+	uint64_t timestamps[2];
+	if (vkGetQueryPoolResults(device, queryPool, slot * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+	{
+		return;
+	}
+
+	FrameRecord& record = records[recordIndex];
+	uint64_t mask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+	record.gpuMs = ((timestamps[1] - timestamps[0]) & mask) * timestampPeriod / 1e6;
+	if (getCalibratedTimestamps != nullptr)
+	{
+		if (Now() - calibrationMs > kCalibrationIntervalMs)
+		{
+			Calibrate();
+		}
+		record.times[(size_t)LatencyMarker::GpuStart] = GpuToCpu(timestamps[0]);
+		record.times[(size_t)LatencyMarker::GpuEnd] = GpuToCpu(timestamps[1]);
+	}
+}
+
+void LatencyTracer::Calibrate()
+{
+	// the driver samples both clocks within maxDeviation of each other. Without the host domain the
+	// CPU clock read around the call stands in for it, off by up to the duration of the call
+	VkCalibratedTimestampInfoEXT infos[2] = {};
+	infos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+	infos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+	infos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+	infos[1].timeDomain = kHostTimeDomain;
+	uint64_t timestamps[2] = {};
+	uint64_t maxDeviation = 0;
+	double before = Now();
+	if (getCalibratedTimestamps(device, hostDomain ? 2 : 1, infos, timestamps, &maxDeviation) != VK_SUCCESS)
+	{
+		return;
+	}
+	calibrationMs = hostDomain ? std::chrono::duration<double, std::milli>(HostTime(timestamps[1]) - origin).count()
+		: (before + Now()) * 0.5;
+	calibrationTicks = timestamps[0];
+}
+
+double LatencyTracer::GpuToCpu(uint64_t ticks) const
+{
+	// sign extend the difference so timestamps before the calibration come out negative
+	uint32_t shift = 64 - std::min(validBits, 64u);
+	int64_t delta = (int64_t)((ticks - calibrationTicks) << shift) >> shift;
+	return calibrationMs + delta * timestampPeriod / 1e6;
+}
+
+void LatencyTracer::SetPresentId(uint64_t presentId)
+{
+	if (current >= 0)
+	{
+		records[current].presentId = presentId;
+	}
+}
+
+void LatencyTracer::MarkOnScreen(uint64_t presentId, Clock::time_point time)
+{
+	// the present completes a frame or two after it was queued, search back from the newest
+	for (size_t i = records.size(); i > 0 && i + 8 > records.size(); i--)
+	{
+		if (records[i - 1].presentId == presentId)
+		{
+			records[i - 1].times[(size_t)LatencyMarker::OnScreen] = std::chrono::duration<double, std::milli>(time - origin).count();
+			return;
+		}
+	}
+}
+
+std::vector<double> LatencyTracer::Span(LatencyMarker marker) const
+{
+	std::vector<double> span;
+	for (const FrameRecord& record : records)
+	{
+		double end = record.times[(size_t)marker];
+		if (end >= 0.0)
+		{
+			span.push_back(end - record.times[(size_t)LatencyMarker::Input]);
+		}
+	}
+	std::sort(span.begin(), span.end());
+	return span;
+}
+
+void LatencyTracer::PrintSummary() const
+{
+	std::cout << "latency trace, " << records.size() << " frames" << (dropped ? " (later frames not traced)" : "") << ", input to:" << std::endl;
+	for (uint32_t marker = 1; marker < (uint32_t)LatencyMarker::Count; marker++)
+	{
+		std::vector<double> span = Span((LatencyMarker)marker);
+		if (span.empty())
+		{
+			continue;
+		}
+		double avg = std::accumulate(span.begin(), span.end(), 0.0) / span.size();
+		std::cout << "  " << kMarkerNames[marker] << ": avg " << avg << " ms, p50 " << Percentile(span, 0.5) << " ms, p99 "
+			<< Percentile(span, 0.99) << " ms, max " << span.back() << " ms" << std::endl;
+	}
+}
+
+void LatencyTracer::WriteJson(const std::string& path) const
+{
+	std::ofstream file(path);
+	if (!file)
+	{
+		std::cout << "fail to write latency trace " << path << std::endl;
+		return;
+	}
+
+	auto writeTime = [&](double time)
+		{
+			if (time < 0.0)
+			{
+				file << "null";
+			}
+			else
+			{
+				file << time;
+			}
+		};
+
+	file << "{\n  \"unit\": \"ms\",\n  \"frames\": [";
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		const FrameRecord& record = records[i];
+		file << (i == 0 ? "\n" : ",\n") << "    {\"id\": " << record.id << ", \"presentId\": " << record.presentId;
+		for (uint32_t marker = 0; marker < (uint32_t)LatencyMarker::Count; marker++)
+		{
+			file << ", \"" << kMarkerNames[marker] << "\": ";
+			writeTime(record.times[marker]);
+		}
+		file << ", \"gpuDuration\": ";
+		writeTime(record.gpuMs);
+		file << "}";
+	}
+
+	// one histogram per span from input, the last bucket also counts everything above it
+	file << "\n  ],\n  \"histogramBucketMs\": " << kHistogramBucketMs << ",\n  \"histograms\": {";
+	bool first = true;
+	for (uint32_t marker = 1; marker < (uint32_t)LatencyMarker::Count; marker++)
+	{
+		std::vector<double> span = Span((LatencyMarker)marker);
+		if (span.empty())
+		{
+			continue;
+		}
+		std::vector<uint32_t> buckets(kHistogramBuckets, 0);
+		for (double value : span)
+		{
+			buckets[std::min((uint32_t)(std::max(value, 0.0) / kHistogramBucketMs), kHistogramBuckets - 1)]++;
+		}
+		double avg = std::accumulate(span.begin(), span.end(), 0.0) / span.size();
+		file << (first ? "\n" : ",\n") << "    \"" << kMarkerNames[marker] << "\": {\"count\": " << span.size() << ", \"avg\": " << avg
+			<< ", \"p50\": " << Percentile(span, 0.5) << ", \"p99\": " << Percentile(span, 0.99) << ", \"max\": " << span.back()
+			<< ", \"buckets\": [";
+		for (uint32_t bucket = 0; bucket < kHistogramBuckets; bucket++)
+		{
+			file << (bucket == 0 ? "" : ", ") << buckets[bucket];
+		}
+		file << "]}";
+		first = false;
+	}
+	file << "\n  }\n}\n";
+	std::cout << "succeed to write latency trace " << path << std::endl;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Points in the life of a frame, from reading input to the image reaching the screen
+enum class LatencyMarker : uint32_t
+{
+	// glfwPollEvents returned, or the simulation thread started the frame's snapshot
+	Input,
+	// camera, culling and uniforms are done
+	Simulation,
+	Recorded,
+	// vkQueueSubmit returned
+	Submit,
+	// timestamps around the frame's GPU work
+	GpuStart,
+	GpuEnd,
+	// vkQueuePresentKHR returned
+	Present,
+	// vkWaitForPresentKHR reported the present done, only with present wait
+	OnScreen,
+	Count,
+};
+
+// Timestamps the markers of every frame, correlated by frame id, and reports the spans from input
+// to each later marker as summaries, histograms and a JSON dump. GPU timestamps are moved onto the
+// CPU clock with VK_EXT_calibrated_timestamps; without it GpuStart and GpuEnd stay unknown and only
+// the GPU duration is reported.
+class LatencyTracer
+{
+public:
+	// frameSlots is the number of frames in flight, calibrated means VK_EXT_calibrated_timestamps is enabled
+	LatencyTracer(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, uint32_t frameSlots,
+		bool calibrated);
+	~LatencyTracer();
+
+	LatencyTracer(const LatencyTracer&) = delete;
+	LatencyTracer& operator=(const LatencyTracer&) = delete;
+
+	// starts the next frame and marks Input at the time input was read, now by default
+	void BeginFrame(std::chrono::steady_clock::time_point input = std::chrono::steady_clock::now());
+	// marks the current frame now
+	void Mark(LatencyMarker marker);
+
+	// each begins and ends its own command buffer, submitted first and last with the frame
+	void RecordGpuStart(VkCommandBuffer commandBuffer, uint32_t slot);
+	void RecordGpuEnd(VkCommandBuffer commandBuffer, uint32_t slot);
+	// after the slot's previous submission completed
+	void ResolveGpu(uint32_t slot);
+
+	// the present of the current frame carries presentId
+	void SetPresentId(uint64_t presentId);
+	void MarkOnScreen(uint64_t presentId, std::chrono::steady_clock::time_point time);
+
+	void PrintSummary() const;
+	void WriteJson(const std::string& path) const;
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct FrameRecord
+	{
+		uint64_t id;
+		uint64_t presentId;
+		// milliseconds since the tracer was created, negative when the marker never happened
+		double times[(size_t)LatencyMarker::Count];
+		double gpuMs;
+	};
+
+	double Now() const;
+	void Calibrate();
+	// GPU ticks to milliseconds on the CPU clock
+	double GpuToCpu(uint64_t ticks) const;
+	// input to marker for every frame that has both, sorted
+	std::vector<double> Span(LatencyMarker marker) const;
+
+	VkDevice device;
+	Clock::time_point origin;
+	std::vector<FrameRecord> records;
+	// index of the frame being marked, -1 before the first frame or once records are full
+	int64_t current = -1;
+	uint64_t nextId = 0;
+	bool dropped = false;
+
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	// record index each slot's queries belong to
+	std::vector<int64_t> slotRecords;
+	double timestampPeriod = 1.0;
+	uint32_t validBits = 0;
+
+	PFN_vkGetCalibratedTimestampsEXT getCalibratedTimestamps = nullptr;
+	// the clock of steady_clock is a calibrateable domain, sampled together with the device clock
+	bool hostDomain = false;
+	uint64_t calibrationTicks = 0;
+	double calibrationMs = -1.0;
+};
@@ -0,0 +1,143 @@
+#include "layout_cache.h"
+#include "spirv_reflect.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+LayoutCache::LayoutCache(VkDevice device)
+	: device(device)
+{
+}
+
+LayoutCache::~LayoutCache()
+{
+	for (const auto& entry : pipelineLayouts)
+	{
+		vkDestroyPipelineLayout(device, entry.second, nullptr);
+	}
+	for (const auto& entry : setLayouts)
+	{
+		vkDestroyDescriptorSetLayout(device, entry.second, nullptr);
+	}
+}
+
+VkDescriptorSetLayout LayoutCache::GetSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+{
+	std::vector<VkDescriptorSetLayoutBinding> sorted = bindings;
+	std::sort(sorted.begin(), sorted.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b)
+		{
+			return a.binding < b.binding;
+		});
+
+	std::vector<uint64_t> key;
+	for (const auto& binding : sorted)
+	{
+		if (binding.pImmutableSamplers != nullptr)
+		{
+			throw std::runtime_error("fail to cache descriptor set layout, immutable samplers are not supported");
+		}
+		key.insert(key.end(), { binding.binding, (uint64_t)binding.descriptorType, binding.descriptorCount, binding.stageFlags });
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto found = setLayouts.find(key);
+	if (found != setLayouts.end())
+	{
+		cacheHits++;
+		return found->second;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = (uint32_t)sorted.size();
+	layoutInfo.pBindings = sorted.data();
+
+	VkDescriptorSetLayout layout;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to create descriptor set layout");
+	}
+	setLayouts.emplace(std::move(key), layout);
+	return layout;
+}
+
+VkPipelineLayout LayoutCache::GetPipelineLayout(const std::vector<VkDescriptorSetLayout>& layouts,
+	const std::vector<VkPushConstantRange>& pushConstants)
+{
+	std::vector<uint64_t> key;
+	key.push_back(layouts.size());
+	for (VkDescriptorSetLayout layout : layouts)
+	{
+		key.push_back((uint64_t)layout);
+	}
+	for (const auto& range : pushConstants)
+	{
+		key.insert(key.end(), { range.stageFlags, range.offset, range.size });
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto found = pipelineLayouts.find(key);
+	if (found != pipelineLayouts.end())
+	{
+		cacheHits++;
+		return found->second;
+	}
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = (uint32_t)layouts.size();
+	pipelineLayoutInfo.pSetLayouts = layouts.data();
+	pipelineLayoutInfo.pushConstantRangeCount = (uint32_t)pushConstants.size();
+	pipelineLayoutInfo.pPushConstantRanges = pushConstants.data();
+
+	VkPipelineLayout layout;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to create pipeline layout");
+	}
+	pipelineLayouts.emplace(std::move(key), layout);
+	return layout;
+}
+
+std::vector<VkDescriptorSetLayout> LayoutCache::GetSetLayouts(const ShaderInterface& shaderInterface)
+{
+	std::vector<VkDescriptorSetLayout> layouts;
+	if (!shaderInterface.sets.empty())
+	{
+		uint32_t setCount = shaderInterface.sets.rbegin()->first + 1;
+		for (uint32_t set = 0; set < setCount; set++)
+		{
+			layouts.push_back(GetSetLayout(shaderInterface.Bindings(set)));
+		}
+	}
+	return layouts;
+}
+
+VkPipelineLayout LayoutCache::GetPipelineLayout(const ShaderInterface& shaderInterface)
+{
+	return GetPipelineLayout(GetSetLayouts(shaderInterface), shaderInterface.pushConstants);
+}
+
+std::vector<VkDescriptorPoolSize> LayoutCache::PoolSizes(const std::vector<VkDescriptorSetLayoutBinding>& bindings, uint32_t setCount)
+{
+	std::vector<VkDescriptorPoolSize> poolSizes;
+	for (const auto& binding : bindings)
+	{
+		auto same = std::find_if(poolSizes.begin(), poolSizes.end(),
+			[&](const VkDescriptorPoolSize& size) { return size.type == binding.descriptorType; });
+		if (same == poolSizes.end())
+		{
+			poolSizes.push_back({ binding.descriptorType, 0 });
+			same = poolSizes.end() - 1;
+		}
+		same->descriptorCount += binding.descriptorCount * setCount;
+	}
+	return poolSizes;
+}
+
+void LayoutCache::PrintStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::cout << "layout cache: " << setLayouts.size() << " set layouts, " << pipelineLayouts.size() << " pipeline layouts, "
+		<< cacheHits << " requests shared an existing layout" << std::endl;
+}
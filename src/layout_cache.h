@@ -0,0 +1,40 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+struct ShaderInterface;
+
+// Owns descriptor set layouts and pipeline layouts, handing out the same object for identical
+// definitions. Shaders with the same interface therefore share layouts, and pipelines built from
+// them stay compatible for descriptor sets bound before a pipeline switch.
+class LayoutCache
+{
+public:
+	explicit LayoutCache(VkDevice device);
+	~LayoutCache();
+
+	LayoutCache(const LayoutCache&) = delete;
+	LayoutCache& operator=(const LayoutCache&) = delete;
+
+	VkDescriptorSetLayout GetSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+	VkPipelineLayout GetPipelineLayout(const std::vector<VkDescriptorSetLayout>& setLayouts,
+		const std::vector<VkPushConstantRange>& pushConstants);
+	// one set layout for every set up to the highest one used, gaps get an empty layout
+	std::vector<VkDescriptorSetLayout> GetSetLayouts(const ShaderInterface& shaderInterface);
+	VkPipelineLayout GetPipelineLayout(const ShaderInterface& shaderInterface);
+
+	// pool sizes for setCount sets with the given bindings
+	static std::vector<VkDescriptorPoolSize> PoolSizes(const std::vector<VkDescriptorSetLayoutBinding>& bindings, uint32_t setCount);
+
+	void PrintStats();
+
+private:
+	VkDevice device;
+	std::mutex mutex;
+	std::map<std::vector<uint64_t>, VkDescriptorSetLayout> setLayouts;
+	std::map<std::vector<uint64_t>, VkPipelineLayout> pipelineLayouts;
+	uint32_t cacheHits = 0;
+};
@@ -0,0 +1,236 @@
+#include "meshlet.h"
+#include "frustum_culling.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace
+{
+	void ComputeBounds(const std::vector<glm::vec3>& positions, const MeshletData& data, const Meshlet& meshlet,
+		MeshletBounds& bounds)
+	{
+		glm::vec3 boxMin(std::numeric_limits<float>::max());
+		glm::vec3 boxMax(-std::numeric_limits<float>::max());
+		for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+		{
+			const glm::vec3& p = positions[data.vertices[meshlet.vertexOffset + i]];
+			boxMin = glm::min(boxMin, p);
+			boxMax = glm::max(boxMax, p);
+		}
+
+		glm::vec3 center = (boxMin + boxMax) * 0.5f;
+		float radius = 0.0f;
+		for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+		{
+			radius = std::max(radius, glm::length(positions[data.vertices[meshlet.vertexOffset + i]] - center));
+		}
+		bounds.sphere = glm::vec4(center, radius);
+
+		std::vector<glm::vec3> normals;
+		std::vector<glm::vec3> corners;
+		normals.reserve(meshlet.triangleCount);
+		corners.reserve(meshlet.triangleCount);
+		glm::vec3 axis(0.0f);
+		for (uint32_t t = 0; t < meshlet.triangleCount; t++)
+		{
+			const uint8_t* tri = &data.triangles[meshlet.triangleOffset + t * 3];
+			glm::vec3 p0 = positions[data.vertices[meshlet.vertexOffset + tri[0]]];
+			glm::vec3 p1 = positions[data.vertices[meshlet.vertexOffset + tri[1]]];
+			glm::vec3 p2 = positions[data.vertices[meshlet.vertexOffset + tri[2]]];
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+			if (area <= 0.0f)
+			{
+				continue;
+			}
+			normal /= area;
+			normals.push_back(normal);
+			corners.push_back(p0);
+			axis += normal;
+		}
+
+		// cutoff 1 never passes the backface test, used when the normals are too spread out
+		bounds.coneApex = glm::vec4(center, 0.0f);
+		bounds.coneAxis = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+		float axisLength = glm::length(axis);
+		if (normals.empty() || axisLength <= 0.0f)
+		{
+			return;
+		}
+		axis /= axisLength;
+
+		float minDot = 1.0f;
+		for (const auto& normal : normals)
+		{
+			minDot = std::min(minDot, glm::dot(axis, normal));
+		}
+		if (minDot <= 0.1f)
+		{
+			return;
+		}
+
+		// move the apex back along the axis until every triangle plane is in front of it
+		float maxT = 0.0f;
+		for (size_t i = 0; i < normals.size(); i++)
+		{
+			float t = glm::dot(center - corners[i], normals[i]) / glm::dot(axis, normals[i]);
+			maxT = std::max(maxT, t);
+		}
+
+		bounds.coneApex = glm::vec4(center - axis * maxT, 0.0f);
+		bounds.coneAxis = glm::vec4(axis, std::sqrt(1.0f - minDot * minDot));
+	}
+}
+
+MeshletData BuildMeshlets(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices)
+{
+	MeshletData data;
+	std::vector<int32_t> localIndex(positions.size(), -1);
+
+	Meshlet current = {};
+	auto flush = [&]()
+		{
+			if (current.triangleCount == 0)
+			{
+				return;
+			}
+			for (uint32_t i = 0; i < current.vertexCount; i++)
+			{
+				localIndex[data.vertices[current.vertexOffset + i]] = -1;
+			}
+			data.meshlets.push_back(current);
+
+			current = {};
+			current.vertexOffset = (uint32_t)data.vertices.size();
+			current.triangleOffset = (uint32_t)data.triangles.size();
+		};
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		uint32_t newVertices = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			newVertices += localIndex[indices[i + k]] < 0 ? 1 : 0;
+		}
+		if (current.vertexCount + newVertices > MeshletData::kMaxVertices ||
+			current.triangleCount + 1 > MeshletData::kMaxTriangles)
+		{
+			flush();
+		}
+
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t vertex = indices[i + k];
+			if (localIndex[vertex] < 0)
+			{
+				localIndex[vertex] = (int32_t)current.vertexCount++;
+				data.vertices.push_back(vertex);
+			}
+			data.triangles.push_back((uint8_t)localIndex[vertex]);
+		}
+		current.triangleCount++;
+	}
+	flush();
+
+	// the shaders read the triangle bytes through a uint array
+	data.triangles.resize((data.triangles.size() + 3) / 4 * 4, 0);
+
+	data.bounds.resize(data.meshlets.size());
+	for (size_t i = 0; i < data.meshlets.size(); i++)
+	{
+		ComputeBounds(positions, data, data.meshlets[i], data.bounds[i]);
+	}
+	return data;
+}
+
+bool IsMeshletBackfacing(const MeshletBounds& bounds, const glm::vec3& cameraPosition)
+{
+	glm::vec3 toApex = glm::vec3(bounds.coneApex) - cameraPosition;
+	float length = glm::length(toApex);
+	return length > 0.0f && glm::dot(toApex / length, glm::vec3(bounds.coneAxis)) >= bounds.coneAxis.w;
+}
+
+void RunMeshletBenchmark(uint32_t sphereSegments)
+{
+	// uv sphere with sphereSegments * sphereSegments / 2 quads
+	uint32_t rings = std::max(2u, sphereSegments / 2);
+	uint32_t segments = std::max(3u, sphereSegments);
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> indices;
+	for (uint32_t r = 0; r <= rings; r++)
+	{
+		float phi = glm::pi<float>() * r / rings;
+		for (uint32_t s = 0; s <= segments; s++)
+		{
+			float theta = 2.0f * glm::pi<float>() * s / segments;
+			positions.emplace_back(std::sin(phi) * std::cos(theta), std::sin(phi) * std::sin(theta), std::cos(phi));
+		}
+	}
+	for (uint32_t r = 0; r < rings; r++)
+	{
+		for (uint32_t s = 0; s < segments; s++)
+		{
+			uint32_t a = r * (segments + 1) + s;
+			uint32_t b = a + segments + 1;
+			indices.insert(indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+		}
+	}
+	uint32_t triangleCount = (uint32_t)indices.size() / 3;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	MeshletData data = BuildMeshlets(positions, indices);
+	auto end = std::chrono::high_resolution_clock::now();
+
+	size_t vertexTotal = 0;
+	for (const auto& meshlet : data.meshlets)
+	{
+		vertexTotal += meshlet.vertexCount;
+	}
+	std::cout << "meshlet benchmark: " << triangleCount << " triangles, " << data.meshlets.size() << " meshlets, avg "
+		<< (float)vertexTotal / data.meshlets.size() << " vertices / " << (float)triangleCount / data.meshlets.size()
+		<< " triangles, built in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+
+	// same projection as HelloTriangleApplication::UpdateUniformBuffer, camera circling the sphere
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), 1400.0f / 1200.0f, 0.1f, 10.0f);
+	proj[1][1] *= -1;
+	const float distances[] = { 4.0f, 2.0f, 1.3f };
+	for (float distance : distances)
+	{
+		uint64_t frustumCulled = 0;
+		uint64_t coneCulled = 0;
+		const uint32_t views = 16;
+		for (uint32_t v = 0; v < views; v++)
+		{
+			float angle = 2.0f * glm::pi<float>() * v / views;
+			glm::vec3 eye(distance * std::cos(angle), distance * std::sin(angle), 0.5f * distance);
+			Frustum frustum = ExtractFrustumPlanes(proj * glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
+
+			for (size_t i = 0; i < data.meshlets.size(); i++)
+			{
+				const MeshletBounds& bounds = data.bounds[i];
+				bool outside = false;
+				for (const auto& plane : frustum.planes)
+				{
+					outside |= glm::dot(glm::vec3(plane), glm::vec3(bounds.sphere)) + plane.w < -bounds.sphere.w;
+				}
+				if (outside)
+				{
+					frustumCulled += data.meshlets[i].triangleCount;
+				}
+				else if (IsMeshletBackfacing(bounds, eye))
+				{
+					coneCulled += data.meshlets[i].triangleCount;
+				}
+			}
+		}
+
+		double total = (double)triangleCount * views;
+		std::cout << "  camera distance " << distance << ": " << 100.0 * frustumCulled / total << "% triangles frustum culled, "
+			<< 100.0 * coneCulled / total << "% cone culled, " << 100.0 * (frustumCulled + coneCulled) / total
+			<< "% never reach the mesh shader" << std::endl;
+	}
+}
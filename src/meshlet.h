@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Matches the Meshlet struct in meshlet.task / meshlet.mesh (std430).
+struct Meshlet
+{
+	uint32_t vertexOffset;   // into MeshletData::vertices
+	uint32_t triangleOffset; // into MeshletData::triangles, in bytes
+	uint32_t vertexCount;
+	uint32_t triangleCount;
+};
+
+// Matches MeshletBounds in meshlet.task (std430).
+struct MeshletBounds
+{
+	glm::vec4 sphere;      // xyz = center, w = radius
+	glm::vec4 coneApex;    // xyz = apex
+	glm::vec4 coneAxis;    // xyz = axis, w = cutoff, the meshlet is backfacing when
+	                       // dot(normalize(apex - camera), axis) >= cutoff
+};
+
+struct MeshletData
+{
+	static constexpr uint32_t kMaxVertices = 64;
+	static constexpr uint32_t kMaxTriangles = 124;
+
+	std::vector<Meshlet> meshlets;
+	std::vector<MeshletBounds> bounds;
+	std::vector<uint32_t> vertices;  // meshlet local vertex -> mesh vertex
+	std::vector<uint8_t> triangles;  // 3 local vertex indices per triangle, padded to 4 bytes
+};
+
+// splits an indexed triangle list into meshlets of at most kMaxVertices vertices and kMaxTriangles
+// triangles, in index order, and computes a bounding sphere and normal cone for each of them
+MeshletData BuildMeshlets(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices);
+
+// cpu version of the test in meshlet.task
+bool IsMeshletBackfacing(const MeshletBounds& bounds, const glm::vec3& cameraPosition);
+
+void RunMeshletBenchmark(uint32_t sphereSegments);
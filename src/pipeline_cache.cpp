@@ -0,0 +1,219 @@
+#include "pipeline_cache.h"
+#include "thread_pool.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+	const uint32_t kFileMagic = 0x43505643; // "CVPC"
+	const uint32_t kFileVersion = 1;
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t dataSize;
+		uint64_t dataHash;
+	};
+
+	uint64_t HashBytes(const char* data, size_t size)
+	{
+		// FNV-1a
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= (uint8_t)data[i];
+			hash *= 0x100000001b3ull;
+		}
+		return hash;
+	}
+}
+
+PipelineCache::PipelineCache(VkDevice device, VkPhysicalDevice physicalDevice, std::string path)
+	: device(device), path(std::move(path)), writer(std::make_unique<ThreadPool>(1))
+{
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	if (!Load())
+	{
+		VkPipelineCacheCreateInfo cacheInfo = {};
+		cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create pipeline cache");
+		}
+	}
+	lastSave = Clock::now();
+}
+
+PipelineCache::~PipelineCache()
+{
+	// a background save may still read the cache
+	writer.reset();
+	vkDestroyPipelineCache(device, cache, nullptr);
+}
+
+bool PipelineCache::Load()
+{
+	std::ifstream ifs(path, std::ios::binary);
+	if (!ifs.is_open())
+	{
+		std::cout << "pipeline cache: no cache at " << path << ", starting cold" << std::endl;
+		return false;
+	}
+
+	FileHeader header = {};
+	ifs.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!ifs || header.magic != kFileMagic || header.version != kFileVersion || header.dataSize > (1ull << 30))
+	{
+		std::cout << "pipeline cache: " << path << " is not a cache file, ignored" << std::endl;
+		return false;
+	}
+
+	std::vector<char> blob((size_t)header.dataSize);
+	ifs.read(blob.data(), blob.size());
+	if (!ifs || HashBytes(blob.data(), blob.size()) != header.dataHash)
+	{
+		std::cout << "pipeline cache: " << path << " is truncated or corrupt, ignored" << std::endl;
+		return false;
+	}
+
+	if (!ValidateHeader(blob))
+	{
+		return false;
+	}
+
+	VkPipelineCacheCreateInfo cacheInfo = {};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.initialDataSize = blob.size();
+	cacheInfo.pInitialData = blob.data();
+	if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache) != VK_SUCCESS)
+	{
+		std::cout << "pipeline cache: driver rejected " << path << ", starting cold" << std::endl;
+		return false;
+	}
+
+	loadedBytes = blob.size();
+	std::cout << "pipeline cache: loaded " << loadedBytes << " bytes from " << path << std::endl;
+	return true;
+}
+
+bool PipelineCache::ValidateHeader(const std::vector<char>& blob) const
+{
+	VkPipelineCacheHeaderVersionOne driverHeader = {};
+	if (blob.size() < sizeof(driverHeader))
+	{
+		std::cout << "pipeline cache: blob too small, ignored" << std::endl;
+		return false;
+	}
+	memcpy(&driverHeader, blob.data(), sizeof(driverHeader));
+
+	if (driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || driverHeader.headerSize < sizeof(driverHeader))
+	{
+		std::cout << "pipeline cache: unknown header version, ignored" << std::endl;
+		return false;
+	}
+	if (driverHeader.vendorID != properties.vendorID || driverHeader.deviceID != properties.deviceID)
+	{
+		std::cout << "pipeline cache: written by another device, ignored" << std::endl;
+		return false;
+	}
+	if (memcmp(driverHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+	{
+		std::cout << "pipeline cache: written by another driver version, ignored" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void PipelineCache::Save()
+{
+	writer->WaitIdle();
+	dirty = false;
+	Write();
+	lastSave = Clock::now();
+}
+
+void PipelineCache::Write()
+{
+	// vkGetPipelineCacheData may run while the registry workers create pipelines with the same
+	// cache, whatever they add after this point is saved the next time
+	size_t size = 0;
+	if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS || size == 0)
+	{
+		return;
+	}
+	std::vector<char> blob(size);
+	if (vkGetPipelineCacheData(device, cache, &size, blob.data()) != VK_SUCCESS)
+	{
+		// VK_INCOMPLETE when pipelines were added since the size query, saved on the next attempt
+		dirty = true;
+		return;
+	}
+	blob.resize(size);
+
+	FileHeader header = {};
+	header.magic = kFileMagic;
+	header.version = kFileVersion;
+	header.dataSize = blob.size();
+	header.dataHash = HashBytes(blob.data(), blob.size());
+
+	std::string tmpPath = path + ".tmp";
+	{
+		std::ofstream ofs(tmpPath, std::ios::binary | std::ios::trunc);
+		ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		ofs.write(blob.data(), blob.size());
+		if (!ofs)
+		{
+			std::cout << "pipeline cache: fail to write " << tmpPath << std::endl;
+			dirty = true;
+			return;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tmpPath, path, error);
+	if (error)
+	{
+		std::cout << "pipeline cache: fail to replace " << path << ": " << error.message() << std::endl;
+		dirty = true;
+	}
+}
+
+void PipelineCache::SaveIfDue(double intervalSeconds)
+{
+	if (!dirty || saving || std::chrono::duration<double>(Clock::now() - lastSave).count() < intervalSeconds)
+	{
+		return;
+	}
+
+	// cleared before the blob is taken, so pipelines created during the save mark it dirty again
+	dirty = false;
+	saving = true;
+	lastSave = Clock::now();
+	writer->Submit([this]
+		{
+			Write();
+			saving = false;
+		});
+}
+
+void PipelineCache::AddCreationTime(double milliseconds)
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+	createdPipelines++;
+	creationMilliseconds += milliseconds;
+	dirty = true;
+}
+
+void PipelineCache::PrintStats(const char* label)
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+	std::cout << "pipeline cache: " << label << " created " << createdPipelines << " pipelines in " << creationMilliseconds
+		<< " ms (" << (IsWarm() ? "warm" : "cold") << " start)" << std::endl;
+	createdPipelines = 0;
+	creationMilliseconds = 0.0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// VkPipelineCache persisted to disk. The file is our own small header followed by the driver blob,
+// the blob is only handed to the driver when its header matches the current device.
+class PipelineCache
+{
+public:
+	PipelineCache(VkDevice device, VkPhysicalDevice physicalDevice, std::string path);
+	~PipelineCache();
+
+	PipelineCache(const PipelineCache&) = delete;
+	PipelineCache& operator=(const PipelineCache&) = delete;
+
+	VkPipelineCache Get() const { return cache; }
+	bool IsWarm() const { return loadedBytes > 0; }
+
+	// writes to path.tmp and renames it over path, so a crash never leaves a half written cache.
+	// Waits for a save started by SaveIfDue first
+	void Save();
+	// when pipelines were created since the last save and the interval has passed, starts a save on
+	// a background thread so the frame that triggers it doesn't pay for the blob and the file
+	void SaveIfDue(double intervalSeconds);
+
+	// pipeline creation timing, reported by PrintStats
+	void AddCreationTime(double milliseconds);
+	void PrintStats(const char* label);
+
+private:
+	bool Load();
+	bool ValidateHeader(const std::vector<char>& blob) const;
+	void Write();
+
+	using Clock = std::chrono::steady_clock;
+
+	VkDevice device;
+	VkPhysicalDeviceProperties properties;
+	std::string path;
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	size_t loadedBytes = 0;
+
+	Clock::time_point lastSave;
+	std::atomic<bool> dirty{ false };
+	// one thread, so background saves never overlap
+	std::unique_ptr<ThreadPool> writer;
+	std::atomic<bool> saving{ false };
+
+	std::mutex statsMutex;
+	uint32_t createdPipelines = 0;
+	double creationMilliseconds = 0.0;
+};
@@ -0,0 +1,45 @@
+#include "pipeline_library.h"
+#include <iostream>
+
+PipelineLibraryCache::PipelineLibraryCache(VkDevice device)
+	: device(device)
+{
+}
+
+PipelineLibraryCache::~PipelineLibraryCache()
+{
+	for (const auto& entry : libraries)
+	{
+		vkDestroyPipeline(device, entry.second, nullptr);
+	}
+}
+
+VkPipeline PipelineLibraryCache::Get(const std::string& key, const std::function<VkPipeline()>& create)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto found = libraries.find(key);
+		if (found != libraries.end())
+		{
+			cacheHits++;
+			return found->second;
+		}
+	}
+
+	VkPipeline library = create();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto inserted = libraries.emplace(key, library);
+	if (!inserted.second)
+	{
+		vkDestroyPipeline(device, library, nullptr);
+	}
+	return inserted.first->second;
+}
+
+void PipelineLibraryCache::PrintStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::cout << "pipeline library cache: " << libraries.size() << " parts, "
+		<< cacheHits << " links reused an existing part" << std::endl;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Owns the VK_EXT_graphics_pipeline_library parts (vertex input, pre-rasterization, fragment shader
+// and fragment output) that linked pipelines are built from. Parts are looked up by
+// GraphicsPipelineDesc::LibraryKey, so a new pipeline only compiles the parts no earlier pipeline had.
+class PipelineLibraryCache
+{
+public:
+	explicit PipelineLibraryCache(VkDevice device);
+	~PipelineLibraryCache();
+
+	PipelineLibraryCache(const PipelineLibraryCache&) = delete;
+	PipelineLibraryCache& operator=(const PipelineLibraryCache&) = delete;
+
+	// returns the part stored under key, or calls create and stores its result. create runs without
+	// the lock held, when two threads build the same part the second one is destroyed
+	VkPipeline Get(const std::string& key, const std::function<VkPipeline()>& create);
+
+	void PrintStats();
+
+private:
+	VkDevice device;
+	std::mutex mutex;
+	std::unordered_map<std::string, VkPipeline> libraries;
+	uint32_t cacheHits = 0;
+};
@@ -0,0 +1,523 @@
+#include "pipeline_registry.h"
+#include "dynamic_state.h"
+#include "thread_pool.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+	uint64_t HashString(const std::string& text)
+	{
+		// FNV-1a
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (char c : text)
+		{
+			hash ^= (uint8_t)c;
+			hash *= 0x100000001b3ull;
+		}
+		return hash;
+	}
+
+	std::vector<std::string> Split(const std::string& line, char separator)
+	{
+		std::vector<std::string> fields;
+		std::stringstream stream(line);
+		std::string field;
+		while (std::getline(stream, field, separator))
+		{
+			fields.push_back(field);
+		}
+		return fields;
+	}
+
+	// the whole field has to be a number, so lines written by an older layout are rejected
+	bool ParseNumber(const std::string& field, unsigned long& value)
+	{
+		size_t used = 0;
+		value = std::stoul(field, &used);
+		return used == field.size();
+	}
+
+	// b:binding,stride,inputRate;a:location,binding,format,offset;... or - without vertex input
+	std::string SerializeVertexLayout(const std::vector<VkVertexInputBindingDescription>& bindings,
+		const std::vector<VkVertexInputAttributeDescription>& attributes)
+	{
+		if (bindings.empty() && attributes.empty())
+		{
+			return "-";
+		}
+
+		std::ostringstream layout;
+		const char* separator = "";
+		for (const auto& binding : bindings)
+		{
+			layout << separator << "b:" << binding.binding << ',' << binding.stride << ',' << (int)binding.inputRate;
+			separator = ";";
+		}
+		for (const auto& attribute : attributes)
+		{
+			layout << separator << "a:" << attribute.location << ',' << attribute.binding << ',' << (int)attribute.format
+				<< ',' << attribute.offset;
+			separator = ";";
+		}
+		return layout.str();
+	}
+
+	bool ParseVertexLayout(const std::string& field, std::vector<VkVertexInputBindingDescription>& bindings,
+		std::vector<VkVertexInputAttributeDescription>& attributes)
+	{
+		if (field == "-")
+		{
+			return true;
+		}
+
+		for (const std::string& entry : Split(field, ';'))
+		{
+			if (entry.size() < 2 || entry[1] != ':' || (entry[0] != 'b' && entry[0] != 'a'))
+			{
+				return false;
+			}
+			std::vector<std::string> numbers = Split(entry.substr(2), ',');
+			unsigned long values[4] = {};
+			if (numbers.size() != (entry[0] == 'b' ? 3u : 4u))
+			{
+				return false;
+			}
+			for (size_t i = 0; i < numbers.size(); i++)
+			{
+				if (!ParseNumber(numbers[i], values[i]))
+				{
+					return false;
+				}
+			}
+
+			if (entry[0] == 'b')
+			{
+				bindings.push_back({ (uint32_t)values[0], (uint32_t)values[1], (VkVertexInputRate)values[2] });
+			}
+			else
+			{
+				attributes.push_back({ (uint32_t)values[0], (uint32_t)values[1], (VkFormat)values[2], (uint32_t)values[3] });
+			}
+		}
+		return true;
+	}
+}
+
+// layout|vertexLayout|cullMode|depthWrite|depthCompare|blendEnable|colorWriteMask|colorFormat|depthFormat|features|dynamicState|stage:path|...
+std::string GraphicsPipelineDesc::Serialize() const
+{
+	std::ostringstream line;
+	line << layout << '|' << SerializeVertexLayout(vertexBindings, vertexAttributes) << '|' << cullMode << '|' << depthWrite << '|' << (int)depthCompare << '|'
+		<< blendEnable << '|' << colorWriteMask << '|' << (int)colorFormat << '|' << (int)depthFormat << '|' << features
+		<< '|' << dynamicState;
+	for (const auto& shader : shaders)
+	{
+		line << '|' << (uint32_t)shader.first << ':' << shader.second;
+	}
+	return line.str();
+}
+
+bool GraphicsPipelineDesc::Parse(const std::string& line, GraphicsPipelineDesc& desc)
+{
+	const size_t kFixedFields = 11;
+	std::vector<std::string> fields = Split(line, '|');
+	if (fields.size() <= kFixedFields)
+	{
+		return false;
+	}
+
+	try
+	{
+		unsigned long values[kFixedFields] = {};
+		for (size_t i = 2; i < kFixedFields; i++)
+		{
+			if (!ParseNumber(fields[i], values[i]))
+			{
+				return false;
+			}
+		}
+
+		desc = GraphicsPipelineDesc();
+		desc.layout = fields[0];
+		if (!ParseVertexLayout(fields[1], desc.vertexBindings, desc.vertexAttributes))
+		{
+			return false;
+		}
+		desc.cullMode = (VkCullModeFlags)values[2];
+		desc.depthWrite = values[3] != 0;
+		desc.depthCompare = (VkCompareOp)values[4];
+		desc.blendEnable = values[5] != 0;
+		desc.colorWriteMask = (VkColorComponentFlags)values[6];
+		desc.colorFormat = (VkFormat)values[7];
+		desc.depthFormat = (VkFormat)values[8];
+		desc.features = (uint32_t)values[9];
+		desc.dynamicState = (uint32_t)values[10];
+		for (size_t i = kFixedFields; i < fields.size(); i++)
+		{
+			size_t colon = fields[i].find(':');
+			if (colon == std::string::npos)
+			{
+				return false;
+			}
+			desc.shaders.emplace_back((VkShaderStageFlagBits)std::stoul(fields[i].substr(0, colon)), fields[i].substr(colon + 1));
+		}
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+	return true;
+}
+
+GraphicsPipelineDesc GraphicsPipelineDesc::WithDynamicState(uint32_t groups) const
+{
+	const GraphicsPipelineDesc defaults;
+	GraphicsPipelineDesc desc = *this;
+	desc.dynamicState = groups;
+	if (HasDynamicState(groups, DynamicStateGroup::Extended))
+	{
+		desc.cullMode = defaults.cullMode;
+		desc.depthWrite = defaults.depthWrite;
+		desc.depthCompare = defaults.depthCompare;
+	}
+	if (HasDynamicState(groups, DynamicStateGroup::Extended3Blend))
+	{
+		desc.blendEnable = defaults.blendEnable;
+		desc.colorWriteMask = defaults.colorWriteMask;
+	}
+	return desc;
+}
+
+uint64_t GraphicsPipelineDesc::Key() const
+{
+	return HashString(Serialize());
+}
+
+std::string GraphicsPipelineDesc::LibraryKey(VkGraphicsPipelineLibraryFlagBitsEXT part) const
+{
+	std::ostringstream key;
+	key << (uint32_t)part << '|' << dynamicState << '|';
+	switch (part)
+	{
+	case VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT:
+		key << SerializeVertexLayout(vertexBindings, vertexAttributes);
+		break;
+	case VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT:
+		key << layout << '|' << cullMode;
+		for (const auto& shader : shaders)
+		{
+			if (shader.first != VK_SHADER_STAGE_FRAGMENT_BIT)
+			{
+				key << '|' << (uint32_t)shader.first << ':' << shader.second;
+			}
+		}
+		break;
+	case VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT:
+		key << layout << '|' << depthWrite << '|' << (int)depthCompare << '|' << features;
+		for (const auto& shader : shaders)
+		{
+			if (shader.first == VK_SHADER_STAGE_FRAGMENT_BIT)
+			{
+				key << '|' << shader.second;
+			}
+		}
+		break;
+	case VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT:
+		key << blendEnable << '|' << colorWriteMask << '|' << (int)colorFormat << '|' << (int)depthFormat;
+		break;
+	default:
+		throw std::runtime_error("fail to build library key, unknown pipeline library part");
+	}
+	return key.str();
+}
+
+PipelineRegistry::PipelineRegistry(VkDevice device, Builder builder, uint32_t threadCount, bool libraryLinking)
+	: device(device), builder(std::move(builder)), libraryLinking(libraryLinking), workers(std::make_unique<ThreadPool>(threadCount))
+{
+	if (libraryLinking)
+	{
+		optimizer = std::make_unique<ThreadPool>(1);
+	}
+}
+
+PipelineRegistry::~PipelineRegistry()
+{
+	WaitIdle();
+	workers.reset();
+	optimizer.reset();
+
+	for (const auto& entry : entries)
+	{
+		if (entry.second.pipeline != VK_NULL_HANDLE)
+		{
+			vkDestroyPipeline(device, entry.second.pipeline, nullptr);
+		}
+	}
+	for (VkPipeline pipeline : retired)
+	{
+		vkDestroyPipeline(device, pipeline, nullptr);
+	}
+}
+
+void PipelineRegistry::RegisterLayout(const std::string& name, VkPipelineLayout layout)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	layouts[name] = layout;
+}
+
+void PipelineRegistry::SetRenderTargetFormats(VkFormat color, VkFormat depth)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	colorFormat = color;
+	depthFormat = depth;
+}
+
+void PipelineRegistry::SetDynamicState(uint32_t groups)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	dynamicState = groups;
+}
+
+uint64_t PipelineRegistry::Request(const GraphicsPipelineDesc& fullDesc)
+{
+	GraphicsPipelineDesc desc;
+	uint64_t key;
+	VkPipelineLayout layout;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		desc = fullDesc.WithDynamicState(dynamicState);
+		key = desc.Key();
+		auto existing = entries.find(key);
+		if (existing != entries.end())
+		{
+			// the key is only a hash, two descs sharing it would silently draw with the wrong pipeline
+			if (existing->second.desc.Serialize() != desc.Serialize())
+			{
+				throw std::runtime_error("fail to request pipeline, key collision between " + existing->second.desc.Serialize()
+					+ " and " + desc.Serialize());
+			}
+			duplicateRequests++;
+			return key;
+		}
+
+		auto found = layouts.find(desc.layout);
+		if (found == layouts.end())
+		{
+			throw std::runtime_error("fail to request pipeline, layout " + desc.layout + " is not registered");
+		}
+		layout = found->second;
+
+		Entry entry;
+		entry.desc = desc;
+		entries.emplace(key, std::move(entry));
+	}
+
+	workers->Submit([this, key, desc, layout] { Compile(key, desc, layout); });
+	return key;
+}
+
+VkPipeline PipelineRegistry::Build(const GraphicsPipelineDesc& desc, VkPipelineLayout layout, PipelineLink link, std::string& error)
+{
+	// runs on the worker threads, so nothing is printed here
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	auto start = std::chrono::high_resolution_clock::now();
+	try
+	{
+		pipeline = builder(desc, layout, link);
+	}
+	catch (const std::exception& e)
+	{
+		error = e.what();
+	}
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	if (pipeline != VK_NULL_HANDLE)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		buildCounts[(int)link]++;
+		buildMilliseconds[(int)link] += milliseconds;
+	}
+	return pipeline;
+}
+
+void PipelineRegistry::Compile(uint64_t key, const GraphicsPipelineDesc& desc, VkPipelineLayout layout)
+{
+	std::string error;
+	VkPipeline pipeline = Build(desc, layout, libraryLinking ? PipelineLink::Fast : PipelineLink::Monolithic, error);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Entry& entry = entries[key];
+		entry.pipeline = pipeline;
+		entry.state = pipeline != VK_NULL_HANDLE ? State::Ready : State::Failed;
+		entry.error = error;
+	}
+	compiled.notify_all();
+
+	if (libraryLinking && pipeline != VK_NULL_HANDLE)
+	{
+		optimizer->Submit([this, key, desc, layout] { Optimize(key, desc, layout); });
+	}
+}
+
+void PipelineRegistry::Optimize(uint64_t key, const GraphicsPipelineDesc& desc, VkPipelineLayout layout)
+{
+	// the fast linked pipeline keeps working when the optimized link fails
+	std::string error;
+	VkPipeline pipeline = Build(desc, layout, PipelineLink::Optimized, error);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	Entry& entry = entries[key];
+	if (pipeline == VK_NULL_HANDLE)
+	{
+		entry.error = "optimized link: " + error;
+		return;
+	}
+	retired.push_back(entry.pipeline);
+	entry.pipeline = pipeline;
+	entry.optimized = true;
+}
+
+VkPipeline PipelineRegistry::Acquire(uint64_t key)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto found = entries.find(key);
+	if (found == entries.end() || found->second.state != State::Ready)
+	{
+		missedAcquires++;
+		return VK_NULL_HANDLE;
+	}
+	return found->second.pipeline;
+}
+
+VkPipeline PipelineRegistry::Wait(uint64_t key)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	auto found = entries.find(key);
+	if (found == entries.end())
+	{
+		throw std::runtime_error("fail to wait for pipeline, it was never requested");
+	}
+
+	// entries are never erased while the registry is alive, so the iterator stays valid
+	compiled.wait(lock, [&] { return found->second.state != State::Compiling; });
+	if (found->second.state == State::Failed)
+	{
+		throw std::runtime_error("fail to create graphics pipeline " + found->second.desc.Serialize() + ": " + found->second.error);
+	}
+	return found->second.pipeline;
+}
+
+void PipelineRegistry::WaitIdle()
+{
+	workers->WaitIdle();
+	if (optimizer)
+	{
+		optimizer->WaitIdle();
+	}
+}
+
+std::vector<VkPipeline> PipelineRegistry::TakeRetired()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<VkPipeline> taken;
+	taken.swap(retired);
+	return taken;
+}
+
+void PipelineRegistry::Prewarm(const std::string& path)
+{
+	std::ifstream ifs(path);
+	if (!ifs.is_open())
+	{
+		return;
+	}
+
+	uint32_t requested = 0;
+	std::string line;
+	while (std::getline(ifs, line))
+	{
+		GraphicsPipelineDesc desc;
+		if (!GraphicsPipelineDesc::Parse(line, desc))
+		{
+			continue;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (entries.count(desc.Key()) > 0 || layouts.count(desc.layout) == 0
+				|| desc.colorFormat != colorFormat || desc.depthFormat != depthFormat || desc.dynamicState != dynamicState)
+			{
+				continue;
+			}
+		}
+		Request(desc);
+		requested++;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	prewarmed += requested;
+	std::cout << "succeed to prewarm " << requested << " pipelines from " << path << std::endl;
+}
+
+void PipelineRegistry::SaveKeys(const std::string& path)
+{
+	std::ofstream ofs(path, std::ios::trunc);
+	if (!ofs.is_open())
+	{
+		std::cerr << "fail to write pipeline keys to " << path << std::endl;
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for (const auto& entry : entries)
+	{
+		if (entry.second.state != State::Failed)
+		{
+			ofs << entry.second.desc.Serialize() << '\n';
+		}
+	}
+}
+
+void PipelineRegistry::PrintStats(const char* label)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	uint32_t ready = 0, compiling = 0, failed = 0, optimized = 0;
+	std::vector<const Entry*> errors;
+	for (const auto& entry : entries)
+	{
+		ready += entry.second.state == State::Ready;
+		compiling += entry.second.state == State::Compiling;
+		failed += entry.second.state == State::Failed;
+		optimized += entry.second.optimized;
+		if (!entry.second.error.empty())
+		{
+			errors.push_back(&entry.second);
+		}
+	}
+	std::cout << "pipeline registry (" << label << "): " << ready << " ready, " << compiling << " compiling, "
+		<< failed << " failed, " << prewarmed << " prewarmed, " << duplicateRequests << " duplicate requests, "
+		<< missedAcquires << " acquires before the pipeline was ready" << std::endl;
+	if (libraryLinking)
+	{
+		std::cout << "  " << optimized << " of " << ready << " ready pipelines use the optimized link" << std::endl;
+	}
+
+	const char* linkNames[] = { "monolithic", "missing parts + fast link", "optimized link" };
+	for (int link = 0; link < 3; link++)
+	{
+		if (buildCounts[link] > 0)
+		{
+			std::cout << "  " << linkNames[link] << ": " << buildCounts[link] << " pipelines, "
+				<< buildMilliseconds[link] / buildCounts[link] << " ms average" << std::endl;
+		}
+	}
+	for (const Entry* entry : errors)
+	{
+		std::cerr << "  fail to compile pipeline " << entry->desc.Serialize() << ": " << entry->error << std::endl;
+	}
+}
@@ -0,0 +1,146 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class ThreadPool;
+
+// Everything that goes into a scene graphics pipeline. The layout is referenced by the name it was
+// registered under so a desc can be written to the key list and read back in the next run.
+struct GraphicsPipelineDesc
+{
+	std::vector<std::pair<VkShaderStageFlagBits, std::string>> shaders;
+	std::string layout;
+	// empty when the pipeline reads no vertex buffer (depth-only proxies, mesh shading)
+	std::vector<VkVertexInputBindingDescription> vertexBindings;
+	std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+	VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+	bool depthWrite = true;
+	VkCompareOp depthCompare = VK_COMPARE_OP_LESS;
+	bool blendEnable = false;
+	VkColorComponentFlags colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT
+		| VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	VkFormat colorFormat = VK_FORMAT_UNDEFINED;
+	VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+	// ShaderFeatures mask, passed to the fragment stage as a specialization constant
+	uint32_t features = 0;
+	// DynamicStateGroup mask the pipeline is built with, the states in it are set at record time
+	uint32_t dynamicState = 0;
+
+	// a copy built with groups, the fields they make dynamic are reset to their defaults so descs
+	// that only differ there get the same key
+	GraphicsPipelineDesc WithDynamicState(uint32_t groups) const;
+
+	// one line of the key list, the key is the hash of this line
+	std::string Serialize() const;
+	static bool Parse(const std::string& line, GraphicsPipelineDesc& desc);
+	uint64_t Key() const;
+
+	// only the fields that go into one VK_EXT_graphics_pipeline_library part, so pipelines that
+	// differ elsewhere share the library for this part
+	std::string LibraryKey(VkGraphicsPipelineLibraryFlagBitsEXT part) const;
+};
+
+enum class PipelineLink
+{
+	// one vkCreateGraphicsPipelines call with the whole state
+	Monolithic,
+	// links precompiled library parts without link time optimization, cheap enough for first use
+	Fast,
+	// links the same parts with link time optimization, replaces the fast linked pipeline
+	Optimized,
+};
+
+// Compiles graphics pipelines on worker threads. Requests with the same state share one pipeline,
+// draws check Acquire every frame and fall back (or skip) until their pipeline is ready.
+// With library linking a request is ready after the fast link, the optimized link runs on a
+// separate thread so it never delays new requests, and Acquire returns it once it is done.
+class PipelineRegistry
+{
+public:
+	using Builder = std::function<VkPipeline(const GraphicsPipelineDesc& desc, VkPipelineLayout layout, PipelineLink link)>;
+
+	PipelineRegistry(VkDevice device, Builder builder, uint32_t threadCount, bool libraryLinking);
+	~PipelineRegistry();
+
+	PipelineRegistry(const PipelineRegistry&) = delete;
+	PipelineRegistry& operator=(const PipelineRegistry&) = delete;
+
+	void RegisterLayout(const std::string& name, VkPipelineLayout layout);
+	// descs for other targets are ignored by Prewarm
+	void SetRenderTargetFormats(VkFormat colorFormat, VkFormat depthFormat);
+	// DynamicStateGroup mask every request is built with, descs with another mask are ignored by Prewarm
+	void SetDynamicState(uint32_t groups);
+
+	// queues the pipeline for compilation unless it is already known, returns its key. The desc is
+	// reduced to the states that are not dynamic first, so the draw sets the rest from its own desc.
+	// Throws when the key is already taken by a different desc
+	uint64_t Request(const GraphicsPipelineDesc& desc);
+	// VK_NULL_HANDLE while the pipeline is still compiling or failed to compile. The handle can
+	// change when the optimized link is swapped in, so look it up again for every frame
+	VkPipeline Acquire(uint64_t key);
+	// blocks until the pipeline is compiled, throws with the reason when it failed
+	VkPipeline Wait(uint64_t key);
+	void WaitIdle();
+
+	// fast linked pipelines replaced since the last call, the caller destroys them once the frames
+	// that may have bound them are finished
+	std::vector<VkPipeline> TakeRetired();
+
+	// requests every key recorded by SaveKeys whose layout and formats exist in this run
+	void Prewarm(const std::string& path);
+	void SaveKeys(const std::string& path);
+
+	void PrintStats(const char* label);
+
+private:
+	enum class State
+	{
+		Compiling,
+		Ready,
+		Failed,
+	};
+
+	struct Entry
+	{
+		GraphicsPipelineDesc desc;
+		State state = State::Compiling;
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		bool optimized = false;
+		// why the compile or the optimized link failed, reported by Wait and PrintStats
+		std::string error;
+	};
+
+	void Compile(uint64_t key, const GraphicsPipelineDesc& desc, VkPipelineLayout layout);
+	void Optimize(uint64_t key, const GraphicsPipelineDesc& desc, VkPipelineLayout layout);
+	// VK_NULL_HANDLE and the exception message in error when the builder throws
+	VkPipeline Build(const GraphicsPipelineDesc& desc, VkPipelineLayout layout, PipelineLink link, std::string& error);
+
+	VkDevice device;
+	Builder builder;
+	bool libraryLinking;
+	std::unique_ptr<ThreadPool> workers;
+	std::unique_ptr<ThreadPool> optimizer;
+
+	std::mutex mutex;
+	std::condition_variable compiled;
+	std::unordered_map<uint64_t, Entry> entries;
+	std::unordered_map<std::string, VkPipelineLayout> layouts;
+	VkFormat colorFormat = VK_FORMAT_UNDEFINED;
+	VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+	uint32_t dynamicState = 0;
+
+	uint32_t duplicateRequests = 0;
+	uint32_t prewarmed = 0;
+	uint64_t missedAcquires = 0;
+	std::vector<VkPipeline> retired;
+	uint32_t buildCounts[3] = {};
+	double buildMilliseconds[3] = {};
+};
@@ -0,0 +1,617 @@
+#include "render_graph.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::Read(RenderGraphResource resource, VkPipelineStageFlags2 stages, VkAccessFlags2 access,
+	VkImageLayout layout, const ImageRange& range)
+{
+	graph.AddAccess(pass, { resource, AccessType::Read, stages, access, layout, range });
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::Write(RenderGraphResource resource, VkPipelineStageFlags2 stages, VkAccessFlags2 access,
+	VkImageLayout layout, const ImageRange& range)
+{
+	graph.AddAccess(pass, { resource, AccessType::Write, stages, access, layout, range });
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::Discard(RenderGraphResource resource, VkPipelineStageFlags2 stages, VkAccessFlags2 access,
+	VkImageLayout layout)
+{
+	graph.AddAccess(pass, { resource, AccessType::Discard, stages, access, layout, ImageRange() });
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::SideEffect()
+{
+	graph.passes[pass].sideEffect = true;
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::Async()
+{
+	graph.passes[pass].async = true;
+	return *this;
+}
+
+RenderGraph::RenderGraph(VkPhysicalDevice physicalDevice, VkDevice device, ResourceStateTracker& states)
+	: physicalDevice(physicalDevice), device(device), states(states)
+{
+}
+
+RenderGraph::~RenderGraph()
+{
+	for (Resource& resource : resources)
+	{
+		if (resource.transient && resource.image != VK_NULL_HANDLE)
+		{
+			states.RemoveImage(resource.image);
+			vkDestroyImageView(device, resource.view, nullptr);
+			vkDestroyImage(device, resource.image, nullptr);
+		}
+	}
+	for (MemoryBlock& block : blocks)
+	{
+		vkFreeMemory(device, block.memory, nullptr);
+	}
+}
+
+RenderGraphResource RenderGraph::ImportImage(const std::string& name)
+{
+	Resource resource;
+	resource.name = name;
+	resource.isImage = true;
+	resource.transient = false;
+	resources.push_back(resource);
+	return (RenderGraphResource)resources.size() - 1;
+}
+
+RenderGraphResource RenderGraph::ImportBuffer(const std::string& name)
+{
+	Resource resource;
+	resource.name = name;
+	resource.isImage = false;
+	resource.transient = false;
+	resources.push_back(resource);
+	return (RenderGraphResource)resources.size() - 1;
+}
+
+RenderGraphResource RenderGraph::CreateImage(const std::string& name, const RenderGraphImageDesc& desc)
+{
+	Resource resource;
+	resource.name = name;
+	resource.isImage = true;
+	resource.transient = true;
+	resource.desc = desc;
+	resources.push_back(resource);
+	return (RenderGraphResource)resources.size() - 1;
+}
+
+RenderGraph::PassBuilder RenderGraph::AddPass(const std::string& name, PassFunction execute)
+{
+	Pass pass;
+	pass.name = name;
+	pass.execute = std::move(execute);
+	passes.push_back(std::move(pass));
+	return PassBuilder(*this, (uint32_t)passes.size() - 1);
+}
+
+void RenderGraph::MarkOutput(RenderGraphResource resource)
+{
+	resources.at(resource).output = true;
+}
+
+void RenderGraph::SetAsyncCompute(uint32_t graphicsFamily, uint32_t computeFamily, GpuTimeline& graphicsTimeline, GpuTimeline& computeTimeline)
+{
+	if (compiled)
+	{
+		throw std::runtime_error("fail to set up async compute after compiling the render graph");
+	}
+	asyncCompute = graphicsFamily != computeFamily;
+	families[(int)RenderGraphQueue::Graphics] = graphicsFamily;
+	families[(int)RenderGraphQueue::Compute] = computeFamily;
+	timelines[(int)RenderGraphQueue::Graphics] = &graphicsTimeline;
+	timelines[(int)RenderGraphQueue::Compute] = &computeTimeline;
+}
+
+void RenderGraph::AddAccess(uint32_t pass, const Access& access)
+{
+	if (compiled)
+	{
+		throw std::runtime_error("fail to change render graph " + passes[pass].name + " after compiling");
+	}
+	if (access.resource >= resources.size())
+	{
+		throw std::runtime_error("fail to add an unknown resource to render graph pass " + passes[pass].name);
+	}
+	passes[pass].accesses.push_back(access);
+}
+
+void RenderGraph::CullPasses()
+{
+	// a pass is needed when it has a side effect, writes the final contents of an output, or
+	// produces what a needed pass reads. Writes a later pass discards feed nothing
+	std::vector<std::vector<uint32_t>> producers(passes.size());
+	std::vector<int32_t> lastWriter(resources.size(), -1);
+	for (uint32_t pass = 0; pass < passes.size(); pass++)
+	{
+		for (const Access& access : passes[pass].accesses)
+		{
+			if (access.type != AccessType::Discard && lastWriter[access.resource] >= 0)
+			{
+				producers[pass].push_back((uint32_t)lastWriter[access.resource]);
+			}
+		}
+		for (const Access& access : passes[pass].accesses)
+		{
+			if (access.type != AccessType::Read)
+			{
+				lastWriter[access.resource] = (int32_t)pass;
+			}
+		}
+	}
+
+	std::vector<uint32_t> stack;
+	std::vector<bool> needed(passes.size(), false);
+	for (uint32_t pass = 0; pass < passes.size(); pass++)
+	{
+		if (passes[pass].sideEffect)
+		{
+			stack.push_back(pass);
+		}
+	}
+	for (RenderGraphResource resource = 0; resource < resources.size(); resource++)
+	{
+		if (resources[resource].output && lastWriter[resource] >= 0)
+		{
+			stack.push_back((uint32_t)lastWriter[resource]);
+		}
+	}
+	while (!stack.empty())
+	{
+		uint32_t pass = stack.back();
+		stack.pop_back();
+		if (needed[pass])
+		{
+			continue;
+		}
+		needed[pass] = true;
+		stack.insert(stack.end(), producers[pass].begin(), producers[pass].end());
+	}
+
+	schedule.clear();
+	for (uint32_t pass = 0; pass < passes.size(); pass++)
+	{
+		passes[pass].culled = !needed[pass];
+		if (needed[pass])
+		{
+			schedule.push_back(pass);
+		}
+	}
+}
+
+void RenderGraph::BuildBatches()
+{
+	for (uint32_t pass : schedule)
+	{
+		passes[pass].queue = asyncCompute && passes[pass].async ? RenderGraphQueue::Compute : RenderGraphQueue::Graphics;
+	}
+	if (!schedule.empty() && passes[schedule.back()].queue != RenderGraphQueue::Graphics)
+	{
+		throw std::runtime_error("fail to compile render graph, the last pass " + passes[schedule.back()].name + " has to run on the graphics queue");
+	}
+
+	batches.clear();
+	for (uint32_t step = 0; step < schedule.size(); step++)
+	{
+		RenderGraphQueue queue = passes[schedule[step]].queue;
+		if (batches.empty() || batches.back().queue != queue)
+		{
+			Batch batch = {};
+			batch.queue = queue;
+			batch.begin = step;
+			batches.push_back(batch);
+		}
+		batches.back().end = step + 1;
+	}
+	bool seen[2] = {};
+	for (Batch& batch : batches)
+	{
+		batch.first = !seen[(int)batch.queue];
+		seen[(int)batch.queue] = true;
+	}
+	seen[0] = seen[1] = false;
+	for (size_t i = batches.size(); i > 0; i--)
+	{
+		batches[i - 1].last = !seen[(int)batches[i - 1].queue];
+		seen[(int)batches[i - 1].queue] = true;
+	}
+
+	// an image that keeps its contents across a queue change is released by the batch that used it last
+	std::vector<int32_t> lastBatch(resources.size(), -1);
+	std::vector<RenderGraphQueue> firstQueue(resources.size(), RenderGraphQueue::Graphics);
+	std::vector<bool> carried(resources.size(), false);
+	for (uint32_t b = 0; b < batches.size(); b++)
+	{
+		for (uint32_t step = batches[b].begin; step < batches[b].end; step++)
+		{
+			for (Access& access : passes[schedule[step]].accesses)
+			{
+				const Resource& resource = resources[access.resource];
+				bool keepsContents = resource.isImage && access.type != AccessType::Discard && !(resource.transient && resource.firstUse == step);
+				int32_t& previous = lastBatch[access.resource];
+				if (previous < 0)
+				{
+					firstQueue[access.resource] = batches[b].queue;
+					carried[access.resource] = keepsContents && !resource.transient;
+				}
+				else if (keepsContents && batches[previous].queue != batches[b].queue)
+				{
+					access.acquire = true;
+					batches[previous].releases.push_back({ access.resource, access.layout, batches[b].queue });
+				}
+				previous = (int32_t)b;
+			}
+		}
+	}
+	for (RenderGraphResource resource = 0; resource < resources.size(); resource++)
+	{
+		if (carried[resource] && batches[lastBatch[resource]].queue != firstQueue[resource])
+		{
+			throw std::runtime_error("fail to compile render graph, " + resources[resource].name + " carries its contents into the next frame on another queue");
+		}
+	}
+}
+
+uint32_t RenderGraph::FindDeviceLocalMemory(uint32_t typeBits) const
+{
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+		{
+			return i;
+		}
+	}
+	throw std::runtime_error("fail to find device local memory for render graph images");
+}
+
+void RenderGraph::AllocateTransients()
+{
+	std::vector<RenderGraphResource> transients;
+	for (uint32_t step = 0; step < schedule.size(); step++)
+	{
+		for (const Access& access : passes[schedule[step]].accesses)
+		{
+			Resource& resource = resources[access.resource];
+			if (!resource.transient)
+			{
+				continue;
+			}
+			if (resource.firstUse == UINT32_MAX)
+			{
+				if (access.type == AccessType::Read)
+				{
+					throw std::runtime_error("fail to compile render graph, pass " + passes[schedule[step]].name + " reads " + resource.name +
+						" before any pass writes it");
+				}
+				resource.firstUse = step;
+				transients.push_back(access.resource);
+			}
+			resource.lastUse = step;
+		}
+	}
+
+	std::vector<uint32_t> memoryTypes(resources.size());
+	for (RenderGraphResource index : transients)
+	{
+		Resource& resource = resources[index];
+		VkImageCreateInfo imageInfo = {};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.extent = { resource.desc.extent.width, resource.desc.extent.height, 1 };
+		imageInfo.mipLevels = resource.desc.mipLevels;
+		imageInfo.arrayLayers = 1;
+		imageInfo.format = resource.desc.format;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.usage = resource.desc.usage;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		if (vkCreateImage(device, &imageInfo, nullptr, &resource.image) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create render graph image " + resource.name);
+		}
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(device, resource.image, &requirements);
+		resource.size = requirements.size;
+		memoryTypes[index] = FindDeviceLocalMemory(requirements.memoryTypeBits);
+		states.AddImage(resource.image, resource.desc.aspect, resource.desc.mipLevels, 1);
+	}
+
+	// largest first, each into the first block of the same memory type whose residents are all
+	// dead before it starts or born after it ends. Images are bound at offset 0, a block grows to its largest resident
+	std::vector<RenderGraphResource> bySize = transients;
+	std::stable_sort(bySize.begin(), bySize.end(),
+		[&](RenderGraphResource a, RenderGraphResource b) { return resources[a].size > resources[b].size; });
+	for (RenderGraphResource index : bySize)
+	{
+		Resource& resource = resources[index];
+		for (uint32_t b = 0; b < blocks.size() && resource.block < 0; b++)
+		{
+			if (blocks[b].memoryType != memoryTypes[index])
+			{
+				continue;
+			}
+			bool overlaps = std::any_of(blocks[b].residents.begin(), blocks[b].residents.end(), [&](RenderGraphResource other)
+				{
+					return resources[other].firstUse <= resource.lastUse && resource.firstUse <= resources[other].lastUse;
+				});
+			if (!overlaps)
+			{
+				resource.block = (int32_t)b;
+			}
+		}
+		if (resource.block < 0)
+		{
+			MemoryBlock block;
+			block.memoryType = memoryTypes[index];
+			blocks.push_back(block);
+			resource.block = (int32_t)blocks.size() - 1;
+		}
+		MemoryBlock& block = blocks[resource.block];
+		block.size = std::max(block.size, resource.size);
+		block.residents.push_back(index);
+	}
+
+	for (MemoryBlock& block : blocks)
+	{
+		VkMemoryAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = block.size;
+		allocInfo.memoryTypeIndex = block.memoryType;
+		if (vkAllocateMemory(device, &allocInfo, nullptr, &block.memory) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to allocate render graph memory");
+		}
+	}
+
+	for (RenderGraphResource index : transients)
+	{
+		Resource& resource = resources[index];
+		vkBindImageMemory(device, resource.image, blocks[resource.block].memory, 0);
+
+		// a depth stencil view can only be sampled through its depth aspect
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = resource.image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = resource.desc.format;
+		viewInfo.subresourceRange.aspectMask = (resource.desc.aspect & VK_IMAGE_ASPECT_DEPTH_BIT) ? VK_IMAGE_ASPECT_DEPTH_BIT : resource.desc.aspect;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = resource.desc.mipLevels;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+		if (vkCreateImageView(device, &viewInfo, nullptr, &resource.view) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to create render graph image view " + resource.name);
+		}
+	}
+}
+
+void RenderGraph::Compile()
+{
+	if (compiled)
+	{
+		return;
+	}
+	CullPasses();
+	AllocateTransients();
+	BuildBatches();
+	compiled = true;
+}
+
+VkImage RenderGraph::GetImage(RenderGraphResource resource) const
+{
+	return resources.at(resource).image;
+}
+
+VkImageView RenderGraph::GetImageView(RenderGraphResource resource) const
+{
+	return resources.at(resource).view;
+}
+
+void RenderGraph::SetImage(RenderGraphResource resource, VkImage image)
+{
+	Resource& entry = resources.at(resource);
+	if (entry.transient || !entry.isImage)
+	{
+		throw std::runtime_error("fail to bind " + entry.name + ", it is not an imported image");
+	}
+	entry.image = image;
+}
+
+void RenderGraph::SetBuffer(RenderGraphResource resource, VkBuffer buffer)
+{
+	Resource& entry = resources.at(resource);
+	if (entry.isImage)
+	{
+		throw std::runtime_error("fail to bind " + entry.name + ", it is not an imported buffer");
+	}
+	entry.buffer = buffer;
+}
+
+void RenderGraph::Execute(const AllocateFunction& allocate, const SubmitFunction& submit)
+{
+	if (!compiled)
+	{
+		throw std::runtime_error("fail to execute a render graph that is not compiled");
+	}
+
+	// resources this graph has not used yet may still be in use by the graphics queue
+	const uint64_t graphicsBaseline = asyncCompute ? timelines[(int)RenderGraphQueue::Graphics]->LastSubmitted() : 0;
+	uint64_t computeValue = 0;
+	std::vector<RenderGraphResource> touched;
+	for (const Batch& batch : batches)
+	{
+		const RenderGraphQueue other = batch.queue == RenderGraphQueue::Graphics ? RenderGraphQueue::Compute : RenderGraphQueue::Graphics;
+		VkCommandBuffer commandBuffer = allocate(batch.queue);
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to begin render graph command buffer");
+		}
+
+		uint64_t waitValue = 0;
+		VkPipelineStageFlags2 waitStages = 0;
+		touched.clear();
+		for (uint32_t step = batch.begin; step < batch.end; step++)
+		{
+			const Pass& pass = passes[schedule[step]];
+			for (const Access& access : pass.accesses)
+			{
+				Resource& resource = resources[access.resource];
+				// the other queue used it last: wait for that submission, the barriers only see this queue's commands
+				bool crosses = asyncCompute && (resource.used ? resource.lastQueue != batch.queue : batch.queue == RenderGraphQueue::Compute);
+				if (crosses)
+				{
+					waitValue = std::max(waitValue, resource.used ? resource.lastValue : graphicsBaseline);
+					waitStages |= access.stages;
+				}
+				resource.used = true;
+				resource.lastQueue = batch.queue;
+				touched.push_back(access.resource);
+
+				if (!resource.isImage)
+				{
+					if (resource.buffer == VK_NULL_HANDLE)
+					{
+						throw std::runtime_error("fail to execute render graph, " + resource.name + " is not bound");
+					}
+					if (crosses)
+					{
+						states.RemoveBuffer(resource.buffer);
+					}
+					states.UseBuffer(resource.buffer, access.stages, access.access);
+					continue;
+				}
+				if (resource.image == VK_NULL_HANDLE)
+				{
+					throw std::runtime_error("fail to execute render graph, " + resource.name + " is not bound");
+				}
+				if (access.acquire)
+				{
+					states.AcquireImage(resource.image, access.stages, access.access, families[(int)other], families[(int)batch.queue]);
+					continue;
+				}
+
+				// a transient's contents never outlive the frame. Its first use also has to wait for
+				// the image that had the memory before, which may be from the previous frame
+				bool firstUse = resource.transient && resource.firstUse == step;
+				bool discard = firstUse || access.type == AccessType::Discard;
+				if (firstUse)
+				{
+					MemoryBlock& block = blocks[resource.block];
+					if (block.lastUser >= 0 && block.lastUser != (int32_t)access.resource)
+					{
+						const Resource& previous = resources[block.lastUser];
+						if (asyncCompute && previous.used && previous.lastQueue != batch.queue)
+						{
+							waitValue = std::max(waitValue, previous.lastValue);
+							waitStages |= access.stages;
+							crosses = true;
+						}
+						else
+						{
+							states.AliasImage(resource.image, previous.image);
+						}
+					}
+					block.lastUser = (int32_t)access.resource;
+				}
+				if (discard)
+				{
+					if (crosses)
+					{
+						// nothing to wait for on this queue, the semaphore wait at these stages comes first
+						states.ImportImage(resource.image, VK_IMAGE_LAYOUT_UNDEFINED, access.stages);
+					}
+					states.DiscardImage(resource.image, access.stages, access.access, access.layout);
+				}
+				else
+				{
+					states.UseImage(resource.image, access.range, access.stages, access.access, access.layout);
+				}
+			}
+			states.Flush(commandBuffer);
+			pass.execute(commandBuffer);
+		}
+
+		for (const Release& release : batch.releases)
+		{
+			states.ReleaseImage(resources[release.resource].image, release.layout, families[(int)batch.queue], families[(int)release.queue]);
+		}
+		states.Flush(commandBuffer);
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("fail to record render graph command buffer");
+		}
+
+		// the graphics timeline has to cover the whole frame
+		if (batch.queue == RenderGraphQueue::Graphics && batch.last && computeValue > waitValue)
+		{
+			waitValue = computeValue;
+			waitStages = waitStages != 0 ? waitStages : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		}
+		submit({ batch.queue, commandBuffer, waitValue, waitStages, batch.first, batch.last });
+
+		uint64_t value = asyncCompute ? timelines[(int)batch.queue]->LastSubmitted() : 0;
+		if (batch.queue == RenderGraphQueue::Compute)
+		{
+			computeValue = value;
+		}
+		for (RenderGraphResource resource : touched)
+		{
+			resources[resource].lastValue = value;
+		}
+	}
+}
+
+void RenderGraph::PrintSchedule() const
+{
+	static const char* const accessNames[] = { "read", "write", "discard" };
+	static const char* const queueNames[] = { "graphics", "compute" };
+
+	std::cout << "render graph: " << schedule.size() << " of " << passes.size() << " passes in " << batches.size() << " submissions" << std::endl;
+	for (uint32_t pass = 0; pass < passes.size(); pass++)
+	{
+		std::cout << "  " << (passes[pass].culled ? "culled" : queueNames[(int)passes[pass].queue]) << " " << passes[pass].name << ":";
+		for (const Access& access : passes[pass].accesses)
+		{
+			std::cout << " " << accessNames[(int)access.type] << (access.acquire ? " (acquire) " : " ") << resources[access.resource].name;
+		}
+		std::cout << std::endl;
+	}
+
+	VkDeviceSize separate = 0;
+	VkDeviceSize aliased = 0;
+	for (const Resource& resource : resources)
+	{
+		if (resource.transient && resource.block >= 0)
+		{
+			std::cout << "  transient " << resource.name << ": " << resource.size / 1024 << " KB in block " << resource.block
+				<< ", alive in passes " << resource.firstUse << " to " << resource.lastUse << std::endl;
+			separate += resource.size;
+		}
+	}
+	for (const MemoryBlock& block : blocks)
+	{
+		aliased += block.size;
+	}
+	std::cout << "  transient memory: " << aliased / 1024 << " KB in " << blocks.size() << " blocks, " << separate / 1024
+		<< " KB without aliasing, " << (separate - aliased) / 1024 << " KB saved" << std::endl;
+}
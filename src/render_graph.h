@@ -0,0 +1,226 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include "gpu_timeline.h"
+#include "resource_state.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+using RenderGraphResource = uint32_t;
+
+// An image the graph creates and owns. It only lives from its first to its last pass in a frame,
+// so transients that are never alive at the same time share memory.
+struct RenderGraphImageDesc
+{
+	VkFormat format;
+	VkExtent2D extent;
+	VkImageUsageFlags usage;
+	VkImageAspectFlags aspect;
+	uint32_t mipLevels = 1;
+};
+
+enum class RenderGraphQueue
+{
+	Graphics,
+	Compute,
+};
+
+// A run of consecutive passes on one queue, recorded into one command buffer and submitted on its
+// own. The submission signals the next value of its queue's timeline.
+struct RenderGraphSubmit
+{
+	RenderGraphQueue queue;
+	VkCommandBuffer commandBuffer;
+	// a value of the other queue's timeline to wait for at waitStages, 0 when there is none
+	uint64_t waitValue;
+	VkPipelineStageFlags2 waitStages;
+	// the first and last submission of this queue in the frame
+	bool first;
+	bool last;
+};
+
+// A frame described as passes that declare how they read and write virtual resources. Compile
+// drops the passes no output depends on, works out the lifetimes of the transient images and
+// places them in as little memory as possible. Execute runs the remaining passes and lets the
+// resource state tracker put the barriers each pass needs in front of it, one batch per pass.
+//
+// Passes are scheduled in the order they were added, which is always a valid order: a pass can
+// only depend on passes added before it. The graph is built once and executed every frame, the
+// imported resources are bound before each Execute.
+//
+// With async compute, passes marked Async run on the compute queue and the schedule is split into
+// submissions wherever the queue changes. A submission waits on the other queue's timeline for the
+// submissions that last used its resources, in this frame or an earlier one, so async work overlaps
+// whatever the graphics queue is still doing. Images whose contents move between the queues are
+// released and acquired; buffers used by both queues have to be created VK_SHARING_MODE_CONCURRENT.
+// An image an async pass uses without discarding must be new or last used by an async pass, and
+// only the graphics queue may carry an image's contents into the next frame. The last pass has to
+// run on the graphics queue, whose last submission also waits for the frame's compute work, so the
+// graphics timeline alone tells when a frame is finished.
+class RenderGraph
+{
+public:
+	using PassFunction = std::function<void(VkCommandBuffer)>;
+	// a command buffer of the queue's family, ready to begin
+	using AllocateFunction = std::function<VkCommandBuffer(RenderGraphQueue)>;
+	// submits on the queue and signals the queue's timeline with its Next value
+	using SubmitFunction = std::function<void(const RenderGraphSubmit&)>;
+
+	class PassBuilder
+	{
+	public:
+		// range only narrows the barrier, the pass still depends on the whole resource
+		PassBuilder& Read(RenderGraphResource resource, VkPipelineStageFlags2 stages, VkAccessFlags2 access,
+			VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED, const ImageRange& range = ImageRange());
+		// writes on top of the current contents
+		PassBuilder& Write(RenderGraphResource resource, VkPipelineStageFlags2 stages, VkAccessFlags2 access,
+			VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED, const ImageRange& range = ImageRange());
+		// writes the whole resource without needing its old contents, e.g. a cleared attachment
+		PassBuilder& Discard(RenderGraphResource resource, VkPipelineStageFlags2 stages, VkAccessFlags2 access,
+			VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED);
+		// the pass has effects outside the graph, e.g. present, and is never culled
+		PassBuilder& SideEffect();
+		// runs on the compute queue when async compute is set up, in order on the graphics queue otherwise
+		PassBuilder& Async();
+
+	private:
+		friend class RenderGraph;
+		PassBuilder(RenderGraph& graph, uint32_t pass) : graph(graph), pass(pass) {}
+
+		RenderGraph& graph;
+		uint32_t pass;
+	};
+
+	RenderGraph(VkPhysicalDevice physicalDevice, VkDevice device, ResourceStateTracker& states);
+	~RenderGraph();
+
+	RenderGraph(const RenderGraph&) = delete;
+	RenderGraph& operator=(const RenderGraph&) = delete;
+
+	// owned outside the graph, the handle is bound with SetImage or SetBuffer
+	RenderGraphResource ImportImage(const std::string& name);
+	RenderGraphResource ImportBuffer(const std::string& name);
+	RenderGraphResource CreateImage(const std::string& name, const RenderGraphImageDesc& desc);
+	PassBuilder AddPass(const std::string& name, PassFunction execute);
+	// the frame's results, including what the next frame reads
+	void MarkOutput(RenderGraphResource resource);
+	// before Compile. Nothing changes when both families are the same
+	void SetAsyncCompute(uint32_t graphicsFamily, uint32_t computeFamily, GpuTimeline& graphicsTimeline, GpuTimeline& computeTimeline);
+
+	void Compile();
+	// transient images exist after Compile
+	VkImage GetImage(RenderGraphResource resource) const;
+	VkImageView GetImageView(RenderGraphResource resource) const;
+
+	void SetImage(RenderGraphResource resource, VkImage image);
+	void SetBuffer(RenderGraphResource resource, VkBuffer buffer);
+	// records and submits the frame, one command buffer per submission
+	void Execute(const AllocateFunction& allocate, const SubmitFunction& submit);
+
+	// the schedule, culled passes, transient lifetimes and memory
+	void PrintSchedule() const;
+
+private:
+	enum class AccessType
+	{
+		Read,
+		Write,
+		Discard,
+	};
+
+	struct Access
+	{
+		RenderGraphResource resource;
+		AccessType type;
+		VkPipelineStageFlags2 stages;
+		VkAccessFlags2 access;
+		VkImageLayout layout;
+		ImageRange range;
+		// the contents come from the other queue, the first use acquires the image
+		bool acquire = false;
+	};
+
+	struct Pass
+	{
+		std::string name;
+		PassFunction execute;
+		std::vector<Access> accesses;
+		bool sideEffect = false;
+		bool async = false;
+		bool culled = false;
+		RenderGraphQueue queue = RenderGraphQueue::Graphics;
+	};
+
+	struct Release
+	{
+		RenderGraphResource resource;
+		VkImageLayout layout;
+		RenderGraphQueue queue;
+	};
+
+	struct Batch
+	{
+		RenderGraphQueue queue;
+		// schedule positions [begin, end)
+		uint32_t begin;
+		uint32_t end;
+		bool first;
+		bool last;
+		// images handed to the other queue after the batch's last pass
+		std::vector<Release> releases;
+	};
+
+	struct Resource
+	{
+		std::string name;
+		bool isImage;
+		bool transient;
+		bool output = false;
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		VkBuffer buffer = VK_NULL_HANDLE;
+		RenderGraphImageDesc desc = {};
+		// transients only: size, memory block and the schedule positions of the first and last use
+		VkDeviceSize size = 0;
+		int32_t block = -1;
+		uint32_t firstUse = UINT32_MAX;
+		uint32_t lastUse = 0;
+		// the queue and timeline value of the last submission that used it, across frames
+		bool used = false;
+		RenderGraphQueue lastQueue = RenderGraphQueue::Graphics;
+		uint64_t lastValue = 0;
+	};
+
+	struct MemoryBlock
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		uint32_t memoryType;
+		std::vector<RenderGraphResource> residents;
+		// the transient that used the memory last, across frames, -1 before the first frame
+		int32_t lastUser = -1;
+	};
+
+	void AddAccess(uint32_t pass, const Access& access);
+	void CullPasses();
+	void BuildBatches();
+	void AllocateTransients();
+	uint32_t FindDeviceLocalMemory(uint32_t typeBits) const;
+
+	VkPhysicalDevice physicalDevice;
+	VkDevice device;
+	ResourceStateTracker& states;
+	std::vector<Resource> resources;
+	std::vector<Pass> passes;
+	// indices of the passes that run, in order
+	std::vector<uint32_t> schedule;
+	std::vector<MemoryBlock> blocks;
+	std::vector<Batch> batches;
+	bool compiled = false;
+
+	bool asyncCompute = false;
+	// indexed by RenderGraphQueue
+	uint32_t families[2] = {};
+	GpuTimeline* timelines[2] = {};
+};
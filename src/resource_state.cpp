@@ -0,0 +1,316 @@
+#include "resource_state.h"
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+	const VkAccessFlags2 kWriteAccess = VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT |
+		VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+}
+
+void ResourceStateTracker::AddImage(VkImage image, VkImageAspectFlags aspect, uint32_t mipLevels, uint32_t layers, VkImageLayout layout)
+{
+	Image& entry = images[image];
+	entry.aspect = aspect;
+	entry.mipLevels = mipLevels;
+	entry.layers = layers;
+	entry.states.assign(mipLevels * layers, State());
+	for (State& state : entry.states)
+	{
+		state.layout = layout;
+	}
+}
+
+void ResourceStateTracker::RemoveImage(VkImage image)
+{
+	images.erase(image);
+}
+
+void ResourceStateTracker::RemoveBuffer(VkBuffer buffer)
+{
+	buffers.erase(buffer);
+}
+
+void ResourceStateTracker::ImportImage(VkImage image, VkImageLayout layout, VkPipelineStageFlags2 stages)
+{
+	auto it = images.find(image);
+	if (it == images.end())
+	{
+		throw std::runtime_error("fail to import an image the resource state tracker does not know");
+	}
+	for (State& state : it->second.states)
+	{
+		state = State();
+		state.layout = layout;
+		// the semaphore wait counts as the last write, later uses wait for it at stages
+		state.writeStages = stages;
+	}
+}
+
+void ResourceStateTracker::AliasImage(VkImage image, VkImage previous)
+{
+	auto it = images.find(image);
+	auto previousIt = images.find(previous);
+	if (it == images.end() || previousIt == images.end())
+	{
+		throw std::runtime_error("fail to alias an image the resource state tracker does not know");
+	}
+	VkPipelineStageFlags2 stages = 0;
+	VkAccessFlags2 access = 0;
+	for (const State& state : previousIt->second.states)
+	{
+		stages |= state.writeStages | state.readStages;
+		access |= state.writeAccess;
+	}
+	for (State& state : it->second.states)
+	{
+		state = State();
+		state.writeStages = stages;
+		state.writeAccess = access;
+	}
+}
+
+bool ResourceStateTracker::Transition(State& state, VkPipelineStageFlags2 stages, VkAccessFlags2 access, VkImageLayout layout, bool discard,
+	VkPipelineStageFlags2& srcStages, VkAccessFlags2& srcAccess)
+{
+	if (state.batch == batch)
+	{
+		throw std::runtime_error("fail to track a resource used twice before a flush");
+	}
+	state.batch = batch;
+
+	bool write = (access & kWriteAccess) != 0;
+	bool layoutChange = discard || layout != state.layout;
+	if (write || layoutChange)
+	{
+		// write after write and write after read wait for every earlier access, a layout transition is a write too
+		srcStages = state.writeStages | state.readStages;
+		srcAccess = state.writeAccess;
+		bool needed = layoutChange || srcStages != 0;
+		state.layout = layout;
+		state.writeStages = stages;
+		state.writeAccess = access & kWriteAccess;
+		state.visibleStages = stages;
+		state.visibleAccess = access;
+		state.readStages = write ? 0 : stages;
+		return needed;
+	}
+
+	state.readStages |= stages;
+	if (state.writeStages == 0)
+	{
+		return false;
+	}
+	if ((stages & ~state.visibleStages) == 0 && (access & ~state.visibleAccess) == 0)
+	{
+		skipped++;
+		return false;
+	}
+	// read after write, only the stages the write is not visible to yet have to wait
+	srcStages = state.writeStages;
+	srcAccess = state.writeAccess;
+	state.visibleStages |= stages;
+	state.visibleAccess |= access;
+	return true;
+}
+
+void ResourceStateTracker::UseImageRange(VkImage image, const ImageRange& range, VkPipelineStageFlags2 stages, VkAccessFlags2 access,
+	VkImageLayout layout, bool discard)
+{
+	auto it = images.find(image);
+	if (it == images.end())
+	{
+		throw std::runtime_error("fail to use an image the resource state tracker does not know");
+	}
+	Image& entry = it->second;
+	uint32_t mipEnd = range.mipCount == VK_REMAINING_MIP_LEVELS ? entry.mipLevels : range.baseMip + range.mipCount;
+	uint32_t layerEnd = range.layerCount == VK_REMAINING_ARRAY_LAYERS ? entry.layers : range.baseLayer + range.layerCount;
+
+	for (uint32_t layer = range.baseLayer; layer < layerEnd; layer++)
+	{
+		for (uint32_t mip = range.baseMip; mip < mipEnd; mip++)
+		{
+			State& state = entry.states[layer * entry.mipLevels + mip];
+			VkImageLayout oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+			VkPipelineStageFlags2 srcStages = 0;
+			VkAccessFlags2 srcAccess = 0;
+			if (!Transition(state, stages, access, layout, discard, srcStages, srcAccess))
+			{
+				continue;
+			}
+
+			// neighbouring mips of a layer that came from the same state share one barrier
+			if (!imageBarriers.empty())
+			{
+				VkImageMemoryBarrier2& last = imageBarriers.back();
+				if (last.image == image && last.srcStageMask == srcStages && last.srcAccessMask == srcAccess && last.oldLayout == oldLayout &&
+					last.newLayout == layout && last.dstStageMask == stages && last.dstAccessMask == access &&
+					last.subresourceRange.baseArrayLayer == layer && last.subresourceRange.layerCount == 1 &&
+					last.subresourceRange.baseMipLevel + last.subresourceRange.levelCount == mip)
+				{
+					last.subresourceRange.levelCount++;
+					continue;
+				}
+			}
+
+			VkImageMemoryBarrier2 barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+			barrier.srcStageMask = srcStages;
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstStageMask = stages;
+			barrier.dstAccessMask = access;
+			barrier.oldLayout = oldLayout;
+			barrier.newLayout = layout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = image;
+			barrier.subresourceRange = { entry.aspect, mip, 1, layer, 1 };
+			imageBarriers.push_back(barrier);
+		}
+	}
+}
+
+void ResourceStateTracker::UseImage(VkImage image, const ImageRange& range, VkPipelineStageFlags2 stages, VkAccessFlags2 access,
+	VkImageLayout layout)
+{
+	UseImageRange(image, range, stages, access, layout, false);
+}
+
+void ResourceStateTracker::DiscardImage(VkImage image, VkPipelineStageFlags2 stages, VkAccessFlags2 access, VkImageLayout layout)
+{
+	UseImageRange(image, ImageRange(), stages, access, layout, true);
+}
+
+void ResourceStateTracker::UseBuffer(VkBuffer buffer, VkPipelineStageFlags2 stages, VkAccessFlags2 access)
+{
+	VkPipelineStageFlags2 srcStages = 0;
+	VkAccessFlags2 srcAccess = 0;
+	if (!Transition(buffers[buffer], stages, access, VK_IMAGE_LAYOUT_UNDEFINED, false, srcStages, srcAccess))
+	{
+		return;
+	}
+
+	VkBufferMemoryBarrier2 barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+	barrier.srcStageMask = srcStages;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstStageMask = stages;
+	barrier.dstAccessMask = access;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	bufferBarriers.push_back(barrier);
+}
+
+void ResourceStateTracker::ReleaseImage(VkImage image, VkImageLayout layout, uint32_t srcFamily, uint32_t dstFamily)
+{
+	auto it = images.find(image);
+	if (it == images.end())
+	{
+		throw std::runtime_error("fail to release an image the resource state tracker does not know");
+	}
+	Image& entry = it->second;
+	for (uint32_t layer = 0; layer < entry.layers; layer++)
+	{
+		for (uint32_t mip = 0; mip < entry.mipLevels; mip++)
+		{
+			State& state = entry.states[layer * entry.mipLevels + mip];
+			VkImageMemoryBarrier2 barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+			barrier.srcStageMask = state.writeStages | state.readStages;
+			barrier.srcAccessMask = state.writeAccess;
+			barrier.oldLayout = state.layout;
+			barrier.newLayout = layout;
+			barrier.srcQueueFamilyIndex = srcFamily;
+			barrier.dstQueueFamilyIndex = dstFamily;
+			barrier.image = image;
+			barrier.subresourceRange = { entry.aspect, mip, 1, layer, 1 };
+			imageBarriers.push_back(barrier);
+
+			// the other queue starts from the layout alone, the semaphore covers the rest
+			uint64_t lastBatch = state.batch;
+			VkImageLayout oldLayout = state.layout;
+			state = State();
+			state.layout = layout;
+			state.batch = lastBatch;
+			state.releasedFrom = oldLayout;
+		}
+	}
+}
+
+void ResourceStateTracker::AcquireImage(VkImage image, VkPipelineStageFlags2 stages, VkAccessFlags2 access, uint32_t srcFamily,
+	uint32_t dstFamily)
+{
+	auto it = images.find(image);
+	if (it == images.end())
+	{
+		throw std::runtime_error("fail to acquire an image the resource state tracker does not know");
+	}
+	Image& entry = it->second;
+	for (uint32_t layer = 0; layer < entry.layers; layer++)
+	{
+		for (uint32_t mip = 0; mip < entry.mipLevels; mip++)
+		{
+			State& state = entry.states[layer * entry.mipLevels + mip];
+			if (state.batch == batch)
+			{
+				throw std::runtime_error("fail to track a resource used twice before a flush");
+			}
+
+			// the same transition as the release, it runs after the semaphore wait at stages
+			VkImageMemoryBarrier2 barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+			barrier.srcStageMask = stages;
+			barrier.dstStageMask = stages;
+			barrier.dstAccessMask = access;
+			barrier.oldLayout = state.releasedFrom;
+			barrier.newLayout = state.layout;
+			barrier.srcQueueFamilyIndex = srcFamily;
+			barrier.dstQueueFamilyIndex = dstFamily;
+			barrier.image = image;
+			barrier.subresourceRange = { entry.aspect, mip, 1, layer, 1 };
+			imageBarriers.push_back(barrier);
+
+			// like a layout transition, later uses on this queue wait for it
+			bool write = (access & kWriteAccess) != 0;
+			state.releasedFrom = VK_IMAGE_LAYOUT_UNDEFINED;
+			state.writeStages = stages;
+			state.writeAccess = access & kWriteAccess;
+			state.visibleStages = stages;
+			state.visibleAccess = access;
+			state.readStages = write ? 0 : stages;
+			state.batch = batch;
+		}
+	}
+}
+
+void ResourceStateTracker::Flush(VkCommandBuffer commandBuffer)
+{
+	batch++;
+	if (imageBarriers.empty() && bufferBarriers.empty())
+	{
+		return;
+	}
+
+	VkDependencyInfo dependencyInfo = {};
+	dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	dependencyInfo.imageMemoryBarrierCount = (uint32_t)imageBarriers.size();
+	dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+	dependencyInfo.bufferMemoryBarrierCount = (uint32_t)bufferBarriers.size();
+	dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+	vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+	flushes++;
+	barriers += imageBarriers.size() + bufferBarriers.size();
+	imageBarriers.clear();
+	bufferBarriers.clear();
+}
+
+void ResourceStateTracker::PrintStats() const
+{
+	std::cout << "resource states: " << barriers << " barriers in " << flushes << " vkCmdPipelineBarrier2 calls, "
+		<< skipped << " reads needed no barrier" << std::endl;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// mips and layers of a tracked image, the aspect comes from AddImage
+struct ImageRange
+{
+	uint32_t baseMip = 0;
+	uint32_t mipCount = VK_REMAINING_MIP_LEVELS;
+	uint32_t baseLayer = 0;
+	uint32_t layerCount = VK_REMAINING_ARRAY_LAYERS;
+};
+
+// Keeps the layout, last write and reads since that write of every image subresource and buffer,
+// in the order the commands are recorded. Callers declare how the next commands use a resource,
+// the tracker queues only the synchronization2 barriers those uses need and Flush issues all of
+// them in one vkCmdPipelineBarrier2. Reads that an earlier barrier already made visible need no
+// new barrier.
+//
+// The uses declared between two flushes belong to the same commands, so one subresource may only
+// be used once between them. The tracker assumes every command buffer runs on one queue in the
+// order it was recorded.
+class ResourceStateTracker
+{
+public:
+	// layout is the current layout of every subresource, usually VK_IMAGE_LAYOUT_UNDEFINED
+	void AddImage(VkImage image, VkImageAspectFlags aspect, uint32_t mipLevels, uint32_t layers,
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED);
+	void RemoveImage(VkImage image);
+	// buffers are added by their first use
+	void RemoveBuffer(VkBuffer buffer);
+
+	// the image comes from outside the command stream, e.g. a swapchain image whose acquire
+	// semaphore is waited on at stages. Nothing earlier needs to be waited for
+	void ImportImage(VkImage image, VkImageLayout layout, VkPipelineStageFlags2 stages);
+	// image takes over memory that previous used last, so its first use waits for every access to previous
+	void AliasImage(VkImage image, VkImage previous);
+
+	void UseImage(VkImage image, const ImageRange& range, VkPipelineStageFlags2 stages, VkAccessFlags2 access, VkImageLayout layout);
+	// like UseImage on the whole image, but the old contents are not needed, so the transition starts from UNDEFINED
+	void DiscardImage(VkImage image, VkPipelineStageFlags2 stages, VkAccessFlags2 access, VkImageLayout layout);
+	void UseBuffer(VkBuffer buffer, VkPipelineStageFlags2 stages, VkAccessFlags2 access);
+
+	// Hands an exclusive image to another queue family. The release goes at the end of the source
+	// queue's commands, waits for every earlier access and moves the image to layout. The acquire is
+	// the first use on the other queue, in that layout, and its submission waits on a semaphore the
+	// source signals after the release
+	void ReleaseImage(VkImage image, VkImageLayout layout, uint32_t srcFamily, uint32_t dstFamily);
+	void AcquireImage(VkImage image, VkPipelineStageFlags2 stages, VkAccessFlags2 access, uint32_t srcFamily, uint32_t dstFamily);
+
+	// records the queued barriers, nothing when no use needed one
+	void Flush(VkCommandBuffer commandBuffer);
+
+	void PrintStats() const;
+
+private:
+	struct State
+	{
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags2 writeStages = 0;
+		VkAccessFlags2 writeAccess = 0;
+		// stages and accesses the last write is already visible to
+		VkPipelineStageFlags2 visibleStages = 0;
+		VkAccessFlags2 visibleAccess = 0;
+		// stages that read since the last write, a write has to wait for them
+		VkPipelineStageFlags2 readStages = 0;
+		// batch of the last use, to catch two uses between flushes
+		uint64_t batch = 0;
+		// layout before a queue family release, the acquire repeats the release's transition
+		VkImageLayout releasedFrom = VK_IMAGE_LAYOUT_UNDEFINED;
+	};
+
+	struct Image
+	{
+		VkImageAspectFlags aspect;
+		uint32_t mipLevels;
+		uint32_t layers;
+		// indexed by layer * mipLevels + mip
+		std::vector<State> states;
+	};
+
+	// moves state to the use and returns whether a barrier is needed, with its source in srcStages and srcAccess
+	bool Transition(State& state, VkPipelineStageFlags2 stages, VkAccessFlags2 access, VkImageLayout layout, bool discard,
+		VkPipelineStageFlags2& srcStages, VkAccessFlags2& srcAccess);
+	void UseImageRange(VkImage image, const ImageRange& range, VkPipelineStageFlags2 stages, VkAccessFlags2 access,
+		VkImageLayout layout, bool discard);
+
+	std::unordered_map<VkImage, Image> images;
+	std::unordered_map<VkBuffer, State> buffers;
+	std::vector<VkImageMemoryBarrier2> imageBarriers;
+	std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+	uint64_t batch = 1;
+
+	uint64_t flushes = 0;
+	uint64_t barriers = 0;
+	uint64_t skipped = 0;
+};
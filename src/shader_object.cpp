@@ -0,0 +1,191 @@
+#include "shader_object.h"
+#include "pipeline_registry.h"
+#include "shader_variants.h"
+#include "vk_helpers.h"
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+ShaderObjectCache::ShaderObjectCache(VkDevice device, VkShaderStageFlags unusedStages)
+	: device(device), unusedStages(unusedStages)
+{
+	createShaders = LoadDeviceFunction<PFN_vkCreateShadersEXT>(device, "vkCreateShadersEXT");
+	destroyShader = LoadDeviceFunction<PFN_vkDestroyShaderEXT>(device, "vkDestroyShaderEXT");
+	cmdBindShaders = LoadDeviceFunction<PFN_vkCmdBindShadersEXT>(device, "vkCmdBindShadersEXT");
+	cmdSetVertexInput = LoadDeviceFunction<PFN_vkCmdSetVertexInputEXT>(device, "vkCmdSetVertexInputEXT");
+	cmdSetPolygonMode = LoadDeviceFunction<PFN_vkCmdSetPolygonModeEXT>(device, "vkCmdSetPolygonModeEXT");
+	cmdSetRasterizationSamples = LoadDeviceFunction<PFN_vkCmdSetRasterizationSamplesEXT>(device, "vkCmdSetRasterizationSamplesEXT");
+	cmdSetSampleMask = LoadDeviceFunction<PFN_vkCmdSetSampleMaskEXT>(device, "vkCmdSetSampleMaskEXT");
+	cmdSetAlphaToCoverageEnable = LoadDeviceFunction<PFN_vkCmdSetAlphaToCoverageEnableEXT>(device, "vkCmdSetAlphaToCoverageEnableEXT");
+	cmdSetColorBlendEnable = LoadDeviceFunction<PFN_vkCmdSetColorBlendEnableEXT>(device, "vkCmdSetColorBlendEnableEXT");
+	cmdSetColorBlendEquation = LoadDeviceFunction<PFN_vkCmdSetColorBlendEquationEXT>(device, "vkCmdSetColorBlendEquationEXT");
+	cmdSetColorWriteMask = LoadDeviceFunction<PFN_vkCmdSetColorWriteMaskEXT>(device, "vkCmdSetColorWriteMaskEXT");
+}
+
+ShaderObjectCache::~ShaderObjectCache()
+{
+	for (const auto& entry : shaders)
+	{
+		destroyShader(device, entry.second, nullptr);
+	}
+}
+
+ShaderObjectSet ShaderObjectCache::Get(const GraphicsPipelineDesc& desc, const std::vector<VkDescriptorSetLayout>& setLayouts,
+	const std::vector<VkPushConstantRange>& pushConstants)
+{
+	bool hasFragment = false;
+	for (const auto& shader : desc.shaders)
+	{
+		if (shader.first != VK_SHADER_STAGE_VERTEX_BIT && shader.first != VK_SHADER_STAGE_FRAGMENT_BIT)
+		{
+			throw std::runtime_error("fail to create shader objects, only vertex and fragment shaders are supported");
+		}
+		hasFragment |= shader.first == VK_SHADER_STAGE_FRAGMENT_BIT;
+	}
+
+	ShaderObjectSet set;
+	for (VkShaderStageFlagBits stage : { VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT })
+	{
+		VkShaderEXT shader = VK_NULL_HANDLE;
+		for (const auto& entry : desc.shaders)
+		{
+			if (entry.first == stage)
+			{
+				VkShaderStageFlags nextStage = stage == VK_SHADER_STAGE_VERTEX_BIT && hasFragment ? VK_SHADER_STAGE_FRAGMENT_BIT : 0;
+				shader = CreateShader(stage, nextStage, entry.second, stage == VK_SHADER_STAGE_FRAGMENT_BIT ? desc.features : 0,
+					setLayouts, pushConstants);
+			}
+		}
+		set.stages.push_back(stage);
+		set.shaders.push_back(shader);
+	}
+
+	for (uint32_t bit = 0; bit < 32; bit++)
+	{
+		if ((unusedStages & (1u << bit)) != 0)
+		{
+			set.stages.push_back((VkShaderStageFlagBits)(1u << bit));
+			set.shaders.push_back(VK_NULL_HANDLE);
+		}
+	}
+
+	for (const auto& binding : desc.vertexBindings)
+	{
+		VkVertexInputBindingDescription2EXT binding2 = {};
+		binding2.sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_BINDING_DESCRIPTION_2_EXT;
+		binding2.binding = binding.binding;
+		binding2.stride = binding.stride;
+		binding2.inputRate = binding.inputRate;
+		binding2.divisor = 1;
+		set.vertexBindings.push_back(binding2);
+	}
+	for (const auto& attribute : desc.vertexAttributes)
+	{
+		VkVertexInputAttributeDescription2EXT attribute2 = {};
+		attribute2.sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT;
+		attribute2.location = attribute.location;
+		attribute2.binding = attribute.binding;
+		attribute2.format = attribute.format;
+		attribute2.offset = attribute.offset;
+		set.vertexAttributes.push_back(attribute2);
+	}
+	return set;
+}
+
+VkShaderEXT ShaderObjectCache::CreateShader(VkShaderStageFlagBits stage, VkShaderStageFlags nextStage, const std::string& path,
+	uint32_t features, const std::vector<VkDescriptorSetLayout>& setLayouts, const std::vector<VkPushConstantRange>& pushConstants)
+{
+	std::string key = std::to_string(stage) + '|' + path + '|' + std::to_string(features);
+	auto found = shaders.find(key);
+	if (found != shaders.end())
+	{
+		cacheHits++;
+		return found->second;
+	}
+
+	std::vector<char> code = ReadFile(path);
+	ShaderSpecialization specialization(ShaderFeatures::FromMask(features));
+
+	VkShaderCreateInfoEXT shaderInfo = {};
+	shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT;
+	shaderInfo.stage = stage;
+	shaderInfo.nextStage = nextStage;
+	shaderInfo.codeType = VK_SHADER_CODE_TYPE_SPIRV_EXT;
+	shaderInfo.codeSize = code.size();
+	shaderInfo.pCode = code.data();
+	shaderInfo.pName = "main";
+	shaderInfo.setLayoutCount = (uint32_t)setLayouts.size();
+	shaderInfo.pSetLayouts = setLayouts.data();
+	shaderInfo.pushConstantRangeCount = (uint32_t)pushConstants.size();
+	shaderInfo.pPushConstantRanges = pushConstants.data();
+	shaderInfo.pSpecializationInfo = stage == VK_SHADER_STAGE_FRAGMENT_BIT ? specialization.Get() : nullptr;
+
+	VkShaderEXT shader;
+	auto start = std::chrono::high_resolution_clock::now();
+	if (createShaders(device, 1, &shaderInfo, nullptr, &shader) != VK_SUCCESS)
+	{
+		throw std::runtime_error("fail to create shader object for " + path);
+	}
+	createMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	shaders.emplace(key, shader);
+	return shader;
+}
+
+void ShaderObjectCache::Bind(VkCommandBuffer commandBuffer, const ShaderObjectSet& set) const
+{
+	cmdBindShaders(commandBuffer, (uint32_t)set.stages.size(), set.stages.data(), set.shaders.data());
+	cmdSetVertexInput(commandBuffer, (uint32_t)set.vertexBindings.size(), set.vertexBindings.data(),
+		(uint32_t)set.vertexAttributes.size(), set.vertexAttributes.data());
+}
+
+void ShaderObjectCache::SetState(VkCommandBuffer commandBuffer, const GraphicsPipelineDesc& desc, VkExtent2D extent) const
+{
+	VkViewport viewport = {};
+	viewport.width = (float)extent.width;
+	viewport.height = (float)extent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	VkRect2D scissor = {};
+	scissor.extent = extent;
+	vkCmdSetViewportWithCount(commandBuffer, 1, &viewport);
+	vkCmdSetScissorWithCount(commandBuffer, 1, &scissor);
+
+	vkCmdSetPrimitiveTopology(commandBuffer, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	vkCmdSetPrimitiveRestartEnable(commandBuffer, VK_FALSE);
+
+	vkCmdSetRasterizerDiscardEnable(commandBuffer, VK_FALSE);
+	cmdSetPolygonMode(commandBuffer, VK_POLYGON_MODE_FILL);
+	vkCmdSetCullMode(commandBuffer, desc.cullMode);
+	vkCmdSetFrontFace(commandBuffer, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+	vkCmdSetDepthBiasEnable(commandBuffer, VK_FALSE);
+
+	VkSampleMask sampleMask = ~0u;
+	cmdSetRasterizationSamples(commandBuffer, VK_SAMPLE_COUNT_1_BIT);
+	cmdSetSampleMask(commandBuffer, VK_SAMPLE_COUNT_1_BIT, &sampleMask);
+	cmdSetAlphaToCoverageEnable(commandBuffer, VK_FALSE);
+
+	vkCmdSetDepthTestEnable(commandBuffer, VK_TRUE);
+	vkCmdSetDepthWriteEnable(commandBuffer, desc.depthWrite ? VK_TRUE : VK_FALSE);
+	vkCmdSetDepthCompareOp(commandBuffer, desc.depthCompare);
+	vkCmdSetDepthBoundsTestEnable(commandBuffer, VK_FALSE);
+	vkCmdSetStencilTestEnable(commandBuffer, VK_FALSE);
+
+	VkBool32 blendEnable = desc.blendEnable ? VK_TRUE : VK_FALSE;
+	VkColorBlendEquationEXT equation = {};
+	equation.srcColorBlendFactor = desc.blendEnable ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+	equation.dstColorBlendFactor = desc.blendEnable ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ZERO;
+	equation.colorBlendOp = VK_BLEND_OP_ADD;
+	equation.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	equation.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	equation.alphaBlendOp = VK_BLEND_OP_ADD;
+	cmdSetColorBlendEnable(commandBuffer, 0, 1, &blendEnable);
+	cmdSetColorBlendEquation(commandBuffer, 0, 1, &equation);
+	cmdSetColorWriteMask(commandBuffer, 0, 1, &desc.colorWriteMask);
+}
+
+void ShaderObjectCache::PrintStats()
+{
+	std::cout << "shader objects: " << shaders.size() << " created in " << createMilliseconds << " ms, "
+		<< cacheHits << " requests reused an existing shader" << std::endl;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct GraphicsPipelineDesc;
+
+// The shaders bound for one GraphicsPipelineDesc. Stages without a shader are bound to VK_NULL_HANDLE.
+struct ShaderObjectSet
+{
+	std::vector<VkShaderStageFlagBits> stages;
+	std::vector<VkShaderEXT> shaders;
+	// the vertex layout of the desc, empty without vertex input
+	std::vector<VkVertexInputBindingDescription2EXT> vertexBindings;
+	std::vector<VkVertexInputAttributeDescription2EXT> vertexAttributes;
+};
+
+// Draws without VkPipeline objects, through VK_EXT_shader_object. Each shader is created once per
+// stage, file and feature set. The state a scene pipeline would bake in is set with dynamic state
+// commands from the same GraphicsPipelineDesc, so a new state combination costs no compile.
+class ShaderObjectCache
+{
+public:
+	// unusedStages are bound to VK_NULL_HANDLE with every set. They have to include every optional
+	// stage whose feature is enabled, e.g. task and mesh with mesh shading.
+	ShaderObjectCache(VkDevice device, VkShaderStageFlags unusedStages);
+	~ShaderObjectCache();
+
+	ShaderObjectCache(const ShaderObjectCache&) = delete;
+	ShaderObjectCache& operator=(const ShaderObjectCache&) = delete;
+
+	// Vertex and fragment shaders only. The set layouts and push constants have to be the ones of the
+	// pipeline layout that the descriptor sets are bound with, and the same for every call.
+	ShaderObjectSet Get(const GraphicsPipelineDesc& desc, const std::vector<VkDescriptorSetLayout>& setLayouts,
+		const std::vector<VkPushConstantRange>& pushConstants);
+
+	// binds the shaders and sets the vertex input of the desc the set was made for
+	void Bind(VkCommandBuffer commandBuffer, const ShaderObjectSet& set) const;
+	// the rest of what CreateScenePipeline bakes in: input assembly, viewport, raster, multisample,
+	// depth and blend. Binding a pipeline invalidates it and the vertex input, so bind the set again afterwards
+	void SetState(VkCommandBuffer commandBuffer, const GraphicsPipelineDesc& desc, VkExtent2D extent) const;
+
+	void PrintStats();
+
+private:
+	VkShaderEXT CreateShader(VkShaderStageFlagBits stage, VkShaderStageFlags nextStage, const std::string& path, uint32_t features,
+		const std::vector<VkDescriptorSetLayout>& setLayouts, const std::vector<VkPushConstantRange>& pushConstants);
+
+	VkDevice device;
+	VkShaderStageFlags unusedStages;
+
+	PFN_vkCreateShadersEXT createShaders;
+	PFN_vkDestroyShaderEXT destroyShader;
+	PFN_vkCmdBindShadersEXT cmdBindShaders;
+	PFN_vkCmdSetVertexInputEXT cmdSetVertexInput;
+	PFN_vkCmdSetPolygonModeEXT cmdSetPolygonMode;
+	PFN_vkCmdSetRasterizationSamplesEXT cmdSetRasterizationSamples;
+	PFN_vkCmdSetSampleMaskEXT cmdSetSampleMask;
+	PFN_vkCmdSetAlphaToCoverageEnableEXT cmdSetAlphaToCoverageEnable;
+	PFN_vkCmdSetColorBlendEnableEXT cmdSetColorBlendEnable;
+	PFN_vkCmdSetColorBlendEquationEXT cmdSetColorBlendEquation;
+	PFN_vkCmdSetColorWriteMaskEXT cmdSetColorWriteMask;
+
+	// "stage|path|features" -> shader
+	std::unordered_map<std::string, VkShaderEXT> shaders;
+	uint32_t cacheHits = 0;
+	double createMilliseconds = 0.0;
+};
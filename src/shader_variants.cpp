@@ -0,0 +1,74 @@
+#include "shader_variants.h"
+#include <sstream>
+
+namespace
+{
+	struct FeatureName
+	{
+		ShaderFeature feature;
+		const char* name;
+	};
+
+	const FeatureName kFeatureNames[] = {
+		{ ShaderFeature::Texture, "texture" },
+		{ ShaderFeature::VertexColor, "vertexcolor" },
+		{ ShaderFeature::AlphaTest, "alphatest" },
+		{ ShaderFeature::Fog, "fog" },
+	};
+}
+
+std::string ShaderFeatures::Name() const
+{
+	std::string name;
+	for (const auto& featureName : kFeatureNames)
+	{
+		if (Has(featureName.feature))
+		{
+			name += name.empty() ? "" : "+";
+			name += featureName.name;
+		}
+	}
+	return name.empty() ? "none" : name;
+}
+
+bool ShaderFeatures::Parse(const std::string& text, ShaderFeatures& features)
+{
+	features = ShaderFeatures();
+	if (text == "none")
+	{
+		return true;
+	}
+
+	std::stringstream stream(text);
+	std::string token;
+	while (std::getline(stream, token, ','))
+	{
+		bool found = false;
+		for (const auto& featureName : kFeatureNames)
+		{
+			if (token == featureName.name)
+			{
+				features = features | featureName.feature;
+				found = true;
+			}
+		}
+		if (!found)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+ShaderSpecialization::ShaderSpecialization(ShaderFeatures features)
+	: data(features.Mask())
+{
+	entry.constantID = kShaderFeaturesConstantId;
+	entry.offset = 0;
+	entry.size = sizeof(data);
+
+	info.mapEntryCount = 1;
+	info.pMapEntries = &entry;
+	info.dataSize = sizeof(data);
+	info.pData = &data;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <string>
+
+// Optional features of simpleTriangle.frag. Each bit is tested against the FEATURES specialization
+// constant, so the driver removes the branches of disabled features when the pipeline is built.
+enum class ShaderFeature : uint32_t
+{
+	Texture = 1u << 0,
+	VertexColor = 1u << 1,
+	AlphaTest = 1u << 2,
+	Fog = 1u << 3,
+};
+
+class ShaderFeatures
+{
+public:
+	constexpr ShaderFeatures() = default;
+	constexpr ShaderFeatures(ShaderFeature feature) : mask((uint32_t)feature) {}
+
+	constexpr ShaderFeatures operator|(ShaderFeatures other) const { return FromMask(mask | other.mask); }
+	constexpr bool Has(ShaderFeature feature) const { return (mask & (uint32_t)feature) != 0; }
+	constexpr uint32_t Mask() const { return mask; }
+
+	static constexpr ShaderFeatures FromMask(uint32_t mask)
+	{
+		ShaderFeatures features;
+		features.mask = mask & kAllMask;
+		return features;
+	}
+
+	// "texture+fog", or "none"
+	std::string Name() const;
+	// comma separated feature names, e.g. "texture,vertexcolor"
+	static bool Parse(const std::string& text, ShaderFeatures& features);
+
+private:
+	static constexpr uint32_t kAllMask = 0xF;
+
+	uint32_t mask = 0;
+};
+
+constexpr ShaderFeatures operator|(ShaderFeature a, ShaderFeature b)
+{
+	return ShaderFeatures(a) | ShaderFeatures(b);
+}
+
+// the constant_id of FEATURES in simpleTriangle.frag
+const uint32_t kShaderFeaturesConstantId = 0;
+// what the shader does when it is not specialized
+constexpr ShaderFeatures kDefaultShaderFeatures = ShaderFeature::Texture;
+
+// Owns the map entry and data a VkSpecializationInfo points at, so keep it alive until the pipeline
+// is created.
+class ShaderSpecialization
+{
+public:
+	explicit ShaderSpecialization(ShaderFeatures features);
+
+	ShaderSpecialization(const ShaderSpecialization&) = delete;
+	ShaderSpecialization& operator=(const ShaderSpecialization&) = delete;
+
+	const VkSpecializationInfo* Get() const { return &info; }
+
+private:
+	uint32_t data;
+	VkSpecializationMapEntry entry;
+	VkSpecializationInfo info;
+};
@@ -0,0 +1,494 @@
+#include "spirv_reflect.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace
+{
+	// the handful of SPIR-V enums the reflector needs, values from the SPIR-V 1.6 specification
+	const uint32_t kMagic = 0x07230203;
+
+	enum Op : uint32_t
+	{
+		OpName = 5,
+		OpEntryPoint = 15,
+		OpTypeBool = 20,
+		OpTypeInt = 21,
+		OpTypeFloat = 22,
+		OpTypeVector = 23,
+		OpTypeMatrix = 24,
+		OpTypeImage = 25,
+		OpTypeSampler = 26,
+		OpTypeSampledImage = 27,
+		OpTypeArray = 28,
+		OpTypeRuntimeArray = 29,
+		OpTypeStruct = 30,
+		OpTypePointer = 32,
+		OpConstant = 43,
+		OpSpecConstant = 50,
+		OpVariable = 59,
+		OpDecorate = 71,
+		OpMemberDecorate = 72,
+	};
+
+	enum Decoration : uint32_t
+	{
+		DecorationSpecId = 1,
+		DecorationBlock = 2,
+		DecorationBufferBlock = 3,
+		DecorationArrayStride = 6,
+		DecorationMatrixStride = 7,
+		DecorationBuiltIn = 11,
+		DecorationLocation = 30,
+		DecorationBinding = 33,
+		DecorationDescriptorSet = 34,
+		DecorationOffset = 35,
+	};
+
+	enum StorageClass : uint32_t
+	{
+		StorageUniformConstant = 0,
+		StorageInput = 1,
+		StorageUniform = 2,
+		StoragePushConstant = 9,
+		StorageStorageBuffer = 12,
+	};
+
+	const uint32_t kDimBuffer = 5;
+	const uint32_t kDimSubpassData = 6;
+	const uint32_t kNotSet = ~0u;
+
+	VkShaderStageFlags ExecutionModelStage(uint32_t model)
+	{
+		switch (model)
+		{
+		case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+		case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+		case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+		case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+		case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+		case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+		case 5364: return VK_SHADER_STAGE_TASK_BIT_EXT;
+		case 5365: return VK_SHADER_STAGE_MESH_BIT_EXT;
+		default: return 0;
+		}
+	}
+
+	struct Id
+	{
+		uint32_t opcode = 0;
+		std::vector<uint32_t> operands; // the words after the result id
+		uint32_t constant = 0;
+		std::string name;
+
+		uint32_t set = kNotSet;
+		uint32_t binding = kNotSet;
+		uint32_t location = kNotSet;
+		uint32_t arrayStride = 0;
+		bool builtIn = false;
+		bool block = false;
+		bool bufferBlock = false;
+		std::vector<uint32_t> memberOffsets;
+		std::vector<uint32_t> memberMatrixStrides;
+	};
+
+	class Reflector
+	{
+	public:
+		explicit Reflector(const std::vector<char>& code)
+		{
+			if (code.size() < 20 || code.size() % 4 != 0)
+			{
+				throw std::runtime_error("fail to reflect shader, not a SPIR-V module");
+			}
+			words.resize(code.size() / 4);
+			std::memcpy(words.data(), code.data(), code.size());
+			if (words[0] != kMagic)
+			{
+				throw std::runtime_error("fail to reflect shader, bad SPIR-V magic");
+			}
+			ids.resize(words[3]);
+		}
+
+		ShaderInterface Run()
+		{
+			Parse();
+
+			ShaderInterface result;
+			result.stages = stages;
+			result.specConstants = specConstants;
+			for (const Id& variable : ids)
+			{
+				if (variable.opcode != OpVariable)
+				{
+					continue;
+				}
+
+				uint32_t storage = variable.operands[1];
+				const Id& pointer = ids[variable.operands[0]];
+				uint32_t typeId = pointer.operands[1];
+
+				if (storage == StoragePushConstant)
+				{
+					AddPushConstant(result, typeId);
+				}
+				else if (storage == StorageInput && (stages & VK_SHADER_STAGE_VERTEX_BIT))
+				{
+					if (!variable.builtIn && variable.location != kNotSet)
+					{
+						result.vertexInputs.push_back({ variable.location, VertexFormat(typeId) });
+					}
+				}
+				else if (variable.binding != kNotSet)
+				{
+					AddBinding(result, variable, storage, typeId);
+				}
+			}
+			std::sort(result.vertexInputs.begin(), result.vertexInputs.end(),
+				[](const ShaderVertexInput& a, const ShaderVertexInput& b) { return a.location < b.location; });
+			return result;
+		}
+
+	private:
+		void Parse()
+		{
+			size_t offset = 5;
+			while (offset < words.size())
+			{
+				uint32_t wordCount = words[offset] >> 16;
+				uint32_t opcode = words[offset] & 0xFFFF;
+				if (wordCount == 0 || offset + wordCount > words.size())
+				{
+					throw std::runtime_error("fail to reflect shader, truncated instruction");
+				}
+				const uint32_t* inst = &words[offset];
+				ParseInstruction(opcode, inst, wordCount);
+				offset += wordCount;
+			}
+		}
+
+		Id& At(uint32_t id)
+		{
+			if (id >= ids.size())
+			{
+				throw std::runtime_error("fail to reflect shader, id out of bound");
+			}
+			return ids[id];
+		}
+
+		void ParseInstruction(uint32_t opcode, const uint32_t* inst, uint32_t wordCount)
+		{
+			switch (opcode)
+			{
+			case OpEntryPoint:
+				stages |= ExecutionModelStage(inst[1]);
+				break;
+			case OpName:
+				At(inst[1]).name = (const char*)&inst[2];
+				break;
+			case OpTypeBool: case OpTypeInt: case OpTypeFloat: case OpTypeVector: case OpTypeMatrix:
+			case OpTypeImage: case OpTypeSampler: case OpTypeSampledImage: case OpTypeArray:
+			case OpTypeRuntimeArray: case OpTypeStruct: case OpTypePointer:
+			{
+				Id& id = At(inst[1]);
+				id.opcode = opcode;
+				id.operands.assign(inst + 2, inst + wordCount);
+				break;
+			}
+			case OpConstant: case OpSpecConstant:
+			{
+				// array lengths only, a spec constant length is taken at its default value
+				Id& id = At(inst[2]);
+				id.opcode = opcode;
+				id.constant = wordCount > 3 ? inst[3] : 0;
+				break;
+			}
+			case OpVariable:
+			{
+				Id& id = At(inst[2]);
+				id.opcode = opcode;
+				id.operands = { inst[1], inst[3] };
+				break;
+			}
+			case OpDecorate:
+			{
+				Id& id = At(inst[1]);
+				uint32_t value = wordCount > 3 ? inst[3] : 0;
+				switch (inst[2])
+				{
+				case DecorationSpecId: specConstants.insert(value); break;
+				case DecorationBlock: id.block = true; break;
+				case DecorationBufferBlock: id.bufferBlock = true; break;
+				case DecorationArrayStride: id.arrayStride = value; break;
+				case DecorationBuiltIn: id.builtIn = true; break;
+				case DecorationLocation: id.location = value; break;
+				case DecorationBinding: id.binding = value; break;
+				case DecorationDescriptorSet: id.set = value; break;
+				}
+				break;
+			}
+			case OpMemberDecorate:
+			{
+				Id& id = At(inst[1]);
+				uint32_t member = inst[2];
+				if (inst[3] == DecorationOffset || inst[3] == DecorationMatrixStride)
+				{
+					auto& values = inst[3] == DecorationOffset ? id.memberOffsets : id.memberMatrixStrides;
+					if (values.size() <= member)
+					{
+						values.resize(member + 1, 0);
+					}
+					values[member] = inst[4];
+				}
+				break;
+			}
+			}
+		}
+
+		uint32_t TypeSize(uint32_t typeId, uint32_t matrixStride = 0)
+		{
+			const Id& type = At(typeId);
+			switch (type.opcode)
+			{
+			case OpTypeBool:
+				return 4;
+			case OpTypeInt: case OpTypeFloat:
+				return type.operands[0] / 8;
+			case OpTypeVector:
+				return type.operands[1] * TypeSize(type.operands[0]);
+			case OpTypeMatrix:
+				return type.operands[1] * (matrixStride != 0 ? matrixStride : TypeSize(type.operands[0]));
+			case OpTypeArray:
+			{
+				uint32_t length = At(type.operands[1]).constant;
+				return length * (type.arrayStride != 0 ? type.arrayStride : TypeSize(type.operands[0]));
+			}
+			case OpTypeStruct:
+			{
+				uint32_t size = 0;
+				for (uint32_t member = 0; member < type.operands.size(); member++)
+				{
+					uint32_t offset = member < type.memberOffsets.size() ? type.memberOffsets[member] : 0;
+					uint32_t stride = member < type.memberMatrixStrides.size() ? type.memberMatrixStrides[member] : 0;
+					size = std::max(size, offset + TypeSize(type.operands[member], stride));
+				}
+				return size;
+			}
+			default:
+				return 0;
+			}
+		}
+
+		void AddPushConstant(ShaderInterface& result, uint32_t typeId)
+		{
+			const Id& type = At(typeId);
+			uint32_t begin = type.memberOffsets.empty() ? 0
+				: *std::min_element(type.memberOffsets.begin(), type.memberOffsets.end());
+			uint32_t end = (TypeSize(typeId) + 3) & ~3u;
+
+			VkPushConstantRange range = {};
+			range.stageFlags = stages;
+			range.offset = begin;
+			range.size = end - begin;
+			result.pushConstants.push_back(range);
+		}
+
+		VkFormat VertexFormat(uint32_t typeId)
+		{
+			const Id& type = At(typeId);
+			uint32_t components = 1;
+			const Id* scalar = &type;
+			if (type.opcode == OpTypeVector)
+			{
+				components = type.operands[1];
+				scalar = &At(type.operands[0]);
+			}
+
+			static const VkFormat floatFormats[] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT,
+				VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+			static const VkFormat intFormats[] = { VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT,
+				VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+			static const VkFormat uintFormats[] = { VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT,
+				VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+			if (components < 1 || components > 4 || scalar->operands.empty() || scalar->operands[0] != 32)
+			{
+				return VK_FORMAT_UNDEFINED;
+			}
+			if (scalar->opcode == OpTypeFloat)
+			{
+				return floatFormats[components - 1];
+			}
+			if (scalar->opcode == OpTypeInt)
+			{
+				return scalar->operands[1] ? intFormats[components - 1] : uintFormats[components - 1];
+			}
+			return VK_FORMAT_UNDEFINED;
+		}
+
+		void AddBinding(ShaderInterface& result, const Id& variable, uint32_t storage, uint32_t typeId)
+		{
+			uint32_t count = 1;
+			while (At(typeId).opcode == OpTypeArray || At(typeId).opcode == OpTypeRuntimeArray)
+			{
+				// runtime arrays would need variable descriptor counts, one descriptor is bound
+				const Id& array = At(typeId);
+				if (array.opcode == OpTypeArray)
+				{
+					count *= At(array.operands[1]).constant;
+				}
+				typeId = array.operands[0];
+			}
+
+			const Id& type = At(typeId);
+			VkDescriptorType descriptorType;
+			if (storage == StorageStorageBuffer || (storage == StorageUniform && type.bufferBlock))
+			{
+				descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			}
+			else if (storage == StorageUniform)
+			{
+				descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			}
+			else if (storage == StorageUniformConstant && type.opcode == OpTypeSampledImage)
+			{
+				descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			}
+			else if (storage == StorageUniformConstant && type.opcode == OpTypeSampler)
+			{
+				descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+			}
+			else if (storage == StorageUniformConstant && type.opcode == OpTypeImage)
+			{
+				uint32_t dim = type.operands[1];
+				bool storageImage = type.operands[5] == 2;
+				if (dim == kDimSubpassData)
+				{
+					descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+				}
+				else if (dim == kDimBuffer)
+				{
+					descriptorType = storageImage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+				}
+				else
+				{
+					descriptorType = storageImage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+				}
+			}
+			else
+			{
+				// acceleration structures and other types the renderer does not use
+				return;
+			}
+
+			uint32_t set = variable.set != kNotSet ? variable.set : 0;
+			VkDescriptorSetLayoutBinding binding = {};
+			binding.binding = variable.binding;
+			binding.descriptorType = descriptorType;
+			binding.descriptorCount = count;
+			binding.stageFlags = stages;
+			binding.pImmutableSamplers = nullptr;
+			result.sets[set][variable.binding] = binding;
+
+			if (!variable.name.empty())
+			{
+				result.bindingNames[variable.name] = { set, variable.binding };
+			}
+		}
+
+		std::vector<uint32_t> words;
+		std::vector<Id> ids;
+		VkShaderStageFlags stages = 0;
+		std::set<uint32_t> specConstants;
+	};
+}
+
+void ShaderInterface::Merge(const ShaderInterface& other)
+{
+	stages |= other.stages;
+
+	for (const auto& set : other.sets)
+	{
+		for (const auto& entry : set.second)
+		{
+			auto& bindings = sets[set.first];
+			auto found = bindings.find(entry.first);
+			if (found == bindings.end())
+			{
+				bindings[entry.first] = entry.second;
+				continue;
+			}
+
+			if (found->second.descriptorType != entry.second.descriptorType)
+			{
+				throw std::runtime_error("fail to merge shader interfaces, set " + std::to_string(set.first) + " binding "
+					+ std::to_string(entry.first) + " is declared with different types");
+			}
+			found->second.stageFlags |= entry.second.stageFlags;
+			found->second.descriptorCount = std::max(found->second.descriptorCount, entry.second.descriptorCount);
+		}
+	}
+
+	for (const auto& range : other.pushConstants)
+	{
+		auto same = std::find_if(pushConstants.begin(), pushConstants.end(), [&](const VkPushConstantRange& existing)
+			{
+				return existing.offset == range.offset && existing.size == range.size;
+			});
+		if (same != pushConstants.end())
+		{
+			same->stageFlags |= range.stageFlags;
+		}
+		else
+		{
+			pushConstants.push_back(range);
+		}
+	}
+
+	if (vertexInputs.empty())
+	{
+		vertexInputs = other.vertexInputs;
+	}
+	bindingNames.insert(other.bindingNames.begin(), other.bindingNames.end());
+	specConstants.insert(other.specConstants.begin(), other.specConstants.end());
+}
+
+void ShaderInterface::SetDescriptorType(uint32_t set, uint32_t binding, VkDescriptorType type)
+{
+	auto found = sets.find(set);
+	if (found == sets.end() || found->second.count(binding) == 0)
+	{
+		throw std::runtime_error("fail to set descriptor type, set " + std::to_string(set) + " binding "
+			+ std::to_string(binding) + " is not used by the shaders");
+	}
+	found->second[binding].descriptorType = type;
+}
+
+std::vector<VkDescriptorSetLayoutBinding> ShaderInterface::Bindings(uint32_t set) const
+{
+	std::vector<VkDescriptorSetLayoutBinding> bindings;
+	auto found = sets.find(set);
+	if (found != sets.end())
+	{
+		for (const auto& entry : found->second)
+		{
+			bindings.push_back(entry.second);
+		}
+	}
+	return bindings;
+}
+
+uint32_t ShaderInterface::FindBinding(uint32_t set, const std::string& name) const
+{
+	auto found = bindingNames.find(name);
+	if (found == bindingNames.end() || found->second.first != set)
+	{
+		throw std::runtime_error("fail to find shader binding " + name + " in set " + std::to_string(set));
+	}
+	return found->second.second;
+}
+
+ShaderInterface ReflectSpirv(const std::vector<char>& code)
+{
+	return Reflector(code).Run();
+}
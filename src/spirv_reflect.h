@@ -0,0 +1,42 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+struct ShaderVertexInput
+{
+	uint32_t location;
+	VkFormat format;
+};
+
+// The resource interface of one or more shader stages, as read from their SPIR-V.
+struct ShaderInterface
+{
+	VkShaderStageFlags stages = 0;
+	// set -> binding -> layout binding, pImmutableSamplers is always null
+	std::map<uint32_t, std::map<uint32_t, VkDescriptorSetLayoutBinding>> sets;
+	std::vector<VkPushConstantRange> pushConstants;
+	// only for vertex shaders, builtins are skipped
+	std::vector<ShaderVertexInput> vertexInputs;
+	// variable name -> (set, binding), e.g. "ubo" or "texSampler"
+	std::map<std::string, std::pair<uint32_t, uint32_t>> bindingNames;
+	// constant_id of every specialization constant
+	std::set<uint32_t> specConstants;
+
+	// combines the stages of both, throws when a binding is declared with different types
+	void Merge(const ShaderInterface& other);
+
+	// SPIR-V has no notion of dynamic offsets, so dynamic buffers are marked by the caller
+	void SetDescriptorType(uint32_t set, uint32_t binding, VkDescriptorType type);
+
+	std::vector<VkDescriptorSetLayoutBinding> Bindings(uint32_t set) const;
+	// binding number of a named variable in the given set, throws when it does not exist
+	uint32_t FindBinding(uint32_t set, const std::string& name) const;
+};
+
+// Reads the sets, bindings, descriptor types, push constant ranges, vertex inputs and specialization
+// constants of a SPIR-V module. Throws std::runtime_error for data that is not SPIR-V.
+ShaderInterface ReflectSpirv(const std::vector<char>& code);
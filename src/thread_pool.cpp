@@ -0,0 +1,119 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+	if (threadCount == 0)
+	{
+		threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+	}
+
+	workers.reserve(threadCount);
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		workers.emplace_back(&ThreadPool::WorkerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	taskAvailable.notify_all();
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push(std::move(task));
+		pendingTasks++;
+	}
+	taskAvailable.notify_one();
+}
+
+void ThreadPool::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	taskFinished.wait(lock, [this] { return pendingTasks == 0; });
+}
+
+void ThreadPool::ParallelFor(uint32_t count, uint32_t minChunk, uint32_t alignment,
+	const std::function<void(uint32_t, uint32_t)>& fn)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	uint32_t chunkCount = std::min(GetThreadCount() + 1, (count + minChunk - 1) / minChunk);
+	uint32_t chunkSize = (count + chunkCount - 1) / chunkCount;
+	chunkSize = (chunkSize + alignment - 1) / alignment * alignment;
+
+	if (chunkSize >= count)
+	{
+		fn(0, count);
+		return;
+	}
+
+	uint32_t remaining = 0;
+	std::mutex doneMutex;
+	std::condition_variable done;
+
+	for (uint32_t begin = chunkSize; begin < count; begin += chunkSize)
+	{
+		uint32_t end = std::min(begin + chunkSize, count);
+		{
+			std::lock_guard<std::mutex> lock(doneMutex);
+			remaining++;
+		}
+		Submit([&, begin, end]
+			{
+				fn(begin, end);
+
+				std::lock_guard<std::mutex> lock(doneMutex);
+				if (--remaining == 0)
+				{
+					done.notify_one();
+				}
+			});
+	}
+
+	fn(0, chunkSize);
+
+	std::unique_lock<std::mutex> lock(doneMutex);
+	done.wait(lock, [&] { return remaining == 0; });
+}
+
+void ThreadPool::WorkerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			taskAvailable.wait(lock, [this] { return stopping || !tasks.empty(); });
+			if (stopping && tasks.empty())
+			{
+				return;
+			}
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+
+		task();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pendingTasks--;
+		}
+		taskFinished.notify_all();
+	}
+}
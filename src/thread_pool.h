@@ -0,0 +1,39 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	explicit ThreadPool(uint32_t threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	uint32_t GetThreadCount() const { return (uint32_t)workers.size(); }
+
+	void Submit(std::function<void()> task);
+	void WaitIdle();
+
+	// splits [0, count) into chunks of at least minChunk items (rounded up to a multiple of
+	// alignment) and runs fn(begin, end) for each chunk, the calling thread takes part in the work
+	void ParallelFor(uint32_t count, uint32_t minChunk, uint32_t alignment,
+		const std::function<void(uint32_t, uint32_t)>& fn);
+
+private:
+	void WorkerLoop();
+
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable taskAvailable;
+	std::condition_variable taskFinished;
+	uint32_t pendingTasks = 0;
+	bool stopping = false;
+};
@@ -0,0 +1,93 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Hands the newest value from one producer thread to one consumer thread. The producer fills the
+// back slot and publishes it by swapping it with the middle slot; the consumer takes the middle
+// slot by swapping it with the front slot it is done with. Publish and Take are one atomic exchange
+// each, so neither side ever waits for the other to finish with a slot, and a value the consumer
+// did not take in time is replaced by the newer one.
+//
+// The Wait functions only park a thread that has nothing to do, they never guard the slots.
+template <typename T>
+class TripleBuffer
+{
+public:
+	// producer: the slot to fill, invisible to the consumer until Publish
+	T& WriteSlot() { return slots[back]; }
+	void Publish()
+	{
+		back = middle.exchange(back | kFresh, std::memory_order_acq_rel) & kIndexMask;
+		published++;
+		Notify();
+	}
+	// until the consumer took the last published value, false once closed
+	bool WaitTaken()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [this] { return closed || !(middle.load(std::memory_order_acquire) & kFresh); });
+		return !closed;
+	}
+
+	// consumer: until a value the consumer has not taken yet is published, false once closed
+	bool WaitPublished()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [this] { return closed || (middle.load(std::memory_order_acquire) & kFresh); });
+		return !closed;
+	}
+	// the newest published value, or the last one taken when nothing new was published. It stays
+	// unchanged until the next Take
+	const T& Take()
+	{
+		// only the consumer clears kFresh, so it can't go away between the check and the exchange
+		if (middle.load(std::memory_order_acquire) & kFresh)
+		{
+			front = middle.exchange(front, std::memory_order_acq_rel) & kIndexMask;
+			taken++;
+			Notify();
+		}
+		return slots[front];
+	}
+
+	// wakes both sides, every Wait returns false from now on
+	void Close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+		}
+		changed.notify_all();
+	}
+
+	// values published and taken so far, the rest were replaced before the consumer got to them
+	uint64_t Published() const { return published; }
+	uint64_t Taken() const { return taken; }
+
+private:
+	static const uint32_t kIndexMask = 3;
+	static const uint32_t kFresh = 4;
+
+	void Notify()
+	{
+		// a waiter checks under the mutex, taking it here orders the notify after that check
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+		}
+		changed.notify_all();
+	}
+
+	T slots[3];
+	// back and published belong to the producer, front and taken to the consumer
+	uint32_t back = 0;
+	std::atomic<uint32_t> middle{ 1 };
+	uint32_t front = 2;
+	std::atomic<uint64_t> published{ 0 };
+	std::atomic<uint64_t> taken{ 0 };
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	bool closed = false;
+};
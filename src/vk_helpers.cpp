@@ -0,0 +1,16 @@
+#include "vk_helpers.h"
+#include <fstream>
+
+std::vector<char> ReadFile(const std::string& path)
+{
+	std::ifstream ifs(path, std::ios::ate | std::ios::binary);
+	if (!ifs.is_open())
+	{
+		throw std::runtime_error("fail to open file " + path);
+	}
+
+	std::vector<char> buffer((size_t)ifs.tellg());
+	ifs.seekg(0);
+	ifs.read(buffer.data(), buffer.size());
+	return buffer;
+}
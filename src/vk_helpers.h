@@ -0,0 +1,20 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// a device level entry point that the feature needs, throws when the driver doesn't expose it
+template <typename T>
+T LoadDeviceFunction(VkDevice device, const char* name)
+{
+	auto function = (T)vkGetDeviceProcAddr(device, name);
+	if (function == nullptr)
+	{
+		throw std::runtime_error(std::string("fail to load ") + name);
+	}
+	return function;
+}
+
+// the whole file, e.g. a SPIR-V module, throws when it can't be opened
+std::vector<char> ReadFile(const std::string& path);